@@ -76,6 +76,13 @@ class KeyHandlerBopomofoTests: XCTestCase {
         handler.syncWithPreferences()
     }
 
+    func testReloadDataModelsIfChangedKeepsUnchangedModels() {
+        // The bundled data files have not been replaced since they were loaded.
+        XCTAssertFalse(LanguageModelManager.reloadDataModelsIfChanged())
+        XCTAssertFalse(LanguageModelManager.reloadDataModelsIfChanged())
+        XCTAssertNotNil(LanguageModelManager.reading(for: "你"))
+    }
+
     func testIgnoreEmpty() {
         let input = KeyHandlerInput(
             inputText: "", keyCode: 0, charCode: 0, flags: [], isVerticalMode: false)
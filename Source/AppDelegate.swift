@@ -168,6 +168,7 @@ class AppDelegate: NSObject, NSApplicationDelegate, NonModalAlertWindowControlle
     private var checkTask: URLSessionTask?
     private var updateNextStepURL: URL?
     private var fsStreamHelper: FSEventStreamHelper?
+    private var dataModelReloadSource: DispatchSourceSignal?
     private var serviceProvider = ServiceProvider()
     private var serviceProviderHelper = ServiceProviderInputHelper()
 
@@ -187,6 +188,7 @@ class AppDelegate: NSObject, NSApplicationDelegate, NonModalAlertWindowControlle
     func applicationDidFinishLaunching(_ notification: Notification) {
         LanguageModelManager.setupDataModelValueConverter()
         updateUserPhrases()
+        installDataModelReloadHandler()
 
         if UserDefaults.standard.object(forKey: kCheckUpdateAutomatically) == nil {
             UserDefaults.standard.set(true, forKey: kCheckUpdateAutomatically)
@@ -204,6 +206,14 @@ class AppDelegate: NSObject, NSApplicationDelegate, NonModalAlertWindowControlle
             self.updateUserPhrases()
         }
 
+        // The user override model is saved a while after it learns something;
+        // save what is pending when the user logs out or shuts down.
+        NSWorkspace.shared.notificationCenter.addObserver(
+            forName: NSWorkspace.willPowerOffNotification, object: nil, queue: OperationQueue.main
+        ) { notification in
+            LanguageModelManager.saveUserOverrideModel()
+        }
+
         serviceProvider.delegate = (serviceProviderHelper as! any ServiceProviderDelegate)
         NSApp.servicesProvider = serviceProvider
 
@@ -212,6 +222,23 @@ class AppDelegate: NSObject, NSApplicationDelegate, NonModalAlertWindowControlle
         checkForUpdate()
     }
 
+    func applicationWillTerminate(_ notification: Notification) {
+        LanguageModelManager.saveUserOverrideModel()
+    }
+
+    /// Reloads the language models when their data files have been replaced.
+    /// `make install` in Source/Data sends SIGHUP after installing new files,
+    /// which would otherwise terminate the input method.
+    func installDataModelReloadHandler() {
+        signal(SIGHUP, SIG_IGN)
+        let source = DispatchSource.makeSignalSource(signal: SIGHUP, queue: .main)
+        source.setEventHandler {
+            LanguageModelManager.reloadDataModelsIfChanged()
+        }
+        source.resume()
+        dataModelReloadSource = source
+    }
+
     @MainActor
     @objc func showPreferences() {
         if preferencesWindowController == nil {
@@ -24,12 +24,14 @@
 #include "AssociatedPhrasesV2.h"
 
 #include <algorithm>
-#include <cstdlib>
+#include <cstdint>
 #include <limits>
 #include <memory>
+#include <mutex>
+#include <numeric>
 #include <sstream>
 #include <string>
-#include <unordered_set>
+#include <string_view>
 #include <utility>
 #include <vector>
 
@@ -46,61 +48,105 @@ enum class RowParseState { kParsingValue, kParsingReading };
 
 // Find the score in a string of the form /^(.+?)\s((-?)\d+(\.?)\d+)$/.
 static double GetScoreInRow(const std::string_view& v) {
-  const auto* it = v.cbegin();
-  const auto* end = v.cend();
-
-  while (it != end) {
-    if (*it == ' ') {
-      ++it;
-      break;
-    }
-    ++it;
-  }
-
-  if (it == end) {
+  size_t separator = v.find(' ');
+  if (separator == std::string_view::npos || separator + 1 == v.length()) {
     return std::numeric_limits<double>::lowest();
   }
 
-  return std::stod(std::string(it, end));
+  double score = 0;
+  ParselessPhraseDB::ParseScore(v.substr(separator + 1), score);
+  return score;
 }
 
-// Parse an associated phrases entry to the Phrase struct.
-static AssociatedPhrasesV2::Phrase PhraseFromRow(const std::string_view& v) {
-  const auto* it = v.cbegin();
-  const auto* end = v.cend();
-
-  std::stringstream sst;
-  std::vector<std::string> readings;
-
+// Parse an associated phrases entry to the value and readings of a Phrase.
+// The readings are skipped if readings is nullptr.
+static void ParseRow(std::string_view v, std::string* value,
+                     std::vector<std::string>* readings) {
   RowParseState state = RowParseState::kParsingValue;
-  const auto* prev = it;
-  while (it != end) {
-    if (*it == ' ' || *it == kSeparatorChar) {
-      switch (state) {
-        case RowParseState::kParsingValue:
-          // Switch to parsing readings.
-          state = RowParseState::kParsingReading;
-          sst << std::string{prev, it};
-          break;
-        case RowParseState::kParsingReading:
-          // Switch to parsing values.
-          state = RowParseState::kParsingValue;
-          readings.emplace_back(std::string{prev, it});
-          break;
-      }
+  size_t prev = 0;
+  for (size_t i = 0, s = v.length(); i < s; ++i) {
+    if (v[i] != ' ' && v[i] != kSeparatorChar) {
+      continue;
+    }
 
-      if (*it == ' ') {
+    switch (state) {
+      case RowParseState::kParsingValue:
+        // Switch to parsing readings.
+        state = RowParseState::kParsingReading;
+        value->append(v.substr(prev, i - prev));
         break;
-      }
+      case RowParseState::kParsingReading:
+        // Switch to parsing values.
+        state = RowParseState::kParsingValue;
+        if (readings != nullptr) {
+          readings->emplace_back(v.substr(prev, i - prev));
+        }
+        break;
+    }
 
-      prev = ++it;
-      continue;
+    if (v[i] == ' ') {
+      break;
     }
+    prev = i + 1;
+  }
+}
 
-    ++it;
+// Calls the visitor with each piece of the phrase's value in the row, split
+// the same way as ParseRow() does, so that values can be hashed and
+// compared without forming them.
+template <typename Visitor>
+static void ForEachValuePiece(std::string_view row, Visitor&& visitor) {
+  bool parsingValue = true;
+  size_t prev = 0;
+  for (size_t i = 0, s = row.length(); i < s; ++i) {
+    if (row[i] != ' ' && row[i] != kSeparatorChar) {
+      continue;
+    }
+    if (parsingValue) {
+      visitor(row.substr(prev, i - prev));
+    }
+    parsingValue = !parsingValue;
+    if (row[i] == ' ') {
+      break;
+    }
+    prev = i + 1;
   }
+}
 
-  return {sst.str(), readings};
+// FNV-1a over the bytes of the phrase's value.
+static uint32_t ValueHash(std::string_view row) {
+  uint32_t hash = 2166136261U;
+  ForEachValuePiece(row, [&hash](std::string_view piece) {
+    for (char c : piece) {
+      hash = (hash ^ static_cast<unsigned char>(c)) * 16777619U;
+    }
+  });
+  return hash;
+}
+
+static bool ValueEquals(std::string_view row, std::string_view value) {
+  size_t pos = 0;
+  bool equal = true;
+  ForEachValuePiece(row, [&](std::string_view piece) {
+    equal = equal && value.compare(pos, piece.length(), piece) == 0;
+    pos += piece.length();
+  });
+  return equal && pos == value.length();
+}
+
+// Returns the first value and reading of the row, such as "輸-ㄕㄨ-", or an
+// empty view if the row does not have both, as comments do not.
+static std::string_view GroupKeyOfRow(std::string_view row) {
+  row = row.substr(0, row.find(' '));
+  size_t first = row.find(kSeparatorChar);
+  if (first == std::string_view::npos) {
+    return {};
+  }
+  size_t second = row.find(kSeparatorChar, first + 1);
+  if (second == std::string_view::npos) {
+    return {};
+  }
+  return row.substr(0, second + 1);
 }
 
 AssociatedPhrasesV2::~AssociatedPhrasesV2() { close(); }
@@ -117,10 +163,22 @@ bool AssociatedPhrasesV2::open(const char* path) {
 
   db_ = std::make_unique<ParselessPhraseDB>(
       mmapedFile_.data(), mmapedFile_.length(), /*validate_pragma=*/true);
+  compile();
   return true;
 }
 
 void AssociatedPhrasesV2::close() {
+  {
+    std::lock_guard<std::mutex> lock(cacheMutex_);
+    cache_.clear();
+  }
+  rankedRows_.clear();
+  rankedRows_.shrink_to_fit();
+  rowsByKey_.clear();
+  rowsByKey_.shrink_to_fit();
+  groups_.clear();
+  groups_.shrink_to_fit();
+  rowsBegin_ = nullptr;
   db_ = nullptr;
   mmapedFile_.close();
 }
@@ -133,71 +191,259 @@ bool AssociatedPhrasesV2::open(std::unique_ptr<ParselessPhraseDB> db) {
   }
 
   db_ = std::move(db);
+  compile();
   return true;
 }
 
+void AssociatedPhrasesV2::compile() {
+  ParselessPhraseDB::RowRange rows = db_->rows("");
+  if (rows.empty()) {
+    return;
+  }
+  rowsBegin_ = rows.front().data();
+
+  // The rows are sorted, and so the rows of a group are next to each other.
+  for (std::string_view row : rows) {
+    std::string_view key = GroupKeyOfRow(row);
+    if (key.empty()) {
+      continue;
+    }
+    auto offset = static_cast<size_t>(row.data() - rowsBegin_);
+    if (offset + row.length() > std::numeric_limits<uint32_t>::max()) {
+      // Too large for 32-bit offsets; leave the rest out.
+      break;
+    }
+    auto index = static_cast<uint32_t>(rankedRows_.size());
+    if (groups_.empty() || groupKey(groups_.back()) != key) {
+      groups_.push_back(Group{static_cast<uint32_t>(offset),
+                              static_cast<uint32_t>(key.length()), index,
+                              index});
+    }
+    ++groups_.back().end;
+    rankedRows_.push_back(RankedRow{GetScoreInRow(row),
+                                    static_cast<uint32_t>(offset),
+                                    static_cast<uint32_t>(row.length()),
+                                    ValueHash(row), false});
+  }
+
+  rowsByKey_.resize(rankedRows_.size());
+  std::vector<uint32_t> order;
+  std::vector<RankedRow> ranked;
+  for (const Group& group : groups_) {
+    // Rank the rows, which are in the order of the DB, and remember where each
+    // of them went. Rows with the same score stay in the order of the DB.
+    order.resize(group.end - group.begin);
+    std::iota(order.begin(), order.end(), group.begin);
+    std::stable_sort(order.begin(), order.end(),
+                     [this](uint32_t a, uint32_t b) {
+                       return rankedRows_[a].score > rankedRows_[b].score;
+                     });
+    ranked.clear();
+    for (uint32_t index : order) {
+      rowsByKey_[index] = group.begin + static_cast<uint32_t>(ranked.size());
+      ranked.push_back(rankedRows_[index]);
+    }
+    std::copy(ranked.cbegin(), ranked.cend(),
+              rankedRows_.begin() + group.begin);
+
+    auto begin = rankedRows_.begin() + group.begin;
+    auto end = rankedRows_.begin() + group.end;
+
+    std::string value;
+    for (auto it = begin; it != end; ++it) {
+      for (auto higher = begin; higher != it; ++higher) {
+        if (higher->valueHash != it->valueHash || higher->duplicate) {
+          continue;
+        }
+        value.clear();
+        ParseRow(rowAt(*higher), &value, nullptr);
+        if (ValueEquals(rowAt(*it), value)) {
+          it->duplicate = true;
+          break;
+        }
+      }
+    }
+  }
+}
+
+std::pair<std::vector<AssociatedPhrasesV2::Group>::const_iterator,
+          std::vector<AssociatedPhrasesV2::Group>::const_iterator>
+AssociatedPhrasesV2::findGroups(std::string_view prefix) const {
+  auto first = std::lower_bound(
+      groups_.cbegin(), groups_.cend(), prefix,
+      [this](const Group& g, std::string_view p) { return groupKey(g) < p; });
+  auto last = std::find_if_not(first, groups_.cend(), [&](const Group& g) {
+    return groupKey(g).starts_with(prefix);
+  });
+  return {first, last};
+}
+
 std::vector<AssociatedPhrasesV2::Phrase> AssociatedPhrasesV2::findPhrases(
     const std::string& prefixValue,
-    const std::vector<std::string>& prefixReadings) const {
-  if (prefixValue.empty()) {
+    const std::vector<std::string>& prefixReadings, size_t maxCount) const {
+  if (db_ == nullptr || prefixValue.empty() || maxCount == 0) {
     return {};
   }
 
+  // The prefix of the rows to find, such as "輸-ㄕㄨ-入-ㄖㄨˋ-", and the prefix
+  // of the keys of the groups they are in, such as "輸-ㄕㄨ-".
+  std::string internalPrefix;
+  std::string_view groupPrefix;
   if (prefixReadings.empty()) {
-    std::string internalPrefix = prefixValue + kSeparatorChar;
-    return findPhrases(internalPrefix);
+    internalPrefix = prefixValue + kSeparatorChar;
+    groupPrefix = internalPrefix;
+  } else {
+    std::vector<std::string> values = Split(prefixValue);
+    if (values.size() != prefixReadings.size()) {
+      return {};
+    }
+    for (size_t i = 0, s = values.size(); i < s; ++i) {
+      internalPrefix += values[i];
+      internalPrefix += kSeparatorChar;
+      internalPrefix += prefixReadings[i];
+      internalPrefix += kSeparatorChar;
+    }
+    groupPrefix = std::string_view(internalPrefix)
+                      .substr(0, values[0].length() +
+                                     prefixReadings[0].length() + 2);
   }
 
-  std::vector<std::string> values = Split(prefixValue);
-  if (values.size() != prefixReadings.size()) {
+  std::lock_guard<std::mutex> lock(cacheMutex_);
+  const Matches* matches = findMatches(internalPrefix, groupPrefix);
+  if (matches == nullptr) {
     return {};
   }
 
-  std::stringstream sst;
-  for (size_t i = 0, s = values.size(); i < s; ++i) {
-    sst << values[i];
-    sst << kSeparatorChar;
-    sst << prefixReadings[i];
-    sst << kSeparatorChar;
+  std::vector<Phrase> phrases;
+  // Phrase cannot be moved, so reserve enough to never reallocate.
+  phrases.reserve(std::min(matches->rows.size(), maxCount));
+  std::vector<uint32_t> valueHashes;
+  for (auto it = matches->rows.cbegin();
+       it != matches->rows.cend() && phrases.size() < maxCount; ++it) {
+    const RankedRow& row = rankedRows_[*it];
+    if (matches->wholeGroups && row.duplicate) {
+      continue;
+    }
+
+    std::string_view text = rowAt(row);
+    if (matches->checkDuplicates) {
+      bool seen = false;
+      for (size_t i = 0, s = phrases.size(); i < s && !seen; ++i) {
+        seen = valueHashes[i] == row.valueHash &&
+               ValueEquals(text, phrases[i].value);
+      }
+      if (seen) {
+        continue;
+      }
+      valueHashes.push_back(row.valueHash);
+    }
+
+    std::string value;
+    std::vector<std::string> readings;
+    ParseRow(text, &value, &readings);
+    phrases.emplace_back(std::move(value), std::move(readings));
   }
-  return findPhrases(sst.str());
+  return phrases;
 }
 
-std::vector<AssociatedPhrasesV2::Phrase> AssociatedPhrasesV2::findPhrases(
-    const std::string& internalPrefix) const {
-  if (db_ == nullptr) {
-    return {};
+const AssociatedPhrasesV2::Matches* AssociatedPhrasesV2::findMatches(
+    const std::string& internalPrefix, std::string_view groupPrefix) const {
+  // Move a cached hit to the front, which is the most recently used.
+  auto hit = std::find_if(cache_.begin(), cache_.end(), [&](const Matches& m) {
+    return m.prefix == internalPrefix;
+  });
+  if (hit != cache_.end()) {
+    std::rotate(cache_.begin(), hit, hit + 1);
+    return &cache_.front();
   }
 
-  std::vector<std::string_view> matchingRows = db_->findRows(internalPrefix);
-  if (matchingRows.empty()) {
-    return {};
+  Matches matches;
+  matches.prefix = internalPrefix;
+  matches.wholeGroups = internalPrefix.length() == groupPrefix.length();
+
+  // The rows for a longer prefix are among those for a shorter one, in the
+  // same order, so narrow down the longest cached shorter prefix if any.
+  const Matches* shorter = nullptr;
+  for (const Matches& m : cache_) {
+    if (internalPrefix.starts_with(m.prefix) &&
+        (shorter == nullptr || m.prefix.length() > shorter->prefix.length())) {
+      shorter = &m;
+    }
   }
 
-  using RowScorePair = std::pair<std::string_view, double>;
+  if (shorter != nullptr) {
+    // Only a single group can be narrowed down to.
+    matches.checkDuplicates = !matches.wholeGroups;
+    for (uint32_t index : shorter->rows) {
+      if (rowAt(rankedRows_[index]).starts_with(internalPrefix)) {
+        matches.rows.push_back(index);
+      }
+    }
+  } else {
+    auto [first, last] = findGroups(groupPrefix);
+    if (first == last) {
+      return nullptr;
+    }
 
-  std::vector<RowScorePair> scoredRows;
-  for (const auto& strviews : matchingRows) {
-    scoredRows.emplace_back(strviews, GetScoreInRow(strviews));
+    if (!matches.wholeGroups) {
+      // Only some rows of the group match, and their duplicates may be among
+      // the rows that do not. The matching rows are next to each other in the
+      // DB, so they are found by a binary search over the group's rows in the
+      // DB's order, and then put in the order of their ranks.
+      auto keysBegin = rowsByKey_.cbegin() + first->begin;
+      auto keysEnd = rowsByKey_.cbegin() + first->end;
+      auto matchBegin = std::lower_bound(
+          keysBegin, keysEnd, internalPrefix,
+          [this](uint32_t index, const std::string& prefix) {
+            return rowAt(rankedRows_[index]).substr(0, prefix.length()) <
+                   prefix;
+          });
+      auto matchEnd =
+          std::find_if_not(matchBegin, keysEnd, [&](uint32_t index) {
+            return rowAt(rankedRows_[index]).starts_with(internalPrefix);
+          });
+      matches.rows.assign(matchBegin, matchEnd);
+      std::sort(matches.rows.begin(), matches.rows.end());
+      matches.checkDuplicates = true;
+    } else {
+      // Whole groups match, and the duplicates marked by compile() can be
+      // skipped. Only phrases from different groups need to be checked.
+      matches.checkDuplicates = last - first > 1;
+
+      // Merge the groups' rows by taking the highest-ranking row among them
+      // each time. Rows with the same score are taken in the order of the DB.
+      std::vector<uint32_t> cursors;
+      size_t rowCount = 0;
+      for (auto it = first; it != last; ++it) {
+        cursors.push_back(it->begin);
+        rowCount += it->end - it->begin;
+      }
+      matches.rows.reserve(rowCount);
+      while (matches.rows.size() < rowCount) {
+        const RankedRow* row = nullptr;
+        size_t taken = 0;
+        for (size_t i = 0, s = cursors.size(); i < s; ++i) {
+          if (cursors[i] == first[i].end) {
+            continue;
+          }
+          const RankedRow& candidate = rankedRows_[cursors[i]];
+          if (row == nullptr || candidate.score > row->score ||
+              (candidate.score == row->score &&
+               candidate.offset < row->offset)) {
+            row = &candidate;
+            taken = i;
+          }
+        }
+        matches.rows.push_back(cursors[taken]++);
+      }
+    }
   }
 
-  std::stable_sort(
-      scoredRows.begin(), scoredRows.end(),
-      [](const auto& r1, const auto& r2) { return r1.second > r2.second; });
-
-  // Dedup the phrases with the same value. Since the vector is now ranked,
-  // higher-ranking values will be retained.
-  std::unordered_set<std::string> dedupSet;
-  std::vector<AssociatedPhrasesV2::Phrase> phrases;
-  for (const auto& rspair : scoredRows) {
-    Phrase p = PhraseFromRow(rspair.first);
-    if (dedupSet.find(p.value) != dedupSet.cend()) {
-      continue;
-    }
-    dedupSet.insert(p.value);
-    phrases.emplace_back(std::move(p));
+  if (cache_.size() == kCacheSize) {
+    cache_.pop_back();
   }
-  return phrases;
+  cache_.insert(cache_.begin(), std::move(matches));
+  return &cache_.front();
 }
 
 std::string AssociatedPhrasesV2::Phrase::combinedReading() const {
@@ -24,8 +24,13 @@
 #ifndef SRC_ENGINE_ASSOCIATEDPHRASESV2_H_
 #define SRC_ENGINE_ASSOCIATEDPHRASESV2_H_
 
+#include <cstddef>
+#include <cstdint>
+#include <limits>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
 #include <utility>
 #include <vector>
 
@@ -34,6 +39,14 @@
 
 namespace McBopomofo {
 
+// Finds associated phrases from a DB of rows such as "輸-ㄕㄨ-入-ㄖㄨˋ -5.3",
+// sorted by the byte value of the rows. When the DB is opened, the rows are
+// compiled into groups by their first value and reading, such as "輸-ㄕㄨ-".
+// Each group is ranked by score, with the lower-ranking rows of the same phrase
+// marked as duplicates, so that lookups stream the results in order and only
+// parse the rows that they return. The rows found for the last few prefixes
+// are cached, so that looking a prefix up again, or looking up a longer one as
+// associated phrases are chained, does not search the DB again.
 class AssociatedPhrasesV2 {
  public:
   ~AssociatedPhrasesV2();
@@ -69,9 +82,12 @@ class AssociatedPhrasesV2 {
   // behavior will be exactly like that of our previous implementation of
   // associated phrases, where we were only able to search with single-codepoint
   // prefix values (such as using 輸 to find phrases like 輸入法).
+  //
+  // At most maxCount phrases, the highest-ranking ones, are returned.
   std::vector<Phrase> findPhrases(
       const std::string& prefixValue,
-      const std::vector<std::string>& prefixReadings) const;
+      const std::vector<std::string>& prefixReadings,
+      size_t maxCount = std::numeric_limits<size_t>::max()) const;
 
   // Convenience for splitting reading, e.g. "ㄕㄨ-ㄖㄨˋ" to ["ㄕㄨ", "ㄖㄨˋ"].
   static std::vector<std::string> SplitReadings(
@@ -81,10 +97,73 @@ class AssociatedPhrasesV2 {
   static std::string CombineReadings(const std::vector<std::string>& readings);
 
  protected:
-  std::vector<Phrase> findPhrases(const std::string& internalPrefix) const;
+  // A row of the DB, compiled.
+  struct RankedRow {
+    double score;
+    // The row's position from the start of the DB's rows.
+    uint32_t offset;
+    uint32_t length;
+    // A hash of the phrase's value, for finding duplicates.
+    uint32_t valueHash;
+    // Whether a higher-ranking row of the same group has the same value.
+    bool duplicate;
+  };
+
+  // The rows that start with the same value and reading, such as "輸-ㄕㄨ-".
+  struct Group {
+    uint32_t keyOffset;
+    uint32_t keyLength;
+    // The group's range in rankedRows_.
+    uint32_t begin;
+    uint32_t end;
+  };
+
+  // The rows that match a prefix, in the order of their ranks.
+  struct Matches {
+    std::string prefix;
+    // The positions of the rows in rankedRows_.
+    std::vector<uint32_t> rows;
+    // Whether the prefix matches whole groups, in which case the rows marked
+    // as duplicates can be skipped.
+    bool wholeGroups = false;
+    // Whether rows with the same value as a higher-ranking one can remain.
+    bool checkDuplicates = true;
+  };
+
+  static constexpr size_t kCacheSize = 8;
+
+  void compile();
+
+  // Returns the matches for the prefix, from the cache if possible, or
+  // nullptr if there are none. cacheMutex_ must be held.
+  const Matches* findMatches(const std::string& internalPrefix,
+                             std::string_view groupPrefix) const;
+
+  std::string_view groupKey(const Group& group) const {
+    return {rowsBegin_ + group.keyOffset, group.keyLength};
+  }
+
+  std::string_view rowAt(const RankedRow& row) const {
+    return {rowsBegin_ + row.offset, row.length};
+  }
+
+  // Returns the groups whose keys start with the prefix.
+  std::pair<std::vector<Group>::const_iterator,
+            std::vector<Group>::const_iterator>
+  findGroups(std::string_view prefix) const;
 
   MemoryMappedFile mmapedFile_;
   std::unique_ptr<ParselessPhraseDB> db_;
+  const char* rowsBegin_ = nullptr;
+  std::vector<RankedRow> rankedRows_;
+  // The positions in rankedRows_ of each group's rows, in the order of the
+  // DB, for finding the rows that match a prefix longer than a group's key.
+  std::vector<uint32_t> rowsByKey_;
+  std::vector<Group> groups_;
+
+  mutable std::mutex cacheMutex_;
+  // The matches of recent lookups, the most recently used first.
+  mutable std::vector<Matches> cache_;
 };
 
 }  // namespace McBopomofo
@@ -0,0 +1,280 @@
+// Copyright (c) 2026 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "AssociatedPhrasesV2.h"
+#include "ParselessPhraseDB.h"
+
+namespace {
+
+// The shape of the real data: up to 60 phrases of two to four characters for
+// each first character and reading, with some characters having several
+// readings.
+constexpr size_t kCharCount = 4000;
+constexpr size_t kMaxPhrasesPerPrefix = 60;
+constexpr size_t kQueryCount = 1024;
+
+struct Pair {
+  std::string value;
+  std::string reading;
+};
+
+std::string MakeChar(size_t index) {
+  // Encodes a code point from U+4E00 onwards in UTF-8.
+  auto codePoint = static_cast<uint32_t>(0x4E00 + index);
+  std::string s;
+  s += static_cast<char>(0xE0 | (codePoint >> 12));
+  s += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+  s += static_cast<char>(0x80 | (codePoint & 0x3F));
+  return s;
+}
+
+std::string MakeReading(size_t index) {
+  static const char* kInitials[] = {"ㄅ", "ㄆ", "ㄇ", "ㄈ", "ㄉ", "ㄊ", "ㄋ",
+                                    "ㄌ", "ㄍ", "ㄎ", "ㄏ", "ㄐ", "ㄑ", "ㄒ"};
+  static const char* kFinals[] = {"ㄚ", "ㄛ", "ㄜ", "ㄞ", "ㄟ", "ㄠ",
+                                  "ㄡ", "ㄢ", "ㄣ", "ㄤ", "ㄥ", "ㄧ"};
+  static const char* kTones[] = {"", "ˊ", "ˇ", "ˋ"};
+  constexpr size_t kInitialCount = std::size(kInitials);
+  constexpr size_t kFinalCount = std::size(kFinals);
+  constexpr size_t kToneCount = std::size(kTones);
+  return std::string(kInitials[index % kInitialCount]) +
+         kFinals[(index / kInitialCount) % kFinalCount] +
+         kTones[(index / kInitialCount / kFinalCount) % kToneCount];
+}
+
+class BenchmarkDataset {
+ public:
+  BenchmarkDataset() {
+    // Fixed seed so that benchmark runs use the same data.
+    std::mt19937 random(std::mt19937::default_seed);
+    std::uniform_int_distribution<size_t> charIndex(0, kCharCount - 1);
+    std::uniform_int_distribution<size_t> readingIndex(0, 1000);
+    std::uniform_int_distribution<size_t> phraseCount(1, kMaxPhrasesPerPrefix);
+    std::uniform_int_distribution<size_t> extraLength(1, 3);
+    std::uniform_real_distribution<double> score(-8.0, -2.0);
+    std::uniform_int_distribution<int> percent(0, 99);
+
+    std::vector<std::string> rows;
+    for (size_t c = 0; c < kCharCount; ++c) {
+      size_t readingCount = c % 5 == 0 ? 3 : 1;
+      for (size_t r = 0; r < readingCount; ++r) {
+        Pair head{MakeChar(c), MakeReading(c * 3 + r)};
+        prefixes_.push_back(head);
+        for (size_t i = 0, n = phraseCount(random); i < n; ++i) {
+          std::vector<Pair> pairs{head};
+          for (size_t j = 0, m = extraLength(random); j < m; ++j) {
+            size_t next = charIndex(random);
+            pairs.push_back(Pair{MakeChar(next), MakeReading(next * 3)});
+          }
+          rows.push_back(MakeRow(pairs, score(random)));
+          if (i == 0) {
+            longerPrefixes_.push_back(pairs);
+          }
+
+          // The same phrase with another reading, as in 處理 read ㄔㄨˇ or
+          // ㄔㄨˋ, which lookups must drop.
+          if (percent(random) < 10) {
+            pairs.back().reading = MakeReading(readingIndex(random));
+            rows.push_back(MakeRow(pairs, score(random)));
+          }
+        }
+      }
+    }
+    std::sort(rows.begin(), rows.end());
+
+    data_ = McBopomofo::SORTED_PRAGMA_HEADER;
+    for (const std::string& row : rows) {
+      data_ += row;
+      data_ += '\n';
+    }
+
+    std::uniform_int_distribution<size_t> prefixIndex(0, prefixes_.size() - 1);
+    std::uniform_int_distribution<size_t> longerPrefixIndex(
+        0, longerPrefixes_.size() - 1);
+    for (size_t i = 0; i < kQueryCount; ++i) {
+      queries_.push_back(prefixIndex(random));
+      longerQueries_.push_back(longerPrefixIndex(random));
+    }
+  }
+
+  std::unique_ptr<McBopomofo::ParselessPhraseDB> makeDB() const {
+    return McBopomofo::ParselessPhraseDB::CreateValidatedDB(data_.data(),
+                                                            data_.size());
+  }
+
+  size_t dataSize() const { return data_.size(); }
+
+  // The first value and reading of the query at the index.
+  const Pair& prefix(size_t i) const {
+    return prefixes_[queries_[i % kQueryCount]];
+  }
+
+  // The values and readings of a phrase, whose first two are the prefix of
+  // the query at the index.
+  const std::vector<Pair>& phrase(size_t i) const {
+    return longerPrefixes_[longerQueries_[i % kQueryCount]];
+  }
+
+  // The first two values and readings of a phrase, for the query at the
+  // index.
+  std::pair<std::string, std::vector<std::string>> longerPrefix(
+      size_t i) const {
+    const std::vector<Pair>& pairs = phrase(i);
+    return {pairs[0].value + pairs[1].value,
+            {pairs[0].reading, pairs[1].reading}};
+  }
+
+ private:
+  static std::string MakeRow(const std::vector<Pair>& pairs, double score) {
+    std::string row;
+    for (const Pair& pair : pairs) {
+      if (!row.empty()) {
+        row += '-';
+      }
+      row += pair.value + "-" + pair.reading;
+    }
+    char buffer[16];
+    snprintf(buffer, sizeof(buffer), " %.4f", score);
+    return row + buffer;
+  }
+
+  std::string data_;
+  std::vector<Pair> prefixes_;
+  std::vector<std::vector<Pair>> longerPrefixes_;
+  std::vector<size_t> queries_;
+  std::vector<size_t> longerQueries_;
+};
+
+const BenchmarkDataset& Dataset() {
+  static const BenchmarkDataset dataset;
+  return dataset;
+}
+
+void BM_AssociatedPhrasesV2Open(benchmark::State& state) {
+  const BenchmarkDataset& dataset = Dataset();
+  for (auto _ : state) {
+    McBopomofo::AssociatedPhrasesV2 phrases;
+    phrases.open(dataset.makeDB());
+    benchmark::DoNotOptimize(phrases.isLoaded());
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(dataset.dataSize()));
+}
+BENCHMARK(BM_AssociatedPhrasesV2Open)->Unit(benchmark::kMillisecond);
+
+// The lookup that KeyHandler makes after a character is committed.
+void BM_AssociatedPhrasesV2FindByValueAndReading(benchmark::State& state) {
+  const BenchmarkDataset& dataset = Dataset();
+  McBopomofo::AssociatedPhrasesV2 phrases;
+  phrases.open(dataset.makeDB());
+  auto maxCount = static_cast<size_t>(state.range(0));
+  size_t i = 0;
+  for (auto _ : state) {
+    const Pair& prefix = dataset.prefix(i++);
+    auto results =
+        phrases.findPhrases(prefix.value, {prefix.reading}, maxCount);
+    benchmark::DoNotOptimize(results.data());
+  }
+}
+BENCHMARK(BM_AssociatedPhrasesV2FindByValueAndReading)
+    ->Arg(5)
+    ->Arg(10)
+    ->Arg(std::numeric_limits<int>::max());
+
+// The lookup by a character alone, which spans all its readings.
+void BM_AssociatedPhrasesV2FindByValue(benchmark::State& state) {
+  const BenchmarkDataset& dataset = Dataset();
+  McBopomofo::AssociatedPhrasesV2 phrases;
+  phrases.open(dataset.makeDB());
+  size_t i = 0;
+  for (auto _ : state) {
+    auto results = phrases.findPhrases(dataset.prefix(i++).value, {});
+    benchmark::DoNotOptimize(results.data());
+  }
+}
+BENCHMARK(BM_AssociatedPhrasesV2FindByValue);
+
+// The lookup by a two-character prefix, which matches part of a group.
+void BM_AssociatedPhrasesV2FindByLongerPrefix(benchmark::State& state) {
+  const BenchmarkDataset& dataset = Dataset();
+  McBopomofo::AssociatedPhrasesV2 phrases;
+  phrases.open(dataset.makeDB());
+  size_t i = 0;
+  for (auto _ : state) {
+    auto [value, readings] = dataset.longerPrefix(i++);
+    auto results = phrases.findPhrases(value, readings);
+    benchmark::DoNotOptimize(results.data());
+  }
+}
+BENCHMARK(BM_AssociatedPhrasesV2FindByLongerPrefix);
+
+// The same few lookups again and again, as when going back to a state, which
+// the cache answers.
+void BM_AssociatedPhrasesV2FindRepeated(benchmark::State& state) {
+  constexpr size_t kRepeatedQueryCount = 4;
+  const BenchmarkDataset& dataset = Dataset();
+  McBopomofo::AssociatedPhrasesV2 phrases;
+  phrases.open(dataset.makeDB());
+  size_t i = 0;
+  for (auto _ : state) {
+    const Pair& prefix = dataset.prefix(i++ % kRepeatedQueryCount);
+    auto results = phrases.findPhrases(prefix.value, {prefix.reading});
+    benchmark::DoNotOptimize(results.data());
+  }
+}
+BENCHMARK(BM_AssociatedPhrasesV2FindRepeated);
+
+// A lookup by a character and its reading, followed by one for the first two
+// characters of a phrase, which narrows down the first lookup's cached rows.
+void BM_AssociatedPhrasesV2FindChained(benchmark::State& state) {
+  const BenchmarkDataset& dataset = Dataset();
+  McBopomofo::AssociatedPhrasesV2 phrases;
+  phrases.open(dataset.makeDB());
+  size_t i = 0;
+  for (auto _ : state) {
+    const std::vector<Pair>& pairs = dataset.phrase(i++);
+    auto results = phrases.findPhrases(pairs[0].value, {pairs[0].reading});
+    benchmark::DoNotOptimize(results.data());
+    results = phrases.findPhrases(pairs[0].value + pairs[1].value,
+                                  {pairs[0].reading, pairs[1].reading});
+    benchmark::DoNotOptimize(results.data());
+  }
+}
+BENCHMARK(BM_AssociatedPhrasesV2FindChained);
+
+}  // namespace
+
+BENCHMARK_MAIN();
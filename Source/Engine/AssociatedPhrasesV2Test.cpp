@@ -91,6 +91,81 @@ TEST(AssociatedPhrasesV2Test, ReturnsSortedResultsWithReadings) {
   EXPECT_EQ(results[0].value, "一個人");
 }
 
+TEST(AssociatedPhrasesV2Test, DropsDuplicatePhrases) {
+  AssociatedPhrasesV2 phrases;
+  auto db = std::make_unique<ParselessPhraseDB>(kSample, sizeof(kSample));
+  EXPECT_TRUE(phrases.open(std::move(db)));
+
+  // 文書處理 is listed with two readings of 處, but is only returned once.
+  std::vector<AssociatedPhrasesV2::Phrase> results =
+      phrases.findPhrases("文", {});
+  ASSERT_EQ(results.size(), 1);
+  EXPECT_EQ(results[0].combinedReading(), "ㄨㄣˊ-ㄕㄨ-ㄔㄨˇ-ㄌㄧˇ");
+
+  results = phrases.findPhrases("文書", {"ㄨㄣˊ", "ㄕㄨ"});
+  ASSERT_EQ(results.size(), 1);
+  EXPECT_EQ(results[0].value, "文書處理");
+
+  results = phrases.findPhrases("文書處", {"ㄨㄣˊ", "ㄕㄨ", "ㄔㄨˋ"});
+  ASSERT_EQ(results.size(), 1);
+  EXPECT_EQ(results[0].combinedReading(), "ㄨㄣˊ-ㄕㄨ-ㄔㄨˋ-ㄌㄧˇ");
+}
+
+TEST(AssociatedPhrasesV2Test, ReturnsTopResults) {
+  AssociatedPhrasesV2 phrases;
+  auto db = std::make_unique<ParselessPhraseDB>(kSample, sizeof(kSample));
+  EXPECT_TRUE(phrases.open(std::move(db)));
+
+  std::vector<AssociatedPhrasesV2::Phrase> all =
+      phrases.findPhrases("一", {"ㄧ"});
+  ASSERT_EQ(all.size(), 11);
+  for (size_t i = 1; i < all.size(); ++i) {
+    EXPECT_NE(all[i - 1].value, all[i].value);
+  }
+
+  std::vector<AssociatedPhrasesV2::Phrase> top =
+      phrases.findPhrases("一", {"ㄧ"}, 3);
+  ASSERT_EQ(top.size(), 3);
+  for (size_t i = 0; i < top.size(); ++i) {
+    EXPECT_EQ(top[i].value, all[i].value);
+  }
+  EXPECT_EQ(top[1].value, "一些");
+  EXPECT_TRUE(phrases.findPhrases("一", {"ㄧ"}, 0).empty());
+}
+
+TEST(AssociatedPhrasesV2Test, NarrowsDownResults) {
+  AssociatedPhrasesV2 phrases;
+  auto db = std::make_unique<ParselessPhraseDB>(kSample, sizeof(kSample));
+  EXPECT_TRUE(phrases.open(std::move(db)));
+
+  std::vector<AssociatedPhrasesV2::Phrase> results =
+      phrases.findPhrases("一", {"ㄧ"});
+  EXPECT_EQ(results.size(), 11);
+  // A longer prefix narrows down the rows cached for the shorter one.
+  results = phrases.findPhrases("一個", {"ㄧ", "ㄍㄜ˙"});
+  ASSERT_EQ(results.size(), 2);
+  EXPECT_EQ(results[0].value, "一個人");
+  EXPECT_EQ(results[1].value, "一個月");
+  results = phrases.findPhrases("一九", {"ㄧ", "ㄐㄧㄡˇ"}, 1);
+  ASSERT_EQ(results.size(), 1);
+  EXPECT_EQ(results[0].value, "一九九");
+  EXPECT_TRUE(phrases.findPhrases("一二", {"ㄧ", "ㄦˋ"}).empty());
+
+  // Looking up the same prefix again gives the same results.
+  results = phrases.findPhrases("一個", {"ㄧ", "ㄍㄜ˙"});
+  ASSERT_EQ(results.size(), 2);
+  EXPECT_EQ(results[0].value, "一個人");
+
+  // A phrase dropped as a duplicate for the shorter prefix is found for the
+  // longer one that only it matches.
+  results = phrases.findPhrases("文", {});
+  ASSERT_EQ(results.size(), 1);
+  EXPECT_EQ(results[0].combinedReading(), "ㄨㄣˊ-ㄕㄨ-ㄔㄨˇ-ㄌㄧˇ");
+  results = phrases.findPhrases("文書處", {"ㄨㄣˊ", "ㄕㄨ", "ㄔㄨˋ"});
+  ASSERT_EQ(results.size(), 1);
+  EXPECT_EQ(results[0].combinedReading(), "ㄨㄣˊ-ㄕㄨ-ㄔㄨˋ-ㄌㄧˇ");
+}
+
 TEST(AssociatedPhrasesV2Test, ResultsOnlyBeginWithTheSamePrefix) {
   AssociatedPhrasesV2 phrases;
   auto db = std::make_unique<ParselessPhraseDB>(kSample, sizeof(kSample));
@@ -21,32 +21,57 @@
 // FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
 // OTHER DEALINGS IN THE SOFTWARE.
 
-#ifdef ENABLE_EXPERIMENTAL_SIMD_SUPPORT_AVX512
-#if defined(__AVX512F__)
-#include <immintrin.h>
+#include "ByteBlockBackedDictionary.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
-#else
-#error AVX512 support required
-#endif
-#endif
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "MemoryMappedFile.h"
 
 #ifdef ENABLE_EXPERIMENTAL_SIMD_SUPPORT_NEON
 #if defined(__ARM_NEON)
 #include <arm_neon.h>
-
-#include <cstdint>
 #else
 #error ARM NEON support required
 #endif
 #endif
 
-#include "ByteBlockBackedDictionary.h"
+// The x86-64 kernels are compiled with function-level target attributes and
+// are only selected if the host CPU supports them, so no -march flag is needed.
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define MCBOPOMOFO_X86_64_SIMD_KERNELS 1
+#include <immintrin.h>
+#endif
 
 namespace McBopomofo {
 
 namespace {
 
+// The scanning primitives used by the parser. All kernels must return the same
+// results; they only differ in speed.
+struct ScanKernelFunctions {
+  ByteBlockBackedDictionary::ScanKernel kernel;
+  const char* (*advanceToNextCRLF)(const char* ptr, const char* end);
+  const char* (*advanceToNextNonContentCharacter)(const char* ptr,
+                                                  const char* end);
+
+  // Returns the position of the first NULL in [ptr, end), or end if not found.
+  // If a NULL is found and firstLineNumber is not null, the 1-based number of
+  // the line containing it is stored there.
+  const char* (*findFirstNULL)(const char* ptr, const char* end,
+                               size_t* firstLineNumber);
+};
+
 const char* AdvanceToNextNonWhitespace(const char* ptr, const char* end) {
   while (ptr != end) {
     if (const char c = *ptr; c != ' ' && c != '\t') {
@@ -94,10 +119,19 @@ const char* AdvanceToNextNonContentCharacter(const char* ptr, const char* end) {
   return ptr;
 }
 
-#if !defined(ENABLE_EXPERIMENTAL_SIMD_SUPPORT_AVX512) && \
-    !defined(ENABLE_EXPERIMENTAL_SIMD_SUPPORT_NEON)
+size_t CountLinefeeds(const char* ptr, const char* end) {
+  size_t count = 0;
+  while (ptr != end) {
+    if (*ptr == '\n') {
+      ++count;
+    }
+    ++ptr;
+  }
+  return count;
+}
+
 const char* FindFirstNULL(const char* ptr, const char* end,
-                          size_t* firstLineNumber = nullptr) {
+                          size_t* firstLineNumber) {
   const char* i = ptr;
   while (i != end) {
     if (*i == 0) {
@@ -108,46 +142,24 @@ const char* FindFirstNULL(const char* ptr, const char* end,
 
   // Only count the line number if there is indeed a NULL.
   if (i != end && firstLineNumber != nullptr) {
-    size_t lineCounter = 1;
-    while (ptr != i) {
-      if (*ptr == '\n') {
-        ++lineCounter;
-      }
-      ++ptr;
-    }
-    *firstLineNumber = lineCounter;
+    *firstLineNumber = CountLinefeeds(ptr, i) + 1;
   }
 
   return i;
 }
-#endif
 
 bool IsCRLF(char c) { return c == '\n' || c == '\r'; }
 
 bool IsWhitespace(char c) { return c == ' ' || c == '\t'; }
 
-#ifdef ENABLE_EXPERIMENTAL_SIMD_SUPPORT_AVX512
-
-const char* AVX512_AdvanceToNextCRLF(const char* ptr,
-                                     const char* unaligned32End,
-                                     const char* end) {
-  const __m256i lfs = _mm256_set1_epi8('\n');
-  const __m256i crs = _mm256_set1_epi8('\r');
-
-  while (ptr < unaligned32End) {
-    const __m256i block = _mm256_loadu_epi8(ptr);
-    const __mmask32 foundLFs = _mm256_cmpeq_epi8_mask(block, lfs);
-    const __mmask32 foundCRs = _mm256_cmpeq_epi8_mask(block, crs);
-    const __mmask32 mask = _kor_mask32(foundLFs, foundCRs);
-    if (mask != 0) {
-      return ptr + _tzcnt_u32(mask);
-    }
-
-    ptr += 32;
-  }
+constexpr ScanKernelFunctions kScalarKernel = {
+    ByteBlockBackedDictionary::ScanKernel::SCALAR,
+    AdvanceToNextCRLF,
+    AdvanceToNextNonContentCharacter,
+    FindFirstNULL,
+};
 
-  return AdvanceToNextCRLF(ptr, end);
-}
+#ifdef MCBOPOMOFO_X86_64_SIMD_KERNELS
 
 // Four chars: 0x09 (T), 0x0a (L), 0x0d (C), 0x20 (S)
 // T maps to 0x01
@@ -167,10 +179,191 @@ alignas(32) constexpr uint8_t HI_NIBBLES_LOOKUP[32] = {
     0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
 };
 
-const char* AVX512_AdvanceToNextNonContentCharacter(const char* ptr,
-                                                    const char* unaligned32End,
-                                                    const char* end) {
-  while (ptr < unaligned32End) {
+// SSE4.2 string instructions compare a block against a small character set
+// in one go: PCMPESTRI returns the index of the first byte that equals any of
+// the characters in the set, or 16 if there is none.
+alignas(16) constexpr char SSE42_CRLF_SET[16] = {'\r', '\n'};
+alignas(16) constexpr char SSE42_NON_CONTENT_SET[16] = {' ', '\t', '\r', '\n'};
+constexpr int SSE42_EQUAL_ANY = _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY;
+
+__attribute__((target("sse4.2"))) const char* SSE42_AdvanceToNextCRLF(
+    const char* ptr, const char* end) {
+  const __m128i set =
+      _mm_load_si128(reinterpret_cast<const __m128i*>(SSE42_CRLF_SET));
+  while (end - ptr >= 16) {
+    const __m128i block =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr));
+    const int index = _mm_cmpestri(set, 2, block, 16, SSE42_EQUAL_ANY);
+    if (index != 16) {
+      return ptr + index;
+    }
+    ptr += 16;
+  }
+  return AdvanceToNextCRLF(ptr, end);
+}
+
+__attribute__((target("sse4.2"))) const char*
+SSE42_AdvanceToNextNonContentCharacter(const char* ptr, const char* end) {
+  const __m128i set =
+      _mm_load_si128(reinterpret_cast<const __m128i*>(SSE42_NON_CONTENT_SET));
+  while (end - ptr >= 16) {
+    const __m128i block =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr));
+    const int index = _mm_cmpestri(set, 4, block, 16, SSE42_EQUAL_ANY);
+    if (index != 16) {
+      return ptr + index;
+    }
+    ptr += 16;
+  }
+  return AdvanceToNextNonContentCharacter(ptr, end);
+}
+
+__attribute__((target("sse4.2,popcnt"))) const char* SSE42_FindFirstNULL(
+    const char* ptr, const char* end, size_t* firstLineNumber) {
+  const __m128i zeros = _mm_setzero_si128();
+  const char* i = ptr;
+  while (end - i >= 16) {
+    const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(i));
+    const int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, zeros));
+    if (mask != 0) {
+      i += __builtin_ctz(mask);
+      break;
+    }
+    i += 16;
+  }
+  while (i != end && *i != 0) {
+    ++i;
+  }
+
+  if (i == end || firstLineNumber == nullptr) {
+    return i;
+  }
+
+  size_t lineCounter = 1;
+  const __m128i linefeeds = _mm_set1_epi8('\n');
+  const char* p = ptr;
+  while (i - p >= 16) {
+    const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    lineCounter += _mm_popcnt_u32(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(block, linefeeds)));
+    p += 16;
+  }
+  *firstLineNumber = lineCounter + CountLinefeeds(p, i);
+  return i;
+}
+
+__attribute__((target("avx2"))) const char* AVX2_AdvanceToNextCRLF(
+    const char* ptr, const char* end) {
+  const __m256i lfs = _mm256_set1_epi8('\n');
+  const __m256i crs = _mm256_set1_epi8('\r');
+
+  while (end - ptr >= 32) {
+    const __m256i block =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr));
+    const __m256i found = _mm256_or_si256(_mm256_cmpeq_epi8(block, lfs),
+                                          _mm256_cmpeq_epi8(block, crs));
+    const auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(found));
+    if (mask != 0) {
+      return ptr + __builtin_ctz(mask);
+    }
+    ptr += 32;
+  }
+
+  return AdvanceToNextCRLF(ptr, end);
+}
+
+__attribute__((target("avx2"))) const char*
+AVX2_AdvanceToNextNonContentCharacter(const char* ptr, const char* end) {
+  const __m256i mask = _mm256_set1_epi8(0x0f);
+  const __m256i loTbl =
+      _mm256_load_si256(reinterpret_cast<const __m256i*>(LO_NIBBLES_LOOKUP));
+  const __m256i hiTbl =
+      _mm256_load_si256(reinterpret_cast<const __m256i*>(HI_NIBBLES_LOOKUP));
+
+  while (end - ptr >= 32) {
+    const __m256i input =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr));
+    const __m256i loNibbles = _mm256_and_si256(input, mask);
+    const __m256i hiNibbles =
+        _mm256_and_si256(_mm256_srli_epi16(input, 4), mask);
+    const __m256i lo = _mm256_shuffle_epi8(loTbl, loNibbles);
+    const __m256i hi = _mm256_shuffle_epi8(hiTbl, hiNibbles);
+    const __m256i intersection = _mm256_and_si256(lo, hi);
+    // Content characters have an empty intersection.
+    const auto contentMask = static_cast<uint32_t>(_mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(intersection, _mm256_setzero_si256())));
+    if (contentMask != 0xffffffff) {
+      return ptr + __builtin_ctz(~contentMask);
+    }
+    ptr += 32;
+  }
+
+  return AdvanceToNextNonContentCharacter(ptr, end);
+}
+
+__attribute__((target("avx2,popcnt"))) const char* AVX2_FindFirstNULL(
+    const char* ptr, const char* end, size_t* firstLineNumber) {
+  const __m256i zeros = _mm256_setzero_si256();
+  const char* i = ptr;
+  while (end - i >= 32) {
+    const __m256i block =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(i));
+    const auto mask = static_cast<uint32_t>(
+        _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, zeros)));
+    if (mask != 0) {
+      i += __builtin_ctz(mask);
+      break;
+    }
+    i += 32;
+  }
+  while (i != end && *i != 0) {
+    ++i;
+  }
+
+  if (i == end || firstLineNumber == nullptr) {
+    return i;
+  }
+
+  size_t lineCounter = 1;
+  const __m256i linefeeds = _mm256_set1_epi8('\n');
+  const char* p = ptr;
+  while (i - p >= 32) {
+    const __m256i block =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    lineCounter += _mm_popcnt_u32(static_cast<uint32_t>(
+        _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, linefeeds))));
+    p += 32;
+  }
+  *firstLineNumber = lineCounter + CountLinefeeds(p, i);
+  return i;
+}
+
+#define AVX512_TARGET \
+  __attribute__((target("avx512f,avx512bw,avx512vl,popcnt")))
+
+AVX512_TARGET const char* AVX512_AdvanceToNextCRLF(const char* ptr,
+                                                   const char* end) {
+  const __m256i lfs = _mm256_set1_epi8('\n');
+  const __m256i crs = _mm256_set1_epi8('\r');
+
+  while (end - ptr >= 32) {
+    const __m256i block = _mm256_loadu_epi8(ptr);
+    const __mmask32 foundLFs = _mm256_cmpeq_epi8_mask(block, lfs);
+    const __mmask32 foundCRs = _mm256_cmpeq_epi8_mask(block, crs);
+    const __mmask32 mask = foundLFs | foundCRs;
+    if (mask != 0) {
+      return ptr + __builtin_ctz(mask);
+    }
+
+    ptr += 32;
+  }
+
+  return AdvanceToNextCRLF(ptr, end);
+}
+
+AVX512_TARGET const char* AVX512_AdvanceToNextNonContentCharacter(
+    const char* ptr, const char* end) {
+  while (end - ptr >= 32) {
     const __m256i input = _mm256_loadu_epi8(ptr);
 
     const __m256i mask = _mm256_set1_epi8(0x0f);
@@ -187,7 +380,7 @@ const char* AVX512_AdvanceToNextNonContentCharacter(const char* ptr,
     const __mmask32 nonContentMask =
         _mm256_cmpneq_epi8_mask(intersection, _mm256_setzero_si256());
     if (nonContentMask != 0) {
-      return ptr + _tzcnt_u32(nonContentMask);
+      return ptr + __builtin_ctz(nonContentMask);
     }
     ptr += 32;
   }
@@ -198,8 +391,9 @@ const char* AVX512_AdvanceToNextNonContentCharacter(const char* ptr,
 constexpr uintptr_t ALIGN64 = 64;
 constexpr uintptr_t ALIGN64_MASK = ALIGN64 - 1;
 
-const char* AVX512_FindFirstNULL(const char* ptr, const char* end,
-                                 size_t* firstLineNumber = nullptr) {
+AVX512_TARGET const char* AVX512_FindFirstNULL(const char* ptr,
+                                               const char* end,
+                                               size_t* firstLineNumber) {
   const char* i = ptr;
   bool found = false;
   if ((reinterpret_cast<uintptr_t>(i) & ALIGN64_MASK) != 0) {
@@ -219,12 +413,12 @@ const char* AVX512_FindFirstNULL(const char* ptr, const char* end,
     const char* middleEnd = reinterpret_cast<const char*>(
         reinterpret_cast<uintptr_t>(end) & ~ALIGN64_MASK);
     const __m512i zeros = _mm512_setzero_si512();
-    while (i != middleEnd) {
+    while (i < middleEnd) {
       const __m512i block = _mm512_load_si512(i);
       const __mmask64 mask = _mm512_cmpeq_epi8_mask(block, zeros);
       if (mask != 0) {
         found = true;
-        i += _tzcnt_u32(mask);
+        i += __builtin_ctzll(mask);
         break;
       }
       i += ALIGN64;
@@ -250,19 +444,15 @@ const char* AVX512_FindFirstNULL(const char* ptr, const char* end,
     const char* headEnd = reinterpret_cast<const char*>(
         reinterpret_cast<uintptr_t>(ptr + ALIGN64_MASK) & ~ALIGN64_MASK);
     headEnd = headEnd < i ? headEnd : i;
-    while (ptr != headEnd) {
-      if (*ptr == '\n') {
-        ++lineCounter;
-      }
-      ++ptr;
-    }
+    lineCounter += CountLinefeeds(ptr, headEnd);
+    ptr = headEnd;
   }
 
   if (ptr != i) {
     const char* middleEnd = reinterpret_cast<const char*>(
         reinterpret_cast<uintptr_t>(i) & ~ALIGN64_MASK);
     const __m512i linefeeds = _mm512_set1_epi8('\n');
-    while (ptr != middleEnd) {
+    while (ptr < middleEnd) {
       const __m512i block = _mm512_load_si512(ptr);
       const __mmask64 mask = _mm512_cmpeq_epi8_mask(block, linefeeds);
       lineCounter += _mm_popcnt_u64(mask);
@@ -270,16 +460,33 @@ const char* AVX512_FindFirstNULL(const char* ptr, const char* end,
     }
   }
 
-  while (ptr != i) {
-    if (*ptr == '\n') {
-      ++lineCounter;
-    }
-    ++ptr;
-  }
-  *firstLineNumber = lineCounter;
+  *firstLineNumber = lineCounter + CountLinefeeds(ptr, i);
   return i;
 }
 
+#undef AVX512_TARGET
+
+constexpr ScanKernelFunctions kSSE42Kernel = {
+    ByteBlockBackedDictionary::ScanKernel::SSE42,
+    SSE42_AdvanceToNextCRLF,
+    SSE42_AdvanceToNextNonContentCharacter,
+    SSE42_FindFirstNULL,
+};
+
+constexpr ScanKernelFunctions kAVX2Kernel = {
+    ByteBlockBackedDictionary::ScanKernel::AVX2,
+    AVX2_AdvanceToNextCRLF,
+    AVX2_AdvanceToNextNonContentCharacter,
+    AVX2_FindFirstNULL,
+};
+
+constexpr ScanKernelFunctions kAVX512Kernel = {
+    ByteBlockBackedDictionary::ScanKernel::AVX512,
+    AVX512_AdvanceToNextCRLF,
+    AVX512_AdvanceToNextNonContentCharacter,
+    AVX512_FindFirstNULL,
+};
+
 #endif
 
 #ifdef ENABLE_EXPERIMENTAL_SIMD_SUPPORT_NEON
@@ -300,12 +507,11 @@ static inline int FirstNonZeroLane16(uint8x16_t v) {
   return 16;
 }
 
-const char* NEON_AdvanceToNextCRLF(const char* ptr, const char* unaligned16End,
-                                   const char* end) {
+const char* NEON_AdvanceToNextCRLF(const char* ptr, const char* end) {
   const uint8x16_t lfs = vdupq_n_u8(static_cast<uint8_t>('\n'));
   const uint8x16_t crs = vdupq_n_u8(static_cast<uint8_t>('\r'));
 
-  while (ptr < unaligned16End) {
+  while (end - ptr >= 16) {
     const uint8x16_t block = vld1q_u8(reinterpret_cast<const uint8_t*>(ptr));
     const uint8x16_t matchLF = vceqq_u8(block, lfs);
     const uint8x16_t matchCR = vceqq_u8(block, crs);
@@ -337,7 +543,6 @@ alignas(16) constexpr uint8_t NEON_HI_NIBBLES_LOOKUP[16] = {
 };
 
 const char* NEON_AdvanceToNextNonContentCharacter(const char* ptr,
-                                                  const char* unaligned16End,
                                                   const char* end) {
   const uint8x16_t loTbl =
       vld1q_u8(reinterpret_cast<const uint8_t*>(NEON_LO_NIBBLES_LOOKUP));
@@ -345,7 +550,7 @@ const char* NEON_AdvanceToNextNonContentCharacter(const char* ptr,
       vld1q_u8(reinterpret_cast<const uint8_t*>(NEON_HI_NIBBLES_LOOKUP));
   const uint8x16_t nibbleMask = vdupq_n_u8(0x0f);
 
-  while (ptr < unaligned16End) {
+  while (end - ptr >= 16) {
     const uint8x16_t input = vld1q_u8(reinterpret_cast<const uint8_t*>(ptr));
     const uint8x16_t loNibbles = vandq_u8(input, nibbleMask);
     const uint8x16_t hiNibbles = vandq_u8(vshrq_n_u8(input, 4), nibbleMask);
@@ -367,7 +572,7 @@ constexpr uintptr_t NEON_ALIGN16 = 16;
 constexpr uintptr_t NEON_ALIGN16_MASK = NEON_ALIGN16 - 1;
 
 const char* NEON_FindFirstNULL(const char* ptr, const char* end,
-                               size_t* firstLineNumber = nullptr) {
+                               size_t* firstLineNumber) {
   const char* i = ptr;
   bool found = false;
 
@@ -428,12 +633,8 @@ const char* NEON_FindFirstNULL(const char* ptr, const char* end,
         (reinterpret_cast<uintptr_t>(p) + NEON_ALIGN16_MASK) &
         ~NEON_ALIGN16_MASK);
     headEnd = headEnd < i ? headEnd : i;
-    while (p != headEnd) {
-      if (*p == '\n') {
-        ++lineCounter;
-      }
-      ++p;
-    }
+    lineCounter += CountLinefeeds(p, headEnd);
+    p = headEnd;
   }
 
   // NEON middle
@@ -451,28 +652,245 @@ const char* NEON_FindFirstNULL(const char* ptr, const char* end,
   }
 
   // Scalar tail
-  while (p != i) {
-    if (*p == '\n') {
-      ++lineCounter;
+  *firstLineNumber = lineCounter + CountLinefeeds(p, i);
+  return i;
+}
+
+constexpr ScanKernelFunctions kNEONKernel = {
+    ByteBlockBackedDictionary::ScanKernel::NEON,
+    NEON_AdvanceToNextCRLF,
+    NEON_AdvanceToNextNonContentCharacter,
+    NEON_FindFirstNULL,
+};
+
+#endif
+
+const ScanKernelFunctions* KernelFunctions(
+    ByteBlockBackedDictionary::ScanKernel k) {
+  switch (k) {
+    case ByteBlockBackedDictionary::ScanKernel::SCALAR:
+      return &kScalarKernel;
+#ifdef MCBOPOMOFO_X86_64_SIMD_KERNELS
+    case ByteBlockBackedDictionary::ScanKernel::SSE42:
+      return __builtin_cpu_supports("sse4.2") &&
+                     __builtin_cpu_supports("popcnt")
+                 ? &kSSE42Kernel
+                 : nullptr;
+    case ByteBlockBackedDictionary::ScanKernel::AVX2:
+      return __builtin_cpu_supports("avx2") &&
+                     __builtin_cpu_supports("popcnt")
+                 ? &kAVX2Kernel
+                 : nullptr;
+    case ByteBlockBackedDictionary::ScanKernel::AVX512:
+      return __builtin_cpu_supports("avx512f") &&
+                     __builtin_cpu_supports("avx512bw") &&
+                     __builtin_cpu_supports("avx512vl") &&
+                     __builtin_cpu_supports("popcnt")
+                 ? &kAVX512Kernel
+                 : nullptr;
+#else
+    case ByteBlockBackedDictionary::ScanKernel::SSE42:
+    case ByteBlockBackedDictionary::ScanKernel::AVX2:
+    case ByteBlockBackedDictionary::ScanKernel::AVX512:
+      return nullptr;
+#endif
+    case ByteBlockBackedDictionary::ScanKernel::NEON:
+#ifdef ENABLE_EXPERIMENTAL_SIMD_SUPPORT_NEON
+      return &kNEONKernel;
+#else
+      return nullptr;
+#endif
+  }
+  return nullptr;
+}
+
+const ScanKernelFunctions* BestKernelFunctions() {
+  for (auto k : {ByteBlockBackedDictionary::ScanKernel::NEON,
+                 ByteBlockBackedDictionary::ScanKernel::AVX512,
+                 ByteBlockBackedDictionary::ScanKernel::AVX2,
+                 ByteBlockBackedDictionary::ScanKernel::SSE42}) {
+    if (const ScanKernelFunctions* f = KernelFunctions(k); f != nullptr) {
+      return f;
     }
-    ++p;
   }
+  return &kScalarKernel;
+}
 
-  *firstLineNumber = lineCounter;
-  return i;
+std::atomic<const ScanKernelFunctions*>& ActiveKernelFunctions() {
+  static std::atomic<const ScanKernelFunctions*> functions(
+      BestKernelFunctions());
+  return functions;
 }
 
-#endif
+const ScanKernelFunctions& Kernel() {
+  return *ActiveKernelFunctions().load(std::memory_order_relaxed);
+}
+
+static constexpr size_t kInitialSlotCount = 64;
+
+inline uint64_t HashKey(std::string_view key) {
+  return std::hash<std::string_view>()(key);
+}
+
+// The tag comes from the high bits, while the slot index comes from the low
+// bits.
+inline uint32_t TagOf(uint64_t hash) {
+  return static_cast<uint32_t>(hash >> 32);
+}
+
+size_t ResolveThreadCount(size_t threadCount) {
+  if (threadCount != 0) {
+    return threadCount;
+  }
+  return std::max<size_t>(std::thread::hardware_concurrency(), 1);
+}
+
+// Returns the offsets at which the chunks of the block start, the first one
+// being 0. Each chunk but the last ends right after a linefeed.
+std::vector<size_t> SplitAtLineBoundaries(const char* block, size_t size,
+                                          size_t threadCount,
+                                          size_t minChunkSize) {
+  size_t chunkCount =
+      std::min(threadCount, size / std::max<size_t>(minChunkSize, 1));
+  std::vector<size_t> starts{0};
+  for (size_t i = 1; i < chunkCount; ++i) {
+    size_t target = size / chunkCount * i;
+    if (target < starts.back()) {
+      continue;
+    }
+    const void* linefeed = memchr(block + target, '\n', size - target);
+    if (linefeed == nullptr) {
+      break;
+    }
+    size_t start = static_cast<const char*>(linefeed) - block + 1;
+    if (start >= size) {
+      break;
+    }
+    starts.push_back(start);
+  }
+  return starts;
+}
+
+// The layout of a snapshot file, in the native byte order: the header, the
+// slots of the hash table as they are in memory, then the keys, the values
+// and the issues.
+constexpr char kSnapshotMagic[8] = {'M', 'C', 'B', 'P', 'B', 'B', 'D', 'S'};
+constexpr uint32_t kSnapshotVersion = 1;
+
+// The hash of this string is stored in the header, so that snapshots written
+// by a build whose std::hash differs are rejected; the slots depend on it.
+constexpr std::string_view kSnapshotHashProbe = "McBopomofo";
+
+struct SnapshotHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t columnOrder;
+  uint64_t hashProbe;
+  uint64_t textSize;
+  int64_t stamp;
+  uint64_t textHash;
+  uint64_t lineCount;
+  uint32_t slotCount;
+  uint32_t keyCount;
+  uint32_t valueCount;
+  uint32_t issueCount;
+};
+
+struct SnapshotKey {
+  uint32_t offset;
+  uint32_t length;
+  uint32_t valuesBegin;
+  uint32_t valueCount;
+};
+
+struct SnapshotValue {
+  uint32_t offset;
+  uint32_t length;
+};
+
+struct SnapshotIssue {
+  uint32_t type;
+  uint32_t reserved;
+  uint64_t lineNumber;
+};
+
+template <typename T>
+void WriteArray(std::ofstream& out, const T* items, size_t count) {
+  out.write(reinterpret_cast<const char*>(items),
+            static_cast<std::streamsize>(sizeof(T) * count));
+}
+
+template <typename T>
+const char* ReadArray(const char* ptr, T* items, size_t count) {
+  memcpy(items, ptr, sizeof(T) * count);
+  return ptr + sizeof(T) * count;
+}
 
 }  // namespace
 
+std::vector<ByteBlockBackedDictionary::ScanKernel>
+ByteBlockBackedDictionary::SupportedScanKernels() {
+  std::vector<ScanKernel> kernels;
+  for (auto k : {ScanKernel::SCALAR, ScanKernel::SSE42, ScanKernel::AVX2,
+                 ScanKernel::AVX512, ScanKernel::NEON}) {
+    if (KernelFunctions(k) != nullptr) {
+      kernels.push_back(k);
+    }
+  }
+  return kernels;
+}
+
+ByteBlockBackedDictionary::ScanKernel
+ByteBlockBackedDictionary::ActiveScanKernel() {
+  return Kernel().kernel;
+}
+
+bool ByteBlockBackedDictionary::SetScanKernel(ScanKernel kernel) {
+  const ScanKernelFunctions* functions = KernelFunctions(kernel);
+  if (functions == nullptr) {
+    return false;
+  }
+  ActiveKernelFunctions().store(functions, std::memory_order_relaxed);
+  return true;
+}
+
+const char* ByteBlockBackedDictionary::ScanKernelName(ScanKernel kernel) {
+  switch (kernel) {
+    case ScanKernel::SCALAR:
+      return "scalar";
+    case ScanKernel::SSE42:
+      return "sse4.2";
+    case ScanKernel::AVX2:
+      return "avx2";
+    case ScanKernel::AVX512:
+      return "avx512";
+    case ScanKernel::NEON:
+      return "neon";
+  }
+  return "unknown";
+}
+
 void ByteBlockBackedDictionary::clear() {
-  dict_.clear();
+  // Release the memory, too; a dictionary is usually cleared when its text is
+  // about to go away.
+  slots_ = std::vector<Slot>();
+  keys_ = std::vector<KeyEntry>();
+  values_ = std::vector<std::string_view>();
   issues_.clear();
+  parsedSize_ = 0;
+  lineCount_ = 0;
+  deadValueCount_ = 0;
 }
 
 bool ByteBlockBackedDictionary::parse(const char* block, size_t size,
                                       ColumnOrder columnOrder) {
+  ParseOptions options;
+  options.columnOrder = columnOrder;
+  return parse(block, size, options);
+}
+
+bool ByteBlockBackedDictionary::parse(const char* block, size_t size,
+                                      const ParseOptions& options) {
   if (block == nullptr) {
     return false;
   }
@@ -482,6 +900,7 @@ bool ByteBlockBackedDictionary::parse(const char* block, size_t size,
   }
 
   clear();
+  columnOrder_ = options.columnOrder;
 
   // Special case if block is a null-ended C string. This is the only place
   // NUL is allowed.
@@ -489,32 +908,323 @@ bool ByteBlockBackedDictionary::parse(const char* block, size_t size,
     --size;
   }
 
-  const char* ptr = block;
-  const char* end = ptr + size;
+  std::vector<size_t> chunkStarts = SplitAtLineBoundaries(
+      block, size, ResolveThreadCount(options.threadCount),
+      options.minChunkSize);
+  if (chunkStarts.size() == 1) {
+    if (!parseChunk(block, size, options.columnOrder, &lineCount_)) {
+      return false;
+    }
+    parsedSize_ = size;
+    return true;
+  }
 
-#ifdef ENABLE_EXPERIMENTAL_SIMD_SUPPORT_AVX512
-  const char* unaligned32End =
-      reinterpret_cast<const char*>(reinterpret_cast<uintptr_t>(end) - 32);
-  if (unaligned32End < ptr) {
-    unaligned32End = ptr;
+  size_t chunkCount = chunkStarts.size();
+  chunkStarts.push_back(size);
+  std::vector<ByteBlockBackedDictionary> chunks(chunkCount);
+  std::vector<size_t> lineCounts(chunkCount);
+  // Not std::vector<bool>, whose elements cannot be written concurrently.
+  std::vector<char> results(chunkCount);
+  auto parseChunkAt = [&](size_t i) {
+    results[i] = chunks[i].parseChunk(block + chunkStarts[i],
+                                      chunkStarts[i + 1] - chunkStarts[i],
+                                      options.columnOrder, &lineCounts[i]);
+  };
+
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < chunkCount; ++i) {
+    workers.emplace_back(parseChunkAt, i);
   }
-#elif defined(ENABLE_EXPERIMENTAL_SIMD_SUPPORT_NEON)
-  const char* unaligned16End =
-      reinterpret_cast<const char*>(reinterpret_cast<uintptr_t>(end) - 16);
-  if (unaligned16End < ptr) {
-    unaligned16End = ptr;
+  parseChunkAt(0);
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+
+  // A chunk only fails on a NULL character. Report the first one, as parsing
+  // on a single thread would.
+  size_t lineOffset = 0;
+  for (size_t i = 0; i < chunkCount; ++i) {
+    if (!results[i]) {
+      issues_.emplace_back(Issue::Type::NULL_CHARACTER_IN_TEXT,
+                           chunks[i].issues_.front().lineNumber + lineOffset);
+      return false;
+    }
+    lineOffset += lineCounts[i];
+  }
+
+  mergeChunks(chunks, lineCounts);
+  parsedSize_ = size;
+  lineCount_ = lineOffset;
+  return true;
+}
+
+bool ByteBlockBackedDictionary::parseAppended(const char* block, size_t size,
+                                              ColumnOrder columnOrder) {
+  if (block == nullptr) {
+    return false;
+  }
+  if (size != 0 && block[size - 1] == 0) {
+    --size;
+  }
+  if (size < parsedSize_) {
+    return false;
+  }
+  if (parsedSize_ != 0 && block[parsedSize_ - 1] != '\n') {
+    return false;
+  }
+  if (size == parsedSize_) {
+    return true;
+  }
+
+  ByteBlockBackedDictionary tail;
+  size_t tailLineCount = 0;
+  if (!tail.parseChunk(block + parsedSize_, size - parsedSize_, columnOrder,
+                       &tailLineCount)) {
+    return false;
+  }
+
+  for (const Issue& issue : tail.issues_) {
+    if (issues_.size() < MAX_ISSUES) {
+      issues_.emplace_back(issue.type, issue.lineNumber + lineCount_);
+    }
+  }
+
+  // New keys get their runs at the end of values_. So do existing keys with
+  // new values, whose old runs are left behind; a key has few values, so the
+  // cost stays proportional to the new bytes.
+  for (const KeyEntry& source : tail.keys_) {
+    KeyEntry& target = keys_[findOrAddKey(source.key)];
+    auto newBegin = static_cast<uint32_t>(values_.size());
+    for (uint32_t i = 0; i < target.valueCount; ++i) {
+      // Copied first, since push_back() may reallocate values_.
+      std::string_view value = values_[target.valuesBegin + i];
+      values_.push_back(value);
+    }
+    deadValueCount_ += target.valueCount;
+    values_.insert(values_.end(),
+                   tail.values_.begin() + source.valuesBegin,
+                   tail.values_.begin() + source.valuesBegin +
+                       source.valueCount);
+    target.valuesBegin = newBegin;
+    target.valueCount += source.valueCount;
+  }
+
+  parsedSize_ = size;
+  lineCount_ += tailLineCount;
+  if (deadValueCount_ > values_.size() / 2) {
+    compactValues();
+  }
+  return true;
+}
+
+bool ByteBlockBackedDictionary::saveSnapshot(const char* snapshotPath,
+                                             const char* block,
+                                             int64_t stamp) const {
+  if (block == nullptr || parsedSize_ > UINT32_MAX) {
+    return false;
+  }
+  auto base = reinterpret_cast<uintptr_t>(block);
+  bool outOfBlock = false;
+  auto offsetOf = [&](std::string_view view) {
+    auto start = reinterpret_cast<uintptr_t>(view.data());
+    if (start < base || start - base + view.size() > parsedSize_) {
+      outOfBlock = true;
+      return uint32_t{0};
+    }
+    return static_cast<uint32_t>(start - base);
+  };
+
+  SnapshotHeader header{};
+  memcpy(header.magic, kSnapshotMagic, sizeof(header.magic));
+  header.version = kSnapshotVersion;
+  header.columnOrder = static_cast<uint32_t>(columnOrder_);
+  header.hashProbe = HashKey(kSnapshotHashProbe);
+  header.textSize = parsedSize_;
+  header.stamp = stamp;
+  header.textHash = HashKey(std::string_view(block, parsedSize_));
+  header.lineCount = lineCount_;
+  header.slotCount = static_cast<uint32_t>(slots_.size());
+  header.keyCount = static_cast<uint32_t>(keys_.size());
+  header.issueCount = static_cast<uint32_t>(issues_.size());
+
+  // The values are written in key order, which also drops the runs left
+  // behind by parseAppended().
+  std::vector<SnapshotKey> keys;
+  std::vector<SnapshotValue> values;
+  keys.reserve(keys_.size());
+  values.reserve(values_.size() - deadValueCount_);
+  for (const KeyEntry& entry : keys_) {
+    keys.push_back(SnapshotKey{offsetOf(entry.key),
+                               static_cast<uint32_t>(entry.key.size()),
+                               static_cast<uint32_t>(values.size()),
+                               entry.valueCount});
+    for (uint32_t i = 0; i < entry.valueCount; ++i) {
+      std::string_view value = values_[entry.valuesBegin + i];
+      values.push_back(
+          SnapshotValue{offsetOf(value), static_cast<uint32_t>(value.size())});
+    }
+  }
+  if (outOfBlock) {
+    return false;
+  }
+  header.valueCount = static_cast<uint32_t>(values.size());
+  std::vector<SnapshotIssue> issues;
+  for (const Issue& issue : issues_) {
+    issues.push_back(
+        SnapshotIssue{static_cast<uint32_t>(issue.type), 0, issue.lineNumber});
+  }
+
+  std::string tempPath = std::string(snapshotPath) + ".tmp";
+  {
+    std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+    WriteArray(out, &header, 1);
+    WriteArray(out, slots_.data(), slots_.size());
+    WriteArray(out, keys.data(), keys.size());
+    WriteArray(out, values.data(), values.size());
+    WriteArray(out, issues.data(), issues.size());
+    if (!out.flush()) {
+      out.close();
+      std::remove(tempPath.c_str());
+      return false;
+    }
+  }
+  if (std::rename(tempPath.c_str(), snapshotPath) != 0) {
+    std::remove(tempPath.c_str());
+    return false;
+  }
+  return true;
+}
+
+ByteBlockBackedDictionary::SnapshotUse ByteBlockBackedDictionary::loadSnapshot(
+    const char* snapshotPath, const char* block, size_t size, int64_t stamp,
+    ColumnOrder columnOrder) {
+  clear();
+  if (block == nullptr || size == 0) {
+    return SnapshotUse::NOT_USED;
+  }
+  if (block[size - 1] == 0) {
+    --size;
+  }
+
+  MemoryMappedFile file;
+  if (!file.open(snapshotPath) || file.length() < sizeof(SnapshotHeader)) {
+    return SnapshotUse::NOT_USED;
+  }
+  SnapshotHeader header;
+  memcpy(&header, file.data(), sizeof(header));
+  if (memcmp(header.magic, kSnapshotMagic, sizeof(header.magic)) != 0 ||
+      header.version != kSnapshotVersion ||
+      header.columnOrder != static_cast<uint32_t>(columnOrder) ||
+      header.hashProbe != HashKey(kSnapshotHashProbe) ||
+      header.textSize > size) {
+    return SnapshotUse::NOT_USED;
+  }
+  uint64_t expectedLength =
+      sizeof(SnapshotHeader) +
+      uint64_t{header.slotCount} * sizeof(Slot) +
+      uint64_t{header.keyCount} * sizeof(SnapshotKey) +
+      uint64_t{header.valueCount} * sizeof(SnapshotValue) +
+      uint64_t{header.issueCount} * sizeof(SnapshotIssue);
+  // Probing for a missing key only stops at an empty slot.
+  if (file.length() != expectedLength ||
+      (header.slotCount & (header.slotCount - 1)) != 0 ||
+      (header.keyCount != 0 && header.keyCount >= header.slotCount)) {
+    return SnapshotUse::NOT_USED;
   }
-#endif
+
+  // Hashing the text is much cheaper than parsing it.
+  bool grown = header.textSize < size;
+  if ((!grown && header.stamp != stamp) ||
+      header.textHash !=
+          HashKey(std::string_view(block, static_cast<size_t>(
+                                              header.textSize)))) {
+    return SnapshotUse::NOT_USED;
+  }
+
+  // Check everything that lookups rely on, so that a damaged snapshot is
+  // rejected rather than read out of bounds.
+  auto inText = [&header](uint32_t offset, uint32_t length) {
+    return uint64_t{offset} + length <= header.textSize;
+  };
+  bool valid = true;
+  const char* ptr = file.data() + sizeof(SnapshotHeader);
+  slots_.resize(header.slotCount);
+  ptr = ReadArray(ptr, slots_.data(), slots_.size());
+  size_t usedSlots = 0;
+  for (const Slot& slot : slots_) {
+    if (slot.keyIndex != EMPTY_SLOT) {
+      valid &= slot.keyIndex < header.keyCount;
+      ++usedSlots;
+    }
+  }
+  valid &= usedSlots == header.keyCount;
+
+  keys_.resize(header.keyCount);
+  for (KeyEntry& entry : keys_) {
+    SnapshotKey key;
+    ptr = ReadArray(ptr, &key, 1);
+    valid &= inText(key.offset, key.length) &&
+             uint64_t{key.valuesBegin} + key.valueCount <= header.valueCount;
+    entry = KeyEntry{std::string_view(block + key.offset, key.length),
+                     key.valuesBegin, key.valueCount};
+  }
+  values_.resize(header.valueCount);
+  for (std::string_view& entry : values_) {
+    SnapshotValue value;
+    ptr = ReadArray(ptr, &value, 1);
+    valid &= inText(value.offset, value.length);
+    entry = std::string_view(block + value.offset, value.length);
+  }
+  for (uint32_t i = 0; i < header.issueCount; ++i) {
+    SnapshotIssue issue;
+    ptr = ReadArray(ptr, &issue, 1);
+    valid &= issue.type <= static_cast<uint32_t>(
+                               Issue::Type::NULL_CHARACTER_IN_TEXT);
+    issues_.emplace_back(static_cast<Issue::Type>(issue.type),
+                         static_cast<size_t>(issue.lineNumber));
+  }
+  if (!valid) {
+    clear();
+    return SnapshotUse::NOT_USED;
+  }
+
+  columnOrder_ = columnOrder;
+  parsedSize_ = static_cast<size_t>(header.textSize);
+  lineCount_ = static_cast<size_t>(header.lineCount);
+  if (!grown) {
+    return SnapshotUse::USED;
+  }
+  if (!parseAppended(block, size, columnOrder)) {
+    clear();
+    return SnapshotUse::NOT_USED;
+  }
+  return SnapshotUse::USED_WITH_APPENDED_TEXT;
+}
+
+void ByteBlockBackedDictionary::compactValues() {
+  std::vector<std::string_view> values;
+  values.reserve(values_.size() - deadValueCount_);
+  for (KeyEntry& entry : keys_) {
+    auto begin = static_cast<uint32_t>(values.size());
+    values.insert(values.end(), values_.begin() + entry.valuesBegin,
+                  values_.begin() + entry.valuesBegin + entry.valueCount);
+    entry.valuesBegin = begin;
+  }
+  values_.swap(values);
+  deadValueCount_ = 0;
+}
+
+bool ByteBlockBackedDictionary::parseChunk(const char* block, size_t size,
+                                           ColumnOrder columnOrder,
+                                           size_t* lineCount) {
+  const char* ptr = block;
+  const char* end = ptr + size;
+
+  const ScanKernelFunctions& kernel = Kernel();
 
   // Validate that no NULL characters are in the text.
   size_t errorAtLine = 0;
-#if defined(ENABLE_EXPERIMENTAL_SIMD_SUPPORT_AVX512)
-  const char* ctrlCharPtr = AVX512_FindFirstNULL(ptr, end, &errorAtLine);
-#elif defined(ENABLE_EXPERIMENTAL_SIMD_SUPPORT_NEON)
-  const char* ctrlCharPtr = NEON_FindFirstNULL(ptr, end, &errorAtLine);
-#else
-  const char* ctrlCharPtr = FindFirstNULL(ptr, end, &errorAtLine);
-#endif
+  const char* ctrlCharPtr = kernel.findFirstNULL(ptr, end, &errorAtLine);
 
   if (ctrlCharPtr != end) {
     issues_.emplace_back(Issue::Type::NULL_CHARACTER_IN_TEXT, errorAtLine);
@@ -523,6 +1233,14 @@ bool ByteBlockBackedDictionary::parse(const char* block, size_t size,
 
   size_t lineCounter = 1;
 
+  std::vector<ParsedValue> parsedValues;
+  auto addValue = [this, &parsedValues](std::string_view key,
+                                        std::string_view value) {
+    uint32_t keyIndex = findOrAddKey(key);
+    ++keys_[keyIndex].valueCount;
+    parsedValues.push_back(ParsedValue{keyIndex, value});
+  };
+
   if (columnOrder == ColumnOrder::KEY_THEN_VALUE) {
     while (ptr != end) {
       ptr = AdvanceToNextContentCharacter(ptr, end, lineCounter);
@@ -531,24 +1249,12 @@ bool ByteBlockBackedDictionary::parse(const char* block, size_t size,
       }
 
       if (*ptr == '#') {
-#if defined(ENABLE_EXPERIMENTAL_SIMD_SUPPORT_AVX512)
-        ptr = AVX512_AdvanceToNextCRLF(ptr, unaligned32End, end);
-#elif defined(ENABLE_EXPERIMENTAL_SIMD_SUPPORT_NEON)
-        ptr = NEON_AdvanceToNextCRLF(ptr, unaligned16End, end);
-#else
-        ptr = AdvanceToNextCRLF(ptr, end);
-#endif
+        ptr = kernel.advanceToNextCRLF(ptr, end);
         continue;
       }
 
       const char* keyStart = ptr;
-#if defined(ENABLE_EXPERIMENTAL_SIMD_SUPPORT_AVX512)
-      ptr = AVX512_AdvanceToNextNonContentCharacter(ptr, unaligned32End, end);
-#elif defined(ENABLE_EXPERIMENTAL_SIMD_SUPPORT_NEON)
-      ptr = NEON_AdvanceToNextNonContentCharacter(ptr, unaligned16End, end);
-#else
-      ptr = AdvanceToNextNonContentCharacter(ptr, end);
-#endif
+      ptr = kernel.advanceToNextNonContentCharacter(ptr, end);
       const char* keyEnd = ptr;
 
       ptr = AdvanceToNextNonWhitespace(ptr, end);
@@ -561,13 +1267,7 @@ bool ByteBlockBackedDictionary::parse(const char* block, size_t size,
       }
 
       const char* valueStart = ptr;
-#if defined(ENABLE_EXPERIMENTAL_SIMD_SUPPORT_AVX512)
-      ptr = AVX512_AdvanceToNextCRLF(ptr, unaligned32End, end);
-#elif defined(ENABLE_EXPERIMENTAL_SIMD_SUPPORT_NEON)
-      ptr = NEON_AdvanceToNextCRLF(ptr, unaligned16End, end);
-#else
-      ptr = AdvanceToNextCRLF(ptr, end);
-#endif
+      ptr = kernel.advanceToNextCRLF(ptr, end);
       const char* valueEnd = ptr;
 
       if (valueEnd == valueStart) {
@@ -600,9 +1300,8 @@ bool ByteBlockBackedDictionary::parse(const char* block, size_t size,
         }
       }
 
-      std::string_view key(keyStart, keyEnd - keyStart);
-      std::string_view value(valueStart, valueEnd - valueStart);
-      dict_[key].emplace_back(value);
+      addValue(std::string_view(keyStart, keyEnd - keyStart),
+               std::string_view(valueStart, valueEnd - valueStart));
     }
   } else {
     while (ptr != end) {
@@ -612,24 +1311,12 @@ bool ByteBlockBackedDictionary::parse(const char* block, size_t size,
       }
 
       if (*ptr == '#') {
-#if defined(ENABLE_EXPERIMENTAL_SIMD_SUPPORT_AVX512)
-        ptr = AVX512_AdvanceToNextCRLF(ptr, unaligned32End, end);
-#elif defined(ENABLE_EXPERIMENTAL_SIMD_SUPPORT_NEON)
-        ptr = NEON_AdvanceToNextCRLF(ptr, unaligned16End, end);
-#else
-        ptr = AdvanceToNextCRLF(ptr, end);
-#endif
+        ptr = kernel.advanceToNextCRLF(ptr, end);
         continue;
       }
 
       const char* valueStart = ptr;
-#if defined(ENABLE_EXPERIMENTAL_SIMD_SUPPORT_AVX512)
-      ptr = AVX512_AdvanceToNextNonContentCharacter(ptr, unaligned32End, end);
-#elif defined(ENABLE_EXPERIMENTAL_SIMD_SUPPORT_NEON)
-      ptr = NEON_AdvanceToNextNonContentCharacter(ptr, unaligned16End, end);
-#else
-      ptr = AdvanceToNextNonContentCharacter(ptr, end);
-#endif
+      ptr = kernel.advanceToNextNonContentCharacter(ptr, end);
       const char* valueEnd = ptr;
 
       ptr = AdvanceToNextNonWhitespace(ptr, end);
@@ -641,13 +1328,7 @@ bool ByteBlockBackedDictionary::parse(const char* block, size_t size,
       }
 
       const char* maybeKeyStart = ptr;
-#if defined(ENABLE_EXPERIMENTAL_SIMD_SUPPORT_AVX512)
-      ptr = AVX512_AdvanceToNextNonContentCharacter(ptr, unaligned32End, end);
-#elif defined(ENABLE_EXPERIMENTAL_SIMD_SUPPORT_NEON)
-      ptr = NEON_AdvanceToNextNonContentCharacter(ptr, unaligned16End, end);
-#else
-      ptr = AdvanceToNextNonContentCharacter(ptr, end);
-#endif
+      ptr = kernel.advanceToNextNonContentCharacter(ptr, end);
       const char* maybeKeyEnd = ptr;
       if (maybeKeyStart == maybeKeyEnd) {
         if (issues_.size() < MAX_ISSUES) {
@@ -670,36 +1351,163 @@ bool ByteBlockBackedDictionary::parse(const char* block, size_t size,
         // More content incoming.
         valueEnd = maybeKeyEnd;
         maybeKeyStart = ptr;
-#if defined(ENABLE_EXPERIMENTAL_SIMD_SUPPORT_AVX512)
-        ptr = AVX512_AdvanceToNextNonContentCharacter(ptr, unaligned32End, end);
-#elif defined(ENABLE_EXPERIMENTAL_SIMD_SUPPORT_NEON)
-        ptr = NEON_AdvanceToNextNonContentCharacter(ptr, unaligned16End, end);
-#else
-        ptr = AdvanceToNextNonContentCharacter(ptr, end);
-#endif
+        ptr = kernel.advanceToNextNonContentCharacter(ptr, end);
         maybeKeyEnd = ptr;
       }
 
-      std::string_view key(maybeKeyStart, maybeKeyEnd - maybeKeyStart);
-      std::string_view value(valueStart, valueEnd - valueStart);
-      dict_[key].emplace_back(value);
+      addValue(std::string_view(maybeKeyStart, maybeKeyEnd - maybeKeyStart),
+               std::string_view(valueStart, valueEnd - valueStart));
     }
   }
 
+  buildValueArena(parsedValues);
+  if (lineCount != nullptr) {
+    *lineCount = lineCounter - 1;
+  }
   return true;
 }
 
+void ByteBlockBackedDictionary::mergeChunks(
+    const std::vector<ByteBlockBackedDictionary>& chunks,
+    const std::vector<size_t>& lineCounts) {
+  size_t lineOffset = 0;
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    for (const Issue& issue : chunks[i].issues_) {
+      if (issues_.size() < MAX_ISSUES) {
+        issues_.emplace_back(issue.type, issue.lineNumber + lineOffset);
+      }
+    }
+    lineOffset += lineCounts[i];
+  }
+
+  // Visiting the chunks in order keeps the keys in the order they first
+  // appear, and the values of each key in text order.
+  std::vector<std::vector<uint32_t>> keyIndices(chunks.size());
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    keyIndices[i].reserve(chunks[i].keys_.size());
+    for (const KeyEntry& entry : chunks[i].keys_) {
+      uint32_t keyIndex = findOrAddKey(entry.key);
+      keys_[keyIndex].valueCount += entry.valueCount;
+      keyIndices[i].push_back(keyIndex);
+    }
+  }
+
+  assignValueRuns();
+  size_t valueCount = 0;
+  for (const ByteBlockBackedDictionary& chunk : chunks) {
+    valueCount += chunk.values_.size();
+  }
+  values_.resize(valueCount);
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    const ByteBlockBackedDictionary& chunk = chunks[i];
+    for (size_t k = 0; k < chunk.keys_.size(); ++k) {
+      const KeyEntry& source = chunk.keys_[k];
+      KeyEntry& target = keys_[keyIndices[i][k]];
+      std::copy_n(chunk.values_.begin() + source.valuesBegin,
+                  source.valueCount,
+                  values_.begin() + target.valuesBegin + target.valueCount);
+      target.valueCount += source.valueCount;
+    }
+  }
+  keys_.shrink_to_fit();
+}
+
 bool ByteBlockBackedDictionary::hasKey(const std::string_view& key) const {
-  return dict_.find(key) != dict_.end();
+  return findKey(key) != EMPTY_SLOT;
 }
 
-std::vector<std::string_view> ByteBlockBackedDictionary::getValues(
+std::span<const std::string_view> ByteBlockBackedDictionary::getValues(
     const std::string_view& key) const {
-  const auto it = dict_.find(key);
-  if (it == dict_.cend()) {
+  uint32_t keyIndex = findKey(key);
+  if (keyIndex == EMPTY_SLOT) {
     return {};
   }
-  return it->second;
+  const KeyEntry& entry = keys_[keyIndex];
+  return {values_.data() + entry.valuesBegin, entry.valueCount};
+}
+
+size_t ByteBlockBackedDictionary::memoryUsage() const {
+  return slots_.capacity() * sizeof(Slot) +
+         keys_.capacity() * sizeof(KeyEntry) +
+         values_.capacity() * sizeof(std::string_view) +
+         issues_.capacity() * sizeof(Issue);
+}
+
+uint32_t ByteBlockBackedDictionary::findKey(std::string_view key) const {
+  if (slots_.empty()) {
+    return EMPTY_SLOT;
+  }
+  uint64_t hash = HashKey(key);
+  uint32_t tag = TagOf(hash);
+  size_t mask = slots_.size() - 1;
+  for (size_t i = hash & mask;; i = (i + 1) & mask) {
+    const Slot& slot = slots_[i];
+    if (slot.keyIndex == EMPTY_SLOT) {
+      return EMPTY_SLOT;
+    }
+    if (slot.tag == tag && keys_[slot.keyIndex].key == key) {
+      return slot.keyIndex;
+    }
+  }
+}
+
+uint32_t ByteBlockBackedDictionary::findOrAddKey(std::string_view key) {
+  // Keep the load factor at 3/4 at most so that probe sequences stay short.
+  if ((keys_.size() + 1) * 4 > slots_.size() * 3) {
+    growTable();
+  }
+  uint64_t hash = HashKey(key);
+  uint32_t tag = TagOf(hash);
+  size_t mask = slots_.size() - 1;
+  for (size_t i = hash & mask;; i = (i + 1) & mask) {
+    Slot& slot = slots_[i];
+    if (slot.keyIndex == EMPTY_SLOT) {
+      slot = Slot{tag, static_cast<uint32_t>(keys_.size())};
+      keys_.push_back(KeyEntry{key});
+      return slot.keyIndex;
+    }
+    if (slot.tag == tag && keys_[slot.keyIndex].key == key) {
+      return slot.keyIndex;
+    }
+  }
+}
+
+void ByteBlockBackedDictionary::growTable() {
+  size_t slotCount = slots_.empty() ? kInitialSlotCount : slots_.size() * 2;
+  std::vector<Slot> slots(slotCount);
+  size_t mask = slotCount - 1;
+  for (size_t k = 0; k < keys_.size(); ++k) {
+    uint64_t hash = HashKey(keys_[k].key);
+    size_t i = hash & mask;
+    while (slots[i].keyIndex != EMPTY_SLOT) {
+      i = (i + 1) & mask;
+    }
+    slots[i] = Slot{TagOf(hash), static_cast<uint32_t>(k)};
+  }
+  slots_.swap(slots);
+}
+
+void ByteBlockBackedDictionary::assignValueRuns() {
+  uint32_t begin = 0;
+  for (KeyEntry& entry : keys_) {
+    entry.valuesBegin = begin;
+    begin += entry.valueCount;
+    entry.valueCount = 0;
+  }
+}
+
+void ByteBlockBackedDictionary::buildValueArena(
+    const std::vector<ParsedValue>& parsedValues) {
+  // A counting sort by key: each key gets a run as long as its value count,
+  // and the values are then placed in text order.
+  assignValueRuns();
+  values_.resize(parsedValues.size());
+  for (const ParsedValue& parsed : parsedValues) {
+    KeyEntry& entry = keys_[parsed.keyIndex];
+    values_[entry.valuesBegin + entry.valueCount] = parsed.value;
+    ++entry.valueCount;
+  }
+  keys_.shrink_to_fit();
 }
 
 }  // namespace McBopomofo
@@ -24,8 +24,10 @@
 #ifndef SRC_ENGINE_BYTEBLOCKBACKEDDICTIONARY_H_
 #define SRC_ENGINE_BYTEBLOCKBACKEDDICTIONARY_H_
 
+#include <cstddef>
+#include <cstdint>
+#include <span>
 #include <string_view>
-#include <unordered_map>
 #include <vector>
 
 namespace McBopomofo {
@@ -64,6 +66,11 @@ namespace McBopomofo {
 // uses std::string_view instead of copying key and value strings out of the
 // text. Therefore, the dictionary must not be used if the block of bytes is
 // gone! You can call clear() to clear all such dangling references to the text.
+//
+// The keys are kept in a flat, open-addressed hash table, and the values of
+// all keys sit in one contiguous arena, grouped by key and in the order they
+// appear in the text. A lookup therefore touches one probe sequence of the
+// table and one run of the arena, and no allocation is made per key.
 class ByteBlockBackedDictionary {
  public:
   struct Issue {
@@ -85,21 +92,190 @@ class ByteBlockBackedDictionary {
     VALUE_THEN_KEY,
   };
 
+  // Options for parsing a large block on several threads. The block is split
+  // at line boundaries into chunks, which are parsed into partial tables
+  // that are then merged. The result, including the issues and their line
+  // numbers, is the same as parsing on a single thread.
+  struct ParseOptions {
+    ColumnOrder columnOrder = ColumnOrder::KEY_THEN_VALUE;
+
+    // The number of threads to use, including the calling one. 0 means one
+    // per hardware thread.
+    size_t threadCount = 1;
+
+    // No chunk is made smaller than this, so that small blocks, for which
+    // starting threads costs more than it saves, are parsed on the calling
+    // thread.
+    size_t minChunkSize = 1024 * 1024;
+  };
+
   void clear();
   bool parse(const char* block, size_t size,
              ColumnOrder columnOrder = ColumnOrder::KEY_THEN_VALUE);
+  bool parse(const char* block, size_t size, const ParseOptions& options);
+
+  // Parses only the bytes appended to the text since it was parsed, that is,
+  // [block + parsedSize(), block + size), into the existing index. block must
+  // hold the previously parsed text followed by the new bytes; it may be at a
+  // new address, such as a new mapping of a file that has grown, but the old
+  // block must then stay alive as long as the dictionary, since the existing
+  // keys and values still point into it. Line numbers of new issues continue
+  // from the parsed text.
+  //
+  // Returns false, leaving the dictionary unchanged, if the new bytes cannot
+  // be parsed on their own: if the parsed text does not end with a linefeed,
+  // so that the first new bytes would continue its last line, if the block is
+  // shorter than the parsed text, or if the new bytes contain a NULL
+  // character. Call parse() on the whole block then.
+  bool parseAppended(const char* block, size_t size, ColumnOrder columnOrder);
+
+  // The number of bytes parsed so far, not counting a terminating NULL.
+  size_t parsedSize() const { return parsedSize_; }
+
+  // A snapshot holds the parsed index of a text, with the keys and values
+  // stored as offsets into the text, so that the index of a text that has not
+  // changed can be loaded without parsing it again. A snapshot is tied to its
+  // text by the text's size, a hash of its contents, and a stamp provided by
+  // the caller, such as the modification time of the text file.
+  //
+  // Writes a snapshot of the index to the file, which is replaced atomically.
+  // block must be the parsed text, and all keys and values must point into
+  // it, which is not the case after parseAppended() with a block at a new
+  // address. Returns false if they do not, or if the file cannot be written.
+  bool saveSnapshot(const char* snapshotPath, const char* block,
+                    int64_t stamp) const;
+
+  enum class SnapshotUse {
+    NOT_USED,
+    USED,
+    // The text has grown since the snapshot was saved. The snapshot was used
+    // for the part it covers, and the rest was parsed with parseAppended().
+    USED_WITH_APPENDED_TEXT,
+  };
+
+  // Maps the snapshot file and, if it was saved for this text with the same
+  // column order and stamp, loads the index from it instead of parsing the
+  // text. If the text has only grown since, the part that the snapshot covers
+  // must still hash the same, and the stamp is not checked, since appending
+  // changes it. If the snapshot is not used, the dictionary is left cleared.
+  SnapshotUse loadSnapshot(const char* snapshotPath, const char* block,
+                           size_t size, int64_t stamp,
+                           ColumnOrder columnOrder);
 
   [[nodiscard]] bool hasKey(const std::string_view& key) const;
-  [[nodiscard]] std::vector<std::string_view> getValues(
+
+  // Returns the values of the key, in the order they appear in the text. The
+  // span points into the dictionary and is valid until the next parse() or
+  // clear().
+  [[nodiscard]] std::span<const std::string_view> getValues(
       const std::string_view& key) const;
 
   const std::vector<Issue>& issues() const { return issues_; }
 
+  size_t keyCount() const { return keys_.size(); }
+
+  // Calls the visitor with each key, in the order they first appear in the
+  // text. Keys are numbered in that order, and firstKey skips the keys before
+  // it, such as the ones that were known before a parseAppended().
+  template <typename Visitor>
+  void forEachKey(Visitor&& visitor, size_t firstKey = 0) const {
+    for (size_t i = firstKey; i < keys_.size(); ++i) {
+      visitor(keys_[i].key);
+    }
+  }
+
+  // Returns the bytes allocated for the table and the arena, not counting the
+  // text itself.
+  size_t memoryUsage() const;
+
+  // The kernels that can be used for scanning the text. The x86-64 kernels
+  // are only available on x86-64, and NEON only if
+  // ENABLE_EXPERIMENTAL_SIMD_SUPPORT_NEON is defined. The best kernel supported
+  // by the host CPU is selected at runtime, so the same binary works on every
+  // host.
+  enum class ScanKernel {
+    SCALAR,
+    SSE42,
+    AVX2,
+    AVX512,
+    NEON,
+  };
+
+  // Returns the kernels that the host CPU supports.
+  static std::vector<ScanKernel> SupportedScanKernels();
+
+  static ScanKernel ActiveScanKernel();
+
+  // Overrides the kernel used by all dictionaries. This is meant for testing
+  // and benchmarking. Returns false if the kernel is not supported.
+  static bool SetScanKernel(ScanKernel kernel);
+
+  static const char* ScanKernelName(ScanKernel kernel);
+
  private:
   static constexpr size_t MAX_ISSUES = 100;
 
+  struct KeyEntry {
+    std::string_view key;
+    uint32_t valuesBegin = 0;
+    uint32_t valueCount = 0;
+  };
+
+  // A slot of the hash table. The tag holds the high bits of the key's hash,
+  // so that most mismatches are rejected without touching the key.
+  struct Slot {
+    uint32_t tag = 0;
+    uint32_t keyIndex = EMPTY_SLOT;
+  };
+  static constexpr uint32_t EMPTY_SLOT = UINT32_MAX;
+
+  // A parsed line, before its value is moved into the arena.
+  struct ParsedValue {
+    uint32_t keyIndex;
+    std::string_view value;
+  };
+
+  // Parses a block that has no terminating NULL into the cleared dictionary.
+  // The line numbers of the issues start at 1 at the start of the block, and
+  // the number of linefeeds in the block is stored in lineCount.
+  bool parseChunk(const char* block, size_t size, ColumnOrder columnOrder,
+                  size_t* lineCount);
+
+  // Merges dictionaries parsed from consecutive chunks, whose line counts are
+  // given, into the cleared dictionary.
+  void mergeChunks(const std::vector<ByteBlockBackedDictionary>& chunks,
+                   const std::vector<size_t>& lineCounts);
+
+  // Returns the index of the key in keys_, adding the key if it is new.
+  uint32_t findOrAddKey(std::string_view key);
+
+  // Returns the index of the key in keys_, or EMPTY_SLOT.
+  uint32_t findKey(std::string_view key) const;
+
+  void growTable();
+
+  // Moves the values of all keys to fresh runs, dropping the ones left behind
+  // by parseAppended().
+  void compactValues();
+
+  // Assigns each key a run in values_ as long as its value count, and resets
+  // the counts to 0 so that they can be used as fill cursors.
+  void assignValueRuns();
+
+  // Groups the parsed values by key into values_.
+  void buildValueArena(const std::vector<ParsedValue>& parsedValues);
+
   std::vector<Issue> issues_;
-  std::unordered_map<std::string_view, std::vector<std::string_view>> dict_;
+  std::vector<Slot> slots_;
+  std::vector<KeyEntry> keys_;
+  std::vector<std::string_view> values_;
+
+  ColumnOrder columnOrder_ = ColumnOrder::KEY_THEN_VALUE;
+  size_t parsedSize_ = 0;
+  // The number of linefeeds in the parsed text.
+  size_t lineCount_ = 0;
+  // The number of entries in values_ that no key points to any more.
+  size_t deadValueCount_ = 0;
 };
 
 }  // namespace McBopomofo
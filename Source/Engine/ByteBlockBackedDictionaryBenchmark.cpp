@@ -23,8 +23,13 @@
 
 #include <benchmark/benchmark.h>
 
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <random>
 #include <sstream>
 #include <string>
+#include <vector>
 
 #include "ByteBlockBackedDictionary.h"
 
@@ -57,7 +62,65 @@ const std::string& GetTestData() {
   return data;
 }
 
+constexpr int kUserPhraseCount = 100000;
+
+// A user phrase file in the value-then-key format, with kUserPhraseCount
+// phrases over fewer readings so that some readings have several phrases.
+const std::string& GetUserPhraseData() {
+  static const std::string data = []() {
+    std::string text = "# user phrases\n";
+    for (int i = 0; i < kUserPhraseCount; ++i) {
+      int reading = i % (kUserPhraseCount * 3 / 4);
+      text += "phrase_" + std::to_string(i) + " ㄅㄚ-" +
+              std::to_string(reading) + "\n";
+    }
+    return text;
+  }();
+  return data;
+}
+
+// Returns lookup keys in a fixed shuffled order. Half of the keys exist.
+std::vector<std::string> GetUserPhraseLookupKeys() {
+  std::vector<std::string> keys;
+  for (int i = 0; i < kUserPhraseCount; ++i) {
+    keys.push_back((i % 2 == 0 ? "ㄅㄚ-" : "ㄆㄚ-") + std::to_string(i));
+  }
+  std::shuffle(keys.begin(), keys.end(),
+               std::mt19937(std::mt19937::default_seed));
+  return keys;
+}
+
+// Registers one run per scan kernel supported by the host CPU.
+void ScanKernelArguments(benchmark::internal::Benchmark* benchmark) {
+  for (auto kernel :
+       McBopomofo::ByteBlockBackedDictionary::SupportedScanKernels()) {
+    benchmark->Arg(static_cast<int64_t>(kernel));
+  }
+}
+
+// Switches to the kernel of the run and restores the default when it ends.
+class ScopedScanKernel {
+ public:
+  explicit ScopedScanKernel(benchmark::State& state)
+      : original_(McBopomofo::ByteBlockBackedDictionary::ActiveScanKernel()) {
+    auto kernel =
+        static_cast<McBopomofo::ByteBlockBackedDictionary::ScanKernel>(
+            state.range(0));
+    McBopomofo::ByteBlockBackedDictionary::SetScanKernel(kernel);
+    state.SetLabel(
+        McBopomofo::ByteBlockBackedDictionary::ScanKernelName(kernel));
+  }
+
+  ~ScopedScanKernel() {
+    McBopomofo::ByteBlockBackedDictionary::SetScanKernel(original_);
+  }
+
+ private:
+  McBopomofo::ByteBlockBackedDictionary::ScanKernel original_;
+};
+
 void BM_ByteBlockBackedDictionaryParseTest(benchmark::State& state) {
+  const ScopedScanKernel scanKernel(state);
   const std::string& testData = GetTestData();
 
   for (auto _ : state) {
@@ -65,10 +128,11 @@ void BM_ByteBlockBackedDictionaryParseTest(benchmark::State& state) {
     dictionary.parse(testData.c_str(), testData.size());
   }
 }
-BENCHMARK(BM_ByteBlockBackedDictionaryParseTest);
+BENCHMARK(BM_ByteBlockBackedDictionaryParseTest)->Apply(ScanKernelArguments);
 
 void BM_ByteBlockBackedDictionaryValueColumnFirstParseTest(
     benchmark::State& state) {
+  const ScopedScanKernel scanKernel(state);
   const std::string& testData = GetTestData();
 
   for (auto _ : state) {
@@ -78,7 +142,150 @@ void BM_ByteBlockBackedDictionaryValueColumnFirstParseTest(
         McBopomofo::ByteBlockBackedDictionary::ColumnOrder::VALUE_THEN_KEY);
   }
 }
-BENCHMARK(BM_ByteBlockBackedDictionaryValueColumnFirstParseTest);
+BENCHMARK(BM_ByteBlockBackedDictionaryValueColumnFirstParseTest)
+    ->Apply(ScanKernelArguments);
+
+void BM_ByteBlockBackedDictionaryParseUserPhrases(benchmark::State& state) {
+  const std::string& testData = GetUserPhraseData();
+  size_t memoryUsage = 0;
+  for (auto _ : state) {
+    McBopomofo::ByteBlockBackedDictionary dictionary;
+    dictionary.parse(
+        testData.c_str(), testData.size(),
+        McBopomofo::ByteBlockBackedDictionary::ColumnOrder::VALUE_THEN_KEY);
+    memoryUsage = dictionary.memoryUsage();
+  }
+  state.counters["memory_bytes"] = static_cast<double>(memoryUsage);
+  state.counters["bytes_per_phrase"] =
+      static_cast<double>(memoryUsage) / kUserPhraseCount;
+}
+BENCHMARK(BM_ByteBlockBackedDictionaryParseUserPhrases);
+
+// About 40 MB of user phrases, the size of a large imported file.
+const std::string& GetLargeUserPhraseData() {
+  static const std::string data = []() {
+    std::string text;
+    for (int i = 0; i < 20; ++i) {
+      text += GetUserPhraseData();
+    }
+    return text;
+  }();
+  return data;
+}
+
+void BM_ByteBlockBackedDictionaryParallelParse(benchmark::State& state) {
+  const std::string& testData = GetLargeUserPhraseData();
+  McBopomofo::ByteBlockBackedDictionary::ParseOptions options;
+  options.columnOrder =
+      McBopomofo::ByteBlockBackedDictionary::ColumnOrder::VALUE_THEN_KEY;
+  options.threadCount = static_cast<size_t>(state.range(0));
+  for (auto _ : state) {
+    McBopomofo::ByteBlockBackedDictionary dictionary;
+    dictionary.parse(testData.c_str(), testData.size(), options);
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(testData.size()));
+}
+BENCHMARK(BM_ByteBlockBackedDictionaryParallelParse)
+    ->Arg(1)
+    ->Arg(2)
+    ->Arg(4)
+    ->Arg(8)
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+
+// Adding one phrase to a file of kUserPhraseCount phrases, which a full
+// parse (BM_ByteBlockBackedDictionaryParseUserPhrases) would cost the whole
+// file.
+void BM_ByteBlockBackedDictionaryParseAppendedLine(benchmark::State& state) {
+  constexpr int kAppendedLines = 10000;
+  const std::string& userPhrases = GetUserPhraseData();
+  std::string text = userPhrases;
+  std::vector<size_t> lineEnds;
+  for (int i = 0; i < kAppendedLines; ++i) {
+    text += "new_phrase_" + std::to_string(i) + " ㄅㄚ-" +
+            std::to_string(i * 7) + "\n";
+    lineEnds.push_back(text.size());
+  }
+
+  constexpr auto kColumnOrder =
+      McBopomofo::ByteBlockBackedDictionary::ColumnOrder::VALUE_THEN_KEY;
+  McBopomofo::ByteBlockBackedDictionary dictionary;
+  auto lineEnd = lineEnds.end();
+  for (auto _ : state) {
+    if (lineEnd == lineEnds.end()) {
+      state.PauseTiming();
+      dictionary.parse(text.c_str(), userPhrases.size(), kColumnOrder);
+      lineEnd = lineEnds.begin();
+      state.ResumeTiming();
+    }
+    dictionary.parseAppended(text.c_str(), *lineEnd, kColumnOrder);
+    ++lineEnd;
+  }
+}
+BENCHMARK(BM_ByteBlockBackedDictionaryParseAppendedLine);
+
+// Loading the index of the same file from a snapshot instead of parsing it
+// (BM_ByteBlockBackedDictionaryParseUserPhrases).
+void BM_ByteBlockBackedDictionaryLoadSnapshot(benchmark::State& state) {
+  constexpr auto kColumnOrder =
+      McBopomofo::ByteBlockBackedDictionary::ColumnOrder::VALUE_THEN_KEY;
+  const std::string& testData = GetUserPhraseData();
+  std::string snapshotPath =
+      (std::filesystem::temp_directory_path() /
+       "org.openvanilla.mcbopomofo.ByteBlockBackedDictionaryBenchmark.snapshot")
+          .string();
+  {
+    McBopomofo::ByteBlockBackedDictionary dictionary;
+    dictionary.parse(testData.c_str(), testData.size(), kColumnOrder);
+    dictionary.saveSnapshot(snapshotPath.c_str(), testData.c_str(), 0);
+  }
+  state.counters["snapshot_bytes"] =
+      static_cast<double>(std::filesystem::file_size(snapshotPath));
+
+  for (auto _ : state) {
+    McBopomofo::ByteBlockBackedDictionary dictionary;
+    auto use = dictionary.loadSnapshot(snapshotPath.c_str(), testData.c_str(),
+                                       testData.size(), 0, kColumnOrder);
+    benchmark::DoNotOptimize(use);
+  }
+  std::filesystem::remove(snapshotPath);
+}
+BENCHMARK(BM_ByteBlockBackedDictionaryLoadSnapshot);
+
+void BM_ByteBlockBackedDictionaryGetValues(benchmark::State& state) {
+  const std::string& testData = GetUserPhraseData();
+  McBopomofo::ByteBlockBackedDictionary dictionary;
+  dictionary.parse(
+      testData.c_str(), testData.size(),
+      McBopomofo::ByteBlockBackedDictionary::ColumnOrder::VALUE_THEN_KEY);
+  const std::vector<std::string> keys = GetUserPhraseLookupKeys();
+  auto key = keys.begin();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(dictionary.getValues(*key).size());
+    if (++key == keys.end()) {
+      key = keys.begin();
+    }
+  }
+}
+BENCHMARK(BM_ByteBlockBackedDictionaryGetValues);
+
+void BM_ByteBlockBackedDictionaryHasKey(benchmark::State& state) {
+  const std::string& testData = GetUserPhraseData();
+  McBopomofo::ByteBlockBackedDictionary dictionary;
+  dictionary.parse(
+      testData.c_str(), testData.size(),
+      McBopomofo::ByteBlockBackedDictionary::ColumnOrder::VALUE_THEN_KEY);
+  const std::vector<std::string> keys = GetUserPhraseLookupKeys();
+  auto key = keys.begin();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(dictionary.hasKey(*key));
+    if (++key == keys.end()) {
+      key = keys.begin();
+    }
+  }
+}
+BENCHMARK(BM_ByteBlockBackedDictionaryHasKey);
 
 };  // namespace
 
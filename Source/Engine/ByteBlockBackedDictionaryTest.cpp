@@ -21,6 +21,15 @@
 // FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
 // OTHER DEALINGS IN THE SOFTWARE.
 
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <set>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
 #include "ByteBlockBackedDictionary.h"
 #include "gtest/gtest.h"
 
@@ -36,14 +45,16 @@ TEST(ByteBlockBackedDictionaryTest, Simple1) {
   constexpr char data[] = "key1 value1";
   ByteBlockBackedDictionary dict;
   ASSERT_TRUE(dict.parse(data, sizeof(data)));
-  ASSERT_EQ(dict.getValues("key1").at(0), "value1");
+  ASSERT_EQ(dict.getValues("key1").size(), 1);
+  ASSERT_EQ(dict.getValues("key1")[0], "value1");
 }
 
 TEST(ByteBlockBackedDictionaryTest, Simple2) {
   constexpr char data[] = "key1 value1\n";
   ByteBlockBackedDictionary dict;
   ASSERT_TRUE(dict.parse(data, sizeof(data)));
-  ASSERT_EQ(dict.getValues("key1").at(0), "value1");
+  ASSERT_EQ(dict.getValues("key1").size(), 1);
+  ASSERT_EQ(dict.getValues("key1")[0], "value1");
 }
 
 TEST(ByteBlockBackedDictionaryTest, EncodingAgnostic1) {
@@ -51,7 +62,8 @@ TEST(ByteBlockBackedDictionaryTest, EncodingAgnostic1) {
   const char* charData = reinterpret_cast<const char*>(data);
   ByteBlockBackedDictionary dict;
   ASSERT_TRUE(dict.parse(charData, strlen(charData)));
-  ASSERT_EQ(dict.getValues("smile").at(0),
+  ASSERT_EQ(dict.getValues("smile").size(), 1);
+  ASSERT_EQ(dict.getValues("smile")[0],
             reinterpret_cast<const char*>(u8"😊"));
 }
 
@@ -61,7 +73,8 @@ TEST(ByteBlockBackedDictionaryTest, EncodingAgnostic2) {
       "\xe9\x81\x94\xe8\xb3\xb4\xe5\x96\x87\xe5\x98\x9b";
   ByteBlockBackedDictionary dict;
   ASSERT_TRUE(dict.parse(data, sizeof(data)));
-  ASSERT_EQ(dict.getValues("Nobel-Laureate").at(0),
+  ASSERT_EQ(dict.getValues("Nobel-Laureate").size(), 1);
+  ASSERT_EQ(dict.getValues("Nobel-Laureate")[0],
             "\xe9\x81\x94\xe8\xb3\xb4\xe5\x96\x87\xe5\x98\x9b");
 }
 
@@ -120,8 +133,10 @@ TEST(ByteBlockBackedDictionaryTest, TrailingSpacesInValuesAreStripped) {
   ByteBlockBackedDictionary dict;
   bool result = dict.parse(data, sizeof(data));
   ASSERT_TRUE(result);
-  ASSERT_EQ(dict.getValues("some_key").at(0), "some_value");
-  ASSERT_EQ(dict.getValues("another").at(0), "another_value");
+  ASSERT_EQ(dict.getValues("some_key").size(), 1);
+  ASSERT_EQ(dict.getValues("some_key")[0], "some_value");
+  ASSERT_EQ(dict.getValues("another").size(), 1);
+  ASSERT_EQ(dict.getValues("another")[0], "another_value");
 }
 
 TEST(ByteBlockBackedDictionaryTest, ValueColumnThenKeyColumn) {
@@ -133,7 +148,7 @@ TEST(ByteBlockBackedDictionaryTest, ValueColumnThenKeyColumn) {
   ASSERT_TRUE(result);
   ASSERT_TRUE(dict.hasKey("key"));
   ASSERT_EQ(dict.getValues("key").size(), 1);
-  ASSERT_EQ(dict.getValues("key").at(0), "many words in value");
+  ASSERT_EQ(dict.getValues("key")[0], "many words in value");
 }
 
 TEST(ByteBlockBackedDictionaryTest, ValueColumnThenKeyColumnWithTrailingSpace) {
@@ -145,8 +160,8 @@ TEST(ByteBlockBackedDictionaryTest, ValueColumnThenKeyColumnWithTrailingSpace) {
   ASSERT_TRUE(result);
   ASSERT_TRUE(dict.hasKey("key"));
   ASSERT_EQ(dict.getValues("key").size(), 2);
-  ASSERT_EQ(dict.getValues("key").at(0), "many words in value");
-  ASSERT_EQ(dict.getValues("key").at(1), "another value");
+  ASSERT_EQ(dict.getValues("key")[0], "many words in value");
+  ASSERT_EQ(dict.getValues("key")[1], "another value");
 }
 
 TEST(ByteBlockBackedDictionaryTest, NullCharacterNotAllowed) {
@@ -227,10 +242,10 @@ TEST(ByteBlockBackedDictionaryTest, ComplexEntries) {
   ASSERT_EQ(dict.issues().at(2).lineNumber, 13);
 
   ASSERT_EQ(dict.getValues("key1").size(), 4);
-  ASSERT_EQ(dict.getValues("key1").at(0), "value1");
-  ASSERT_EQ(dict.getValues("key1").at(1), "value1 1");
-  ASSERT_EQ(dict.getValues("key1").at(2), "value1\t2");
-  ASSERT_EQ(dict.getValues("key1").at(3), "value1 \t 3 # comment");
+  ASSERT_EQ(dict.getValues("key1")[0], "value1");
+  ASSERT_EQ(dict.getValues("key1")[1], "value1 1");
+  ASSERT_EQ(dict.getValues("key1")[2], "value1\t2");
+  ASSERT_EQ(dict.getValues("key1")[3], "value1 \t 3 # comment");
 }
 
 TEST(ByteBlockBackedDictionaryTest, ComplexEntriesValueThenKey) {
@@ -272,14 +287,418 @@ TEST(ByteBlockBackedDictionaryTest, ComplexEntriesValueThenKey) {
   ASSERT_EQ(dict.issues().at(2).lineNumber, 13);
 
   ASSERT_EQ(dict.getValues("key1").size(), 4);
-  ASSERT_EQ(dict.getValues("key1").at(0), "value1");
-  ASSERT_EQ(dict.getValues("key1").at(1), "value1 1");
-  ASSERT_EQ(dict.getValues("key1").at(2), "value1 \t 2");
-  ASSERT_EQ(dict.getValues("key1").at(3), "value1 \t 3 # comment");
+  ASSERT_EQ(dict.getValues("key1")[0], "value1");
+  ASSERT_EQ(dict.getValues("key1")[1], "value1 1");
+  ASSERT_EQ(dict.getValues("key1")[2], "value1 \t 2");
+  ASSERT_EQ(dict.getValues("key1")[3], "value1 \t 3 # comment");
 
   // This may be surprising, but it really has to do with the fact that we made
   // this choice to keep the parsing simple.
-  ASSERT_EQ(dict.getValues("comment").at(0), "value1 \t key1  #");
+  ASSERT_EQ(dict.getValues("comment").size(), 1);
+  ASSERT_EQ(dict.getValues("comment")[0], "value1 \t key1  #");
+}
+
+TEST(ByteBlockBackedDictionaryTest, ManyKeysWithInterleavedValues) {
+  // Enough keys to grow the table several times, with the values of each key
+  // spread across the text.
+  constexpr int kKeys = 5000;
+  std::string data;
+  for (int round = 0; round < 3; ++round) {
+    for (int k = 0; k < kKeys; ++k) {
+      if (round == 0 || k % (round + 1) == 0) {
+        data += "key" + std::to_string(k) + " value" + std::to_string(k) +
+                "_" + std::to_string(round) + "\n";
+      }
+    }
+  }
+
+  ByteBlockBackedDictionary dict;
+  ASSERT_TRUE(dict.parse(data.c_str(), data.size()));
+  EXPECT_EQ(dict.keyCount(), kKeys);
+  EXPECT_GT(dict.memoryUsage(), 0);
+  for (int k = 0; k < kKeys; ++k) {
+    std::string key = "key" + std::to_string(k);
+    std::span<const std::string_view> values = dict.getValues(key);
+    std::vector<std::string> expected;
+    for (int round = 0; round < 3; ++round) {
+      if (round == 0 || k % (round + 1) == 0) {
+        expected.push_back("value" + std::to_string(k) + "_" +
+                           std::to_string(round));
+      }
+    }
+    ASSERT_TRUE(std::ranges::equal(values, expected)) << key;
+  }
+  EXPECT_FALSE(dict.hasKey("key"));
+  EXPECT_FALSE(dict.hasKey("key5000"));
+  EXPECT_TRUE(dict.getValues("value1_0").empty());
+
+  // Keys are visited in the order they first appear.
+  int next = 0;
+  dict.forEachKey([&next](std::string_view key) {
+    EXPECT_EQ(key, "key" + std::to_string(next));
+    ++next;
+  });
+  EXPECT_EQ(next, kKeys);
+
+  dict.clear();
+  EXPECT_EQ(dict.keyCount(), 0);
+  EXPECT_FALSE(dict.hasKey("key0"));
+  EXPECT_TRUE(dict.getValues("key0").empty());
+}
+
+TEST(ByteBlockBackedDictionaryTest, ParallelParseMatchesSingleThreaded) {
+  // Values of the same key in many chunks, comments, blank lines, CRLFs and
+  // lines with a missing column, so that chunk boundaries land everywhere.
+  std::string data;
+  for (int i = 0; i < 2000; ++i) {
+    std::string key = "key" + std::to_string(i % 97);
+    switch (i % 7) {
+      case 0:
+        data += "# comment " + std::to_string(i) + "\n";
+        break;
+      case 1:
+        data += key + "\n";
+        break;
+      case 2:
+        data += "\n  \t\n";
+        break;
+      case 3:
+        data += key + "  value " + std::to_string(i) + " \r\n";
+        break;
+      default:
+        data += key + " value" + std::to_string(i) + "\n";
+        break;
+    }
+  }
+
+  using ColumnOrder = ByteBlockBackedDictionary::ColumnOrder;
+  for (auto columnOrder :
+       {ColumnOrder::KEY_THEN_VALUE, ColumnOrder::VALUE_THEN_KEY}) {
+    ByteBlockBackedDictionary expected;
+    ASSERT_TRUE(expected.parse(data.c_str(), data.size(), columnOrder));
+    std::vector<std::string_view> expectedKeys;
+    expected.forEachKey(
+        [&expectedKeys](std::string_view key) { expectedKeys.push_back(key); });
+
+    for (size_t threadCount : {2, 3, 8}) {
+      SCOPED_TRACE(threadCount);
+      ByteBlockBackedDictionary::ParseOptions options;
+      options.columnOrder = columnOrder;
+      options.threadCount = threadCount;
+      options.minChunkSize = 64;
+      ByteBlockBackedDictionary dict;
+      ASSERT_TRUE(dict.parse(data.c_str(), data.size(), options));
+
+      std::vector<std::string_view> keys;
+      dict.forEachKey([&keys](std::string_view key) { keys.push_back(key); });
+      ASSERT_EQ(keys, expectedKeys);
+      for (const auto& key : keys) {
+        EXPECT_TRUE(std::ranges::equal(dict.getValues(key),
+                                       expected.getValues(key)));
+      }
+      ASSERT_EQ(dict.issues().size(), expected.issues().size());
+      for (size_t i = 0; i < dict.issues().size(); ++i) {
+        EXPECT_EQ(dict.issues()[i].type, expected.issues()[i].type);
+        EXPECT_EQ(dict.issues()[i].lineNumber,
+                  expected.issues()[i].lineNumber);
+      }
+    }
+  }
+}
+
+TEST(ByteBlockBackedDictionaryTest, ParallelParseReportsFirstNULL) {
+  std::string data;
+  for (int i = 0; i < 1000; ++i) {
+    data += "key" + std::to_string(i) + " value\n";
+  }
+  data[data.size() / 2] = '\0';
+  data[data.size() * 3 / 4] = '\0';
+
+  ByteBlockBackedDictionary expected;
+  ASSERT_FALSE(expected.parse(data.c_str(), data.size()));
+  ASSERT_EQ(expected.issues().size(), 1);
+
+  ByteBlockBackedDictionary::ParseOptions options;
+  options.threadCount = 4;
+  options.minChunkSize = 64;
+  ByteBlockBackedDictionary dict;
+  ASSERT_FALSE(dict.parse(data.c_str(), data.size(), options));
+  ASSERT_EQ(dict.issues().size(), 1);
+  EXPECT_EQ(dict.issues()[0].type,
+            ByteBlockBackedDictionary::Issue::Type::NULL_CHARACTER_IN_TEXT);
+  EXPECT_EQ(dict.issues()[0].lineNumber, expected.issues()[0].lineNumber);
+  EXPECT_EQ(dict.keyCount(), 0);
+}
+
+TEST(ByteBlockBackedDictionaryTest, ParseAppended) {
+  std::string text = "key1 value1\nkey2 value2\n";
+  ByteBlockBackedDictionary dict;
+  ASSERT_TRUE(dict.parse(text.c_str(), text.size()));
+  EXPECT_EQ(dict.parsedSize(), text.size());
+
+  // The appended text goes into a new buffer, as a new mapping of a grown
+  // file would, while the old one stays alive.
+  std::string grown = text + "key3 value3\nkey1 value1b\nbroken\n";
+  ASSERT_TRUE(dict.parseAppended(
+      grown.c_str(), grown.size(),
+      ByteBlockBackedDictionary::ColumnOrder::KEY_THEN_VALUE));
+  EXPECT_EQ(dict.parsedSize(), grown.size());
+  EXPECT_EQ(dict.keyCount(), 3);
+  ASSERT_EQ(dict.getValues("key1").size(), 2);
+  EXPECT_EQ(dict.getValues("key1")[0], "value1");
+  EXPECT_EQ(dict.getValues("key1")[1], "value1b");
+  ASSERT_EQ(dict.getValues("key2").size(), 1);
+  EXPECT_EQ(dict.getValues("key2")[0], "value2");
+  ASSERT_EQ(dict.getValues("key3").size(), 1);
+  EXPECT_EQ(dict.getValues("key3")[0], "value3");
+  ASSERT_EQ(dict.issues().size(), 1);
+  EXPECT_EQ(dict.issues()[0].lineNumber, 5);
+
+  std::vector<std::string_view> newKeys;
+  dict.forEachKey([&newKeys](std::string_view key) { newKeys.push_back(key); },
+                  2);
+  EXPECT_EQ(newKeys, std::vector<std::string_view>{"key3"});
+
+  // Many appends to the same key keep the values in order.
+  std::vector<std::string> buffers{grown};
+  for (int i = 0; i < 50; ++i) {
+    buffers.push_back(buffers.back() + "key2 v" + std::to_string(i) + "\n");
+    ASSERT_TRUE(dict.parseAppended(
+        buffers.back().c_str(), buffers.back().size(),
+        ByteBlockBackedDictionary::ColumnOrder::KEY_THEN_VALUE));
+  }
+  std::span<const std::string_view> values = dict.getValues("key2");
+  ASSERT_EQ(values.size(), 51);
+  EXPECT_EQ(values[0], "value2");
+  for (int i = 0; i < 50; ++i) {
+    EXPECT_EQ(values[i + 1], "v" + std::to_string(i));
+  }
+  EXPECT_EQ(dict.getValues("key1").size(), 2);
+
+  // Appending nothing is fine.
+  EXPECT_TRUE(dict.parseAppended(
+      buffers.back().c_str(), buffers.back().size(),
+      ByteBlockBackedDictionary::ColumnOrder::KEY_THEN_VALUE));
+}
+
+TEST(ByteBlockBackedDictionaryTest, ParseAppendedRejectsNonAppends) {
+  std::string text = "key1 value1\nkey2 value2";
+  ByteBlockBackedDictionary dict;
+  ASSERT_TRUE(dict.parse(text.c_str(), text.size()));
+
+  // The last line has no linefeed, so appended bytes would continue it.
+  std::string grown = text + "x\n";
+  EXPECT_FALSE(dict.parseAppended(
+      grown.c_str(), grown.size(),
+      ByteBlockBackedDictionary::ColumnOrder::KEY_THEN_VALUE));
+
+  text += "\n";
+  ASSERT_TRUE(dict.parse(text.c_str(), text.size()));
+  EXPECT_FALSE(dict.parseAppended(
+      text.c_str(), text.size() - 1,
+      ByteBlockBackedDictionary::ColumnOrder::KEY_THEN_VALUE));
+
+  std::string withNULL = text + "key3 val";
+  withNULL.push_back('\0');
+  withNULL += "ue3\n";
+  EXPECT_FALSE(dict.parseAppended(
+      withNULL.c_str(), withNULL.size(),
+      ByteBlockBackedDictionary::ColumnOrder::KEY_THEN_VALUE));
+  EXPECT_EQ(dict.parsedSize(), text.size());
+  EXPECT_EQ(dict.keyCount(), 2);
+  EXPECT_TRUE(dict.issues().empty());
+}
+
+TEST(ByteBlockBackedDictionaryTest, Snapshots) {
+  using SnapshotUse = ByteBlockBackedDictionary::SnapshotUse;
+  constexpr auto kColumnOrder =
+      ByteBlockBackedDictionary::ColumnOrder::VALUE_THEN_KEY;
+  std::string snapshotPath =
+      (std::filesystem::temp_directory_path() /
+       "org.openvanilla.mcbopomofo.ByteBlockBackedDictionaryTest.snapshot")
+          .string();
+
+  std::string text;
+  for (int i = 0; i < 300; ++i) {
+    text += "value" + std::to_string(i) + " key" + std::to_string(i % 100) +
+            "\n";
+  }
+  text += "broken\n";
+  ByteBlockBackedDictionary parsed;
+  ASSERT_TRUE(parsed.parse(text.c_str(), text.size(), kColumnOrder));
+  ASSERT_TRUE(parsed.saveSnapshot(snapshotPath.c_str(), text.c_str(), 42));
+
+  // The snapshot works for any copy of the same text.
+  std::string copy = text;
+  ByteBlockBackedDictionary loaded;
+  ASSERT_EQ(loaded.loadSnapshot(snapshotPath.c_str(), copy.c_str(),
+                                copy.size(), 42, kColumnOrder),
+            SnapshotUse::USED);
+  EXPECT_EQ(loaded.keyCount(), parsed.keyCount());
+  EXPECT_EQ(loaded.parsedSize(), parsed.parsedSize());
+  parsed.forEachKey([&](std::string_view key) {
+    EXPECT_TRUE(
+        std::ranges::equal(loaded.getValues(key), parsed.getValues(key)));
+    EXPECT_GE(loaded.getValues(key)[0].data(), copy.c_str());
+  });
+  EXPECT_FALSE(loaded.hasKey("key100"));
+  ASSERT_EQ(loaded.issues().size(), 1);
+  EXPECT_EQ(loaded.issues()[0].lineNumber, 301);
+
+  // A different stamp, column order or content is a mismatch.
+  EXPECT_EQ(loaded.loadSnapshot(snapshotPath.c_str(), copy.c_str(),
+                                copy.size(), 43, kColumnOrder),
+            SnapshotUse::NOT_USED);
+  EXPECT_EQ(loaded.keyCount(), 0);
+  EXPECT_EQ(loaded.loadSnapshot(
+                snapshotPath.c_str(), copy.c_str(), copy.size(), 42,
+                ByteBlockBackedDictionary::ColumnOrder::KEY_THEN_VALUE),
+            SnapshotUse::NOT_USED);
+  copy[3] = 'X';
+  EXPECT_EQ(loaded.loadSnapshot(snapshotPath.c_str(), copy.c_str(),
+                                copy.size(), 42, kColumnOrder),
+            SnapshotUse::NOT_USED);
+
+  // Appended text is parsed on top of the snapshot, whatever the stamp.
+  std::string grown = text + "value300 key7\nvalue301 key100\n";
+  ASSERT_EQ(loaded.loadSnapshot(snapshotPath.c_str(), grown.c_str(),
+                                grown.size(), 44, kColumnOrder),
+            SnapshotUse::USED_WITH_APPENDED_TEXT);
+  EXPECT_EQ(loaded.keyCount(), 101);
+  ASSERT_EQ(loaded.getValues("key7").size(), 4);
+  EXPECT_EQ(loaded.getValues("key7")[3], "value300");
+  EXPECT_TRUE(loaded.saveSnapshot(snapshotPath.c_str(), grown.c_str(), 44));
+
+  // A snapshot of an index that points into other blocks is refused.
+  std::string grownAgain = grown + "value302 key8\n";
+  ASSERT_TRUE(loaded.parseAppended(grownAgain.c_str(), grownAgain.size(),
+                                   kColumnOrder));
+  EXPECT_FALSE(
+      loaded.saveSnapshot(snapshotPath.c_str(), grownAgain.c_str(), 45));
+
+  // A damaged snapshot is rejected. Zeroing 128 slots right after the
+  // 72-byte header makes them all point to key 0, which leaves the table
+  // with more used slots than keys.
+  {
+    std::fstream file(snapshotPath,
+                      std::ios::binary | std::ios::in | std::ios::out);
+    file.seekp(72);
+    std::string zeros(1024, '\0');
+    file.write(zeros.data(), static_cast<std::streamsize>(zeros.size()));
+  }
+  ByteBlockBackedDictionary damaged;
+  EXPECT_EQ(damaged.loadSnapshot(snapshotPath.c_str(), grown.c_str(),
+                                 grown.size(), 44, kColumnOrder),
+            SnapshotUse::NOT_USED);
+  EXPECT_EQ(damaged.keyCount(), 0);
+  ByteBlockBackedDictionary reparsed;
+  ASSERT_TRUE(reparsed.parse(grown.c_str(), grown.size(), kColumnOrder));
+  ASSERT_TRUE(reparsed.saveSnapshot(snapshotPath.c_str(), grown.c_str(), 44));
+  ASSERT_EQ(damaged.loadSnapshot(snapshotPath.c_str(), grown.c_str(),
+                                 grown.size(), 44, kColumnOrder),
+            SnapshotUse::USED);
+  std::filesystem::resize_file(snapshotPath,
+                               std::filesystem::file_size(snapshotPath) - 1);
+  EXPECT_EQ(damaged.loadSnapshot(snapshotPath.c_str(), grown.c_str(),
+                                 grown.size(), 44, kColumnOrder),
+            SnapshotUse::NOT_USED);
+  {
+    std::ofstream file(snapshotPath, std::ios::binary | std::ios::trunc);
+    file << "garbage";
+  }
+  EXPECT_EQ(damaged.loadSnapshot(snapshotPath.c_str(), grown.c_str(),
+                                 grown.size(), 44, kColumnOrder),
+            SnapshotUse::NOT_USED);
+  std::filesystem::remove(snapshotPath);
+  EXPECT_EQ(damaged.loadSnapshot(snapshotPath.c_str(), grown.c_str(),
+                                 grown.size(), 44, kColumnOrder),
+            SnapshotUse::NOT_USED);
+}
+
+TEST(ByteBlockBackedDictionaryTest, AllScanKernelsAgree) {
+  // Long keys and values make every kernel cross block boundaries, and the
+  // short ones exercise the scalar tails.
+  std::string data;
+  std::set<std::string> keys;
+  for (int i = 0; i < 200; ++i) {
+    std::string key =
+        "key" + std::to_string(i % 17) + std::string(i % 41, 'k');
+    keys.insert(key);
+    std::string value = "value " + std::string(i % 73, 'v');
+    data += (i % 3 == 0) ? key + " \t" + value + "\r\n"
+                         : key + " " + value + "\n";
+    if (i % 11 == 0) {
+      data += "  # comment " + std::string(i % 67, 'c') + "\n";
+    }
+    if (i % 13 == 0) {
+      data += key + "\n";
+    }
+  }
+
+  ByteBlockBackedDictionary::ScanKernel original =
+      ByteBlockBackedDictionary::ActiveScanKernel();
+
+  for (auto columnOrder :
+       {ByteBlockBackedDictionary::ColumnOrder::KEY_THEN_VALUE,
+        ByteBlockBackedDictionary::ColumnOrder::VALUE_THEN_KEY}) {
+    ASSERT_TRUE(ByteBlockBackedDictionary::SetScanKernel(
+        ByteBlockBackedDictionary::ScanKernel::SCALAR));
+    ByteBlockBackedDictionary expected;
+    ASSERT_TRUE(expected.parse(data.c_str(), data.size(), columnOrder));
+
+    for (auto kernel : ByteBlockBackedDictionary::SupportedScanKernels()) {
+      SCOPED_TRACE(ByteBlockBackedDictionary::ScanKernelName(kernel));
+      ASSERT_TRUE(ByteBlockBackedDictionary::SetScanKernel(kernel));
+      EXPECT_EQ(ByteBlockBackedDictionary::ActiveScanKernel(), kernel);
+
+      ByteBlockBackedDictionary dict;
+      ASSERT_TRUE(dict.parse(data.c_str(), data.size(), columnOrder));
+      ASSERT_EQ(dict.issues().size(), expected.issues().size());
+      for (size_t i = 0; i < dict.issues().size(); ++i) {
+        EXPECT_EQ(dict.issues()[i].lineNumber,
+                  expected.issues()[i].lineNumber);
+      }
+      for (const auto& key : keys) {
+        EXPECT_TRUE(std::ranges::equal(dict.getValues(key),
+                                       expected.getValues(key)));
+      }
+    }
+  }
+
+  ByteBlockBackedDictionary::SetScanKernel(original);
+}
+
+TEST(ByteBlockBackedDictionaryTest, AllScanKernelsFindNULL) {
+  ByteBlockBackedDictionary::ScanKernel original =
+      ByteBlockBackedDictionary::ActiveScanKernel();
+
+  // Place the NULL at every offset of a few blocks, including the upper half
+  // of a 64-byte block, and check the reported line number.
+  for (auto kernel : ByteBlockBackedDictionary::SupportedScanKernels()) {
+    SCOPED_TRACE(ByteBlockBackedDictionary::ScanKernelName(kernel));
+    ASSERT_TRUE(ByteBlockBackedDictionary::SetScanKernel(kernel));
+
+    for (size_t offset = 0; offset < 200; ++offset) {
+      std::string data;
+      while (data.size() < 256) {
+        data += "k v\n";
+      }
+      data[offset] = 0;
+      size_t expectedLine = 1;
+      for (size_t i = 0; i < offset; ++i) {
+        expectedLine += data[i] == '\n' ? 1 : 0;
+      }
+
+      ByteBlockBackedDictionary dict;
+      ASSERT_FALSE(dict.parse(data.c_str(), data.size()));
+      ASSERT_EQ(dict.issues().size(), 1);
+      EXPECT_EQ(dict.issues()[0].type,
+                ByteBlockBackedDictionary::Issue::Type::NULL_CHARACTER_IN_TEXT);
+      EXPECT_EQ(dict.issues()[0].lineNumber, expectedLine);
+    }
+  }
+
+  ByteBlockBackedDictionary::SetScanKernel(original);
 }
 
 }  // namespace McBopomofo
@@ -0,0 +1,445 @@
+// Copyright (c) 2026 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include "CompressedLM.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace McBopomofo {
+
+static_assert(std::endian::native == std::endian::little,
+              "The compressed image is stored in little-endian byte order");
+
+static constexpr char kMagic[8] = {'M', 'C', 'B', 'P', 'F', 'C', 'L', 'M'};
+static constexpr uint32_t kVersion = 1;
+
+struct CompressedLM::Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t scoreBits;
+  uint32_t keysPerBlock;
+  uint32_t blockCount;
+  uint32_t dataSize;
+  uint32_t poolSize;
+  double minScore;
+  double scoreStep;
+};
+
+namespace {
+
+void AppendVarint(std::string& output, uint32_t value) {
+  while (value >= 0x80) {
+    output.push_back(static_cast<char>((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  output.push_back(static_cast<char>(value));
+}
+
+// Reads a varint and advances ptr past it. Returns false if the varint runs
+// past end or does not fit in 32 bits.
+bool ReadVarint(const char*& ptr, const char* end, uint32_t& value) {
+  value = 0;
+  for (int shift = 0; shift < 35 && ptr < end; shift += 7) {
+    auto byte = static_cast<unsigned char>(*ptr++);
+    value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Reads a quantized score of the given width in bytes.
+bool ReadQuantizedScore(const char*& ptr, const char* end, uint32_t bytes,
+                        uint32_t& value) {
+  if (static_cast<size_t>(end - ptr) < bytes) {
+    return false;
+  }
+  value = 0;
+  for (uint32_t i = 0; i < bytes; ++i) {
+    value |= static_cast<uint32_t>(static_cast<unsigned char>(ptr[i]))
+             << (8 * i);
+  }
+  ptr += bytes;
+  return true;
+}
+
+// The position of the next entry in a block, with its key still front-coded.
+struct Entry {
+  uint32_t shared;
+  std::string_view suffix;
+  const char* payload;
+  const char* payloadEnd;
+};
+
+bool ReadEntry(const char*& ptr, const char* end, Entry& entry) {
+  uint32_t suffixLength = 0;
+  uint32_t payloadSize = 0;
+  if (!ReadVarint(ptr, end, entry.shared) ||
+      !ReadVarint(ptr, end, suffixLength) ||
+      static_cast<size_t>(end - ptr) < suffixLength) {
+    return false;
+  }
+  entry.suffix = std::string_view(ptr, suffixLength);
+  ptr += suffixLength;
+  if (!ReadVarint(ptr, end, payloadSize) ||
+      static_cast<size_t>(end - ptr) < payloadSize) {
+    return false;
+  }
+  entry.payload = ptr;
+  entry.payloadEnd = ptr + payloadSize;
+  ptr = entry.payloadEnd;
+  return true;
+}
+
+size_t SharedPrefixLength(std::string_view a, std::string_view b) {
+  size_t length = std::min(a.length(), b.length());
+  size_t i = 0;
+  while (i < length && a[i] == b[i]) {
+    ++i;
+  }
+  return i;
+}
+
+}  // namespace
+
+std::string CompressedLM::Compile(const ParselessPhraseDB& db,
+                                  const CompileOptions& options) {
+  // Group the values by key. The map also sorts the keys, while each key
+  // keeps its values in the order of the rows.
+  std::map<std::string_view, std::vector<ParselessPhraseDB::Row>> rowsByKey;
+  double minScore = 0;
+  double maxScore = 0;
+  bool first = true;
+  for (std::string_view row : db.rows("")) {
+    ParselessPhraseDB::Row decoded = ParselessPhraseDB::DecodeRow(row);
+    if (decoded.key.empty() || decoded.key.length() == row.length()) {
+      continue;
+    }
+    rowsByKey[decoded.key].push_back(decoded);
+    minScore = first ? decoded.score : std::min(minScore, decoded.score);
+    maxScore = first ? decoded.score : std::max(maxScore, decoded.score);
+    first = false;
+  }
+
+  auto scoreBits = static_cast<uint32_t>(options.scoreBits);
+  uint32_t scoreBytes = scoreBits / 8;
+  double levels = static_cast<double>((uint32_t{1} << scoreBits) - 1);
+  double scoreStep = (maxScore - minScore) / levels;
+  size_t keysPerBlock = std::max<size_t>(options.keysPerBlock, 1);
+
+  std::string pool;
+  std::unordered_map<std::string_view, uint32_t> pooledValues;
+  std::vector<uint32_t> blockOffsets;
+  std::string data;
+  std::string payload;
+  std::string_view previousKey;
+  size_t index = 0;
+  for (const auto& [key, rows] : rowsByKey) {
+    if (index++ % keysPerBlock == 0) {
+      blockOffsets.push_back(static_cast<uint32_t>(data.size()));
+      previousKey = std::string_view();
+    }
+
+    payload.clear();
+    AppendVarint(payload, static_cast<uint32_t>(rows.size()));
+    for (const auto& row : rows) {
+      auto [it, inserted] = pooledValues.try_emplace(
+          row.value, static_cast<uint32_t>(pool.size()));
+      if (inserted) {
+        AppendVarint(pool, static_cast<uint32_t>(row.value.length()));
+        pool.append(row.value);
+      }
+      AppendVarint(payload, it->second);
+
+      double q = scoreStep > 0 ? std::round((row.score - minScore) / scoreStep)
+                               : 0;
+      auto quantized = static_cast<uint32_t>(std::clamp(q, 0.0, levels));
+      for (uint32_t i = 0; i < scoreBytes; ++i) {
+        payload.push_back(static_cast<char>(quantized >> (8 * i)));
+      }
+    }
+
+    size_t shared = SharedPrefixLength(previousKey, key);
+    AppendVarint(data, static_cast<uint32_t>(shared));
+    AppendVarint(data, static_cast<uint32_t>(key.length() - shared));
+    data.append(key.substr(shared));
+    AppendVarint(data, static_cast<uint32_t>(payload.size()));
+    data.append(payload);
+    previousKey = key;
+  }
+  blockOffsets.push_back(static_cast<uint32_t>(data.size()));
+
+  Header header{};
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.scoreBits = scoreBits;
+  header.keysPerBlock = static_cast<uint32_t>(keysPerBlock);
+  header.blockCount = static_cast<uint32_t>(blockOffsets.size() - 1);
+  header.dataSize = static_cast<uint32_t>(data.size());
+  header.poolSize = static_cast<uint32_t>(pool.size());
+  header.minScore = minScore;
+  header.scoreStep = scoreStep;
+
+  std::string image;
+  image.reserve(sizeof(Header) + blockOffsets.size() * sizeof(uint32_t) +
+                data.size() + pool.size());
+  image.append(reinterpret_cast<const char*>(&header), sizeof(Header));
+  image.append(reinterpret_cast<const char*>(blockOffsets.data()),
+               blockOffsets.size() * sizeof(uint32_t));
+  image.append(data);
+  image.append(pool);
+  return image;
+}
+
+bool CompressedLM::CompileFile(const char* sortedDataPath,
+                               const char* outputPath,
+                               const CompileOptions& options) {
+  MemoryMappedFile file;
+  if (!file.open(sortedDataPath)) {
+    return false;
+  }
+  std::unique_ptr<ParselessPhraseDB> db =
+      ParselessPhraseDB::CreateValidatedDB(file.data(), file.length());
+  if (db == nullptr) {
+    return false;
+  }
+
+  std::string image = Compile(*db, options);
+  std::ofstream output(outputPath, std::ios::binary | std::ios::trunc);
+  output.write(image.data(), static_cast<std::streamsize>(image.size()));
+  return output.good();
+}
+
+bool CompressedLM::isLoaded() const { return blockOffsets_ != nullptr; }
+
+bool CompressedLM::open(const char* path) {
+  if (isLoaded()) {
+    return false;
+  }
+  if (!mmapedFile_.open(path)) {
+    return false;
+  }
+  if (!load(mmapedFile_.data(), mmapedFile_.length())) {
+    mmapedFile_.close();
+    return false;
+  }
+  return true;
+}
+
+bool CompressedLM::open(std::string_view image) {
+  if (isLoaded()) {
+    return false;
+  }
+  if (image.size() < sizeof(Header) ||
+      !MemoryMappedFile::CopyToAlignedWords(image, ownedImage_)) {
+    return false;
+  }
+  if (!load(reinterpret_cast<const char*>(ownedImage_.data()),
+            image.size())) {
+    ownedImage_.clear();
+    return false;
+  }
+  return true;
+}
+
+void CompressedLM::close() {
+  mmapedFile_.close();
+  ownedImage_.clear();
+  imageSize_ = 0;
+  scoreBytes_ = blockCount_ = dataSize_ = poolSize_ = 0;
+  minScore_ = scoreStep_ = 0;
+  blockOffsets_ = nullptr;
+  data_ = nullptr;
+  pool_ = nullptr;
+}
+
+bool CompressedLM::load(const char* data, size_t length) {
+  if (length < sizeof(Header)) {
+    return false;
+  }
+  Header header;
+  memcpy(&header, data, sizeof(Header));
+  if (memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+      header.version != kVersion ||
+      (header.scoreBits != 8 && header.scoreBits != 16) ||
+      !std::isfinite(header.minScore) || !std::isfinite(header.scoreStep)) {
+    return false;
+  }
+  size_t dataOffset =
+      sizeof(Header) + (size_t{header.blockCount} + 1) * sizeof(uint32_t);
+  size_t poolOffset = dataOffset + header.dataSize;
+  if (poolOffset + header.poolSize > length) {
+    return false;
+  }
+
+  // The block offsets are checked once here so that lookups can trust them.
+  const auto* blockOffsets =
+      reinterpret_cast<const uint32_t*>(data + sizeof(Header));
+  for (uint32_t i = 0; i < header.blockCount; ++i) {
+    if (blockOffsets[i] > blockOffsets[i + 1]) {
+      return false;
+    }
+  }
+  if (blockOffsets[header.blockCount] > header.dataSize) {
+    return false;
+  }
+
+  imageSize_ = length;
+  scoreBytes_ = header.scoreBits / 8;
+  blockCount_ = header.blockCount;
+  dataSize_ = header.dataSize;
+  poolSize_ = header.poolSize;
+  minScore_ = header.minScore;
+  scoreStep_ = header.scoreStep;
+  blockOffsets_ = blockOffsets;
+  data_ = data + dataOffset;
+  pool_ = data + poolOffset;
+  return true;
+}
+
+bool CompressedLM::findPayload(std::string_view key, const char*& payload,
+                               const char*& payloadEnd) const {
+  if (!isLoaded() || blockCount_ == 0) {
+    return false;
+  }
+
+  // Find the last block whose first key is not greater than the key. The
+  // first key of each block is stored in full.
+  uint32_t low = 0;
+  uint32_t high = blockCount_;
+  while (low < high) {
+    uint32_t mid = low + (high - low) / 2;
+    const char* ptr = data_ + blockOffsets_[mid];
+    Entry entry;
+    if (!ReadEntry(ptr, data_ + blockOffsets_[mid + 1], entry)) {
+      return false;
+    }
+    if (entry.suffix <= key) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  if (low == 0) {
+    return false;
+  }
+
+  // Scan the block without rebuilding the keys: matched is the length of the
+  // prefix that the key shares with the previous entry's key, which is less
+  // than the key. An entry that shares more than that with its predecessor is
+  // still less than the key, and one that shares less is greater.
+  uint32_t block = low - 1;
+  const char* ptr = data_ + blockOffsets_[block];
+  const char* end = data_ + blockOffsets_[block + 1];
+  size_t matched = 0;
+  while (ptr < end) {
+    Entry entry;
+    if (!ReadEntry(ptr, end, entry)) {
+      return false;
+    }
+    if (entry.shared > matched) {
+      continue;
+    }
+    if (entry.shared < matched) {
+      return false;
+    }
+
+    size_t m = 0;
+    size_t remaining = key.length() - matched;
+    while (m < entry.suffix.length() && m < remaining &&
+           entry.suffix[m] == key[matched + m]) {
+      ++m;
+    }
+    if (m == remaining) {
+      if (m == entry.suffix.length()) {
+        payload = entry.payload;
+        payloadEnd = entry.payloadEnd;
+        return true;
+      }
+      // The entry's key has the key as a proper prefix.
+      return false;
+    }
+    if (m < entry.suffix.length() &&
+        static_cast<unsigned char>(entry.suffix[m]) >
+            static_cast<unsigned char>(key[matched + m])) {
+      return false;
+    }
+    matched += m;
+  }
+  return false;
+}
+
+std::vector<Formosa::Gramambular2::LanguageModel::Unigram>
+CompressedLM::getUnigrams(const std::string& key) {
+  const char* ptr = nullptr;
+  const char* end = nullptr;
+  if (!findPayload(key, ptr, end)) {
+    return {};
+  }
+
+  uint32_t count = 0;
+  if (!ReadVarint(ptr, end, count)) {
+    return {};
+  }
+  std::vector<Formosa::Gramambular2::LanguageModel::Unigram> results;
+  results.reserve(std::min<size_t>(count, end - ptr));
+  for (uint32_t i = 0; i < count; ++i) {
+    uint32_t offset = 0;
+    uint32_t quantized = 0;
+    if (!ReadVarint(ptr, end, offset) ||
+        !ReadQuantizedScore(ptr, end, scoreBytes_, quantized)) {
+      break;
+    }
+
+    const char* value = pool_ + std::min(offset, poolSize_);
+    const char* poolEnd = pool_ + poolSize_;
+    uint32_t length = 0;
+    if (!ReadVarint(value, poolEnd, length) ||
+        static_cast<size_t>(poolEnd - value) < length) {
+      continue;
+    }
+    results.emplace_back(std::string(value, length),
+                         minScore_ + quantized * scoreStep_);
+  }
+  return results;
+}
+
+bool CompressedLM::hasUnigrams(const std::string& key) {
+  const char* payload = nullptr;
+  const char* payloadEnd = nullptr;
+  return findPayload(key, payload, payloadEnd);
+}
+
+}  // namespace McBopomofo
@@ -0,0 +1,137 @@
+// Copyright (c) 2026 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef SRC_ENGINE_COMPRESSEDLM_H_
+#define SRC_ENGINE_COMPRESSEDLM_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "MemoryMappedFile.h"
+#include "ParselessPhraseDB.h"
+#include "gramambular2/language_model.h"
+
+namespace McBopomofo {
+
+// A language model backed by a compact, block-compressed image of sorted
+// "key value score" data. It returns the same unigrams, in the same order, as
+// ParselessLM, except that the scores are quantized; see maxScoreError().
+//
+// The keys are grouped into blocks of a fixed number of keys. Within a block,
+// each key is front-coded against the previous one, and the first key of each
+// block is stored in full so that a lookup can binary search the blocks and
+// then decode at most one block. The values are stored once each in a string
+// pool, and the scores are quantized linearly to 8 or 16 bits between the
+// lowest and the highest score in the data. With q-bit scores over the range
+// [min, max], the decoded score is within (max - min) / (2^q - 1) / 2 of the
+// original one. The scores in McBopomofo's data are log10 probabilities that
+// span less than 20, so the error is below 0.04 with 8 bits and 0.00016 with
+// 16 bits.
+//
+// The image is mmapped and used in place, and is laid out as a header,
+// followed by uint32_t blockOffsets[blockCount + 1], the block data, and the
+// pool. Each entry in a block is:
+//
+//   varint shared, varint suffixLength, char suffix[suffixLength],
+//   varint payloadSize, varint unigramCount,
+//   unigramCount x (varint valueOffset, 1- or 2-byte little-endian score)
+//
+// and each value in the pool is a varint length followed by the bytes.
+class CompressedLM : public Formosa::Gramambular2::LanguageModel {
+ public:
+  CompressedLM() = default;
+  CompressedLM(const CompressedLM&) = delete;
+  CompressedLM(CompressedLM&&) = delete;
+  CompressedLM& operator=(const CompressedLM&) = delete;
+  CompressedLM& operator=(CompressedLM&&) = delete;
+
+  enum class ScoreBits {
+    BITS_8 = 8,
+    BITS_16 = 16,
+  };
+
+  struct CompileOptions {
+    ScoreBits scoreBits = ScoreBits::BITS_16;
+    size_t keysPerBlock = 16;
+  };
+
+  // Compiles the rows of a sorted DB in the format that ParselessLM reads.
+  // Rows without a value column are skipped since ParselessLM never returns
+  // them.
+  static std::string Compile(const ParselessPhraseDB& db,
+                             const CompileOptions& options);
+
+  // Compiles a sorted data file, such as data.txt, into an image file.
+  static bool CompileFile(const char* sortedDataPath, const char* outputPath,
+                          const CompileOptions& options);
+
+  bool isLoaded() const;
+  bool open(const char* path);
+
+  // Opens an in-memory image, such as the output of Compile(). The image is
+  // copied.
+  bool open(std::string_view image);
+  void close();
+
+  std::vector<Formosa::Gramambular2::LanguageModel::Unigram> getUnigrams(
+      const std::string& key) override;
+  bool hasUnigrams(const std::string& key) override;
+
+  // Returns the largest possible difference between a decoded score and the
+  // original score.
+  double maxScoreError() const { return scoreStep_ / 2; }
+
+  // Returns the size of the loaded image in bytes.
+  size_t imageSize() const { return imageSize_; }
+
+ private:
+  struct Header;
+
+  bool load(const char* data, size_t length);
+
+  // Finds the payload of the key. Returns false if the key is not found.
+  bool findPayload(std::string_view key, const char*& payload,
+                   const char*& payloadEnd) const;
+
+  MemoryMappedFile mmapedFile_;
+  // Holds in-memory images. uint64_t keeps the sections aligned.
+  std::vector<uint64_t> ownedImage_;
+
+  size_t imageSize_ = 0;
+  uint32_t scoreBytes_ = 0;
+  uint32_t blockCount_ = 0;
+  uint32_t dataSize_ = 0;
+  uint32_t poolSize_ = 0;
+  double minScore_ = 0;
+  double scoreStep_ = 0;
+  const uint32_t* blockOffsets_ = nullptr;
+  const char* data_ = nullptr;
+  const char* pool_ = nullptr;
+};
+
+}  // namespace McBopomofo
+
+#endif  // SRC_ENGINE_COMPRESSEDLM_H_
@@ -0,0 +1,222 @@
+// Copyright (c) 2026 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include "CompressedLM.h"
+
+#include <cmath>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ParselessLM.h"
+#include "gtest/gtest.h"
+
+namespace McBopomofo {
+
+using Unigram = Formosa::Gramambular2::LanguageModel::Unigram;
+
+namespace {
+
+constexpr char kSample[] = R"(# format org.openvanilla.mcbopomofo.sorted
+_punctuation_list ， 0
+ㄅㄚ 八 -3.27631260
+ㄅㄚ 吧 -3.59800309
+ㄅㄚ 巴 -3.80233706
+ㄅㄚ-ㄅㄞˇ 八百 -4.67026409
+ㄅㄚ-ㄅㄞˇ 捌佰 -7.26686119
+ㄅㄚˇ 把 -3.80788383
+ㄅㄚˊ 拔 -4.50054123
+ㄅㄚˋ 爸 -3.93785893
+ㄅㄚ˙ 吧 -3.59800309
+ㄆㄚ 趴
+ㄇㄚ
+)";
+
+// Expects the same values in the same order, with the scores within the
+// error bound of the LM.
+void ExpectSameUnigrams(const CompressedLM& lm, const std::vector<Unigram>& a,
+                        const std::vector<Unigram>& b) {
+  ASSERT_EQ(a.size(), b.size());
+  for (size_t i = 0; i < a.size(); ++i) {
+    EXPECT_EQ(a[i].value(), b[i].value());
+    EXPECT_LE(std::abs(a[i].score() - b[i].score()), lm.maxScoreError());
+  }
+}
+
+CompressedLM::CompileOptions Options(CompressedLM::ScoreBits scoreBits,
+                                     size_t keysPerBlock) {
+  CompressedLM::CompileOptions options;
+  options.scoreBits = scoreBits;
+  options.keysPerBlock = keysPerBlock;
+  return options;
+}
+
+}  // namespace
+
+TEST(CompressedLMTest, UnopenedInstanceReturnsNothing) {
+  CompressedLM lm;
+  EXPECT_FALSE(lm.isLoaded());
+  EXPECT_FALSE(lm.hasUnigrams("ㄅㄚ"));
+  EXPECT_TRUE(lm.getUnigrams("ㄅㄚ").empty());
+}
+
+TEST(CompressedLMTest, MatchesParselessLM) {
+  ParselessPhraseDB db(kSample, sizeof(kSample) - 1, /*validate_pragma=*/true);
+  ParselessLM reference;
+  ASSERT_TRUE(reference.open(std::make_unique<ParselessPhraseDB>(
+      kSample, sizeof(kSample) - 1, /*validate_pragma=*/true)));
+
+  // Blocks of one key store every key in full, and blocks of three split the
+  // keys that share the "ㄅㄚ" prefix.
+  for (auto scoreBits :
+       {CompressedLM::ScoreBits::BITS_8, CompressedLM::ScoreBits::BITS_16}) {
+    for (size_t keysPerBlock : {1, 3, 16}) {
+      SCOPED_TRACE(static_cast<int>(scoreBits));
+      SCOPED_TRACE(keysPerBlock);
+      CompressedLM lm;
+      ASSERT_TRUE(
+          lm.open(CompressedLM::Compile(db, Options(scoreBits, keysPerBlock))));
+      EXPECT_TRUE(lm.isLoaded());
+
+      for (const char* key :
+           {"ㄅㄚ", "ㄅㄚ-ㄅㄞˇ", "ㄅㄚ˙", "ㄅㄚˇ", "ㄅㄚˊ", "ㄅㄚˋ", "ㄆㄚ",
+            "ㄇㄚ", "_punctuation_list", "ㄅ", "ㄅㄚ-", "ㄅㄚㄅ", "", "#",
+            "ㄈㄚ", "ㄅㄚ-ㄅㄞˇ-", "_punctuation_lis", "~"}) {
+        SCOPED_TRACE(key);
+        EXPECT_EQ(lm.hasUnigrams(key), reference.hasUnigrams(key));
+        ExpectSameUnigrams(lm, lm.getUnigrams(key), reference.getUnigrams(key));
+      }
+    }
+  }
+}
+
+TEST(CompressedLMTest, ScoreErrorBound) {
+  ParselessPhraseDB db(kSample, sizeof(kSample) - 1, /*validate_pragma=*/true);
+  CompressedLM lm8;
+  ASSERT_TRUE(lm8.open(CompressedLM::Compile(
+      db, Options(CompressedLM::ScoreBits::BITS_8, 16))));
+  CompressedLM lm16;
+  ASSERT_TRUE(lm16.open(CompressedLM::Compile(
+      db, Options(CompressedLM::ScoreBits::BITS_16, 16))));
+
+  // The scores span [-7.26686119, 0].
+  EXPECT_DOUBLE_EQ(lm8.maxScoreError(), 7.26686119 / 255 / 2);
+  EXPECT_DOUBLE_EQ(lm16.maxScoreError(), 7.26686119 / 65535 / 2);
+
+  // The ends of the range are exact.
+  EXPECT_EQ(lm8.getUnigrams("_punctuation_list")[0].score(), 0);
+  EXPECT_DOUBLE_EQ(lm8.getUnigrams("ㄅㄚ-ㄅㄞˇ")[1].score(), -7.26686119);
+}
+
+TEST(CompressedLMTest, SingleScore) {
+  constexpr char data[] = "ㄅㄚ 八 -3.5\nㄅㄚ 吧 -3.5\n";
+  ParselessPhraseDB db(data, sizeof(data) - 1);
+  CompressedLM lm;
+  ASSERT_TRUE(lm.open(CompressedLM::Compile(db, {})));
+  EXPECT_EQ(lm.maxScoreError(), 0);
+  std::vector<Unigram> unigrams = lm.getUnigrams("ㄅㄚ");
+  ASSERT_EQ(unigrams.size(), 2);
+  EXPECT_EQ(unigrams[0].score(), -3.5);
+  EXPECT_EQ(unigrams[1].score(), -3.5);
+}
+
+TEST(CompressedLMTest, DeduplicatesValues) {
+  ParselessPhraseDB db(kSample, sizeof(kSample) - 1, /*validate_pragma=*/true);
+  std::string image = CompressedLM::Compile(db, {});
+  // "吧" is used by two keys but stored once.
+  size_t count = 0;
+  for (size_t pos = image.find("吧"); pos != std::string::npos;
+       pos = image.find("吧", pos + 1)) {
+    ++count;
+  }
+  EXPECT_EQ(count, 1);
+}
+
+TEST(CompressedLMTest, RejectsInvalidImages) {
+  ParselessPhraseDB db(kSample, sizeof(kSample) - 1, /*validate_pragma=*/true);
+  std::string image = CompressedLM::Compile(db, {});
+
+  CompressedLM lm;
+  EXPECT_FALSE(lm.open(std::string_view()));
+  EXPECT_FALSE(lm.open(std::string_view(image).substr(0, image.size() - 1)));
+  std::string badMagic = image;
+  badMagic[0] = 'X';
+  EXPECT_FALSE(lm.open(badMagic));
+  EXPECT_FALSE(lm.isLoaded());
+
+  EXPECT_TRUE(lm.open(image));
+  EXPECT_FALSE(lm.open(image));
+  lm.close();
+  EXPECT_FALSE(lm.isLoaded());
+  EXPECT_TRUE(lm.open(image));
+}
+
+TEST(CompressedLMTest, EmptyDB) {
+  std::string data = "";
+  ParselessPhraseDB db(data.c_str(), 1);
+  CompressedLM lm;
+  ASSERT_TRUE(lm.open(CompressedLM::Compile(db, {})));
+  EXPECT_FALSE(lm.hasUnigrams("ㄅㄚ"));
+  EXPECT_FALSE(lm.hasUnigrams(""));
+}
+
+TEST(CompressedLMTest, CompileFileAndOpen) {
+  constexpr const char* data_path = "data.txt";
+  if (!std::filesystem::exists(data_path)) {
+    GTEST_SKIP();
+  }
+
+  std::filesystem::path image_path =
+      std::filesystem::temp_directory_path() /
+      "org.openvanilla.mcbopomofo.CompressedLMTest.fclm";
+  ASSERT_TRUE(CompressedLM::CompileFile(
+      data_path, image_path.c_str(),
+      Options(CompressedLM::ScoreBits::BITS_8, 16)));
+
+  CompressedLM lm;
+  ASSERT_TRUE(lm.open(image_path.c_str()));
+  ParselessLM reference;
+  ASSERT_TRUE(reference.open(data_path));
+  EXPECT_LT(lm.imageSize(), std::filesystem::file_size(data_path));
+
+  MemoryMappedFile file;
+  ASSERT_TRUE(file.open(data_path));
+  ParselessPhraseDB db(file.data(), file.length(), /*validate_pragma=*/true);
+  std::string key;
+  for (std::string_view row : db.rows("")) {
+    std::string_view rowKey = ParselessPhraseDB::DecodeRow(row).key;
+    if (rowKey == key) {
+      continue;
+    }
+    key = rowKey;
+    ASSERT_EQ(lm.hasUnigrams(key), reference.hasUnigrams(key)) << key;
+    ExpectSameUnigrams(lm, lm.getUnigrams(key), reference.getUnigrams(key));
+  }
+
+  lm.close();
+  std::filesystem::remove(image_path);
+}
+
+}  // namespace McBopomofo
@@ -0,0 +1,119 @@
+// Copyright (c) 2026 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include "KeyFilter.h"
+
+#include <algorithm>
+#include <functional>
+#include <string_view>
+
+namespace McBopomofo {
+
+namespace {
+
+// The number of bits set per key. Six is close to the best for 10 bits per
+// key with 512-bit blocks.
+constexpr int kProbes = 6;
+
+// Mixes the bits of the hash (the splitmix64 finalizer) so that the probes do
+// not depend on the bits that pick the block.
+uint64_t Mix(uint64_t x) {
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+  return x ^ (x >> 31);
+}
+
+}  // namespace
+
+void KeyFilter::reset(size_t keyCount) {
+  size_t bits = std::max<size_t>(keyCount, 1) * kBitsPerKey;
+  size_t blockBits = sizeof(Block) * 8;
+  blocks_.assign((bits + blockBits - 1) / blockBits, Block{});
+  resetStats();
+}
+
+void KeyFilter::add(std::string_view key) {
+  if (blocks_.empty()) {
+    return;
+  }
+  uint64_t hash = std::hash<std::string_view>()(key);
+  Block& block = blocks_[blockIndex(hash)];
+  uint64_t probes = Mix(hash);
+  for (int i = 0; i < kProbes; ++i) {
+    size_t bit = (probes >> (i * 9)) & 511;
+    block.words[bit / 64] |= uint64_t{1} << (bit % 64);
+  }
+}
+
+void KeyFilter::clear() {
+  blocks_.clear();
+  blocks_.shrink_to_fit();
+  resetStats();
+}
+
+bool KeyFilter::mayContain(std::string_view key) const {
+  if (blocks_.empty()) {
+    return true;
+  }
+  Increment(lookups_);
+  uint64_t hash = std::hash<std::string_view>()(key);
+  const Block& block = blocks_[blockIndex(hash)];
+  uint64_t probes = Mix(hash);
+  for (int i = 0; i < kProbes; ++i) {
+    size_t bit = (probes >> (i * 9)) & 511;
+    if ((block.words[bit / 64] & (uint64_t{1} << (bit % 64))) == 0) {
+      Increment(lookupsSaved_);
+      return false;
+    }
+  }
+  return true;
+}
+
+void KeyFilter::recordFalsePositive() const {
+  if (!blocks_.empty()) {
+    Increment(falsePositives_);
+  }
+}
+
+KeyFilter::Stats& KeyFilter::Stats::operator+=(const Stats& other) {
+  lookups += other.lookups;
+  lookupsSaved += other.lookupsSaved;
+  falsePositives += other.falsePositives;
+  return *this;
+}
+
+KeyFilter::Stats KeyFilter::stats() const {
+  Stats stats;
+  stats.lookups = lookups_.load(std::memory_order_relaxed);
+  stats.lookupsSaved = lookupsSaved_.load(std::memory_order_relaxed);
+  stats.falsePositives = falsePositives_.load(std::memory_order_relaxed);
+  return stats;
+}
+
+void KeyFilter::resetStats() {
+  lookups_.store(0, std::memory_order_relaxed);
+  lookupsSaved_.store(0, std::memory_order_relaxed);
+  falsePositives_.store(0, std::memory_order_relaxed);
+}
+
+}  // namespace McBopomofo
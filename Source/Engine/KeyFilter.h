@@ -0,0 +1,121 @@
+// Copyright (c) 2026 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef SRC_ENGINE_KEYFILTER_H_
+#define SRC_ENGINE_KEYFILTER_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace McBopomofo {
+
+// A blocked Bloom filter over the keys of a dictionary, used to answer most
+// lookups of missing keys without touching the dictionary. All the bits of a
+// key are in the same 64-byte block, so a check costs one hash and one cache
+// line. With 10 bits per key, about 1% of the missing keys pass the filter;
+// keys that were added always pass.
+//
+// A filter that has not been built lets every key pass, so owners can check
+// it unconditionally. The filter also counts its lookups. Since it cannot
+// tell on its own whether a passing key really exists, the owner reports the
+// false positives with recordFalsePositive(). The counters use relaxed atomic
+// loads and stores, so they are cheap and safe to update from concurrent
+// lookups, but may then miss a few counts.
+class KeyFilter {
+ public:
+  static constexpr size_t kBitsPerKey = 10;
+
+  KeyFilter() = default;
+  KeyFilter(const KeyFilter&) = delete;
+  KeyFilter(KeyFilter&&) = delete;
+  KeyFilter& operator=(const KeyFilter&) = delete;
+  KeyFilter& operator=(KeyFilter&&) = delete;
+
+  // Sizes an empty filter for the number of keys, which should not count
+  // duplicates more than a few times. Resets the stats.
+  void reset(size_t keyCount);
+
+  // Adds a key. reset() must be called first.
+  void add(std::string_view key);
+
+  // Makes the filter let every key pass again and frees its memory.
+  void clear();
+
+  bool isBuilt() const { return !blocks_.empty(); }
+
+  // Returns false if the key was definitely not added.
+  bool mayContain(std::string_view key) const;
+
+  // Records that a key that passed the filter was not found.
+  void recordFalsePositive() const;
+
+  struct Stats {
+    // The number of lookups checked against the filter.
+    size_t lookups = 0;
+    // The lookups that the filter rejected, each of which saved a dictionary
+    // lookup.
+    size_t lookupsSaved = 0;
+    size_t falsePositives = 0;
+
+    // The share of the missing keys that passed the filter.
+    double falsePositiveRate() const {
+      size_t misses = lookupsSaved + falsePositives;
+      return misses == 0 ? 0 : static_cast<double>(falsePositives) / misses;
+    }
+
+    Stats& operator+=(const Stats& other);
+  };
+
+  Stats stats() const;
+  void resetStats();
+
+  // Returns the memory used by the filter in bytes.
+  size_t sizeInBytes() const { return blocks_.size() * sizeof(Block); }
+
+ private:
+  struct alignas(64) Block {
+    uint64_t words[8];
+  };
+
+  // Maps the high half of the hash to a block without a division.
+  size_t blockIndex(uint64_t hash) const {
+    return static_cast<size_t>(((hash >> 32) * blocks_.size()) >> 32);
+  }
+
+  static void Increment(std::atomic<size_t>& counter) {
+    counter.store(counter.load(std::memory_order_relaxed) + 1,
+                  std::memory_order_relaxed);
+  }
+
+  std::vector<Block> blocks_;
+  mutable std::atomic<size_t> lookups_ = 0;
+  mutable std::atomic<size_t> lookupsSaved_ = 0;
+  mutable std::atomic<size_t> falsePositives_ = 0;
+};
+
+}  // namespace McBopomofo
+
+#endif  // SRC_ENGINE_KEYFILTER_H_
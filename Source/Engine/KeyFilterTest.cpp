@@ -0,0 +1,125 @@
+// Copyright (c) 2026 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include "KeyFilter.h"
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace McBopomofo {
+
+namespace {
+
+std::vector<std::string> MakeKeys(const std::string& prefix, size_t count) {
+  std::vector<std::string> keys;
+  for (size_t i = 0; i < count; ++i) {
+    keys.push_back(prefix + std::to_string(i));
+  }
+  return keys;
+}
+
+}  // namespace
+
+TEST(KeyFilterTest, UnbuiltFilterLetsEveryKeyPass) {
+  KeyFilter filter;
+  EXPECT_FALSE(filter.isBuilt());
+  EXPECT_TRUE(filter.mayContain("ㄅㄚ"));
+  EXPECT_TRUE(filter.mayContain(""));
+  filter.recordFalsePositive();
+  EXPECT_EQ(filter.stats().lookups, 0);
+  EXPECT_EQ(filter.stats().falsePositives, 0);
+  EXPECT_EQ(filter.sizeInBytes(), 0);
+}
+
+TEST(KeyFilterTest, AddedKeysAlwaysPass) {
+  std::vector<std::string> keys = MakeKeys("ㄅㄚ-", 10000);
+  KeyFilter filter;
+  filter.reset(keys.size());
+  for (const auto& key : keys) {
+    filter.add(key);
+  }
+  EXPECT_TRUE(filter.isBuilt());
+  for (const auto& key : keys) {
+    EXPECT_TRUE(filter.mayContain(key)) << key;
+  }
+  EXPECT_EQ(filter.stats().lookups, keys.size());
+  EXPECT_EQ(filter.stats().lookupsSaved, 0);
+}
+
+TEST(KeyFilterTest, FalsePositiveRate) {
+  std::vector<std::string> keys = MakeKeys("ㄅㄚ-", 10000);
+  KeyFilter filter;
+  filter.reset(keys.size());
+  for (const auto& key : keys) {
+    filter.add(key);
+  }
+  EXPECT_LE(filter.sizeInBytes(),
+            keys.size() * KeyFilter::kBitsPerKey / 8 + 64);
+
+  for (const auto& key : MakeKeys("ㄆㄚ-", 100000)) {
+    if (filter.mayContain(key)) {
+      filter.recordFalsePositive();
+    }
+  }
+  KeyFilter::Stats stats = filter.stats();
+  EXPECT_EQ(stats.lookups, 100000);
+  EXPECT_EQ(stats.lookupsSaved + stats.falsePositives, 100000);
+  EXPECT_LT(stats.falsePositiveRate(), 0.03);
+}
+
+TEST(KeyFilterTest, ResetAndClear) {
+  KeyFilter filter;
+  filter.reset(0);
+  EXPECT_TRUE(filter.isBuilt());
+  EXPECT_FALSE(filter.mayContain("ㄅㄚ"));
+  EXPECT_EQ(filter.stats().lookupsSaved, 1);
+
+  filter.add("ㄅㄚ");
+  EXPECT_TRUE(filter.mayContain("ㄅㄚ"));
+  filter.resetStats();
+  EXPECT_EQ(filter.stats().lookups, 0);
+
+  filter.clear();
+  EXPECT_FALSE(filter.isBuilt());
+  EXPECT_TRUE(filter.mayContain("ㄆㄚ"));
+}
+
+TEST(KeyFilterTest, StatsAddUp) {
+  KeyFilter::Stats a;
+  a.lookups = 10;
+  a.lookupsSaved = 6;
+  a.falsePositives = 2;
+  KeyFilter::Stats b;
+  b.lookups = 5;
+  b.lookupsSaved = 2;
+  a += b;
+  EXPECT_EQ(a.lookups, 15);
+  EXPECT_EQ(a.lookupsSaved, 8);
+  EXPECT_EQ(a.falsePositives, 2);
+  EXPECT_DOUBLE_EQ(a.falsePositiveRate(), 0.2);
+  EXPECT_EQ(KeyFilter::Stats().falsePositiveRate(), 0);
+}
+
+}  // namespace McBopomofo
@@ -0,0 +1,292 @@
+// Copyright (c) 2026 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include <benchmark/benchmark.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <cassert>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "CompressedLM.h"
+#include "ParselessLM.h"
+#include "TrieLM.h"
+
+namespace {
+
+using McBopomofo::CompressedLM;
+using McBopomofo::ParselessLM;
+using McBopomofo::TrieLM;
+
+static const char* kDataPath = "data.txt";
+static constexpr size_t kLookupsPerOpen = 1000;
+
+// Shuffled with a fixed seed so that every run probes the same cold rows.
+std::vector<std::string> LoadShuffledKeys() {
+  std::ifstream input(kDataPath);
+  assert(input.is_open());
+
+  std::vector<std::string> keys;
+  std::string line;
+  std::getline(input, line);
+  while (std::getline(input, line)) {
+    const size_t separator = line.find(' ');
+    if (separator != std::string::npos) {
+      keys.emplace_back(line.substr(0, separator));
+    }
+  }
+  assert(!keys.empty());
+  std::shuffle(keys.begin(), keys.end(),
+               std::mt19937(std::mt19937::default_seed));
+  return keys;
+}
+
+std::string CompiledPath(const char* name) {
+  return (std::filesystem::temp_directory_path() /
+          (std::string("org.openvanilla.mcbopomofo.LanguageModelBenchmark.") +
+           name))
+      .string();
+}
+
+// Compiles data.txt once per process.
+const std::string& TriePath() {
+  static const std::string path = [] {
+    std::string p = CompiledPath("trie");
+    bool compiled = TrieLM::CompileFile(kDataPath, p.c_str());
+    assert(compiled);
+    (void)compiled;
+    return p;
+  }();
+  return path;
+}
+
+const std::string& CompressedPath(CompressedLM::ScoreBits scoreBits) {
+  static const auto compile = [](CompressedLM::ScoreBits bits,
+                                 const char* name) {
+    std::string p = CompiledPath(name);
+    CompressedLM::CompileOptions options;
+    options.scoreBits = bits;
+    bool compiled = CompressedLM::CompileFile(kDataPath, p.c_str(), options);
+    assert(compiled);
+    (void)compiled;
+    return p;
+  };
+  static const std::string path8 =
+      compile(CompressedLM::ScoreBits::BITS_8, "fclm8");
+  static const std::string path16 =
+      compile(CompressedLM::ScoreBits::BITS_16, "fclm16");
+  return scoreBits == CompressedLM::ScoreBits::BITS_8 ? path8 : path16;
+}
+
+long MinorPageFaults() {
+  struct rusage usage {};
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_minflt;
+}
+
+// The backends: the text with binary search, the text with the line index,
+// the compiled trie, and the block-compressed image with 16- and 8-bit scores.
+enum Backend {
+  TEXT = 0,
+  TEXT_WITH_LINE_INDEX = 1,
+  TRIE = 2,
+  COMPRESSED_16 = 3,
+  COMPRESSED_8 = 4
+};
+
+void BackendArguments(benchmark::internal::Benchmark* b) {
+  for (int i = TEXT; i <= COMPRESSED_8; ++i) {
+    b->Arg(i);
+  }
+}
+
+// Opens the LM of the benchmark's backend.
+class BackendLM {
+ public:
+  explicit BackendLM(benchmark::State& state)
+      : backend_(static_cast<Backend>(state.range(0))) {
+    static const char* kLabels[] = {"text", "text + line index", "trie",
+                                    "compressed, 16-bit scores",
+                                    "compressed, 8-bit scores"};
+    state.SetLabel(kLabels[backend_]);
+  }
+
+  void open() {
+    if (backend_ == TRIE) {
+      trie_.open(TriePath().c_str());
+    } else if (isCompressed()) {
+      compressed_.open(path().c_str());
+    } else {
+      ParselessLM::OpenOptions options;
+      options.buildLineIndex = backend_ == TEXT_WITH_LINE_INDEX;
+      text_.open(kDataPath, options);
+    }
+  }
+
+  void close() {
+    trie_.close();
+    compressed_.close();
+    text_.close();
+  }
+
+  Formosa::Gramambular2::LanguageModel& lm() {
+    if (backend_ == TRIE) {
+      return trie_;
+    }
+    if (isCompressed()) {
+      return compressed_;
+    }
+    return text_;
+  }
+
+  size_t fileSize() const { return std::filesystem::file_size(path()); }
+
+ private:
+  bool isCompressed() const {
+    return backend_ == COMPRESSED_16 || backend_ == COMPRESSED_8;
+  }
+
+  std::string path() const {
+    switch (backend_) {
+      case TRIE:
+        return TriePath();
+      case COMPRESSED_16:
+        return CompressedPath(CompressedLM::ScoreBits::BITS_16);
+      case COMPRESSED_8:
+        return CompressedPath(CompressedLM::ScoreBits::BITS_8);
+      default:
+        return kDataPath;
+    }
+  }
+
+  Backend backend_;
+  ParselessLM text_;
+  TrieLM trie_;
+  CompressedLM compressed_;
+};
+
+static void BM_TrieLMCompile(benchmark::State& state) {
+  assert(std::filesystem::exists(kDataPath));
+  McBopomofo::MemoryMappedFile file;
+  file.open(kDataPath);
+  auto db = McBopomofo::ParselessPhraseDB::CreateValidatedDB(file.data(),
+                                                             file.length());
+  size_t imageSize = 0;
+  for (auto _ : state) {
+    imageSize = TrieLM::Compile(*db).size();
+  }
+  state.counters["image_bytes"] = static_cast<double>(imageSize);
+  state.counters["text_bytes"] = static_cast<double>(file.length());
+}
+BENCHMARK(BM_TrieLMCompile)->Unit(benchmark::kMillisecond);
+
+static void BM_CompressedLMCompile(benchmark::State& state) {
+  assert(std::filesystem::exists(kDataPath));
+  McBopomofo::MemoryMappedFile file;
+  file.open(kDataPath);
+  auto db = McBopomofo::ParselessPhraseDB::CreateValidatedDB(file.data(),
+                                                             file.length());
+  CompressedLM::CompileOptions options;
+  options.scoreBits = static_cast<CompressedLM::ScoreBits>(state.range(0));
+  std::string image;
+  for (auto _ : state) {
+    image = CompressedLM::Compile(*db, options);
+  }
+  CompressedLM lm;
+  lm.open(image);
+  state.counters["image_bytes"] = static_cast<double>(image.size());
+  state.counters["text_bytes"] = static_cast<double>(file.length());
+  state.counters["max_score_error"] = lm.maxScoreError();
+}
+BENCHMARK(BM_CompressedLMCompile)
+    ->Arg(16)
+    ->Arg(8)
+    ->Unit(benchmark::kMillisecond);
+
+static void BM_LanguageModelGetUnigrams(benchmark::State& state) {
+  assert(std::filesystem::exists(kDataPath));
+  BackendLM backend(state);
+  backend.open();
+  const std::vector<std::string> keys = LoadShuffledKeys();
+  auto key = keys.begin();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(backend.lm().getUnigrams(*key));
+    if (++key == keys.end()) {
+      key = keys.begin();
+    }
+  }
+  state.counters["file_bytes"] = static_cast<double>(backend.fileSize());
+  backend.close();
+}
+BENCHMARK(BM_LanguageModelGetUnigrams)->Apply(BackendArguments);
+
+static void BM_LanguageModelHasUnigrams(benchmark::State& state) {
+  assert(std::filesystem::exists(kDataPath));
+  BackendLM backend(state);
+  backend.open();
+  const std::vector<std::string> keys = LoadShuffledKeys();
+  auto key = keys.begin();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(backend.lm().hasUnigrams(*key));
+    if (++key == keys.end()) {
+      key = keys.begin();
+    }
+  }
+  backend.close();
+}
+BENCHMARK(BM_LanguageModelHasUnigrams)->Apply(BackendArguments);
+
+// Opens the LM, does a batch of cold lookups, and closes it again, counting
+// the pages that each round touches. The file stays in the page cache, so
+// these are minor faults; they approximate the resident memory that a fresh
+// process needs for the same lookups.
+static void BM_LanguageModelOpenAndLookUp(benchmark::State& state) {
+  assert(std::filesystem::exists(kDataPath));
+  BackendLM backend(state);
+  const std::vector<std::string> keys = LoadShuffledKeys();
+  long faults = 0;
+  for (auto _ : state) {
+    long before = MinorPageFaults();
+    backend.open();
+    for (size_t i = 0; i < kLookupsPerOpen; ++i) {
+      benchmark::DoNotOptimize(
+          backend.lm().getUnigrams(keys[i % keys.size()]));
+    }
+    backend.close();
+    faults += MinorPageFaults() - before;
+  }
+  state.counters["page_faults"] =
+      benchmark::Counter(static_cast<double>(faults),
+                         benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_LanguageModelOpenAndLookUp)
+    ->Apply(BackendArguments)
+    ->Unit(benchmark::kMicrosecond);
+
+}  // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,46 @@
+// Copyright (c) 2026 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include "LayeredPhraseDB.h"
+
+#include <algorithm>
+
+namespace McBopomofo {
+
+bool LayeredPhraseDB::addLayer(const ParselessPhraseDB* db, int priority,
+                               double scoreOffset) {
+  if (db == nullptr || layers_.size() >= kMaxLayers) {
+    return false;
+  }
+
+  // Insert after all the layers with the same or a higher priority.
+  auto it = std::find_if(
+      layers_.begin(), layers_.end(),
+      [priority](const Layer& layer) { return layer.priority < priority; });
+  layers_.insert(it, Layer{db, priority, scoreOffset});
+  return true;
+}
+
+void LayeredPhraseDB::clear() { layers_.clear(); }
+
+}  // namespace McBopomofo
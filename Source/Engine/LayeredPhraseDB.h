@@ -0,0 +1,76 @@
+// Copyright (c) 2026 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef SRC_ENGINE_LAYEREDPHRASEDB_H_
+#define SRC_ENGINE_LAYEREDPHRASEDB_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "ParselessPhraseDB.h"
+
+namespace McBopomofo {
+
+// The layers of sorted ParselessPhraseDB blocks that are merged at query time,
+// so that supplementary dictionaries can be shipped as separate files instead
+// of being compiled into the primary one. The layers are kept in priority
+// order, which is the order that their rows are returned in for the same key.
+class LayeredPhraseDB {
+ public:
+  // The maximum number of layers.
+  static constexpr size_t kMaxLayers = 8;
+
+  LayeredPhraseDB() = default;
+  LayeredPhraseDB(const LayeredPhraseDB&) = delete;
+  LayeredPhraseDB(LayeredPhraseDB&&) = delete;
+  LayeredPhraseDB& operator=(const LayeredPhraseDB&) = delete;
+  LayeredPhraseDB& operator=(LayeredPhraseDB&&) = delete;
+
+  // Adds a layer. The DB is not owned and must outlive this object. Layers
+  // with a higher priority come first, and layers with the same priority keep
+  // the order they were added in. The score offset is meant to be added to
+  // the scores of the layer's rows.
+  // Returns false if db is nullptr or if there are already kMaxLayers layers.
+  bool addLayer(const ParselessPhraseDB* db, int priority = 0,
+                double scoreOffset = 0);
+
+  void clear();
+
+  size_t layerCount() const { return layers_.size(); }
+
+  struct Layer {
+    const ParselessPhraseDB* db = nullptr;
+    int priority = 0;
+    double scoreOffset = 0;
+  };
+
+  // The layers, in priority order.
+  const std::vector<Layer>& layers() const { return layers_; }
+
+ private:
+  std::vector<Layer> layers_;
+};
+
+}  // namespace McBopomofo
+
+#endif  // SRC_ENGINE_LAYEREDPHRASEDB_H_
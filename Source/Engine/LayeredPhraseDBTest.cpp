@@ -0,0 +1,76 @@
+// Copyright (c) 2026 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include "LayeredPhraseDB.h"
+
+#include <string>
+
+#include "ParselessPhraseDB.h"
+#include "gtest/gtest.h"
+
+namespace McBopomofo {
+
+TEST(LayeredPhraseDBTest, EmptyView) {
+  LayeredPhraseDB layered;
+  EXPECT_EQ(layered.layerCount(), 0);
+  EXPECT_TRUE(layered.layers().empty());
+  EXPECT_FALSE(layered.addLayer(nullptr));
+}
+
+TEST(LayeredPhraseDBTest, HigherPriorityComesFirst) {
+  std::string data = "a 1";
+  ParselessPhraseDB lowDB(data.c_str(), data.length());
+  ParselessPhraseDB middleDB(data.c_str(), data.length());
+  ParselessPhraseDB laterMiddleDB(data.c_str(), data.length());
+  ParselessPhraseDB highDB(data.c_str(), data.length());
+
+  LayeredPhraseDB layered;
+  EXPECT_TRUE(layered.addLayer(&middleDB, 1, -1.5));
+  EXPECT_TRUE(layered.addLayer(&lowDB, -1));
+  EXPECT_TRUE(layered.addLayer(&highDB, 2));
+  EXPECT_TRUE(layered.addLayer(&laterMiddleDB, 1));
+  ASSERT_EQ(layered.layers().size(), 4);
+  EXPECT_EQ(layered.layers()[0].db, &highDB);
+  EXPECT_EQ(layered.layers()[1].db, &middleDB);
+  EXPECT_EQ(layered.layers()[1].priority, 1);
+  EXPECT_EQ(layered.layers()[1].scoreOffset, -1.5);
+  EXPECT_EQ(layered.layers()[2].db, &laterMiddleDB);
+  EXPECT_EQ(layered.layers()[3].db, &lowDB);
+
+  layered.clear();
+  EXPECT_EQ(layered.layerCount(), 0);
+}
+
+TEST(LayeredPhraseDBTest, LayerLimit) {
+  std::string data = "a 1";
+  ParselessPhraseDB db(data.c_str(), data.length());
+
+  LayeredPhraseDB layered;
+  for (size_t i = 0; i < LayeredPhraseDB::kMaxLayers; ++i) {
+    EXPECT_TRUE(layered.addLayer(&db));
+  }
+  EXPECT_FALSE(layered.addLayer(&db));
+  EXPECT_EQ(layered.layerCount(), LayeredPhraseDB::kMaxLayers);
+}
+
+}  // namespace McBopomofo
@@ -24,6 +24,8 @@
 #include "McBopomofoLM.h"
 
 #include <algorithm>
+#include <cstdint>
+#include <cstdio>
 #include <limits>
 #include <memory>
 #include <string>
@@ -38,17 +40,41 @@ namespace McBopomofo {
 static constexpr std::string_view kMacroPrefix = "MACRO@";
 static constexpr double kMacroScore = -8.0;
 
+static const char* OrNull(const std::string& s) {
+  return s.empty() ? nullptr : s.c_str();
+}
+
 void McBopomofoLM::loadLanguageModel(const char* languageModelDataPath) {
   if (languageModelDataPath) {
-    languageModel_.close();
-    languageModel_.open(languageModelDataPath);
+    // Most of the reading grid's lookups are for keys that do not exist.
+    ParselessLM::OpenOptions options;
+    options.buildKeyFilter = true;
+    // Start reading the file in right away so that the first few lookups
+    // after launch do not each wait on storage.
+    options.mapping.advice =
+        MemoryMappedFile::OpenOptions::Advice::WILL_NEED;
+    languageModel_.reopen(languageModelDataPath, options);
   }
 }
 
+bool McBopomofoLM::reloadLanguageModelIfChanged() {
+  return languageModel_.reloadIfChanged();
+}
+
 bool McBopomofoLM::isDataModelLoaded() const {
   return languageModel_.isLoaded();
 }
 
+bool McBopomofoLM::addLanguageModelLayer(const char* path, int priority,
+                                         double scoreOffset) {
+  if (path == nullptr) {
+    return false;
+  }
+  return languageModel_.addLayer(path, priority, scoreOffset);
+}
+
+void McBopomofoLM::closeLanguageModelLayers() { languageModel_.closeLayers(); }
+
 void McBopomofoLM::loadAssociatedPhrasesV2(const char* associatedPhrasesPath) {
   if (associatedPhrasesPath) {
     associatedPhrasesV2_.close();
@@ -58,24 +84,70 @@ void McBopomofoLM::loadAssociatedPhrasesV2(const char* associatedPhrasesPath) {
 
 void McBopomofoLM::loadUserPhrases(const char* userPhrasesDataPath,
                                    const char* excludedPhrasesDataPath) {
-  userPhrases_.close();
-  excludedPhrases_.close();
-
+  // The files are usually reloaded because a phrase was appended to one of
+  // them, in which case only the new lines are parsed.
   if (userPhrasesDataPath) {
     userPhrasesDataPath_ = userPhrasesDataPath;
-    userPhrases_.open(userPhrasesDataPath);
+    std::string snapshotPath = snapshotPathFor(*userPhrasesDataPath_);
+    userPhrases_.reopen(userPhrasesDataPath, OrNull(snapshotPath));
   } else {
+    userPhrases_.close();
     userPhrasesDataPath_.reset();
   }
 
   if (excludedPhrasesDataPath) {
     excludedPhrasesDataPath_ = excludedPhrasesDataPath;
-    excludedPhrases_.open(excludedPhrasesDataPath);
+    std::string snapshotPath = snapshotPathFor(*excludedPhrasesDataPath_);
+    excludedPhrases_.reopen(excludedPhrasesDataPath, OrNull(snapshotPath));
   } else {
+    excludedPhrases_.close();
     excludedPhrasesDataPath_.reset();
   }
 }
 
+bool McBopomofoLM::addUserPhrase(const std::string& reading,
+                                 const std::string& value) {
+  excludedPhrases_.remove(reading, value);
+  return userPhrases_.add(reading, value);
+}
+
+bool McBopomofoLM::excludeUserPhrase(const std::string& reading,
+                                     const std::string& value) {
+  userPhrases_.remove(reading, value);
+  return excludedPhrases_.add(reading, value);
+}
+
+void McBopomofoLM::discardUserPhraseChanges(const std::string& reading,
+                                            const std::string& value) {
+  userPhrases_.discard(reading, value);
+  excludedPhrases_.discard(reading, value);
+}
+
+void McBopomofoLM::setIndexSnapshotFolder(const char* folder) {
+  if (folder != nullptr) {
+    indexSnapshotFolder_ = folder;
+  } else {
+    indexSnapshotFolder_.reset();
+  }
+}
+
+std::string McBopomofoLM::snapshotPathFor(
+    const std::filesystem::path& path) const {
+  if (!indexSnapshotFolder_.has_value()) {
+    return {};
+  }
+  // FNV-1a, which is stable across runs and platforms, unlike std::hash.
+  uint64_t hash = 14695981039346656037ull;
+  for (char c : path.string()) {
+    hash = (hash ^ static_cast<uint8_t>(c)) * 1099511628211ull;
+  }
+  char hex[17];
+  snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(hash));
+  return (*indexSnapshotFolder_ /
+          (path.filename().string() + "." + hex + ".snapshot"))
+      .string();
+}
+
 bool McBopomofoLM::isAssociatedPhrasesV2Loaded() const {
   return associatedPhrasesV2_.isLoaded();
 }
@@ -85,7 +157,8 @@ void McBopomofoLM::loadPhraseReplacementMap(const char* phraseReplacementPath) {
 
   if (phraseReplacementPath) {
     phraseReplacementPath_ = phraseReplacementPath;
-    phraseReplacement_.open(phraseReplacementPath);
+    std::string snapshotPath = snapshotPathFor(*phraseReplacementPath_);
+    phraseReplacement_.open(phraseReplacementPath, OrNull(snapshotPath));
   } else {
     phraseReplacementPath_.reset();
   }
@@ -135,6 +208,14 @@ std::vector<McBopomofoLM::UserFileIssue> McBopomofoLM::getUserFileIssues()
   return issues;
 }
 
+McBopomofoLM::KeyFilterStats McBopomofoLM::getKeyFilterStats() const {
+  KeyFilterStats stats;
+  stats.languageModel = languageModel_.keyFilterStats();
+  stats.userPhrases = userPhrases_.keyFilterStats();
+  stats.excludedPhrases = excludedPhrases_.keyFilterStats();
+  return stats;
+}
+
 std::vector<Formosa::Gramambular2::LanguageModel::Unigram>
 McBopomofoLM::getUnigrams(const std::string& key) {
   if (key == " ") {
@@ -336,9 +417,17 @@ McBopomofoLM::filterAndTransformUnigrams(
 
 void McBopomofoLM::loadLanguageModel(std::unique_ptr<ParselessPhraseDB> db) {
   languageModel_.close();
+  if (db != nullptr) {
+    db->buildKeyFilter();
+  }
   languageModel_.open(std::move(db));
 }
 
+bool McBopomofoLM::addLanguageModelLayer(std::unique_ptr<ParselessPhraseDB> db,
+                                         int priority, double scoreOffset) {
+  return languageModel_.addLayer(std::move(db), priority, scoreOffset);
+}
+
 void McBopomofoLM::loadAssociatedPhrasesV2(
     std::unique_ptr<ParselessPhraseDB> db) {
   associatedPhrasesV2_.close();
@@ -33,6 +33,7 @@
 #include <vector>
 
 #include "AssociatedPhrasesV2.h"
+#include "KeyFilter.h"
 #include "ParselessLM.h"
 #include "PhraseReplacementMap.h"
 #include "UserPhrasesLM.h"
@@ -67,10 +68,25 @@ class McBopomofoLM : public Formosa::Gramambular2::LanguageModel {
   McBopomofoLM& operator=(McBopomofoLM&&) = delete;
 
   // Loads (or reloads, if already loaded) the primary language model data file.
+  // On a reload, the current model stays in use until the new file is ready,
+  // and is kept if the new file cannot be loaded.
   void loadLanguageModel(const char* languageModelDataPath);
 
+  // Reloads the primary language model if its data file has been replaced or
+  // modified since it was loaded, as above. Returns true if it was reloaded.
+  bool reloadLanguageModelIfChanged();
+
   bool isDataModelLoaded() const;
 
+  // Adds a sorted supplementary data file, such as a deployment-specific
+  // dictionary, that is merged with the primary language model at query time.
+  // See ParselessLM::addLayer() for the meaning of the arguments.
+  bool addLanguageModelLayer(const char* path, int priority,
+                             double scoreOffset);
+
+  // Removes all the supplementary data files.
+  void closeLanguageModelLayers();
+
   // Loads (or reloads if already loaded) the associated phrases data file.
   void loadAssociatedPhrasesV2(const char* associatedPhrasesPath);
 
@@ -82,9 +98,35 @@ class McBopomofoLM : public Formosa::Gramambular2::LanguageModel {
   void loadUserPhrases(const char* userPhrasesDataPath,
                        const char* excludedPhrasesDataPath);
 
+  // Adds a user phrase in memory and takes it off the excluded phrases, so
+  // that the next lookup has it without waiting for the files to be written
+  // and reloaded. This mirrors what the owner then writes to the files, which
+  // it may do asynchronously; the in-memory changes are dropped as reloads
+  // show them in the files. Returns false if the phrase is already a user
+  // phrase.
+  bool addUserPhrase(const std::string& reading, const std::string& value);
+
+  // Excludes a phrase in memory and takes it off the user phrases, in the
+  // same way. Returns false if the phrase is already excluded.
+  bool excludeUserPhrase(const std::string& reading, const std::string& value);
+
+  // Drops the in-memory changes to a phrase made by the two methods above,
+  // so that it shows as it does in the loaded files. This is for when the
+  // files could not be updated.
+  void discardUserPhraseChanges(const std::string& reading,
+                                const std::string& value);
+
   // Loads (or reloads if already loaded) the phrase replacement mapping file.
   void loadPhraseReplacementMap(const char* phraseReplacementPath);
 
+  // When a folder is set, the parsed index of each user file is kept in a
+  // snapshot file in that folder, so that the next load of an unchanged file
+  // skips parsing. Snapshots are named after the file name and a hash of the
+  // full path, so files from different folders do not share one. The folder
+  // must exist, and should not be the watched user phrase folder. Passing
+  // nullptr, the default, turns snapshots off.
+  void setIndexSnapshotFolder(const char* folder);
+
   // Returns a list of unigrams for the reading. For example, if the reading is
   // "ㄇㄚ", the return may be [unigram("嗎"), unigram("媽") and so on.
   std::vector<Formosa::Gramambular2::LanguageModel::Unigram> getUnigrams(
@@ -112,6 +154,8 @@ class McBopomofoLM : public Formosa::Gramambular2::LanguageModel {
 
   // Methods to allow loading in-memory data for testing purposes.
   void loadLanguageModel(std::unique_ptr<ParselessPhraseDB> db);
+  bool addLanguageModelLayer(std::unique_ptr<ParselessPhraseDB> db,
+                             int priority, double scoreOffset);
   void loadAssociatedPhrasesV2(std::unique_ptr<ParselessPhraseDB> db);
   void loadUserPhrases(const char* data, size_t length);
   void loadExcludedPhrases(const char* data, size_t length);
@@ -143,7 +187,22 @@ class McBopomofoLM : public Formosa::Gramambular2::LanguageModel {
   // excluded phrases, or phrase replacements), if any.
   std::vector<UserFileIssue> getUserFileIssues() const;
 
+  // The stats of the key filters that let lookups of missing keys skip the
+  // language model (all its layers combined), the user phrases, and the
+  // excluded phrases.
+  struct KeyFilterStats {
+    KeyFilter::Stats languageModel;
+    KeyFilter::Stats userPhrases;
+    KeyFilter::Stats excludedPhrases;
+  };
+
+  KeyFilterStats getKeyFilterStats() const;
+
  protected:
+  // Returns the path of the index snapshot of a user file, or an empty string
+  // if no snapshot folder is set.
+  std::string snapshotPathFor(const std::filesystem::path& path) const;
+
   // Filters and converts the input unigrams and returns a new list of unigrams.
   // Unigrams whose values are found in `excludedValues` are removed, and the
   // kept values will be inserted to the `insertedValues` set.
@@ -165,6 +224,7 @@ class McBopomofoLM : public Formosa::Gramambular2::LanguageModel {
   std::optional<std::filesystem::path> phraseReplacementPath_;
 
   bool phraseReplacementEnabled_ = false;
+  std::optional<std::filesystem::path> indexSnapshotFolder_;
 
   bool externalConverterEnabled_ = false;
   std::function<std::string(const std::string&)> externalConverter_;
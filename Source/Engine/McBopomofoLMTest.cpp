@@ -22,6 +22,9 @@
 // OTHER DEALINGS IN THE SOFTWARE.
 
 #include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
 #include <memory>
 #include <string>
 #include <utility>
@@ -87,6 +90,89 @@ TEST(McBopomofoLMTest, PrimaryLanguageModel) {
   EXPECT_LT(unigrams[0].score(), 0);
 }
 
+TEST(McBopomofoLMTest, ReloadLanguageModelIfChanged) {
+  std::filesystem::path path =
+      std::filesystem::temp_directory_path() /
+      "org.openvanilla.mcbopomofo.McBopomofoLMTest.data.txt";
+  std::filesystem::path newPath = path.string() + ".new";
+  // Replaces the file by a rename, as `make install` in Source/Data does.
+  auto install = [&](const std::string& data) {
+    {
+      std::ofstream out(newPath, std::ios::binary);
+      out << SORTED_PRAGMA_HEADER << data;
+    }
+    std::filesystem::rename(newPath, path);
+  };
+
+  McBopomofoLM lm;
+  EXPECT_FALSE(lm.reloadLanguageModelIfChanged());
+  install("ㄇㄧㄥˊ 名 -3.0\n");
+  lm.loadLanguageModel(path.c_str());
+  ASSERT_TRUE(lm.isDataModelLoaded());
+  EXPECT_FALSE(lm.reloadLanguageModelIfChanged());
+  EXPECT_FALSE(lm.hasUnigrams("ㄘˋ"));
+
+  install("ㄇㄧㄥˊ 名 -3.0\nㄘˋ 刺 -4.0\n");
+  EXPECT_TRUE(lm.reloadLanguageModelIfChanged());
+  EXPECT_TRUE(lm.hasUnigrams("ㄘˋ"));
+  EXPECT_FALSE(lm.reloadLanguageModelIfChanged());
+
+  std::filesystem::remove(path);
+}
+
+TEST(McBopomofoLMTest, LanguageModelLayers) {
+  constexpr char kSupplementData[] = R"(
+# format org.openvanilla.mcbopomofo.sorted
+ㄇㄧㄥˊ 冥 -9.0
+ㄇㄧㄥˊ 明 -1.0
+ㄋㄧㄡˊ-ㄖㄡˋ-ㄇㄧㄢˋ 牛肉麵 -5.0
+)";
+
+  McBopomofoLM lm;
+  lm.loadLanguageModel(std::make_unique<ParselessPhraseDB>(
+      kPrimaryLMData, sizeof(kPrimaryLMData)));
+  EXPECT_FALSE(lm.hasUnigrams("ㄋㄧㄡˊ-ㄖㄡˋ-ㄇㄧㄢˋ"));
+  EXPECT_TRUE(lm.addLanguageModelLayer(
+      std::make_unique<ParselessPhraseDB>(kSupplementData,
+                                          sizeof(kSupplementData)),
+      /*priority=*/1, /*scoreOffset=*/-1.0));
+
+  EXPECT_TRUE(lm.hasUnigrams("ㄋㄧㄡˊ-ㄖㄡˋ-ㄇㄧㄢˋ"));
+
+  // The values from the higher-priority layer come first and win over the
+  // duplicates in the primary model.
+  auto unigrams = lm.getUnigrams("ㄇㄧㄥˊ");
+  ASSERT_EQ(unigrams.size(), 4);
+  EXPECT_EQ(unigrams[0].value(), "冥");
+  EXPECT_EQ(unigrams[0].score(), -10.0);
+  EXPECT_EQ(unigrams[1].value(), "明");
+  EXPECT_EQ(unigrams[1].score(), -2.0);
+  EXPECT_EQ(unigrams[2].value(), "名");
+
+  lm.closeLanguageModelLayers();
+  EXPECT_FALSE(lm.hasUnigrams("ㄋㄧㄡˊ-ㄖㄡˋ-ㄇㄧㄢˋ"));
+  EXPECT_EQ(lm.getUnigrams("ㄇㄧㄥˊ").size(), 3);
+}
+
+TEST(McBopomofoLMTest, KeyFilterStats) {
+  McBopomofoLM lm;
+  lm.loadLanguageModel(std::make_unique<ParselessPhraseDB>(
+      kPrimaryLMData, sizeof(kPrimaryLMData)));
+  lm.loadUserPhrases(kUserPhrasesData, sizeof(kUserPhrasesData));
+  lm.loadExcludedPhrases(kExcludedPhrasesData, sizeof(kExcludedPhrasesData));
+
+  EXPECT_FALSE(lm.hasUnigrams("ㄇㄧㄥˊ-ㄉㄨㄥˋ"));
+  EXPECT_FALSE(lm.hasUnigrams("ㄉㄨㄥˋ-ㄇㄧㄥˊ"));
+  EXPECT_TRUE(lm.hasUnigrams("ㄇㄧㄥˊ"));
+
+  McBopomofoLM::KeyFilterStats stats = lm.getKeyFilterStats();
+  for (const KeyFilter::Stats* layer :
+       {&stats.languageModel, &stats.userPhrases, &stats.excludedPhrases}) {
+    EXPECT_GE(layer->lookups, 2);
+    EXPECT_GE(layer->lookupsSaved + layer->falsePositives, 2);
+  }
+}
+
 TEST(McBopomofoLMTest, AssociatedPhrasesV2) {
   McBopomofoLM lm;
   auto db = std::make_unique<ParselessPhraseDB>(
@@ -114,6 +200,48 @@ TEST(McBopomofoLMTest, UserPhrases) {
   EXPECT_EQ(unigrams[0].value(), "茗");
 }
 
+TEST(McBopomofoLMTest, IndexSnapshotsAreKeptInTheirOwnFolder) {
+  std::filesystem::path root = std::filesystem::temp_directory_path() /
+                               "org.openvanilla.mcbopomofo.McBopomofoLMTest";
+  std::filesystem::path userFolder = root / "user";
+  std::filesystem::path otherUserFolder = root / "other";
+  std::filesystem::path snapshotFolder = root / "snapshots";
+  std::filesystem::remove_all(root);
+  for (const auto& folder : {userFolder, otherUserFolder, snapshotFolder}) {
+    std::filesystem::create_directories(folder);
+  }
+  for (const auto& folder : {userFolder, otherUserFolder}) {
+    std::ofstream out(folder / "data.txt", std::ios::binary);
+    out << kUserPhrasesData;
+  }
+  auto countFiles = [](const std::filesystem::path& folder) {
+    return std::distance(std::filesystem::directory_iterator(folder),
+                         std::filesystem::directory_iterator());
+  };
+
+  McBopomofoLM lm;
+  lm.setIndexSnapshotFolder(snapshotFolder.c_str());
+  lm.loadUserPhrases((userFolder / "data.txt").c_str(), nullptr);
+  EXPECT_EQ(lm.getUnigrams("ㄇㄧㄥˊ")[0].value(), "茗");
+  EXPECT_EQ(countFiles(snapshotFolder), 1);
+  EXPECT_EQ(countFiles(userFolder), 1);
+
+  // A file of the same name in another folder gets its own snapshot.
+  lm.loadUserPhrases((otherUserFolder / "data.txt").c_str(), nullptr);
+  EXPECT_EQ(countFiles(snapshotFolder), 2);
+  EXPECT_EQ(countFiles(otherUserFolder), 1);
+
+  // Without a folder, no snapshots are written.
+  lm.setIndexSnapshotFolder(nullptr);
+  std::filesystem::remove_all(snapshotFolder);
+  std::filesystem::create_directories(snapshotFolder);
+  lm.loadUserPhrases((userFolder / "data.txt").c_str(), nullptr);
+  EXPECT_EQ(countFiles(snapshotFolder), 0);
+  EXPECT_EQ(countFiles(userFolder), 1);
+
+  std::filesystem::remove_all(root);
+}
+
 TEST(McBopomofoLMTest, ExcludedPhrases) {
   McBopomofoLM lm;
   auto db = std::make_unique<ParselessPhraseDB>(kPrimaryLMData,
@@ -128,6 +256,46 @@ TEST(McBopomofoLMTest, ExcludedPhrases) {
   EXPECT_TRUE(unigrams.empty());
 }
 
+TEST(McBopomofoLMTest, AddAndExcludeUserPhrasesInMemory) {
+  McBopomofoLM lm;
+  auto db = std::make_unique<ParselessPhraseDB>(kPrimaryLMData,
+                                                sizeof(kPrimaryLMData));
+  lm.loadLanguageModel(std::move(db));
+  lm.loadUserPhrases(kUserPhrasesData, sizeof(kUserPhrasesData));
+  lm.loadExcludedPhrases(kExcludedPhrasesData, sizeof(kExcludedPhrasesData));
+
+  EXPECT_TRUE(lm.addUserPhrase("ㄇㄧㄥˊ", "冥"));
+  EXPECT_FALSE(lm.addUserPhrase("ㄇㄧㄥˊ", "冥"));
+  auto unigrams = lm.getUnigrams("ㄇㄧㄥˊ");
+  ASSERT_GE(unigrams.size(), 2);
+  EXPECT_EQ(unigrams[0].value(), "茗");
+  EXPECT_EQ(unigrams[1].value(), "冥");
+
+  // Adding an excluded phrase brings it back.
+  EXPECT_TRUE(lm.getUnigrams("ㄉㄨㄥˋ-ㄗㄨㄛˋ").empty());
+  EXPECT_TRUE(lm.addUserPhrase("ㄉㄨㄥˋ-ㄗㄨㄛˋ", "動作"));
+  unigrams = lm.getUnigrams("ㄉㄨㄥˋ-ㄗㄨㄛˋ");
+  ASSERT_FALSE(unigrams.empty());
+  EXPECT_EQ(unigrams[0].value(), "動作");
+
+  // Excluding a user phrase hides it everywhere.
+  EXPECT_TRUE(lm.excludeUserPhrase("ㄇㄧㄥˊ", "茗"));
+  EXPECT_FALSE(lm.excludeUserPhrase("ㄇㄧㄥˊ", "茗"));
+  for (const auto& unigram : lm.getUnigrams("ㄇㄧㄥˊ")) {
+    EXPECT_NE(unigram.value(), "茗");
+  }
+  EXPECT_TRUE(lm.excludeUserPhrase("ㄇㄧㄥˊ", "明"));
+  for (const auto& unigram : lm.getUnigrams("ㄇㄧㄥˊ")) {
+    EXPECT_NE(unigram.value(), "明");
+  }
+
+  // Discarding the changes goes back to what the loaded data has.
+  lm.discardUserPhraseChanges("ㄇㄧㄥˊ", "茗");
+  EXPECT_EQ(lm.getUnigrams("ㄇㄧㄥˊ")[0].value(), "茗");
+  lm.discardUserPhraseChanges("ㄉㄨㄥˋ-ㄗㄨㄛˋ", "動作");
+  EXPECT_TRUE(lm.getUnigrams("ㄉㄨㄥˋ-ㄗㄨㄛˋ").empty());
+}
+
 TEST(McBopomofoLMTest, PhraseReplacementMap) {
   McBopomofoLM lm;
   auto db = std::make_unique<ParselessPhraseDB>(kPrimaryLMData,
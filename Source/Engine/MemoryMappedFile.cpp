@@ -25,30 +25,115 @@
 
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <cstdint>
+#include <cstring>
+#include <string>
 #include <utility>
+#include <vector>
 
 namespace McBopomofo {
 
+static constexpr size_t kHugePageSize = 2 * 1024 * 1024;
+
+static size_t PageSize() {
+  static const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  return pageSize;
+}
+
+// Maps the file at an address aligned to the huge page size: a larger
+// anonymous region is reserved first, and the file is mapped over its aligned
+// part. Returns MAP_FAILED on failure.
+static void* MapAlignedToHugePage(int fd, size_t length, int flags) {
+  size_t reservedLength = length + kHugePageSize;
+  void* reserved = mmap(nullptr, reservedLength, PROT_NONE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (reserved == MAP_FAILED) {
+    return MAP_FAILED;
+  }
+  auto start = reinterpret_cast<uintptr_t>(reserved);
+  uintptr_t aligned = (start + kHugePageSize - 1) & ~(kHugePageSize - 1);
+  void* data = mmap(reinterpret_cast<void*>(aligned), length, PROT_READ,
+                    flags | MAP_FIXED, fd, 0);
+  if (data == MAP_FAILED) {
+    munmap(reserved, reservedLength);
+    return MAP_FAILED;
+  }
+
+  // Give back the parts of the reservation around the mapping.
+  size_t mappedLength = (length + PageSize() - 1) & ~(PageSize() - 1);
+  if (aligned > start) {
+    munmap(reserved, aligned - start);
+  }
+  uintptr_t mappedEnd = aligned + mappedLength;
+  uintptr_t reservedEnd = start + reservedLength;
+  if (reservedEnd > mappedEnd) {
+    munmap(reinterpret_cast<void*>(mappedEnd), reservedEnd - mappedEnd);
+  }
+  return data;
+}
+
+static int AdviceFlag(MemoryMappedFile::OpenOptions::Advice advice) {
+  switch (advice) {
+    case MemoryMappedFile::OpenOptions::Advice::RANDOM:
+      return MADV_RANDOM;
+    case MemoryMappedFile::OpenOptions::Advice::SEQUENTIAL:
+      return MADV_SEQUENTIAL;
+    case MemoryMappedFile::OpenOptions::Advice::WILL_NEED:
+      return MADV_WILLNEED;
+    default:
+      return MADV_NORMAL;
+  }
+}
+
+static MemoryMappedFile::FileIdentity IdentityOf(const struct stat& sb) {
+  MemoryMappedFile::FileIdentity identity;
+  identity.device = static_cast<uint64_t>(sb.st_dev);
+  identity.inode = static_cast<uint64_t>(sb.st_ino);
+  identity.size = static_cast<uint64_t>(sb.st_size);
+#ifdef __APPLE__
+  const struct timespec& mtime = sb.st_mtimespec;
+#else
+  const struct timespec& mtime = sb.st_mtim;
+#endif
+  identity.modificationTimeNanoseconds =
+      static_cast<int64_t>(mtime.tv_sec) * 1000000000 + mtime.tv_nsec;
+  return identity;
+}
+
 MemoryMappedFile::MemoryMappedFile(MemoryMappedFile&& other) noexcept
     : fd_(std::exchange(other.fd_, -1)),
       data_(std::exchange(other.data_, nullptr)),
-      length_(std::exchange(other.length_, 0)) {}
+      length_(std::exchange(other.length_, 0)),
+      locked_(std::exchange(other.locked_, false)),
+      path_(std::exchange(other.path_, std::string())),
+      identity_(std::exchange(other.identity_, FileIdentity())) {}
 
 MemoryMappedFile& MemoryMappedFile::operator=(
     MemoryMappedFile&& other) noexcept {
+  if (this == &other) {
+    return *this;
+  }
   close();
   fd_ = std::exchange(other.fd_, -1);
   data_ = std::exchange(other.data_, nullptr);
   length_ = std::exchange(other.length_, 0);
+  locked_ = std::exchange(other.locked_, false);
+  path_ = std::exchange(other.path_, std::string());
+  identity_ = std::exchange(other.identity_, FileIdentity());
   return *this;
 }
 
 MemoryMappedFile::~MemoryMappedFile() { close(); }
 
 bool MemoryMappedFile::open(const char* path) {
+  return open(path, OpenOptions());
+}
+
+bool MemoryMappedFile::open(const char* path, const OpenOptions& options) {
   if (fd_ != -1) {
     return false;
   }
@@ -67,8 +152,21 @@ bool MemoryMappedFile::open(const char* path) {
 
   length_ = static_cast<size_t>(sb.st_size);
 
+  int flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+  if (options.prefault) {
+    flags |= MAP_POPULATE;
+  }
+#endif
+
   // No need to check if length_ is 0; mmmap fails on empty files.
-  data_ = mmap(nullptr, length_, PROT_READ, MAP_SHARED, fd_, 0);
+  data_ = MAP_FAILED;
+  if (options.hugePages && length_ >= kHugePageSize) {
+    data_ = MapAlignedToHugePage(fd_, length_, flags);
+  }
+  if (data_ == MAP_FAILED) {
+    data_ = mmap(nullptr, length_, PROT_READ, flags, fd_, 0);
+  }
   if (data_ == MAP_FAILED) {
     ::close(fd_);
     fd_ = -1;
@@ -77,9 +175,73 @@ bool MemoryMappedFile::open(const char* path) {
     return false;
   }
 
+  if (options.advice != OpenOptions::Advice::NORMAL) {
+    madvise(data_, length_, AdviceFlag(options.advice));
+  }
+#ifdef MADV_HUGEPAGE
+  if (options.hugePages) {
+    madvise(data_, length_, MADV_HUGEPAGE);
+  }
+#endif
+#ifndef MAP_POPULATE
+  if (options.prefault) {
+    const volatile char* bytes = static_cast<const char*>(data_);
+    for (size_t i = 0; i < length_; i += PageSize()) {
+      (void)bytes[i];
+    }
+  }
+#endif
+  if (options.lock) {
+    locked_ = mlock(data_, length_) == 0;
+  }
+
+  path_ = path;
+  identity_ = IdentityOf(sb);
   return true;
 }
 
+bool MemoryMappedFile::lockRange(size_t offset, size_t length) {
+  if (fd_ == -1 || offset > length_ || length > length_ - offset) {
+    return false;
+  }
+  // mlock() wants a page-aligned start.
+  size_t start = offset & ~(PageSize() - 1);
+  return mlock(static_cast<const char*>(data_) + start,
+               offset + length - start) == 0;
+}
+
+bool MemoryMappedFile::CopyToAlignedWords(std::string_view image,
+                                          std::vector<uint64_t>& words) {
+  words.clear();
+  if (image.empty()) {
+    return false;
+  }
+  words.resize((image.size() + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+  memcpy(words.data(), image.data(), image.size());
+  return true;
+}
+
+uint64_t MemoryMappedFile::MajorPageFaults() {
+  struct rusage usage {};
+#ifdef RUSAGE_THREAD
+  getrusage(RUSAGE_THREAD, &usage);
+#else
+  getrusage(RUSAGE_SELF, &usage);
+#endif
+  return static_cast<uint64_t>(usage.ru_majflt);
+}
+
+bool MemoryMappedFile::hasChanged() const {
+  if (fd_ == -1) {
+    return false;
+  }
+  struct stat sb;
+  if (stat(path_.c_str(), &sb) == -1) {
+    return false;
+  }
+  return IdentityOf(sb) != identity_;
+}
+
 void MemoryMappedFile::close() {
   if (fd_ == -1) {
     return;
@@ -89,6 +251,9 @@ void MemoryMappedFile::close() {
   fd_ = -1;
   length_ = 0;
   data_ = nullptr;
+  locked_ = false;
+  path_.clear();
+  identity_ = FileIdentity();
 }
 
 }  // namespace McBopomofo
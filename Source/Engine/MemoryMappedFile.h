@@ -25,6 +25,10 @@
 #define SRC_ENGINE_MEMORYMAPPEDFILE_H_
 
 #include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
 
 namespace McBopomofo {
 
@@ -32,8 +36,12 @@ namespace McBopomofo {
 //
 // On POSIX systems, we obtain a readable (PROT_READ) shared page (MAP_SHARED),
 // and *file content* changes are reflected in the mapped memory. This class
-// does not track the underlying file: it is up to the user of this class to
+// does not reload the underlying file, but it can tell whether the file at the
+// path has changed since it was opened: it is up to the user of this class to
 // decide what to do when the underlying file gets updated, resized, or removed.
+// Files that are updated while mapped should be replaced by renaming a new
+// file over them, which leaves the existing mapping intact, rather than be
+// rewritten in place.
 class MemoryMappedFile {
  public:
   MemoryMappedFile() = default;
@@ -45,11 +53,87 @@ class MemoryMappedFile {
   MemoryMappedFile(const MemoryMappedFile&) = delete;
 
   ~MemoryMappedFile();
+
+  // Controls how the pages of the file get into memory. By default, pages are
+  // read in on first access, which means a major page fault for each page
+  // that is not in the page cache yet. All of these are hints: the file is
+  // still opened if the host does not support or allow them.
+  struct OpenOptions {
+    // How the mapping will be accessed. RANDOM turns off readahead, which
+    // suits sparse lookups into a file that is mostly cold, while WILL_NEED
+    // starts reading the whole file in the background right away.
+    enum class Advice {
+      NORMAL,
+      RANDOM,
+      SEQUENTIAL,
+      WILL_NEED,
+    };
+    Advice advice = Advice::NORMAL;
+
+    // Reads the whole file in and maps it before open() returns, using
+    // MAP_POPULATE where available and touching each page otherwise.
+    bool prefault = false;
+
+    // Locks the whole mapping in memory so that it cannot be paged out. This
+    // is subject to RLIMIT_MEMLOCK; see isLocked().
+    bool lock = false;
+
+    // Aligns mappings of 2 MiB or more to 2 MiB and, on Linux, asks for
+    // transparent huge pages, which the kernel can use for file mappings if
+    // it supports them.
+    bool hugePages = false;
+  };
+
   bool open(const char* path);
+  bool open(const char* path, const OpenOptions& options);
   void close();
 
+  // Locks the pages that overlap the range of the file in memory, such as the
+  // ones that every lookup reads. Returns false if the range is out of bounds
+  // or the lock is not allowed.
+  bool lockRange(size_t offset, size_t length);
+
+  // Returns true if the whole mapping was locked with OpenOptions::lock.
+  bool isLocked() const { return locked_; }
+
+  // Returns the number of major page faults, that is, faults that had to
+  // read from storage, taken so far by the calling thread on Linux, or by
+  // the process elsewhere. Compare two readings to count the faults taken in
+  // between.
+  static uint64_t MajorPageFaults();
+
+  // Copies an image that is in memory rather than mapped into words, so that
+  // it is aligned the way a mapping is, to at least 8 bytes. Returns false,
+  // leaving the words empty, if the image is empty.
+  static bool CopyToAlignedWords(std::string_view image,
+                                 std::vector<uint64_t>& words);
+
   bool isOpen() const { return fd_ != -1; }
 
+  // The path that the file was opened with.
+  const std::string& path() const { return path_; }
+
+  // What identifies a version of a file: a file replaced by a rename has a
+  // different inode, and one rewritten in place a different size or
+  // modification time.
+  struct FileIdentity {
+    uint64_t device = 0;
+    uint64_t inode = 0;
+    uint64_t size = 0;
+    int64_t modificationTimeNanoseconds = 0;
+
+    bool operator==(const FileIdentity& other) const = default;
+  };
+
+  // Returns the identity of the file as it was when opened.
+  const FileIdentity& identity() const { return identity_; }
+
+  // Returns true if the file at the path is no longer the one that was
+  // opened. A missing file does not count as a change, so that a file in the
+  // middle of being replaced is not reported before the new one is in place.
+  // Returns false if the file is not open.
+  bool hasChanged() const;
+
   [[nodiscard]] const char* data() const {
     return static_cast<const char*>(data_);
   }
@@ -61,6 +145,9 @@ class MemoryMappedFile {
   int fd_ = -1;           // POSIX file descriptor used by the mmap call
   void* data_ = nullptr;  // actual mapped data
   size_t length_ = 0;
+  bool locked_ = false;
+  std::string path_;
+  FileIdentity identity_;
 };
 
 }  // namespace McBopomofo
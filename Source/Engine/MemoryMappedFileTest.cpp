@@ -22,12 +22,15 @@
 // OTHER DEALINGS IN THE SOFTWARE.
 
 #include <cassert>
+#include <cstdint>
 #include <cstdio>
 #include <filesystem>
 #include <fstream>
 #include <random>
 #include <string>
+#include <string_view>
 #include <utility>
+#include <vector>
 
 #include "MemoryMappedFile.h"
 #include "gtest/gtest.h"
@@ -181,6 +184,79 @@ TEST(MemoryMappedFileTest, BasicFunctionalities) {
   EXPECT_FALSE(mf5.isOpen());
 }
 
+TEST(MemoryMappedFileTest, DetectsChanges) {
+  constexpr char kOldData[] = "old data";
+  constexpr char kNewData[] = "new data, longer";
+  TempFile temp(kOldData, sizeof(kOldData) - 1);
+
+  MemoryMappedFile mf;
+  EXPECT_FALSE(mf.hasChanged());
+  ASSERT_TRUE(mf.open(temp.path()));
+  EXPECT_EQ(mf.path(), temp.path());
+  EXPECT_EQ(mf.identity().size, sizeof(kOldData) - 1);
+  EXPECT_FALSE(mf.hasChanged());
+
+  // The identity moves with the mapping.
+  MemoryMappedFile moved(std::move(mf));
+  EXPECT_TRUE(mf.path().empty());
+  EXPECT_EQ(moved.path(), temp.path());
+  EXPECT_FALSE(moved.hasChanged());
+
+  // Replace the file by a rename. The existing mapping keeps the old data.
+  std::string newPath = std::string(temp.path()) + ".new";
+  {
+    std::ofstream out(newPath, std::ios::binary);
+    out << kNewData;
+  }
+  std::filesystem::rename(newPath, temp.path());
+  EXPECT_TRUE(moved.hasChanged());
+  EXPECT_EQ(std::string(moved.data(), moved.length()), kOldData);
+
+  MemoryMappedFile reopened;
+  ASSERT_TRUE(reopened.open(temp.path()));
+  EXPECT_FALSE(reopened.hasChanged());
+  EXPECT_NE(reopened.identity(), moved.identity());
+
+  // A missing file is not a change yet.
+  std::filesystem::rename(temp.path(), newPath);
+  EXPECT_FALSE(reopened.hasChanged());
+  std::filesystem::rename(newPath, temp.path());
+
+  // Nor is anything once closed.
+  moved.close();
+  EXPECT_FALSE(moved.hasChanged());
+  EXPECT_TRUE(moved.path().empty());
+}
+
+TEST(MemoryMappedFileTest, MoveAssignment) {
+  constexpr char kData1[] = "first file";
+  constexpr char kData2[] = "second file";
+  TempFile temp1(kData1, sizeof(kData1) - 1);
+  TempFile temp2(kData2, sizeof(kData2) - 1);
+
+  MemoryMappedFile mf1;
+  MemoryMappedFile mf2;
+  ASSERT_TRUE(mf1.open(temp1.path()));
+  ASSERT_TRUE(mf2.open(temp2.path()));
+
+  // Moving onto an open file closes it and takes the other's mapping.
+  mf1 = std::move(mf2);
+  EXPECT_FALSE(mf2.isOpen());
+  EXPECT_TRUE(mf2.path().empty());
+  ASSERT_TRUE(mf1.isOpen());
+  EXPECT_EQ(mf1.path(), temp2.path());
+  EXPECT_EQ(std::string(mf1.data(), mf1.length()), kData2);
+
+  // Moving onto itself keeps the mapping. The alias keeps the compiler from
+  // warning about the self-move.
+  MemoryMappedFile& alias = mf1;
+  mf1 = std::move(alias);
+  ASSERT_TRUE(mf1.isOpen());
+  EXPECT_EQ(mf1.path(), temp2.path());
+  EXPECT_EQ(std::string(mf1.data(), mf1.length()), kData2);
+  EXPECT_FALSE(mf1.hasChanged());
+}
+
 TEST(MemoryMappedFileTest, OpenFailureOnEmptyFile) {
   std::filesystem::path tmp_file_path =
       std::filesystem::temp_directory_path() /
@@ -203,6 +279,64 @@ TEST(MemoryMappedFileTest, OpenFailureOnEmptyFile) {
   std::filesystem::remove(tmp_file_path);
 }
 
+TEST(MemoryMappedFileTest, OpenWithOptions) {
+  // Large enough for the huge page alignment to kick in.
+  constexpr size_t kBufSize = 3 * 1024 * 1024;
+  std::string buf(kBufSize, '\0');
+  std::default_random_engine re(42);
+  std::uniform_int_distribution<unsigned int> randchar(0, 255);
+  for (char& c : buf) {
+    c = static_cast<char>(randchar(re));
+  }
+  TempFile temp(buf.data(), buf.size());
+
+  using Advice = MemoryMappedFile::OpenOptions::Advice;
+  for (Advice advice : {Advice::NORMAL, Advice::RANDOM, Advice::SEQUENTIAL,
+                        Advice::WILL_NEED}) {
+    MemoryMappedFile::OpenOptions options;
+    options.advice = advice;
+    options.prefault = true;
+    options.hugePages = true;
+    MemoryMappedFile mf;
+    ASSERT_TRUE(mf.open(temp.path(), options));
+    ASSERT_EQ(mf.length(), kBufSize);
+    EXPECT_EQ(std::string_view(mf.data(), mf.length()), buf);
+    EXPECT_FALSE(mf.isLocked());
+  }
+}
+
+TEST(MemoryMappedFileTest, LockRange) {
+  std::string buf(10000, 'a');
+  TempFile temp(buf.data(), buf.size());
+
+  MemoryMappedFile mf;
+  EXPECT_FALSE(mf.lockRange(0, 1));
+  ASSERT_TRUE(mf.open(temp.path()));
+  // Whether a lock succeeds depends on RLIMIT_MEMLOCK, but out-of-bounds
+  // ranges always fail.
+  EXPECT_FALSE(mf.lockRange(0, buf.size() + 1));
+  EXPECT_FALSE(mf.lockRange(buf.size() + 1, 0));
+  EXPECT_FALSE(mf.lockRange(1, SIZE_MAX));
+  mf.lockRange(5000, 100);
+
+  MemoryMappedFile::OpenOptions options;
+  options.lock = true;
+  MemoryMappedFile locked;
+  ASSERT_TRUE(locked.open(temp.path(), options));
+  EXPECT_EQ(std::string_view(locked.data(), locked.length()), buf);
+  bool isLocked = locked.isLocked();
+  MemoryMappedFile moved(std::move(locked));
+  EXPECT_EQ(moved.isLocked(), isLocked);
+  moved.close();
+  EXPECT_FALSE(moved.isLocked());
+}
+
+TEST(MemoryMappedFileTest, MajorPageFaultsNeverDecrease) {
+  uint64_t before = MemoryMappedFile::MajorPageFaults();
+  uint64_t after = MemoryMappedFile::MajorPageFaults();
+  EXPECT_LE(before, after);
+}
+
 TEST(MemoryMappedFileTest, OpenFailureOnDirectory) {
   TempDir dir;
   MemoryMappedFile mf;
@@ -217,4 +351,17 @@ TEST(MemoryMappedFileTest, OpenFailureOnDirectory) {
   EXPECT_FALSE(mf.isOpen());
 }
 
+TEST(MemoryMappedFileTest, CopyToAlignedWords) {
+  std::vector<uint64_t> words(3, 42);
+  EXPECT_FALSE(MemoryMappedFile::CopyToAlignedWords({}, words));
+  EXPECT_TRUE(words.empty());
+
+  std::string_view image("0123456789");
+  ASSERT_TRUE(MemoryMappedFile::CopyToAlignedWords(image, words));
+  EXPECT_EQ(words.size(), 2);
+  EXPECT_EQ(std::string_view(reinterpret_cast<const char*>(words.data()),
+                             image.size()),
+            image);
+}
+
 }  // namespace McBopomofo
@@ -38,18 +38,67 @@ namespace McBopomofo {
 
 bool ParselessLM::isLoaded() const { return db_ != nullptr; }
 
-bool ParselessLM::open(const char* path) {
-  if (!mmapedFile_.open(path)) {
+bool ParselessLM::open(const char* path) { return open(path, OpenOptions()); }
+
+static void BuildLookupStructures(ParselessPhraseDB& db,
+                                  const ParselessLM::OpenOptions& options) {
+  if (options.buildLineIndex) {
+    db.buildLineIndex();
+  }
+  if (options.buildJumpTable) {
+    db.buildJumpTable();
+  }
+  if (options.buildKeyFilter) {
+    db.buildKeyFilter();
+  }
+}
+
+bool ParselessLM::open(const char* path, const OpenOptions& options) {
+  if (!mmapedFile_.open(path, options.mapping)) {
     return false;
   }
   db_ = std::unique_ptr<ParselessPhraseDB>(new ParselessPhraseDB(
       mmapedFile_.data(), mmapedFile_.length(), /*validate_pragma=*/true));
+  BuildLookupStructures(*db_, options);
+  openOptions_ = options;
+  rebuildLayeredDB();
+  return true;
+}
+
+bool ParselessLM::reopen(const char* path, const OpenOptions& options) {
+  MemoryMappedFile file;
+  if (!file.open(path, options.mapping)) {
+    return false;
+  }
+  std::unique_ptr<ParselessPhraseDB> db =
+      ParselessPhraseDB::CreateValidatedDB(file.data(), file.length());
+  if (db == nullptr) {
+    return false;
+  }
+  BuildLookupStructures(*db, options);
+
+  // Switch to the new data. The old mapping and DB end up in the locals,
+  // which are released in the reverse order, DB first, on return.
+  std::swap(mmapedFile_, file);
+  db_.swap(db);
+  openOptions_ = options;
+  rebuildLayeredDB();
   return true;
 }
 
+bool ParselessLM::reloadIfChanged() {
+  if (!mmapedFile_.isOpen() || !mmapedFile_.hasChanged()) {
+    return false;
+  }
+  // The path is copied since the switch replaces the file that holds it.
+  std::string path = mmapedFile_.path();
+  return reopen(path.c_str(), openOptions_);
+}
+
 void ParselessLM::close() {
   mmapedFile_.close();
   db_ = nullptr;
+  rebuildLayeredDB();
 }
 
 bool ParselessLM::open(std::unique_ptr<ParselessPhraseDB> db) {
@@ -58,72 +107,177 @@ bool ParselessLM::open(std::unique_ptr<ParselessPhraseDB> db) {
   }
 
   db_ = std::move(db);
+  rebuildLayeredDB();
   return true;
 }
 
-std::vector<Formosa::Gramambular2::LanguageModel::Unigram>
-ParselessLM::getUnigrams(const std::string& key) {
-  if (db_ == nullptr) {
-    return {};
+bool ParselessLM::addLayer(const char* path, int priority,
+                           double scoreOffset) {
+  if (path == nullptr) {
+    return false;
+  }
+  auto file = std::make_unique<MemoryMappedFile>();
+  if (!file->open(path)) {
+    return false;
+  }
+  std::unique_ptr<ParselessPhraseDB> db =
+      ParselessPhraseDB::CreateValidatedDB(file->data(), file->length());
+  if (!addLayer(std::move(db), priority, scoreOffset)) {
+    return false;
   }
+  supplementaryLayers_.back().file = std::move(file);
+  return true;
+}
 
-  std::vector<Formosa::Gramambular2::LanguageModel::Unigram> results;
-  for (const auto& row : db_->findRows(key + " ")) {
-    std::string value;
-    double score = 0;
-
-    // Move ahead until we encounter the first space. This is the key.
-    const auto* it = row.begin();
-    while (it != row.end() && *it != ' ') {
-      ++it;
-    }
+bool ParselessLM::addLayer(std::unique_ptr<ParselessPhraseDB> db,
+                           int priority, double scoreOffset) {
+  // One slot is reserved for the primary data.
+  if (db == nullptr ||
+      supplementaryLayers_.size() + 1 >= LayeredPhraseDB::kMaxLayers) {
+    return false;
+  }
+  db->buildKeyFilter();
 
-    // The key is std::string(row.begin(), it), which we don't need.
+  supplementaryLayers_.push_back(
+      SupplementaryLayer{nullptr, std::move(db), priority, scoreOffset});
+  rebuildLayeredDB();
+  return true;
+}
 
-    // Read past the space.
-    if (it != row.end()) {
-      ++it;
-    }
+void ParselessLM::closeLayers() {
+  supplementaryLayers_.clear();
+  rebuildLayeredDB();
+}
+
+void ParselessLM::rebuildLayeredDB() {
+  layeredDB_.clear();
+  if (db_ != nullptr) {
+    layeredDB_.addLayer(db_.get());
+  }
+  for (const auto& layer : supplementaryLayers_) {
+    layeredDB_.addLayer(layer.db.get(), layer.priority, layer.scoreOffset);
+  }
+}
 
-    if (it != row.end()) {
-      // Now it is the start of the value portion.
-      const auto* value_begin = it;
+// Returns true if the key column of the row is exactly the key. Since the
+// space sorts before any other character used in the keys, these rows come
+// first among the rows that have the key as their prefix, and so the prefix
+// search does not need a key + " " copy.
+static bool IsExactRow(std::string_view row, std::string_view key) {
+  return row.length() > key.length() && row[key.length()] == ' ';
+}
 
-      // Move ahead until we encounter the second space. This is the
-      // value.
-      while (it != row.end() && *it != ' ') {
-        ++it;
+// Since all the rows of an exact lookup have the same key column, merging
+// the layers comes down to visiting them in priority order, which also lets
+// the key filters skip the layers that lack the key.
+template <typename Visitor>
+void ParselessLM::forEachUnigramRow(std::string_view key,
+                                    Visitor&& visitor) const {
+  for (const LayeredPhraseDB::Layer& layer : layeredDB_.layers()) {
+    if (!layer.db->mayHaveKey(key)) {
+      continue;
+    }
+    bool found = false;
+    for (std::string_view row : layer.db->rows(key)) {
+      if (!IsExactRow(row, key)) {
+        break;
       }
-      value = std::string(value_begin, it);
+      found = true;
+      visitor(row, layer.scoreOffset);
     }
-
-    // Read past the space. The remainder, if it exists, is the score.
-    if (it != row.end()) {
-      ++it;
+    if (!found) {
+      layer.db->keyFilter().recordFalsePositive();
     }
+  }
+}
+
+// Adds the major page faults taken during its lifetime to the LM's counters,
+// if counting is on.
+class ParselessLM::FaultCountingScope {
+ public:
+  explicit FaultCountingScope(const ParselessLM* lm)
+      : lm_(lm->countMajorFaults_ ? lm : nullptr),
+        start_(lm_ != nullptr ? MemoryMappedFile::MajorPageFaults() : 0) {}
 
-    if (it != row.end()) {
-      score = std::stod(std::string(it, row.end()));
+  ~FaultCountingScope() {
+    if (lm_ == nullptr) {
+      return;
     }
-    results.emplace_back(std::move(value), score);
+    uint64_t faults = MemoryMappedFile::MajorPageFaults() - start_;
+    lm_->countedLookups_.fetch_add(1, std::memory_order_relaxed);
+    lm_->majorFaults_.fetch_add(faults, std::memory_order_relaxed);
   }
+
+  FaultCountingScope(const FaultCountingScope&) = delete;
+  FaultCountingScope& operator=(const FaultCountingScope&) = delete;
+
+ private:
+  const ParselessLM* lm_;
+  uint64_t start_;
+};
+
+std::vector<Formosa::Gramambular2::LanguageModel::Unigram>
+ParselessLM::getUnigrams(const std::string& key) {
+  FaultCountingScope faultCounting(this);
+  std::vector<Formosa::Gramambular2::LanguageModel::Unigram> results;
+  forEachUnigramRow(key, [&results](std::string_view row, double offset) {
+    ParselessPhraseDB::Row decoded = ParselessPhraseDB::DecodeRow(row);
+    results.emplace_back(std::string(decoded.value), decoded.score + offset);
+  });
   return results;
 }
 
+void ParselessLM::getUnigramViews(std::string_view key,
+                                  std::vector<UnigramView>& results) const {
+  FaultCountingScope faultCounting(this);
+  results.clear();
+  forEachUnigramRow(key, [&results](std::string_view row, double offset) {
+    ParselessPhraseDB::Row decoded = ParselessPhraseDB::DecodeRow(row);
+    results.push_back(UnigramView{decoded.value, decoded.score + offset});
+  });
+}
+
 bool ParselessLM::hasUnigrams(const std::string& key) {
-  if (db_ == nullptr) {
-    return false;
+  FaultCountingScope faultCounting(this);
+  // Only the first row with the key as its prefix needs to be checked in each
+  // layer.
+  for (const LayeredPhraseDB::Layer& layer : layeredDB_.layers()) {
+    if (!layer.db->mayHaveKey(key)) {
+      continue;
+    }
+    ParselessPhraseDB::RowRange rows = layer.db->rows(key);
+    if (!rows.empty() && IsExactRow(rows.front(), key)) {
+      return true;
+    }
+    layer.db->keyFilter().recordFalsePositive();
   }
+  return false;
+}
 
-  return db_->findFirstMatchingLine(key + " ") != nullptr;
+KeyFilter::Stats ParselessLM::keyFilterStats() const {
+  KeyFilter::Stats stats;
+  for (const LayeredPhraseDB::Layer& layer : layeredDB_.layers()) {
+    stats += layer.db->keyFilter().stats();
+  }
+  return stats;
+}
+
+void ParselessLM::setMajorFaultCounting(bool enabled) {
+  countMajorFaults_ = enabled;
+}
+
+ParselessLM::LookupFaultStats ParselessLM::lookupFaultStats() const {
+  return LookupFaultStats{countedLookups_.load(std::memory_order_relaxed),
+                          majorFaults_.load(std::memory_order_relaxed)};
+}
+
+void ParselessLM::resetLookupFaultStats() {
+  countedLookups_.store(0, std::memory_order_relaxed);
+  majorFaults_.store(0, std::memory_order_relaxed);
 }
 
 std::vector<ParselessLM::FoundReading> ParselessLM::getReadings(
     const std::string& value) const {
-  if (db_ == nullptr) {
-    return {};
-  }
-
   std::vector<ParselessLM::FoundReading> results;
 
   // We append a space so that we only find rows with the exact value. We
@@ -131,40 +285,12 @@ std::vector<ParselessLM::FoundReading> ParselessLM::getReadings(
   // be in the format of "key value score".
   std::string actualValue = value + " ";
 
-  for (const auto& row : db_->reverseFindRows(actualValue)) {
-    std::string key;
-    double score = 0;
-
-    // Move ahead until we encounter the first space. This is the key.
-    auto it = row.begin();
-    while (it != row.end() && *it != ' ') {
-      ++it;
-    }
-
-    key = std::string(row.begin(), it);
-
-    // Read past the space.
-    if (it != row.end()) {
-      ++it;
-    }
-
-    if (it != row.end()) {
-      // Now it is the start of the value portion, but we move ahead
-      // until we encounter the second space to skip this part.
-      while (it != row.end() && *it != ' ') {
-        ++it;
-      }
-    }
-
-    // Read past the space. The remainder, if it exists, is the score.
-    if (it != row.end()) {
-      ++it;
-    }
-
-    if (it != row.end()) {
-      score = std::stod(std::string(it, row.end()));
+  for (const LayeredPhraseDB::Layer& layer : layeredDB_.layers()) {
+    for (const auto& row : layer.db->reverseFindRows(actualValue)) {
+      ParselessPhraseDB::Row decoded = ParselessPhraseDB::DecodeRow(row);
+      results.emplace_back(ParselessLM::FoundReading{
+          std::string(decoded.key), decoded.score + layer.scoreOffset});
     }
-    results.emplace_back(ParselessLM::FoundReading{key, score});
   }
   return results;
 }
@@ -24,10 +24,14 @@
 #ifndef SRC_ENGINE_PARSELESSLM_H_
 #define SRC_ENGINE_PARSELESSLM_H_
 
+#include <atomic>
+#include <cstdint>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
 
+#include "LayeredPhraseDB.h"
 #include "MemoryMappedFile.h"
 #include "ParselessPhraseDB.h"
 #include "gramambular2/language_model.h"
@@ -43,16 +47,74 @@ class ParselessLM : public Formosa::Gramambular2::LanguageModel {
   ParselessLM& operator=(ParselessLM&&) = delete;
 
   bool isLoaded() const;
+
+  // The optional lookup structures that the DB builds at load time. Each
+  // trades a small amount of memory and one scan of the file for faster
+  // lookups. See ParselessPhraseDB for details.
+  struct OpenOptions {
+    bool buildLineIndex = false;
+    bool buildJumpTable = false;
+    bool buildKeyFilter = false;
+
+    // How the data file is mapped. See MemoryMappedFile::OpenOptions.
+    MemoryMappedFile::OpenOptions mapping;
+  };
+
   bool open(const char* path);
+  bool open(const char* path, const OpenOptions& options);
   void close();
 
+  // Opens the file and switches to it only once it has been mapped and
+  // validated and its lookup structures have been built, so that there is no
+  // moment without data. If the file cannot be opened or lacks the sorted
+  // format pragma, the current data, if any, stays in use and false is
+  // returned. The old data is released right after the switch. This works
+  // whether or not data is already loaded.
+  bool reopen(const char* path, const OpenOptions& options);
+
+  // Reopens the file that the data was opened from, with the same options,
+  // if it has been replaced or modified since. Returns true if the data was
+  // reloaded.
+  bool reloadIfChanged();
+
   // Allows the use of existing in-memory db.
   bool open(std::unique_ptr<ParselessPhraseDB> db);
 
+  // Adds a sorted supplementary data file that is merged with the primary one
+  // at query time. The primary data has priority 0. Among the unigrams of a
+  // key, those from layers with a higher priority come first, and the score
+  // offset is added to the scores of the layer's unigrams. Layers are kept
+  // when the primary data is closed or reopened. Since most keys are missing
+  // from a typical supplementary layer, a key filter is always built for it.
+  // Returns false if the file cannot be opened, if it is not a sorted db
+  // with the pragma, or if there are too many layers.
+  bool addLayer(const char* path, int priority, double scoreOffset);
+  bool addLayer(std::unique_ptr<ParselessPhraseDB> db, int priority,
+                double scoreOffset);
+  void closeLayers();
+
   std::vector<Formosa::Gramambular2::LanguageModel::Unigram> getUnigrams(
       const std::string& key) override;
   bool hasUnigrams(const std::string& key) override;
 
+  // A unigram whose value points into the loaded data.
+  struct UnigramView {
+    std::string_view value;
+    double score = 0;
+  };
+
+  // Decodes the unigrams of the key into the caller-provided vector, which is
+  // cleared first. Unlike getUnigrams(), this does not copy the values, and
+  // reusing the same vector across lookups avoids heap allocations once its
+  // capacity has grown enough.
+  //
+  // The values point into the mapped primary data and layers, so they are
+  // only valid until the data is replaced or released: close(), reopen(),
+  // reloadIfChanged() when it reloads, addLayer() and closeLayers() all
+  // invalidate them. Copy what needs to outlive those calls.
+  void getUnigramViews(std::string_view key,
+                       std::vector<UnigramView>& results) const;
+
   struct FoundReading {
     std::string reading;
     double score = 0;
@@ -61,9 +123,50 @@ class ParselessLM : public Formosa::Gramambular2::LanguageModel {
   // Look up reading by value. This is specific to ParselessLM only.
   std::vector<FoundReading> getReadings(const std::string& value) const;
 
+  // Returns the stats of the key filters of all layers combined.
+  KeyFilter::Stats keyFilterStats() const;
+
+  // When turned on, getUnigrams(), hasUnigrams() and getUnigramViews() count
+  // the major page faults that they take, which tells how often lookups wait
+  // on storage because the data is not in the page cache. Reading the fault
+  // counter costs a system call per lookup, so this is off by default.
+  void setMajorFaultCounting(bool enabled);
+
+  struct LookupFaultStats {
+    uint64_t lookups = 0;
+    uint64_t majorFaults = 0;
+  };
+
+  // Returns the lookups and major page faults counted so far.
+  LookupFaultStats lookupFaultStats() const;
+  void resetLookupFaultStats();
+
  private:
+  // Calls the visitor with each row whose key column is exactly the key,
+  // along with the score offset of the layer that the row comes from.
+  template <typename Visitor>
+  void forEachUnigramRow(std::string_view key, Visitor&& visitor) const;
+
+  void rebuildLayeredDB();
+
+  class FaultCountingScope;
+
+  struct SupplementaryLayer {
+    std::unique_ptr<MemoryMappedFile> file;
+    std::unique_ptr<ParselessPhraseDB> db;
+    int priority = 0;
+    double scoreOffset = 0;
+  };
+
   MemoryMappedFile mmapedFile_;
   std::unique_ptr<ParselessPhraseDB> db_;
+  OpenOptions openOptions_;
+  std::vector<SupplementaryLayer> supplementaryLayers_;
+  LayeredPhraseDB layeredDB_;
+
+  bool countMajorFaults_ = false;
+  mutable std::atomic<uint64_t> countedLookups_ = 0;
+  mutable std::atomic<uint64_t> majorFaults_ = 0;
 };
 
 }  // namespace McBopomofo
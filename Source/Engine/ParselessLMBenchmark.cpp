@@ -22,10 +22,15 @@
 // OTHER DEALINGS IN THE SOFTWARE.
 
 #include <benchmark/benchmark.h>
+#include <fcntl.h>
+#include <unistd.h>
 
+#include <algorithm>
 #include <cassert>
+#include <cstdint>
 #include <filesystem>
 #include <fstream>
+#include <random>
 #include <string>
 #include <vector>
 
@@ -108,6 +113,212 @@ static void BM_ParselessLMFindUnigramsRealKeys(benchmark::State& state) {
 }
 BENCHMARK(BM_ParselessLMFindUnigramsRealKeys);
 
+static void BM_ParselessLMGetUnigramViewsRealKeys(benchmark::State& state) {
+  assert(std::filesystem::exists(kDataPath));
+  ParselessLM lm;
+  lm.open(kDataPath);
+  const std::vector<std::string> keys = LoadRealKeys();
+  std::vector<ParselessLM::UnigramView> views;
+  auto key = keys.begin();
+  for (auto _ : state) {
+    lm.getUnigramViews(*key, views);
+    benchmark::DoNotOptimize(views.data());
+    if (++key == keys.end()) {
+      key = keys.begin();
+    }
+  }
+  lm.close();
+}
+BENCHMARK(BM_ParselessLMGetUnigramViewsRealKeys);
+
+// Runs with no lookup structures, the line index, the jump table, and both.
+static void LookupStructureArguments(benchmark::internal::Benchmark* b) {
+  for (int i = 0; i < 4; ++i) {
+    b->Arg(i);
+  }
+}
+
+static ParselessLM::OpenOptions LookupStructureOptions(
+    benchmark::State& state) {
+  static const char* kLabels[] = {"none", "line index", "jump table", "both"};
+  state.SetLabel(kLabels[state.range(0)]);
+  ParselessLM::OpenOptions options;
+  options.buildLineIndex = (state.range(0) & 1) != 0;
+  options.buildJumpTable = (state.range(0) & 2) != 0;
+  return options;
+}
+
+static void BM_ParselessLMOpenWithLookupStructures(benchmark::State& state) {
+  assert(std::filesystem::exists(kDataPath));
+  const ParselessLM::OpenOptions options = LookupStructureOptions(state);
+  for (auto _ : state) {
+    ParselessLM lm;
+    lm.open(kDataPath, options);
+    lm.close();
+  }
+}
+BENCHMARK(BM_ParselessLMOpenWithLookupStructures)
+    ->Apply(LookupStructureArguments);
+
+static void BM_ParselessLMGetUnigramViewsShuffledKeys(benchmark::State& state) {
+  assert(std::filesystem::exists(kDataPath));
+  ParselessLM lm;
+  lm.open(kDataPath, LookupStructureOptions(state));
+  std::vector<std::string> keys = LoadRealKeys();
+  // Fixed seed so that every run probes the same cold rows.
+  std::shuffle(keys.begin(), keys.end(),
+               std::mt19937(std::mt19937::default_seed));
+  std::vector<ParselessLM::UnigramView> views;
+  auto key = keys.begin();
+  for (auto _ : state) {
+    lm.getUnigramViews(*key, views);
+    benchmark::DoNotOptimize(views.data());
+    if (++key == keys.end()) {
+      key = keys.begin();
+    }
+  }
+  lm.close();
+}
+BENCHMARK(BM_ParselessLMGetUnigramViewsShuffledKeys)
+    ->Apply(LookupStructureArguments);
+
+// Returns the keys that ReadingGrid::update() probes for a stream of
+// readings: every span of up to six syllables. The readings come from real
+// multi-syllable keys in a fixed shuffled order, so most probes are misses.
+std::vector<std::string> LoadGridProbeKeys() {
+  std::vector<std::string> keys = LoadRealKeys();
+  std::shuffle(keys.begin(), keys.end(),
+               std::mt19937(std::mt19937::default_seed));
+
+  std::vector<std::string> syllables;
+  for (const auto& key : keys) {
+    if (key.find('-') == std::string::npos || syllables.size() > 20000) {
+      continue;
+    }
+    size_t start = 0;
+    for (size_t end = key.find('-'); end != std::string::npos;
+         start = end + 1, end = key.find('-', start)) {
+      syllables.push_back(key.substr(start, end - start));
+    }
+    syllables.push_back(key.substr(start));
+  }
+
+  constexpr size_t kMaximumSpanLength = 6;
+  std::vector<std::string> probes;
+  for (size_t i = 0; i < syllables.size(); ++i) {
+    size_t last = std::min(i + kMaximumSpanLength, syllables.size());
+    std::string probe = syllables[i];
+    probes.push_back(probe);
+    for (size_t j = i + 1; j < last; ++j) {
+      probe += "-" + syllables[j];
+      probes.push_back(probe);
+    }
+  }
+  return probes;
+}
+
+static void BM_ParselessLMHasUnigramsGridProbes(benchmark::State& state) {
+  assert(std::filesystem::exists(kDataPath));
+  ParselessLM::OpenOptions options;
+  options.buildKeyFilter = state.range(0) != 0;
+  state.SetLabel(options.buildKeyFilter ? "key filter" : "none");
+  ParselessLM lm;
+  lm.open(kDataPath, options);
+  const std::vector<std::string> keys = LoadGridProbeKeys();
+  size_t hits = 0;
+  size_t lookups = 0;
+  auto key = keys.begin();
+  for (auto _ : state) {
+    hits += lm.hasUnigrams(*key) ? 1 : 0;
+    ++lookups;
+    if (++key == keys.end()) {
+      key = keys.begin();
+    }
+  }
+  McBopomofo::KeyFilter::Stats stats = lm.keyFilterStats();
+  state.counters["miss_pct"] =
+      100.0 * static_cast<double>(lookups - hits) / lookups;
+  state.counters["saved_pct"] =
+      100.0 * static_cast<double>(stats.lookupsSaved) / lookups;
+  state.counters["fp_pct"] = 100.0 * stats.falsePositiveRate();
+  lm.close();
+}
+BENCHMARK(BM_ParselessLMHasUnigramsGridProbes)->Arg(0)->Arg(1);
+
+// Drops the cached pages of the file where the host allows it, so that the
+// next mapping of it starts cold.
+void EvictFromPageCache(const char* path) {
+#ifdef POSIX_FADV_DONTNEED
+  int fd = open(path, O_RDONLY);
+  if (fd != -1) {
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+  }
+#else
+  (void)path;
+#endif
+}
+
+static void MappingArguments(benchmark::internal::Benchmark* b) {
+  // 0: default, 1: RANDOM, 2: WILL_NEED, 3: prefault, 4: lock.
+  b->DenseRange(0, 4);
+}
+
+static void BM_ParselessLMColdOpenAndLookups(benchmark::State& state) {
+  assert(std::filesystem::exists(kDataPath));
+  using Advice = McBopomofo::MemoryMappedFile::OpenOptions::Advice;
+  static const char* kLabels[] = {"default", "random", "will need",
+                                  "prefault", "lock"};
+  ParselessLM::OpenOptions options;
+  switch (state.range(0)) {
+    case 1:
+      options.mapping.advice = Advice::RANDOM;
+      break;
+    case 2:
+      options.mapping.advice = Advice::WILL_NEED;
+      break;
+    case 3:
+      options.mapping.prefault = true;
+      break;
+    case 4:
+      options.mapping.lock = true;
+      break;
+  }
+  state.SetLabel(kLabels[state.range(0)]);
+
+  // A short session's worth of lookups spread across the file.
+  std::vector<std::string> keys = LoadRealKeys();
+  std::shuffle(keys.begin(), keys.end(),
+               std::mt19937(std::mt19937::default_seed));
+  keys.resize(std::min<size_t>(keys.size(), 200));
+
+  ParselessLM lm;
+  lm.setMajorFaultCounting(true);
+  std::vector<ParselessLM::UnigramView> views;
+  uint64_t openFaults = 0;
+  for (auto _ : state) {
+    state.PauseTiming();
+    EvictFromPageCache(kDataPath);
+    state.ResumeTiming();
+
+    uint64_t start = McBopomofo::MemoryMappedFile::MajorPageFaults();
+    lm.open(kDataPath, options);
+    openFaults += McBopomofo::MemoryMappedFile::MajorPageFaults() - start;
+    for (const auto& key : keys) {
+      lm.getUnigramViews(key, views);
+      benchmark::DoNotOptimize(views.data());
+    }
+    lm.close();
+  }
+  ParselessLM::LookupFaultStats stats = lm.lookupFaultStats();
+  state.counters["open_major_faults"] = benchmark::Counter(
+      static_cast<double>(openFaults), benchmark::Counter::kAvgIterations);
+  state.counters["lookup_major_faults"] =
+      benchmark::Counter(static_cast<double>(stats.majorFaults),
+                         benchmark::Counter::kAvgIterations);
+}
+BENCHMARK(BM_ParselessLMColdOpenAndLookups)->Apply(MappingArguments);
+
 static void BM_ParselessLMGetReadingsMissingValue(benchmark::State& state) {
   assert(std::filesystem::exists(kDataPath));
   ParselessLM lm;
@@ -22,8 +22,10 @@
 // OTHER DEALINGS IN THE SOFTWARE.
 
 #include <filesystem>
+#include <fstream>
 #include <iostream>
 #include <memory>
+#include <string>
 #include <utility>
 #include <vector>
 
@@ -89,6 +91,224 @@ TEST(ParselessLMTest, ReturnsResults) {
   EXPECT_NEAR(readings[1].score, -3.59800309, 0.00000001);
 }
 
+TEST(ParselessLMTest, ExactKeyMatchOnly) {
+  ParselessLM lm;
+  auto db = std::make_unique<ParselessPhraseDB>(kSample, sizeof(kSample));
+  EXPECT_TRUE(lm.open(std::move(db)));
+
+  EXPECT_TRUE(lm.hasUnigrams("ㄅㄚ"));
+  EXPECT_FALSE(lm.hasUnigrams("ㄅ"));
+  EXPECT_FALSE(lm.hasUnigrams("ㄅㄚ-ㄅ"));
+  EXPECT_EQ(lm.getUnigrams("ㄅㄚ").size(), 3);
+  EXPECT_TRUE(lm.getUnigrams("ㄅ").empty());
+}
+
+TEST(ParselessLMTest, GetUnigramViews) {
+  ParselessLM lm;
+  std::vector<ParselessLM::UnigramView> views;
+  lm.getUnigramViews("ㄅㄚ", views);
+  EXPECT_TRUE(views.empty());
+
+  auto db = std::make_unique<ParselessPhraseDB>(kSample, sizeof(kSample));
+  EXPECT_TRUE(lm.open(std::move(db)));
+
+  lm.getUnigramViews("ㄅㄚ", views);
+  ASSERT_EQ(views.size(), 3);
+  EXPECT_EQ(views[0].value, "八");
+  EXPECT_NEAR(views[0].score, -3.27631260, 0.00000001);
+  EXPECT_EQ(views[2].value, "巴");
+  EXPECT_NEAR(views[2].score, -3.80233706, 0.00000001);
+
+  // The vector is cleared before being reused.
+  lm.getUnigramViews("ㄅㄚ˙", views);
+  ASSERT_EQ(views.size(), 1);
+  EXPECT_EQ(views[0].value, "吧");
+
+  lm.getUnigramViews("ㄆㄚ", views);
+  EXPECT_TRUE(views.empty());
+}
+
+TEST(ParselessLMTest, SupplementaryLayers) {
+  constexpr char kSupplement[] = R"(ㄅㄚ 叭 -1.0
+ㄅㄚ-ㄅㄞˇ 八佰 -2.0
+ㄆㄚ 趴 -3.0
+)";
+
+  ParselessLM lm;
+  EXPECT_FALSE(lm.addLayer(std::unique_ptr<ParselessPhraseDB>(), 1, 0));
+
+  // Layers can be added before the primary data.
+  EXPECT_TRUE(lm.addLayer(std::make_unique<ParselessPhraseDB>(
+                              kSupplement, sizeof(kSupplement) - 1),
+                          /*priority=*/1, /*scoreOffset=*/-0.5));
+  EXPECT_TRUE(lm.hasUnigrams("ㄆㄚ"));
+  EXPECT_FALSE(lm.isLoaded());
+
+  EXPECT_TRUE(lm.open(std::make_unique<ParselessPhraseDB>(kSample,
+                                                           sizeof(kSample))));
+
+  using Unigram = Formosa::Gramambular2::LanguageModel::Unigram;
+  std::vector<Unigram> unigrams = lm.getUnigrams("ㄅㄚ");
+  ASSERT_EQ(unigrams.size(), 4);
+  EXPECT_EQ(unigrams[0].value(), "叭");
+  EXPECT_NEAR(unigrams[0].score(), -1.5, 0.00000001);
+  EXPECT_EQ(unigrams[1].value(), "八");
+  EXPECT_NEAR(unigrams[1].score(), -3.27631260, 0.00000001);
+
+  std::vector<ParselessLM::UnigramView> views;
+  lm.getUnigramViews("ㄅㄚ-ㄅㄞˇ", views);
+  ASSERT_EQ(views.size(), 3);
+  EXPECT_EQ(views[0].value, "八佰");
+  EXPECT_EQ(views[1].value, "八百");
+  EXPECT_EQ(views[2].value, "捌佰");
+
+  EXPECT_TRUE(lm.hasUnigrams("ㄅㄚ˙"));
+  EXPECT_TRUE(lm.hasUnigrams("ㄆㄚ"));
+  EXPECT_FALSE(lm.hasUnigrams("ㄆ"));
+
+  std::vector<ParselessLM::FoundReading> readings = lm.getReadings("趴");
+  ASSERT_EQ(readings.size(), 1);
+  EXPECT_EQ(readings[0].reading, "ㄆㄚ");
+  EXPECT_NEAR(readings[0].score, -3.5, 0.00000001);
+
+  // Closing the primary data keeps the layers.
+  lm.close();
+  EXPECT_EQ(lm.getUnigrams("ㄅㄚ").size(), 1);
+
+  lm.closeLayers();
+  EXPECT_FALSE(lm.hasUnigrams("ㄆㄚ"));
+}
+
+TEST(ParselessLMTest, KeyFilter) {
+  auto db = std::make_unique<ParselessPhraseDB>(kSample, sizeof(kSample));
+  db->buildKeyFilter();
+  ParselessLM lm;
+  EXPECT_TRUE(lm.open(std::move(db)));
+
+  EXPECT_TRUE(lm.hasUnigrams("ㄅㄚ"));
+  EXPECT_TRUE(lm.hasUnigrams("ㄅㄚ-ㄅㄞˇ"));
+  EXPECT_EQ(lm.getUnigrams("ㄅㄚ˙").size(), 1);
+
+  size_t misses = 0;
+  for (const char* key : {"ㄅ", "ㄅㄚ-", "ㄆㄚ", "ㄇㄚ", "ㄅㄚ-ㄅㄞ", "ㄈ"}) {
+    EXPECT_FALSE(lm.hasUnigrams(key)) << key;
+    EXPECT_TRUE(lm.getUnigrams(key).empty()) << key;
+    misses += 2;
+  }
+
+  KeyFilter::Stats stats = lm.keyFilterStats();
+  EXPECT_EQ(stats.lookups, misses + 3);
+  EXPECT_EQ(stats.lookupsSaved + stats.falsePositives, misses);
+
+  // Supplementary layers always get a filter, which the primary data does
+  // not need.
+  constexpr char kSupplement[] = "ㄆㄚ 趴 -3.0\n";
+  EXPECT_TRUE(lm.addLayer(
+      std::make_unique<ParselessPhraseDB>(kSupplement, sizeof(kSupplement) - 1),
+      /*priority=*/1, /*scoreOffset=*/0));
+  EXPECT_TRUE(lm.hasUnigrams("ㄆㄚ"));
+  EXPECT_EQ(lm.getUnigrams("ㄅㄚ").size(), 3);
+  EXPECT_GT(lm.keyFilterStats().lookups, stats.lookups + 2);
+}
+
+TEST(ParselessLMTest, ReopenAndReloadIfChanged) {
+  std::filesystem::path path =
+      std::filesystem::temp_directory_path() /
+      "org.openvanilla.mcbopomofo.ParselessLMTest.data.txt";
+  std::filesystem::path newPath = path.string() + ".new";
+  // Replaces the file by a rename, as installing a new data file does.
+  auto install = [&](const std::string& data) {
+    {
+      std::ofstream out(newPath, std::ios::binary);
+      out << data;
+    }
+    std::filesystem::rename(newPath, path);
+  };
+  const std::string pragma(SORTED_PRAGMA_HEADER);
+
+  install(pragma + "ㄅㄚ 八 -3.27631260\n");
+  ParselessLM lm;
+  EXPECT_FALSE(lm.reloadIfChanged());
+  ParselessLM::OpenOptions options;
+  options.buildKeyFilter = true;
+  ASSERT_TRUE(lm.reopen(path.c_str(), options));
+  EXPECT_TRUE(lm.hasUnigrams("ㄅㄚ"));
+  EXPECT_FALSE(lm.reloadIfChanged());
+
+  install(pragma + "ㄅㄚ 吧 -3.59800309\nㄆㄚ 趴 -3.0\n");
+  EXPECT_TRUE(lm.reloadIfChanged());
+  ASSERT_EQ(lm.getUnigrams("ㄅㄚ").size(), 1);
+  EXPECT_EQ(lm.getUnigrams("ㄅㄚ")[0].value(), "吧");
+  EXPECT_TRUE(lm.hasUnigrams("ㄆㄚ"));
+  // The options carry over.
+  EXPECT_GT(lm.keyFilterStats().lookups, 0);
+  EXPECT_FALSE(lm.reloadIfChanged());
+
+  // A file without the pragma is rejected, and the current data stays.
+  install("ㄇㄚ 媽 -3.0\n");
+  EXPECT_FALSE(lm.reloadIfChanged());
+  EXPECT_TRUE(lm.hasUnigrams("ㄆㄚ"));
+  EXPECT_FALSE(lm.hasUnigrams("ㄇㄚ"));
+  EXPECT_FALSE(lm.reopen("/nonexistent/data.txt", options));
+  EXPECT_TRUE(lm.hasUnigrams("ㄆㄚ"));
+
+  lm.close();
+  std::filesystem::remove(path);
+}
+
+TEST(ParselessLMTest, AddLayerFromFile) {
+  std::filesystem::path path =
+      std::filesystem::temp_directory_path() /
+      "org.openvanilla.mcbopomofo.ParselessLMTest.layer.txt";
+  auto write = [&](const std::string& data) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out << data;
+  };
+
+  ParselessLM lm;
+  EXPECT_FALSE(lm.addLayer(static_cast<const char*>(nullptr), 1, 0));
+  EXPECT_FALSE(lm.addLayer("/nonexistent/layer.txt", 1, 0));
+
+  // Empty files and files without the pragma are rejected.
+  write("");
+  EXPECT_FALSE(lm.addLayer(path.c_str(), 1, 0));
+  write("ㄆㄚ 趴 -3.0\n");
+  EXPECT_FALSE(lm.addLayer(path.c_str(), 1, 0));
+  EXPECT_FALSE(lm.hasUnigrams("ㄆㄚ"));
+
+  write(std::string(SORTED_PRAGMA_HEADER) + "ㄆㄚ 趴 -3.0\n");
+  EXPECT_TRUE(lm.addLayer(path.c_str(), 1, 0));
+  EXPECT_TRUE(lm.hasUnigrams("ㄆㄚ"));
+
+  lm.closeLayers();
+  std::filesystem::remove(path);
+}
+
+TEST(ParselessLMTest, LookupFaultStats) {
+  std::string data(SORTED_PRAGMA_HEADER);
+  data += "ㄅㄚ 八 -3.27631260\nㄅㄚ 吧 -3.59800309\n";
+  std::unique_ptr<ParselessPhraseDB> db = std::make_unique<ParselessPhraseDB>(
+      data.c_str(), data.length(), /*validate_pragma=*/true);
+  ParselessLM lm;
+  ASSERT_TRUE(lm.open(std::move(db)));
+
+  lm.hasUnigrams("ㄅㄚ");
+  EXPECT_EQ(lm.lookupFaultStats().lookups, 0);
+
+  lm.setMajorFaultCounting(true);
+  lm.hasUnigrams("ㄅㄚ");
+  lm.getUnigrams("ㄅㄚ");
+  std::vector<ParselessLM::UnigramView> views;
+  lm.getUnigramViews("ㄅㄚ", views);
+  EXPECT_EQ(lm.lookupFaultStats().lookups, 3);
+
+  lm.setMajorFaultCounting(false);
+  lm.hasUnigrams("ㄅㄚ");
+  EXPECT_EQ(lm.lookupFaultStats().lookups, 3);
+  lm.resetLookupFaultStats();
+  EXPECT_EQ(lm.lookupFaultStats().lookups, 0);
+}
+
 TEST(ParselessLMTest, SanityCheckTest) {
   constexpr const char* data_path = "data.txt";
   if (!std::filesystem::exists(data_path)) {
@@ -23,25 +23,164 @@
 
 #include "ParselessPhraseDB.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cstdint>
 #include <cstring>
+#include <limits>
+#include <locale>
+#include <sstream>
 #include <string>
+#include <utility>
 #include <vector>
 
 #ifdef ENABLE_EXPERIMENTAL_SIMD_SUPPORT_NEON
 #if defined(__ARM_NEON)
 #include <arm_neon.h>
-
-#include <cstdint>
 #else
 #error ARM NEON support required
 #endif
 #endif
 
+// SSE2 is part of the x86-64 baseline. AVX2 kernels are compiled with a
+// function-level target attribute and are only selected if the host CPU
+// supports them, so no -march flag is needed.
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define MCBOPOMOFO_X86_64_SIMD_KERNELS 1
+#include <immintrin.h>
+#endif
+
 namespace McBopomofo {
 
 namespace {
 
+// The scanning primitives used by the binary search and the linear scan. All
+// kernels must return the same results; they only differ in speed.
+struct ScanKernelFunctions {
+  ParselessPhraseDB::ScanKernel kernel;
+
+  // Returns the position of the first occurrence of the character in
+  // [position, end), or end if not found.
+  const char* (*findNextCharacter)(const char* position, const char* end,
+                                   char character);
+
+  // Returns the start of the line that contains the character right before
+  // position, i.e. the position past the last linefeed in [begin, position),
+  // or begin if there is no linefeed.
+  const char* (*findLineStart)(const char* begin, const char* position);
+};
+
+const char* Scalar_FindNextCharacter(const char* position, const char* end,
+                                     char character) {
+  const char* cursor = position;
+  while (cursor != end && *cursor != character) {
+    ++cursor;
+  }
+  return cursor;
+}
+
+const char* Scalar_FindLineStart(const char* begin, const char* position) {
+  const char* cursor = position;
+  while (cursor != begin) {
+    --cursor;
+    if (*cursor == '\n') {
+      return cursor + 1;
+    }
+  }
+  return begin;
+}
+
+constexpr ScanKernelFunctions kScalarKernel = {
+    ParselessPhraseDB::ScanKernel::SCALAR,
+    Scalar_FindNextCharacter,
+    Scalar_FindLineStart,
+};
+
+#ifdef MCBOPOMOFO_X86_64_SIMD_KERNELS
+
+const char* SSE2_FindNextCharacter(const char* position, const char* end,
+                                   char character) {
+  const char* cursor = position;
+  const __m128i characters = _mm_set1_epi8(character);
+  while (end - cursor >= 16) {
+    const __m128i block =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(cursor));
+    const int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, characters));
+    if (mask != 0) {
+      return cursor + __builtin_ctz(mask);
+    }
+    cursor += 16;
+  }
+  return Scalar_FindNextCharacter(cursor, end, character);
+}
+
+const char* SSE2_FindLineStart(const char* begin, const char* position) {
+  const char* cursor = position;
+  const __m128i linefeeds = _mm_set1_epi8('\n');
+  while (cursor - begin >= 16) {
+    const char* blockStart = cursor - 16;
+    const __m128i block =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(blockStart));
+    const int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, linefeeds));
+    if (mask != 0) {
+      // The highest set bit is the last linefeed in the block.
+      return blockStart + (31 - __builtin_clz(mask)) + 1;
+    }
+    cursor = blockStart;
+  }
+  return Scalar_FindLineStart(begin, cursor);
+}
+
+__attribute__((target("avx2"))) const char* AVX2_FindNextCharacter(
+    const char* position, const char* end, char character) {
+  const char* cursor = position;
+  const __m256i characters = _mm256_set1_epi8(character);
+  while (end - cursor >= 32) {
+    const __m256i block =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cursor));
+    const auto mask = static_cast<uint32_t>(
+        _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, characters)));
+    if (mask != 0) {
+      return cursor + __builtin_ctz(mask);
+    }
+    cursor += 32;
+  }
+  return SSE2_FindNextCharacter(cursor, end, character);
+}
+
+__attribute__((target("avx2"))) const char* AVX2_FindLineStart(
+    const char* begin, const char* position) {
+  const char* cursor = position;
+  const __m256i linefeeds = _mm256_set1_epi8('\n');
+  while (cursor - begin >= 32) {
+    const char* blockStart = cursor - 32;
+    const __m256i block =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(blockStart));
+    const auto mask = static_cast<uint32_t>(
+        _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, linefeeds)));
+    if (mask != 0) {
+      return blockStart + (31 - __builtin_clz(mask)) + 1;
+    }
+    cursor = blockStart;
+  }
+  return SSE2_FindLineStart(begin, cursor);
+}
+
+constexpr ScanKernelFunctions kSSE2Kernel = {
+    ParselessPhraseDB::ScanKernel::SSE2,
+    SSE2_FindNextCharacter,
+    SSE2_FindLineStart,
+};
+
+constexpr ScanKernelFunctions kAVX2Kernel = {
+    ParselessPhraseDB::ScanKernel::AVX2,
+    AVX2_FindNextCharacter,
+    AVX2_FindLineStart,
+};
+
+#endif
+
 #ifdef ENABLE_EXPERIMENTAL_SIMD_SUPPORT_NEON
 
 int FirstNonZeroLane16(uint8x16_t value) {
@@ -67,13 +206,9 @@ int LastNonZeroLane16(uint8x16_t value) {
   return static_cast<int>(vmaxvq_u8(vandq_u8(value, laneIndices))) - 1;
 }
 
-#endif
-
-const char* FindNextCharacter(const char* position, const char* end,
-                              char character) {
+const char* NEON_FindNextCharacter(const char* position, const char* end,
+                                   char character) {
   const char* cursor = position;
-
-#ifdef ENABLE_EXPERIMENTAL_SIMD_SUPPORT_NEON
   const uint8x16_t characters = vdupq_n_u8(static_cast<uint8_t>(character));
   while (end - cursor >= 16) {
     const uint8x16_t block = vld1q_u8(reinterpret_cast<const uint8_t*>(cursor));
@@ -83,18 +218,11 @@ const char* FindNextCharacter(const char* position, const char* end,
     }
     cursor += 16;
   }
-#endif
-
-  while (cursor != end && *cursor != character) {
-    ++cursor;
-  }
-  return cursor;
+  return Scalar_FindNextCharacter(cursor, end, character);
 }
 
-const char* FindLineStart(const char* begin, const char* position) {
+const char* NEON_FindLineStart(const char* begin, const char* position) {
   const char* cursor = position;
-
-#ifdef ENABLE_EXPERIMENTAL_SIMD_SUPPORT_NEON
   const uint8x16_t linefeeds = vdupq_n_u8(static_cast<uint8_t>('\n'));
   while (cursor - begin >= 16) {
     const char* blockStart = cursor - 16;
@@ -106,19 +234,232 @@ const char* FindLineStart(const char* begin, const char* position) {
     }
     cursor = blockStart;
   }
+  return Scalar_FindLineStart(begin, cursor);
+}
+
+constexpr ScanKernelFunctions kNEONKernel = {
+    ParselessPhraseDB::ScanKernel::NEON,
+    NEON_FindNextCharacter,
+    NEON_FindLineStart,
+};
+
 #endif
 
-  while (cursor != begin) {
-    --cursor;
-    if (*cursor == '\n') {
-      return cursor + 1;
+const ScanKernelFunctions* KernelFunctions(ParselessPhraseDB::ScanKernel k) {
+  switch (k) {
+    case ParselessPhraseDB::ScanKernel::SCALAR:
+      return &kScalarKernel;
+    case ParselessPhraseDB::ScanKernel::SSE2:
+#ifdef MCBOPOMOFO_X86_64_SIMD_KERNELS
+      return &kSSE2Kernel;
+#else
+      return nullptr;
+#endif
+    case ParselessPhraseDB::ScanKernel::AVX2:
+#ifdef MCBOPOMOFO_X86_64_SIMD_KERNELS
+      return __builtin_cpu_supports("avx2") ? &kAVX2Kernel : nullptr;
+#else
+      return nullptr;
+#endif
+    case ParselessPhraseDB::ScanKernel::NEON:
+#ifdef ENABLE_EXPERIMENTAL_SIMD_SUPPORT_NEON
+      return &kNEONKernel;
+#else
+      return nullptr;
+#endif
+  }
+  return nullptr;
+}
+
+const ScanKernelFunctions* BestKernelFunctions() {
+  for (auto k : {ParselessPhraseDB::ScanKernel::NEON,
+                 ParselessPhraseDB::ScanKernel::AVX2,
+                 ParselessPhraseDB::ScanKernel::SSE2}) {
+    if (const ScanKernelFunctions* f = KernelFunctions(k); f != nullptr) {
+      return f;
     }
   }
-  return begin;
+  return &kScalarKernel;
+}
+
+std::atomic<const ScanKernelFunctions*>& ActiveKernelFunctions() {
+  static std::atomic<const ScanKernelFunctions*> functions(
+      BestKernelFunctions());
+  return functions;
+}
+
+const ScanKernelFunctions& Kernel() {
+  return *ActiveKernelFunctions().load(std::memory_order_relaxed);
 }
 
 }  // namespace
 
+std::vector<ParselessPhraseDB::ScanKernel>
+ParselessPhraseDB::SupportedScanKernels() {
+  std::vector<ScanKernel> kernels;
+  for (auto k : {ScanKernel::SCALAR, ScanKernel::SSE2, ScanKernel::AVX2,
+                 ScanKernel::NEON}) {
+    if (KernelFunctions(k) != nullptr) {
+      kernels.push_back(k);
+    }
+  }
+  return kernels;
+}
+
+ParselessPhraseDB::ScanKernel ParselessPhraseDB::ActiveScanKernel() {
+  return Kernel().kernel;
+}
+
+bool ParselessPhraseDB::SetScanKernel(ScanKernel kernel) {
+  const ScanKernelFunctions* functions = KernelFunctions(kernel);
+  if (functions == nullptr) {
+    return false;
+  }
+  ActiveKernelFunctions().store(functions, std::memory_order_relaxed);
+  return true;
+}
+
+const char* ParselessPhraseDB::ScanKernelName(ScanKernel kernel) {
+  switch (kernel) {
+    case ScanKernel::SCALAR:
+      return "scalar";
+    case ScanKernel::SSE2:
+      return "sse2";
+    case ScanKernel::AVX2:
+      return "avx2";
+    case ScanKernel::NEON:
+      return "neon";
+  }
+  return "unknown";
+}
+
+const char* ParselessPhraseDB::FindRowEnd(const char* row, const char* end) {
+  return Kernel().findNextCharacter(row, end, '\n');
+}
+
+ParselessPhraseDB::Row ParselessPhraseDB::DecodeRow(
+    const std::string_view& row) {
+  Row result;
+
+  // Move ahead until we encounter the first space. This is the key.
+  size_t keyEnd = row.find(' ');
+  if (keyEnd == std::string_view::npos) {
+    result.key = row;
+    return result;
+  }
+  result.key = row.substr(0, keyEnd);
+
+  // Read past the space. What follows up to the second space is the value.
+  std::string_view rest = row.substr(keyEnd + 1);
+  size_t valueEnd = rest.find(' ');
+  if (valueEnd == std::string_view::npos) {
+    result.value = rest;
+    return result;
+  }
+  result.value = rest.substr(0, valueEnd);
+
+  // The remainder, if it exists, is the score.
+  ParseScore(rest.substr(valueEnd + 1), result.score);
+  return result;
+}
+
+// Powers of ten that are exactly representable as doubles.
+static constexpr double kExactPowersOfTen[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+bool ParselessPhraseDB::ParseScore(const std::string_view& text,
+                                   double& score) {
+  // Scan the longest prefix of the form -?\d*(\.\d*)?([eE][-+]?\d+)? and
+  // collect up to 19 significant digits as an integer.
+  const char* p = text.data();
+  const char* end = p + text.size();
+  const char* begin = p;
+  bool negative = false;
+  if (p != end && *p == '-') {
+    negative = true;
+    ++p;
+  }
+
+  uint64_t mantissa = 0;
+  int significantDigits = 0;
+  int exponent = 0;
+  bool hasDigits = false;
+  for (; p != end && *p >= '0' && *p <= '9'; ++p) {
+    hasDigits = true;
+    if (mantissa == 0 && *p == '0') {
+      continue;
+    }
+    if (significantDigits < 19) {
+      mantissa = mantissa * 10 + static_cast<uint64_t>(*p - '0');
+    } else {
+      ++exponent;
+    }
+    ++significantDigits;
+  }
+  if (p != end && *p == '.') {
+    ++p;
+    for (; p != end && *p >= '0' && *p <= '9'; ++p) {
+      hasDigits = true;
+      if (mantissa == 0 && *p == '0') {
+        --exponent;
+        continue;
+      }
+      if (significantDigits < 19) {
+        mantissa = mantissa * 10 + static_cast<uint64_t>(*p - '0');
+        --exponent;
+      }
+      ++significantDigits;
+    }
+  }
+  if (!hasDigits) {
+    return false;
+  }
+  if (p != end && (*p == 'e' || *p == 'E')) {
+    const char* q = p + 1;
+    bool negativeExponent = false;
+    if (q != end && (*q == '-' || *q == '+')) {
+      negativeExponent = *q == '-';
+      ++q;
+    }
+    if (q != end && *q >= '0' && *q <= '9') {
+      int value = 0;
+      for (; q != end && *q >= '0' && *q <= '9'; ++q) {
+        if (value < 100000) {
+          value = value * 10 + (*q - '0');
+        }
+      }
+      exponent += negativeExponent ? -value : value;
+      p = q;
+    }
+  }
+
+  // If both the digits and the power of ten are exact doubles, a single
+  // multiplication or division is correctly rounded. This covers the scores
+  // in the data, which have no more than a dozen digits.
+  constexpr uint64_t kMaxExactInteger = uint64_t{1} << 53;
+  if (significantDigits <= 19 && mantissa <= kMaxExactInteger &&
+      exponent >= -22 && exponent <= 22) {
+    double value = static_cast<double>(mantissa);
+    value = exponent < 0 ? value / kExactPowersOfTen[-exponent]
+                         : value * kExactPowersOfTen[exponent];
+    score = negative ? -value : value;
+    return true;
+  }
+
+  // Otherwise let the stream do the rounding in the classic locale, which,
+  // unlike std::stod, does not depend on the current C locale.
+  std::istringstream stream(std::string(begin, p));
+  stream.imbue(std::locale::classic());
+  double value = 0;
+  stream >> value;
+  if (stream.fail()) {
+    return false;
+  }
+  score = value;
+  return true;
+}
+
 bool ParselessPhraseDB::ValidatePragma(const char* buf, size_t length) {
   if (length < SORTED_PRAGMA_HEADER.length()) {
     return false;
@@ -160,26 +501,11 @@ ParselessPhraseDB::ParselessPhraseDB(const char* buf, size_t length,
 
 std::vector<std::string_view> ParselessPhraseDB::findRows(
     const std::string_view& key) const {
-  std::vector<std::string_view> rows;
-
-  const char* ptr = findFirstMatchingLine(key);
-  if (ptr == nullptr) {
-    return rows;
-  }
-
-  while (ptr + key.length() <= end_ &&
-         memcmp(ptr, key.data(), key.length()) == 0) {
-    const char* eol = FindNextCharacter(ptr, end_, '\n');
-
-    rows.emplace_back(ptr, eol - ptr);
-    if (eol == end_) {
-      break;
-    }
-
-    ptr = ++eol;
+  std::vector<std::string_view> results;
+  for (std::string_view row : rows(key)) {
+    results.emplace_back(row);
   }
-
-  return rows;
+  return results;
 }
 
 // Implements a binary search that returns the pointer to the first matching
@@ -194,12 +520,22 @@ const char* ParselessPhraseDB::findFirstMatchingLine(
     return begin_;
   }
 
+  if (hasLineIndex_ || hasJumpTable_) {
+    const char* row = lowerBound(key);
+    if (row != nullptr && row + key.length() <= end_ &&
+        memcmp(row, key.data(), key.length()) == 0) {
+      return row;
+    }
+    return nullptr;
+  }
+
+  const ScanKernelFunctions& kernel = Kernel();
   const char* top = begin_;
   const char* bottom = end_;
 
   while (top < bottom) {
     const char* mid = top + ((bottom - top) / 2);
-    const char* ptr = FindLineStart(begin_, mid);
+    const char* ptr = kernel.findLineStart(begin_, mid);
 
     const char* prev = nullptr;
     if (ptr != begin_) {
@@ -229,7 +565,7 @@ const char* ParselessPhraseDB::findFirstMatchingLine(
     }
 
     // Move the prev so that it reaches the previous line.
-    prev = FindLineStart(begin_, prev);
+    prev = kernel.findLineStart(begin_, prev);
 
     int prev_cmp = memcmp(prev, key.data(), key.length());
 
@@ -245,17 +581,295 @@ const char* ParselessPhraseDB::findFirstMatchingLine(
   return nullptr;
 }
 
+const char* ParselessPhraseDB::lowerBound(const std::string_view& key) const {
+  return search(key, /*upper=*/false);
+}
+
+std::string_view ParselessPhraseDB::prefixRange(
+    const std::string_view& key) const {
+  const char* first = findFirstMatchingLine(key);
+  if (first == nullptr) {
+    return {};
+  }
+  const char* last = search(key, /*upper=*/true);
+  if (last == nullptr) {
+    last = end_;
+  }
+  return std::string_view(first, last - first);
+}
+
+std::vector<std::string_view> ParselessPhraseDB::topRowsByScore(
+    const std::string_view& key, size_t count) const {
+  using ScoredRow = std::pair<double, std::string_view>;
+
+  // Orders the better row first. Rows with the same score keep their order in
+  // the DB, which the row position reflects.
+  auto better = [](const ScoredRow& a, const ScoredRow& b) {
+    if (a.first != b.first) {
+      return a.first > b.first;
+    }
+    return a.second.data() < b.second.data();
+  };
+
+  if (count == 0) {
+    return {};
+  }
+
+  // A heap of the best rows so far whose top is the worst of them.
+  std::vector<ScoredRow> heap;
+  heap.reserve(count);
+  for (std::string_view row : rows(key)) {
+    ScoredRow scored(LastColumnScore(row), row);
+    if (heap.size() < count) {
+      heap.push_back(scored);
+      std::push_heap(heap.begin(), heap.end(), better);
+    } else if (better(scored, heap.front())) {
+      std::pop_heap(heap.begin(), heap.end(), better);
+      heap.back() = scored;
+      std::push_heap(heap.begin(), heap.end(), better);
+    }
+  }
+
+  std::sort_heap(heap.begin(), heap.end(), better);
+  std::vector<std::string_view> results;
+  results.reserve(heap.size());
+  for (const auto& scored : heap) {
+    results.push_back(scored.second);
+  }
+  return results;
+}
+
+double ParselessPhraseDB::LastColumnScore(const std::string_view& row) {
+  size_t separator = row.rfind(' ');
+  double score = std::numeric_limits<double>::lowest();
+  if (separator != std::string_view::npos) {
+    ParseScore(row.substr(separator + 1), score);
+  }
+  return score;
+}
+
+const char* ParselessPhraseDB::search(const std::string_view& key,
+                                      bool upper) const {
+  const char* top = begin_;
+  const char* bottom = end_;
+  if (hasJumpTable_) {
+    narrowWindow(key, top, bottom);
+  }
+
+  if (hasLineIndex_) {
+    return indexedSearch(key, upper, top, bottom);
+  }
+
+  // Invariant: all rows before top precede the key, and the row at bottom, if
+  // any, does not.
+  const ScanKernelFunctions& kernel = Kernel();
+  while (top < bottom) {
+    const char* mid = top + ((bottom - top) / 2);
+    const char* row = kernel.findLineStart(top, mid + 1);
+    if (rowPrecedes(row, key, upper)) {
+      top = kernel.findNextCharacter(row, end_, '\n');
+      if (top != end_) {
+        ++top;
+      }
+    } else {
+      bottom = row;
+    }
+  }
+
+  return top == end_ ? nullptr : top;
+}
+
+bool ParselessPhraseDB::buildLineIndex() {
+  if (static_cast<size_t>(end_ - begin_) > UINT32_MAX) {
+    return false;
+  }
+
+  const ScanKernelFunctions& kernel = Kernel();
+  std::vector<uint32_t> lineStarts;
+  const char* ptr = begin_;
+  while (ptr < end_) {
+    lineStarts.push_back(static_cast<uint32_t>(ptr - begin_));
+    ptr = kernel.findNextCharacter(ptr, end_, '\n');
+    if (ptr == end_) {
+      break;
+    }
+    ++ptr;
+  }
+  lineStarts.shrink_to_fit();
+
+  lineStarts_ = std::move(lineStarts);
+  hasLineIndex_ = true;
+  return true;
+}
+
+bool ParselessPhraseDB::rowPrecedes(const char* row,
+                                    const std::string_view& key,
+                                    bool upper) const {
+  size_t length = std::min(key.length(), static_cast<size_t>(end_ - row));
+  int cmp = memcmp(row, key.data(), length);
+  if (cmp != 0) {
+    return cmp < 0;
+  }
+  return length < key.length() || upper;
+}
+
+const char* ParselessPhraseDB::indexedSearch(const std::string_view& key,
+                                             bool upper, const char* top,
+                                             const char* bottom) const {
+  size_t low = std::lower_bound(lineStarts_.begin(), lineStarts_.end(),
+                                static_cast<uint32_t>(top - begin_)) -
+               lineStarts_.begin();
+  size_t high = std::lower_bound(lineStarts_.begin() + low, lineStarts_.end(),
+                                 static_cast<uint32_t>(bottom - begin_)) -
+                lineStarts_.begin();
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    if (rowPrecedes(begin_ + lineStarts_[mid], key, upper)) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return low == lineStarts_.size() ? nullptr : begin_ + lineStarts_[low];
+}
+
+bool ParselessPhraseDB::buildJumpTable() {
+  if (static_cast<size_t>(end_ - begin_) > UINT32_MAX) {
+    return false;
+  }
+
+  const ScanKernelFunctions& kernel = Kernel();
+  std::vector<uint64_t> prefixes;
+  std::vector<uint32_t> offsets;
+  const char* ptr = begin_;
+  while (ptr < end_) {
+    PackedPrefix packed = PackPrefix(std::string_view(ptr, end_ - ptr));
+    if (!prefixes.empty() && packed.prefix <= prefixes.back()) {
+      if (packed.prefix < prefixes.back()) {
+        // The rows are not sorted.
+        return false;
+      }
+    } else {
+      prefixes.push_back(packed.prefix);
+      offsets.push_back(static_cast<uint32_t>(ptr - begin_));
+    }
+
+    ptr = kernel.findNextCharacter(ptr, end_, '\n');
+    if (ptr == end_) {
+      break;
+    }
+    ++ptr;
+  }
+  prefixes.shrink_to_fit();
+  offsets.shrink_to_fit();
+
+  jumpTablePrefixes_ = std::move(prefixes);
+  jumpTableOffsets_ = std::move(offsets);
+  hasJumpTable_ = true;
+  return true;
+}
+
+bool ParselessPhraseDB::buildKeyFilter() {
+  // Visits the distinct key columns. Since the rows are sorted, the rows of
+  // a key are adjacent, and comparing with the previous key is enough.
+  const ScanKernelFunctions& kernel = Kernel();
+  auto forEachKey = [&](auto&& visitor) {
+    std::string_view previous;
+    bool first = true;
+    const char* ptr = begin_;
+    while (ptr < end_) {
+      const char* rowEnd = kernel.findNextCharacter(ptr, end_, '\n');
+      const char* space = kernel.findNextCharacter(ptr, rowEnd, ' ');
+      std::string_view key(ptr, space - ptr);
+      if (space != rowEnd && (first || key != previous)) {
+        visitor(key);
+        previous = key;
+        first = false;
+      }
+      if (rowEnd == end_) {
+        break;
+      }
+      ptr = rowEnd + 1;
+    }
+  };
+
+  size_t keyCount = 0;
+  forEachKey([&keyCount](std::string_view) { ++keyCount; });
+  keyFilter_.reset(keyCount);
+  forEachKey([this](std::string_view key) { keyFilter_.add(key); });
+  return true;
+}
+
+// Rows that start with the key share its packed prefix if the key has two
+// complete code points, and otherwise have packed prefixes that start with
+// the bytes of the key. Either way they are in a contiguous run of entries.
+// All rows before the run are less than the key and all rows after it are
+// greater, so both bounds of the key are inside the window or at its end.
+void ParselessPhraseDB::narrowWindow(const std::string_view& key,
+                                     const char*& top,
+                                     const char*& bottom) const {
+  PackedPrefix packed = PackPrefix(key);
+  uint64_t last = packed.prefix;
+  if (!packed.complete) {
+    last |= packed.length == sizeof(uint64_t)
+                ? 0
+                : ~uint64_t{0} >> (packed.length * 8);
+  }
+
+  auto first = std::lower_bound(jumpTablePrefixes_.begin(),
+                                jumpTablePrefixes_.end(), packed.prefix);
+  auto past = std::upper_bound(first, jumpTablePrefixes_.end(), last);
+  auto offset = [this](auto it) {
+    return it == jumpTablePrefixes_.end()
+               ? end_
+               : begin_ + jumpTableOffsets_[it - jumpTablePrefixes_.begin()];
+  };
+  top = offset(first);
+  bottom = offset(past);
+}
+
+ParselessPhraseDB::PackedPrefix ParselessPhraseDB::PackPrefix(
+    const std::string_view& text) {
+  PackedPrefix packed;
+  size_t codePoints = 0;
+  size_t end = 0;
+  while (codePoints < 2 && end < text.length()) {
+    auto lead = static_cast<unsigned char>(text[end]);
+    size_t length = 1;
+    if ((lead & 0xe0) == 0xc0) {
+      length = 2;
+    } else if ((lead & 0xf0) == 0xe0) {
+      length = 3;
+    } else if ((lead & 0xf8) == 0xf0) {
+      length = 4;
+    }
+    end += length;
+    ++codePoints;
+  }
+  packed.complete = codePoints == 2 && end <= text.length();
+  packed.length = std::min(end, text.length());
+
+  for (size_t i = 0; i < sizeof(uint64_t); ++i) {
+    packed.prefix <<= 8;
+    if (i < packed.length) {
+      packed.prefix |= static_cast<unsigned char>(text[i]);
+    }
+  }
+  return packed;
+}
+
 std::vector<std::string> ParselessPhraseDB::reverseFindRows(
     const std::string_view& value) const {
   std::vector<std::string> rows;
 
+  const ScanKernelFunctions& kernel = Kernel();
   const char* recordBegin = begin_;
 
   while (recordBegin < end_) {
     const char* ptr = recordBegin;
 
     // skip over the key to find the field separator
-    ptr = FindNextCharacter(ptr, end_, ' ');
+    ptr = kernel.findNextCharacter(ptr, end_, ' ');
     // skip over the field separator. there should be just one, but loop just in
     // case.
     while (ptr < end_ && *ptr == ' ') {
@@ -263,7 +877,7 @@ std::vector<std::string> ParselessPhraseDB::reverseFindRows(
     }
 
     // now walk to the end of this record
-    const char* recordEnd = FindNextCharacter(ptr, end_, '\n');
+    const char* recordEnd = kernel.findNextCharacter(ptr, end_, '\n');
 
     if (ptr + value.length() < end_ &&
         memcmp(ptr, value.data(), value.length()) == 0) {
@@ -25,11 +25,16 @@
 #define SRC_ENGINE_PARSELESSPHRASEDB_H_
 
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
 #include <memory>
 #include <string>
 #include <string_view>
 #include <vector>
 
+#include "KeyFilter.h"
+
 namespace McBopomofo {
 
 constexpr std::string_view SORTED_PRAGMA_HEADER =
@@ -55,8 +60,88 @@ class ParselessPhraseDB {
   // at the end.
   std::vector<std::string_view> findRows(const std::string_view& key) const;
 
+  class RowIterator;
+  class RowRange;
+
+  // Returns the rows that match the key as a lazy range. The same prefix-match
+  // rule as findRows() applies, but each row is only located when the
+  // iteration reaches it, so a lookup that stops early does not allocate or
+  // scan the remaining rows. The range refers to the key, which must outlive
+  // it.
+  RowRange rows(const std::string_view& key) const;
+
   const char* findFirstMatchingLine(const std::string_view& key) const;
 
+  // Returns the first row that is not less than the key, or nullptr if there
+  // is no such row. Only the first key.length() bytes of each row are
+  // compared, so if any rows match the key, they start at the returned row.
+  // This is the starting point for range scans.
+  const char* lowerBound(const std::string_view& key) const;
+
+  // Returns the rows that match the key as one contiguous block: it starts at
+  // the first matching row and ends where the next row starts, or at the end
+  // of the DB. Returns an empty view if no rows match. Both ends are found by
+  // binary search, so this takes O(log n) regardless of the number of rows.
+  std::string_view prefixRange(const std::string_view& key) const;
+
+  // Returns up to count rows that match the key, ordered by the score in
+  // their last column, highest first. Rows without a score rank last, and
+  // rows with the same score keep their order in the DB. This keeps only
+  // count rows at a time, so it neither copies nor sorts the whole range.
+  std::vector<std::string_view> topRowsByScore(const std::string_view& key,
+                                               size_t count) const;
+
+  // Builds an index of the line starts so that lookups can binary search over
+  // rows instead of over bytes. The index is built with a single pass of the
+  // active scan kernel and takes 4 bytes per row. Returns false, leaving the
+  // DB unindexed, if the block is too large for 32-bit offsets. This must not
+  // be called while other threads are using the DB.
+  bool buildLineIndex();
+
+  bool hasLineIndex() const { return hasLineIndex_; }
+
+  // Returns the memory used by the line index in bytes.
+  size_t lineIndexSize() const {
+    return lineStarts_.capacity() * sizeof(uint32_t);
+  }
+
+  // Builds a jump table that maps the first two code points of a key to the
+  // byte window of the rows that start with them, so that lookups only need
+  // a short local search. Since the keys of McBopomofo's data use a small
+  // alphabet, the table only takes a few KB. Returns false, leaving the DB
+  // without the table, if the block is too large for 32-bit offsets or if the
+  // rows are not sorted. It can be combined with the line index, and the same
+  // threading rule applies.
+  bool buildJumpTable();
+
+  bool hasJumpTable() const { return hasJumpTable_; }
+
+  // Returns the memory used by the jump table in bytes.
+  size_t jumpTableSize() const {
+    return jumpTablePrefixes_.capacity() * sizeof(uint64_t) +
+           jumpTableOffsets_.capacity() * sizeof(uint32_t);
+  }
+
+  // Builds a filter over the key columns of the rows, that is, the text up to
+  // the first space, so that exact lookups can skip the search for most
+  // missing keys. Rows without a space are left out since no exact lookup
+  // matches them. The filter takes about 10 bits per distinct key, or more if
+  // the rows are not sorted. The same threading rule as buildLineIndex()
+  // applies.
+  bool buildKeyFilter();
+
+  bool hasKeyFilter() const { return keyFilter_.isBuilt(); }
+
+  // The key filter, which lets every key pass if it has not been built.
+  const KeyFilter& keyFilter() const { return keyFilter_; }
+
+  // Returns false if no row has exactly the key as its key column, as told by
+  // the key filter. Keys that contain a space bypass the filter.
+  bool mayHaveKey(const std::string_view& key) const {
+    return key.find(' ') != std::string_view::npos ||
+           keyFilter_.mayContain(key);
+  }
+
   // Find the rows whose text past the key column plus the field separator
   // is a prefix match of the given value. For example, if the row is
   // "foo bar -1.00", the values "b", "ba", "bar", "bar ", "bar -1.00" are
@@ -65,18 +150,178 @@ class ParselessPhraseDB {
   // the underlying data is sorted by keys.
   std::vector<std::string> reverseFindRows(const std::string_view& value) const;
 
+  // A "key value score" row decoded in place. The views point into the
+  // underlying block of the DB that the row comes from.
+  struct Row {
+    std::string_view key;
+    std::string_view value;
+    double score = 0;
+  };
+
+  // Decodes a row without copying. Missing columns are left empty, and a
+  // missing or malformed score is decoded as 0.
+  static Row DecodeRow(const std::string_view& row);
+
+  // Parses a score column. Unlike std::stod, this does not depend on the
+  // current C locale, and it only allocates for numbers with more than 19
+  // significant digits or large exponents. Returns false if the text is not
+  // a well-formed number, in which case score is not modified.
+  static bool ParseScore(const std::string_view& text, double& score);
+
   static bool ValidatePragma(const char* buf, size_t length);
 
+  // The kernels that can be used for scanning rows. SSE2 and AVX2 are only
+  // available on x86-64, and NEON only if ENABLE_EXPERIMENTAL_SIMD_SUPPORT_NEON
+  // is defined. The best kernel supported by the host CPU is selected at
+  // runtime, so the same binary works on every host.
+  enum class ScanKernel {
+    SCALAR,
+    SSE2,
+    AVX2,
+    NEON,
+  };
+
+  // Returns the kernels that the host CPU supports.
+  static std::vector<ScanKernel> SupportedScanKernels();
+
+  static ScanKernel ActiveScanKernel();
+
+  // Overrides the kernel used by all DB instances. This is meant for testing
+  // and benchmarking. Returns false if the kernel is not supported.
+  static bool SetScanKernel(ScanKernel kernel);
+
+  static const char* ScanKernelName(ScanKernel kernel);
+
   // Convenient function for validating and returning a DB instance. nullptr if
   // the block is empty or is not valid.
   static std::unique_ptr<ParselessPhraseDB> CreateValidatedDB(const char* buf,
                                                               size_t length);
 
  private:
+  // Returns the position of the linefeed that ends the row, or end.
+  static const char* FindRowEnd(const char* row, const char* end);
+
+  // Returns true if the first key.length() bytes starting at row are less
+  // than the key, or, if upper is true, less than or equal to the key.
+  bool rowPrecedes(const char* row, const std::string_view& key,
+                   bool upper) const;
+
+  // Returns the first row that rowPrecedes() is false for, or nullptr.
+  const char* search(const std::string_view& key, bool upper) const;
+
+  const char* indexedSearch(const std::string_view& key, bool upper,
+                            const char* top, const char* bottom) const;
+
+  // Returns the score in the last column of the row, or the lowest double if
+  // there is none.
+  static double LastColumnScore(const std::string_view& row);
+
+  // The bytes of the first two code points of a text, packed big-endian and
+  // zero-padded so that comparing the numbers is the same as comparing the
+  // bytes. complete is false if the text ends before the second code point
+  // does.
+  struct PackedPrefix {
+    uint64_t prefix = 0;
+    size_t length = 0;
+    bool complete = false;
+  };
+
+  static PackedPrefix PackPrefix(const std::string_view& text);
+
+  // Narrows [top, bottom) to the window that contains the bounds of the key
+  // using the jump table.
+  void narrowWindow(const std::string_view& key, const char*& top,
+                    const char*& bottom) const;
+
   const char* begin_;
   const char* end_;
+  bool hasLineIndex_ = false;
+  std::vector<uint32_t> lineStarts_;
+  bool hasJumpTable_ = false;
+  std::vector<uint64_t> jumpTablePrefixes_;
+  std::vector<uint32_t> jumpTableOffsets_;
+  KeyFilter keyFilter_;
 };
 
+// A forward iterator over the rows that match a key. The end iterator is
+// default-constructed.
+class ParselessPhraseDB::RowIterator {
+ public:
+  using iterator_category = std::forward_iterator_tag;
+  using value_type = std::string_view;
+  using difference_type = std::ptrdiff_t;
+  using pointer = const std::string_view*;
+  using reference = const std::string_view&;
+
+  RowIterator() = default;
+
+  reference operator*() const { return row_; }
+  pointer operator->() const { return &row_; }
+
+  RowIterator& operator++() {
+    const char* next = row_.data() + row_.length();
+    row_ = next == end_ ? std::string_view() : MatchRow(next + 1, end_, key_);
+    return *this;
+  }
+
+  RowIterator operator++(int) {
+    RowIterator previous = *this;
+    ++*this;
+    return previous;
+  }
+
+  bool operator==(const RowIterator& other) const {
+    return row_.data() == other.row_.data();
+  }
+
+  bool operator!=(const RowIterator& other) const { return !(*this == other); }
+
+ private:
+  friend class ParselessPhraseDB;
+
+  RowIterator(const char* row, const char* end, std::string_view key)
+      : row_(row == nullptr ? std::string_view() : MatchRow(row, end, key)),
+        end_(end),
+        key_(key) {}
+
+  // Returns the row that starts at ptr if it matches the key, or an empty
+  // view with a null data pointer otherwise.
+  static std::string_view MatchRow(const char* ptr, const char* end,
+                                   std::string_view key) {
+    if (ptr + key.length() > end ||
+        memcmp(ptr, key.data(), key.length()) != 0) {
+      return {};
+    }
+    return std::string_view(ptr, FindRowEnd(ptr, end) - ptr);
+  }
+
+  std::string_view row_;
+  const char* end_ = nullptr;
+  std::string_view key_;
+};
+
+class ParselessPhraseDB::RowRange {
+ public:
+  RowIterator begin() const { return begin_; }
+  RowIterator end() const { return RowIterator(); }
+  bool empty() const { return begin_ == RowIterator(); }
+
+  // The first matching row. The range must not be empty.
+  std::string_view front() const { return *begin_; }
+
+ private:
+  friend class ParselessPhraseDB;
+
+  explicit RowRange(RowIterator begin) : begin_(begin) {}
+
+  RowIterator begin_;
+};
+
+inline ParselessPhraseDB::RowRange ParselessPhraseDB::rows(
+    const std::string_view& key) const {
+  return RowRange(RowIterator(findFirstMatchingLine(key), end_, key));
+}
+
 }  // namespace McBopomofo
 
 #endif  // SRC_ENGINE_PARSELESSPHRASEDB_H_
@@ -23,10 +23,14 @@
 
 #include <benchmark/benchmark.h>
 
+#include <algorithm>
+#include <cstdint>
 #include <iomanip>
 #include <random>
 #include <sstream>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
 #include "ParselessPhraseDB.h"
@@ -51,7 +55,8 @@ std::string MakeRows() {
     const size_t valueLength =
         kMinimumValueLength +
         i % (kMaximumValueLength - kMinimumValueLength + 1);
-    stream << MakeKey(i) << ' ' << std::string(valueLength, 'v') << '\n';
+    stream << MakeKey(i) << ' ' << std::string(valueLength, 'v') << " -"
+           << (i * 7919) % 1000 << '\n';
   }
   return stream.str();
 }
@@ -74,22 +79,110 @@ class BenchmarkDataset {
   BenchmarkDataset()
       : rows_(MakeRows()),
         database_(rows_.data(), rows_.size()),
-        queryKeys_(MakeQueryKeys()) {}
+        indexedDatabase_(rows_.data(), rows_.size()),
+        queryKeys_(MakeQueryKeys()) {
+    indexedDatabase_.buildLineIndex();
+  }
 
+  const std::string& rows() const { return rows_; }
   const McBopomofo::ParselessPhraseDB& database() const { return database_; }
+  const McBopomofo::ParselessPhraseDB& indexedDatabase() const {
+    return indexedDatabase_;
+  }
   const std::vector<std::string>& queryKeys() const { return queryKeys_; }
 
  private:
   std::string rows_;
   McBopomofo::ParselessPhraseDB database_;
+  McBopomofo::ParselessPhraseDB indexedDatabase_;
   std::vector<std::string> queryKeys_;
 };
 
+// Registers one run per scan kernel supported by the host CPU.
+void ScanKernelArguments(benchmark::internal::Benchmark* benchmark) {
+  for (auto kernel : McBopomofo::ParselessPhraseDB::SupportedScanKernels()) {
+    benchmark->Arg(static_cast<int64_t>(kernel));
+  }
+}
+
+// Switches to the kernel of the run and restores the default when it ends.
+class ScopedScanKernel {
+ public:
+  explicit ScopedScanKernel(benchmark::State& state)
+      : original_(McBopomofo::ParselessPhraseDB::ActiveScanKernel()) {
+    auto kernel =
+        static_cast<McBopomofo::ParselessPhraseDB::ScanKernel>(state.range(0));
+    McBopomofo::ParselessPhraseDB::SetScanKernel(kernel);
+    state.SetLabel(McBopomofo::ParselessPhraseDB::ScanKernelName(kernel));
+  }
+
+  ~ScopedScanKernel() {
+    McBopomofo::ParselessPhraseDB::SetScanKernel(original_);
+  }
+
+ private:
+  McBopomofo::ParselessPhraseDB::ScanKernel original_;
+};
+
 void BM_ParselessPhraseDBFindFirstMatchingLine(benchmark::State& state) {
+  const ScopedScanKernel scanKernel(state);
+  const BenchmarkDataset dataset;
+  const auto& database = dataset.database();
+  const auto& queryKeys = dataset.queryKeys();
+
+  auto queryKey = queryKeys.begin();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(database.findFirstMatchingLine(*queryKey));
+    if (++queryKey == queryKeys.end()) {
+      queryKey = queryKeys.begin();
+    }
+  }
+}
+BENCHMARK(BM_ParselessPhraseDBFindFirstMatchingLine)
+    ->Apply(ScanKernelArguments);
+
+void BM_ParselessPhraseDBFindRows(benchmark::State& state) {
+  const ScopedScanKernel scanKernel(state);
   const BenchmarkDataset dataset;
   const auto& database = dataset.database();
   const auto& queryKeys = dataset.queryKeys();
 
+  auto queryKey = queryKeys.begin();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(database.findRows(*queryKey));
+    if (++queryKey == queryKeys.end()) {
+      queryKey = queryKeys.begin();
+    }
+  }
+}
+BENCHMARK(BM_ParselessPhraseDBFindRows)->Apply(ScanKernelArguments);
+
+// The one-time cost of the line index. Compare with the lookup benchmarks
+// below to see how many lookups it takes to pay for itself.
+void BM_ParselessPhraseDBBuildLineIndex(benchmark::State& state) {
+  const ScopedScanKernel scanKernel(state);
+  const std::string rows = MakeRows();
+
+  size_t indexSize = 0;
+  for (auto _ : state) {
+    McBopomofo::ParselessPhraseDB database(rows.data(), rows.size());
+    database.buildLineIndex();
+    indexSize = database.lineIndexSize();
+    benchmark::DoNotOptimize(indexSize);
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(rows.size()));
+  state.counters["index_bytes"] = static_cast<double>(indexSize);
+  state.counters["overhead_pct"] =
+      100.0 * static_cast<double>(indexSize) / static_cast<double>(rows.size());
+}
+BENCHMARK(BM_ParselessPhraseDBBuildLineIndex)->Apply(ScanKernelArguments);
+
+void BM_ParselessPhraseDBIndexedFindFirstMatchingLine(benchmark::State& state) {
+  const BenchmarkDataset dataset;
+  const auto& database = dataset.indexedDatabase();
+  const auto& queryKeys = dataset.queryKeys();
+
   auto queryKey = queryKeys.begin();
   for (auto _ : state) {
     benchmark::DoNotOptimize(database.findFirstMatchingLine(*queryKey));
@@ -98,9 +191,97 @@ void BM_ParselessPhraseDBFindFirstMatchingLine(benchmark::State& state) {
     }
   }
 }
-BENCHMARK(BM_ParselessPhraseDBFindFirstMatchingLine);
+BENCHMARK(BM_ParselessPhraseDBIndexedFindFirstMatchingLine);
+
+void BM_ParselessPhraseDBLowerBound(benchmark::State& state) {
+  const ScopedScanKernel scanKernel(state);
+  const BenchmarkDataset dataset;
+  const auto& database = dataset.database();
+  const auto& queryKeys = dataset.queryKeys();
+
+  auto queryKey = queryKeys.begin();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(database.lowerBound(*queryKey));
+    if (++queryKey == queryKeys.end()) {
+      queryKey = queryKeys.begin();
+    }
+  }
+}
+BENCHMARK(BM_ParselessPhraseDBLowerBound)->Apply(ScanKernelArguments);
+
+void BM_ParselessPhraseDBIndexedLowerBound(benchmark::State& state) {
+  const BenchmarkDataset dataset;
+  const auto& database = dataset.indexedDatabase();
+  const auto& queryKeys = dataset.queryKeys();
+
+  auto queryKey = queryKeys.begin();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(database.lowerBound(*queryKey));
+    if (++queryKey == queryKeys.end()) {
+      queryKey = queryKeys.begin();
+    }
+  }
+}
+BENCHMARK(BM_ParselessPhraseDBIndexedLowerBound);
+
+void BM_ParselessPhraseDBPrefixRange(benchmark::State& state) {
+  const BenchmarkDataset dataset;
+  const auto& database = dataset.database();
+
+  // Each prefix spans 100 rows.
+  std::vector<std::string> prefixes;
+  for (const auto& key : dataset.queryKeys()) {
+    prefixes.push_back(key.substr(0, key.length() - 2));
+  }
+
+  auto prefix = prefixes.begin();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(database.prefixRange(*prefix));
+    if (++prefix == prefixes.end()) {
+      prefix = prefixes.begin();
+    }
+  }
+}
+BENCHMARK(BM_ParselessPhraseDBPrefixRange);
+
+constexpr const char* kTopRowsPrefix = "key_0";
+constexpr size_t kTopRowsCount = 10;
+
+// Selects the best rows among the 10,000 rows that match the prefix.
+void BM_ParselessPhraseDBTopRowsByScore(benchmark::State& state) {
+  const BenchmarkDataset dataset;
+  const auto& database = dataset.database();
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        database.topRowsByScore(kTopRowsPrefix, kTopRowsCount));
+  }
+}
+BENCHMARK(BM_ParselessPhraseDBTopRowsByScore);
+
+// The same selection done by sorting all matching rows.
+void BM_ParselessPhraseDBFindRowsAndSort(benchmark::State& state) {
+  const BenchmarkDataset dataset;
+  const auto& database = dataset.database();
+
+  for (auto _ : state) {
+    std::vector<std::string_view> rows = database.findRows(kTopRowsPrefix);
+    std::vector<std::pair<double, std::string_view>> scored;
+    for (std::string_view row : rows) {
+      scored.emplace_back(
+          McBopomofo::ParselessPhraseDB::DecodeRow(row).score, row);
+    }
+    std::stable_sort(
+        scored.begin(), scored.end(),
+        [](const auto& a, const auto& b) { return a.first > b.first; });
+    scored.resize(std::min(scored.size(), kTopRowsCount));
+    benchmark::DoNotOptimize(scored.data());
+  }
+}
+BENCHMARK(BM_ParselessPhraseDBFindRowsAndSort);
 
 void BM_ParselessPhraseDBReverseFindRows(benchmark::State& state) {
+  const ScopedScanKernel scanKernel(state);
   const BenchmarkDataset dataset;
   const auto& database = dataset.database();
 
@@ -108,7 +289,7 @@ void BM_ParselessPhraseDBReverseFindRows(benchmark::State& state) {
     benchmark::DoNotOptimize(database.reverseFindRows("missing"));
   }
 }
-BENCHMARK(BM_ParselessPhraseDBReverseFindRows);
+BENCHMARK(BM_ParselessPhraseDBReverseFindRows)->Apply(ScanKernelArguments);
 
 }  // namespace
 
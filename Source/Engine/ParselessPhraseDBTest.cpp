@@ -21,8 +21,11 @@
 // FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
 // OTHER DEALINGS IN THE SOFTWARE.
 
+#include <algorithm>
+#include <cstdint>
 #include <cstdio>
 #include <filesystem>
+#include <iterator>
 #include <map>
 #include <memory>
 #include <sstream>
@@ -88,6 +91,74 @@ TEST(ParselessPhraseDBTest, FindRowsLongerExample) {
   EXPECT_EQ(db.findRows("A"), (StringViews{}));
 }
 
+TEST(ParselessPhraseDBTest, RowsAreLazy) {
+  std::string data = "a 1\na 2\na 3\nb 42\nb 1\nb 2\nc 7\nd 1";
+  ParselessPhraseDB db(data.c_str(), data.length());
+
+  ParselessPhraseDB::RowRange rows = db.rows("a");
+  ASSERT_FALSE(rows.empty());
+  EXPECT_EQ(rows.front(), "a 1");
+  EXPECT_EQ(rows.front().data(), data.data());
+
+  auto it = rows.begin();
+  EXPECT_EQ(*it, "a 1");
+  EXPECT_EQ(*++it, "a 2");
+  EXPECT_EQ(*it++, "a 2");
+  EXPECT_EQ(*it, "a 3");
+  EXPECT_EQ(it->length(), 3);
+  EXPECT_EQ(++it, rows.end());
+
+  EXPECT_EQ(StringViews(db.rows("b").begin(), db.rows("b").end()),
+            (StringViews{"b 42", "b 1", "b 2"}));
+  EXPECT_EQ(std::distance(db.rows("d").begin(), db.rows("d").end()), 1);
+  EXPECT_TRUE(db.rows("e").empty());
+  EXPECT_TRUE(db.rows("A").empty());
+}
+
+TEST(ParselessPhraseDBTest, DecodeRow) {
+  ParselessPhraseDB::Row row = ParselessPhraseDB::DecodeRow("ㄅㄚ 八 -3.27");
+  EXPECT_EQ(row.key, "ㄅㄚ");
+  EXPECT_EQ(row.value, "八");
+  EXPECT_DOUBLE_EQ(row.score, -3.27);
+
+  row = ParselessPhraseDB::DecodeRow("ㄅㄚ 八");
+  EXPECT_EQ(row.key, "ㄅㄚ");
+  EXPECT_EQ(row.value, "八");
+  EXPECT_EQ(row.score, 0);
+
+  row = ParselessPhraseDB::DecodeRow("ㄅㄚ");
+  EXPECT_EQ(row.key, "ㄅㄚ");
+  EXPECT_TRUE(row.value.empty());
+
+  row = ParselessPhraseDB::DecodeRow("ㄅㄚ 八 x");
+  EXPECT_EQ(row.value, "八");
+  EXPECT_EQ(row.score, 0);
+}
+
+TEST(ParselessPhraseDBTest, ParseScore) {
+  double score = 42;
+  EXPECT_TRUE(ParselessPhraseDB::ParseScore("-4.67026409", score));
+  EXPECT_DOUBLE_EQ(score, -4.67026409);
+  EXPECT_TRUE(ParselessPhraseDB::ParseScore("0", score));
+  EXPECT_EQ(score, 0);
+  EXPECT_TRUE(ParselessPhraseDB::ParseScore("-0.000123e2", score));
+  EXPECT_EQ(score, -0.0123);
+  EXPECT_TRUE(ParselessPhraseDB::ParseScore("12.5 trailing", score));
+  EXPECT_EQ(score, 12.5);
+
+  // Numbers that do not fit the exact fast path are still correctly rounded.
+  EXPECT_TRUE(ParselessPhraseDB::ParseScore("0.1234567890123456789012", score));
+  EXPECT_EQ(score, 0.1234567890123456789012);
+  EXPECT_TRUE(ParselessPhraseDB::ParseScore("-1.5e-30", score));
+  EXPECT_EQ(score, -1.5e-30);
+
+  score = 42;
+  EXPECT_FALSE(ParselessPhraseDB::ParseScore("", score));
+  EXPECT_FALSE(ParselessPhraseDB::ParseScore("x", score));
+  EXPECT_FALSE(ParselessPhraseDB::ParseScore("-.e5", score));
+  EXPECT_EQ(score, 42);
+}
+
 TEST(ParselessPhraseDBTest, FindFirstMatchingLineLongerExample) {
   std::string data = "a 1\na 2\na 3\nb 42\nb 1\nb 2\nc 7\nd 1";
   ParselessPhraseDB db(data.c_str(), data.length());
@@ -135,6 +206,218 @@ TEST(ParselessPhraseDBTest, FindFirstMatchingLineWithLongRows) {
   EXPECT_EQ(db.findFirstMatchingLine("d"), nullptr);
 }
 
+TEST(ParselessPhraseDBTest, AllScanKernelsAgree) {
+  // Mix short and long rows so that every kernel crosses block boundaries
+  // and also handles the scalar tails.
+  std::string data;
+  std::vector<std::string> keys;
+  for (char c = 'a'; c <= 'z'; ++c) {
+    std::string key(1, c);
+    keys.push_back(key);
+    for (int i = 0; i < (c - 'a') % 4 + 1; ++i) {
+      size_t length = ((c - 'a') * 37 + i * 13) % 97;
+      data += key + " " + std::string(length, 'x') +
+              (i % 2 == 0 ? " target" : "") + "\n";
+    }
+  }
+  data.pop_back();
+  keys.emplace_back("zz");
+
+  ParselessPhraseDB::ScanKernel original =
+      ParselessPhraseDB::ActiveScanKernel();
+  ASSERT_TRUE(ParselessPhraseDB::SetScanKernel(
+      ParselessPhraseDB::ScanKernel::SCALAR));
+
+  ParselessPhraseDB db(data.c_str(), data.length());
+  std::vector<StringViews> expectedRows;
+  for (const auto& key : keys) {
+    expectedRows.push_back(db.findRows(key));
+  }
+  std::vector<std::string> expectedReverse = db.reverseFindRows("target");
+  EXPECT_FALSE(expectedReverse.empty());
+
+  for (auto kernel : ParselessPhraseDB::SupportedScanKernels()) {
+    SCOPED_TRACE(ParselessPhraseDB::ScanKernelName(kernel));
+    ASSERT_TRUE(ParselessPhraseDB::SetScanKernel(kernel));
+    EXPECT_EQ(ParselessPhraseDB::ActiveScanKernel(), kernel);
+    for (size_t i = 0; i < keys.size(); ++i) {
+      EXPECT_EQ(db.findRows(keys[i]), expectedRows[i]);
+    }
+    EXPECT_EQ(db.reverseFindRows("target"), expectedReverse);
+  }
+
+  ParselessPhraseDB::SetScanKernel(original);
+}
+
+TEST(ParselessPhraseDBTest, LowerBound) {
+  std::string data = "a 1\na 2\nb 42\nb 1\nd 1\nd 2";
+  ParselessPhraseDB db(data.c_str(), data.length());
+  ParselessPhraseDB indexed(data.c_str(), data.length());
+  ASSERT_TRUE(indexed.buildLineIndex());
+  EXPECT_FALSE(db.hasLineIndex());
+  EXPECT_TRUE(indexed.hasLineIndex());
+  EXPECT_EQ(indexed.lineIndexSize(), 6 * sizeof(uint32_t));
+
+  for (const ParselessPhraseDB* d : {&db, &indexed}) {
+    SCOPED_TRACE(d->hasLineIndex() ? "indexed" : "unindexed");
+    EXPECT_EQ(d->lowerBound(""), data.data());
+    EXPECT_EQ(d->lowerBound("0"), data.data());
+    EXPECT_EQ(d->lowerBound("a"), data.data());
+    EXPECT_EQ(d->lowerBound("a 2"), data.data() + 4);
+    EXPECT_EQ(d->lowerBound("a 3"), data.data() + 8);
+    EXPECT_EQ(d->lowerBound("b"), data.data() + 8);
+    EXPECT_EQ(d->lowerBound("c"), data.data() + 17);
+    EXPECT_EQ(d->lowerBound("d 2"), data.data() + 21);
+    EXPECT_EQ(d->lowerBound("d 23"), nullptr);
+    EXPECT_EQ(d->lowerBound("e"), nullptr);
+  }
+}
+
+TEST(ParselessPhraseDBTest, PrefixRange) {
+  std::string data = "a 1\na 2\nb 42\nb 1\nbc 3\nd 1\nd 2";
+  ParselessPhraseDB db(data.c_str(), data.length());
+  ParselessPhraseDB indexed(data.c_str(), data.length());
+  ASSERT_TRUE(indexed.buildLineIndex());
+  ASSERT_TRUE(indexed.buildJumpTable());
+
+  for (const ParselessPhraseDB* d : {&db, &indexed}) {
+    SCOPED_TRACE(d->hasLineIndex() ? "indexed" : "unindexed");
+    EXPECT_EQ(d->prefixRange("a"), "a 1\na 2\n");
+    EXPECT_EQ(d->prefixRange("a 2"), "a 2\n");
+    EXPECT_EQ(d->prefixRange("b"), "b 42\nb 1\nbc 3\n");
+    EXPECT_EQ(d->prefixRange("b "), "b 42\nb 1\n");
+    EXPECT_EQ(d->prefixRange("d"), "d 1\nd 2");
+    EXPECT_EQ(d->prefixRange("d").data(), data.data() + 22);
+    EXPECT_EQ(d->prefixRange(""), data);
+    EXPECT_TRUE(d->prefixRange("c").empty());
+    EXPECT_TRUE(d->prefixRange("e").empty());
+  }
+}
+
+TEST(ParselessPhraseDBTest, TopRowsByScore) {
+  std::string data =
+      "a x -3\na y -1\na z\na w -2\na v -1\na u -5\nb x 0\nb y 1";
+  ParselessPhraseDB db(data.c_str(), data.length());
+
+  EXPECT_EQ(db.topRowsByScore("a ", 3),
+            (StringViews{"a y -1", "a v -1", "a w -2"}));
+  EXPECT_EQ(db.topRowsByScore("a ", 1), (StringViews{"a y -1"}));
+  EXPECT_EQ(db.topRowsByScore("a ", 10),
+            (StringViews{"a y -1", "a v -1", "a w -2", "a x -3", "a u -5",
+                         "a z"}));
+  EXPECT_EQ(db.topRowsByScore("b", 5), (StringViews{"b y 1", "b x 0"}));
+  EXPECT_TRUE(db.topRowsByScore("a ", 0).empty());
+  EXPECT_TRUE(db.topRowsByScore("c", 3).empty());
+}
+
+TEST(ParselessPhraseDBTest, LineIndexAgreesWithByteSearch) {
+  std::string data;
+  std::vector<std::string> keys;
+  for (char c = 'b'; c <= 'y'; c += 2) {
+    std::string key(1, c);
+    keys.push_back(key);
+    keys.push_back(std::string(1, c - 1));
+    keys.push_back(key + key);
+    for (int i = 0; i < (c - 'a') % 5 + 1; ++i) {
+      data += key + " " + std::string(((c - 'a') * 31 + i * 7) % 89, 'x') +
+              " " + std::to_string(i) + "\n";
+    }
+  }
+  data.pop_back();
+
+  ParselessPhraseDB db(data.c_str(), data.length());
+  ParselessPhraseDB indexed(data.c_str(), data.length());
+  ASSERT_TRUE(indexed.buildLineIndex());
+
+  for (const auto& key : keys) {
+    SCOPED_TRACE(key);
+    EXPECT_EQ(indexed.findFirstMatchingLine(key),
+              db.findFirstMatchingLine(key));
+    EXPECT_EQ(indexed.lowerBound(key), db.lowerBound(key));
+    EXPECT_EQ(indexed.findRows(key + " "), db.findRows(key + " "));
+  }
+}
+
+TEST(ParselessPhraseDBTest, JumpTableAgreesWithByteSearch) {
+  const std::vector<std::string> symbols = {"ㄅ", "ㄆ", "ㄇ", "ㄚ", "ㄞ", "ˇ"};
+  std::vector<std::string> rowKeys;
+  for (const auto& a : symbols) {
+    rowKeys.push_back(a);
+    for (const auto& b : symbols) {
+      rowKeys.push_back(a + b);
+      rowKeys.push_back(a + b + "-" + a);
+    }
+  }
+  rowKeys.emplace_back("_punctuation_list");
+  rowKeys.emplace_back("a");
+  std::sort(rowKeys.begin(), rowKeys.end());
+
+  std::string data;
+  for (size_t i = 0; i < rowKeys.size(); ++i) {
+    for (size_t j = 0; j < i % 3 + 1; ++j) {
+      data += rowKeys[i] + " v" + std::to_string(j) + "\n";
+    }
+  }
+
+  // Also look up keys that are absent and keys that end in the middle of a
+  // code point.
+  std::vector<std::string> keys = rowKeys;
+  keys.emplace_back("ㄈ");
+  keys.emplace_back("ㄅㄈ");
+  keys.emplace_back("ㄅㄚ-ㄆ");
+  keys.emplace_back("_");
+  keys.emplace_back("b");
+  keys.emplace_back("ㄅ").pop_back();
+  keys.emplace_back("ㄅㄚ").pop_back();
+  keys.emplace_back("\xff");
+
+  ParselessPhraseDB db(data.c_str(), data.length());
+  ParselessPhraseDB jumpTable(data.c_str(), data.length());
+  ParselessPhraseDB both(data.c_str(), data.length());
+  ASSERT_TRUE(jumpTable.buildJumpTable());
+  ASSERT_TRUE(both.buildJumpTable());
+  ASSERT_TRUE(both.buildLineIndex());
+  EXPECT_TRUE(jumpTable.hasJumpTable());
+  EXPECT_FALSE(jumpTable.hasLineIndex());
+  EXPECT_GT(jumpTable.jumpTableSize(), 0);
+
+  for (const auto& key : keys) {
+    SCOPED_TRACE(key);
+    for (const ParselessPhraseDB* d : {&jumpTable, &both}) {
+      EXPECT_EQ(d->lowerBound(key), db.lowerBound(key));
+      EXPECT_EQ(d->findFirstMatchingLine(key), db.findFirstMatchingLine(key));
+      EXPECT_EQ(d->findRows(key + " "), db.findRows(key + " "));
+    }
+  }
+}
+
+TEST(ParselessPhraseDBTest, JumpTableRejectsUnsortedRows) {
+  std::string data = "b 1\na 1\n";
+  ParselessPhraseDB db(data.c_str(), data.length());
+  EXPECT_FALSE(db.buildJumpTable());
+  EXPECT_FALSE(db.hasJumpTable());
+}
+
+TEST(ParselessPhraseDBTest, KeyFilter) {
+  std::string data = "a 1\nab 2\nab 3\nb\nc 4 5";
+  ParselessPhraseDB db(data.c_str(), data.length());
+  EXPECT_FALSE(db.hasKeyFilter());
+  EXPECT_TRUE(db.mayHaveKey("x"));
+
+  EXPECT_TRUE(db.buildKeyFilter());
+  EXPECT_TRUE(db.hasKeyFilter());
+  EXPECT_TRUE(db.mayHaveKey("a"));
+  EXPECT_TRUE(db.mayHaveKey("ab"));
+  EXPECT_TRUE(db.mayHaveKey("c"));
+  // Keys with a space are never rejected.
+  EXPECT_TRUE(db.mayHaveKey("a 1"));
+  EXPECT_EQ(db.keyFilter().stats().lookups, 3);
+
+  // The filter has no effect on the search itself.
+  EXPECT_EQ(db.findRows("ab ").size(), 2);
+  EXPECT_EQ(db.findRows("b").size(), 1);
+}
+
 TEST(ParselessPhraseDBTest, InvalidConstructorArguments) {
 #ifdef NDEBUG
   GTEST_SKIP();
@@ -211,9 +494,15 @@ TEST(ParselessPhraseDBTest, StressTest) {
   }
 
   ParselessPhraseDB db(buf.get(), length, /*validate_pragma=*/true);
+  ParselessPhraseDB indexed(buf.get(), length, /*validate_pragma=*/true);
+  ASSERT_TRUE(indexed.buildLineIndex());
+  ParselessPhraseDB jumpTable(buf.get(), length, /*validate_pragma=*/true);
+  ASSERT_TRUE(jumpTable.buildJumpTable());
   for (const auto& it : key_to_lines) {
     std::vector<std::string_view> rows = db.findRows(it.first + " ");
     ASSERT_TRUE(VectorsEqual(rows, it.second));
+    ASSERT_EQ(indexed.findRows(it.first + " "), rows);
+    ASSERT_EQ(jumpTable.findRows(it.first + " "), rows);
   }
 }
 
@@ -29,17 +29,39 @@
 #include <unistd.h>
 
 #include <fstream>
+#include <span>
 #include <string>
+#include <string_view>
 
 namespace McBopomofo {
 
-bool PhraseReplacementMap::open(const char* path) {
+bool PhraseReplacementMap::open(const char* path, const char* snapshotPath) {
   if (!mmapedFile_.open(path)) {
     return false;
   }
 
+  int64_t stamp = mmapedFile_.identity().modificationTimeNanoseconds;
+  if (snapshotPath != nullptr) {
+    ByteBlockBackedDictionary::SnapshotUse use = dictionary_.loadSnapshot(
+        snapshotPath, mmapedFile_.data(), mmapedFile_.length(), stamp,
+        ByteBlockBackedDictionary::ColumnOrder::KEY_THEN_VALUE);
+    if (use == ByteBlockBackedDictionary::SnapshotUse::USED) {
+      return true;
+    }
+    if (use != ByteBlockBackedDictionary::SnapshotUse::NOT_USED) {
+      dictionary_.saveSnapshot(snapshotPath, mmapedFile_.data(), stamp);
+      return true;
+    }
+  }
+
   // MemoryMappedFile self-closes, and so this is fine.
-  return load(mmapedFile_.data(), mmapedFile_.length());
+  if (!load(mmapedFile_.data(), mmapedFile_.length())) {
+    return false;
+  }
+  if (snapshotPath != nullptr) {
+    dictionary_.saveSnapshot(snapshotPath, mmapedFile_.data(), stamp);
+  }
+  return true;
 }
 
 void PhraseReplacementMap::close() {
@@ -51,11 +73,13 @@ bool PhraseReplacementMap::load(const char* data, size_t length) {
   if (data == nullptr || length == 0) {
     return false;
   }
-  return dictionary_.parse(data, length);
+  ByteBlockBackedDictionary::ParseOptions options;
+  options.threadCount = 0;
+  return dictionary_.parse(data, length, options);
 }
 
 std::string PhraseReplacementMap::valueForKey(const std::string& key) const {
-  std::vector<std::string_view> values = dictionary_.getValues(key);
+  std::span<const std::string_view> values = dictionary_.getValues(key);
   if (!values.empty()) {
     return std::string(values[0]);
   }
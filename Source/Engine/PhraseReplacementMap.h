@@ -40,7 +40,9 @@ class PhraseReplacementMap {
   PhraseReplacementMap& operator=(const PhraseReplacementMap&) = delete;
   PhraseReplacementMap& operator=(PhraseReplacementMap&&) = delete;
 
-  bool open(const char* path);
+  // If snapshotPath is given, the index is loaded from the snapshot file
+  // there when it matches the file, and otherwise parsed and saved there.
+  bool open(const char* path, const char* snapshotPath = nullptr);
   void close();
 
   // Allows loading existing in-memory data. It's the caller's responsibility
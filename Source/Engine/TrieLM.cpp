@@ -0,0 +1,415 @@
+// Copyright (c) 2026 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include "TrieLM.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace McBopomofo {
+
+static_assert(std::endian::native == std::endian::little,
+              "The trie image is stored in little-endian byte order");
+
+static constexpr char kMagic[8] = {'M', 'C', 'B', 'P', 'T', 'R', 'I', 'E'};
+static constexpr uint32_t kVersion = 1;
+
+struct TrieLM::Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t slotCount;
+  uint32_t blockCount;
+  uint32_t entryCount;
+  uint32_t poolSize;
+  uint32_t reserved;
+};
+
+namespace {
+
+// The byte offsets of the sections in an image.
+struct Layout {
+  size_t base;
+  size_t check;
+  size_t blockStarts;
+  size_t valueOffsets;
+  size_t scores;
+  size_t pool;
+  size_t end;
+};
+
+size_t AlignUp(size_t offset, size_t alignment) {
+  return (offset + alignment - 1) / alignment * alignment;
+}
+
+template <typename Header>
+Layout ComputeLayout(const Header& header) {
+  Layout layout{};
+  layout.base = sizeof(Header);
+  layout.check = layout.base + size_t{header.slotCount} * sizeof(int32_t);
+  layout.blockStarts =
+      layout.check + size_t{header.slotCount} * sizeof(int32_t);
+  layout.valueOffsets =
+      layout.blockStarts + (size_t{header.blockCount} + 1) * sizeof(uint32_t);
+  layout.scores = AlignUp(
+      layout.valueOffsets + size_t{header.entryCount} * sizeof(uint32_t),
+      alignof(double));
+  layout.pool = layout.scores + size_t{header.entryCount} * sizeof(double);
+  layout.end = layout.pool + header.poolSize;
+  return layout;
+}
+
+// Each value in the pool is prefixed with its length.
+using ValueLength = uint16_t;
+
+// The code of the terminal child. The bytes of the keys use 1 to 256.
+constexpr int32_t kTerminalCode = 0;
+constexpr int32_t kUnusedSlot = -1;
+
+// Builds the double array from the sorted, unique keys. Each key's block is
+// its index in the keys.
+class DoubleArrayBuilder {
+ public:
+  explicit DoubleArrayBuilder(const std::vector<std::string_view>& keys)
+      : keys_(keys) {
+    // The root is slot 0, which no child can take since bases start at 1.
+    ensureSize(1);
+    if (!keys_.empty()) {
+      insert(0, 0, keys_.size(), 0);
+    }
+  }
+
+  const std::vector<int32_t>& base() const { return base_; }
+  const std::vector<int32_t>& check() const { return check_; }
+
+ private:
+  int32_t code(size_t key, size_t depth) const {
+    std::string_view k = keys_[key];
+    return k.length() == depth ? kTerminalCode
+                               : static_cast<unsigned char>(k[depth]) + 1;
+  }
+
+  void ensureSize(size_t size) {
+    if (size > base_.size()) {
+      base_.resize(size, 0);
+      check_.resize(size, kUnusedSlot);
+    }
+  }
+
+  // Finds the first base at which all the codes land on unused slots. Like
+  // the classic first-fit construction, the search starts past the region
+  // that is almost fully used so that the build stays fast.
+  int32_t findBase(const std::vector<int32_t>& codes) {
+    size_t pos = std::max<size_t>(nextCheckPos_, codes.front() + 1);
+    size_t skipped = 0;
+    bool first = true;
+    for (;; ++pos) {
+      ensureSize(pos + 1);
+      if (check_[pos] != kUnusedSlot) {
+        ++skipped;
+        continue;
+      }
+      if (first) {
+        first = false;
+        if (skipped * 20 >= (pos - nextCheckPos_ + 1) * 19) {
+          nextCheckPos_ = pos;
+        }
+      }
+
+      size_t base = pos - codes.front();
+      ensureSize(base + codes.back() + 1);
+      bool fits = std::all_of(codes.begin(), codes.end(), [&](int32_t c) {
+        return check_[base + c] == kUnusedSlot;
+      });
+      if (fits) {
+        return static_cast<int32_t>(base);
+      }
+    }
+  }
+
+  // Places the children of the node for keys [begin, end), which share
+  // their first depth bytes.
+  void insert(int32_t node, size_t begin, size_t end, size_t depth) {
+    std::vector<int32_t> codes;
+    std::vector<size_t> starts;
+    for (size_t i = begin; i < end; ++i) {
+      int32_t c = code(i, depth);
+      if (codes.empty() || codes.back() != c) {
+        codes.push_back(c);
+        starts.push_back(i);
+      }
+    }
+    starts.push_back(end);
+
+    int32_t base = findBase(codes);
+    base_[node] = base;
+    for (int32_t c : codes) {
+      check_[base + c] = node;
+    }
+
+    for (size_t i = 0; i < codes.size(); ++i) {
+      int32_t child = base + codes[i];
+      if (codes[i] == kTerminalCode) {
+        base_[child] = -static_cast<int32_t>(starts[i]) - 1;
+      } else {
+        insert(child, starts[i], starts[i + 1], depth + 1);
+      }
+    }
+  }
+
+  const std::vector<std::string_view>& keys_;
+  std::vector<int32_t> base_;
+  std::vector<int32_t> check_;
+  size_t nextCheckPos_ = 1;
+};
+
+template <typename T>
+void Append(std::string& output, const T* data, size_t count) {
+  output.append(reinterpret_cast<const char*>(data), count * sizeof(T));
+}
+
+}  // namespace
+
+std::string TrieLM::Compile(const ParselessPhraseDB& db) {
+  // Group the values by key. The map also sorts the keys for the builder,
+  // while each key keeps its values in the order of the rows.
+  std::map<std::string_view, std::vector<ParselessPhraseDB::Row>> rowsByKey;
+  for (std::string_view row : db.rows("")) {
+    ParselessPhraseDB::Row decoded = ParselessPhraseDB::DecodeRow(row);
+    if (decoded.key.empty() || decoded.key.length() == row.length() ||
+        decoded.value.length() > std::numeric_limits<ValueLength>::max()) {
+      continue;
+    }
+    rowsByKey[decoded.key].push_back(decoded);
+  }
+
+  std::vector<std::string_view> keys;
+  std::vector<uint32_t> blockStarts;
+  std::vector<uint32_t> valueOffsets;
+  std::vector<double> scores;
+  std::string pool;
+  std::unordered_map<std::string_view, uint32_t> pooledValues;
+  for (const auto& [key, rows] : rowsByKey) {
+    keys.push_back(key);
+    blockStarts.push_back(static_cast<uint32_t>(scores.size()));
+    for (const auto& row : rows) {
+      auto [it, inserted] = pooledValues.try_emplace(
+          row.value, static_cast<uint32_t>(pool.size()));
+      if (inserted) {
+        auto length = static_cast<ValueLength>(row.value.length());
+        pool.append(reinterpret_cast<const char*>(&length), sizeof(length));
+        pool.append(row.value);
+      }
+      valueOffsets.push_back(it->second);
+      scores.push_back(row.score);
+    }
+  }
+  blockStarts.push_back(static_cast<uint32_t>(scores.size()));
+
+  DoubleArrayBuilder builder(keys);
+
+  Header header{};
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.slotCount = static_cast<uint32_t>(builder.base().size());
+  header.blockCount = static_cast<uint32_t>(keys.size());
+  header.entryCount = static_cast<uint32_t>(scores.size());
+  header.poolSize = static_cast<uint32_t>(pool.size());
+  Layout layout = ComputeLayout(header);
+
+  std::string image;
+  image.reserve(layout.end);
+  Append(image, &header, 1);
+  Append(image, builder.base().data(), builder.base().size());
+  Append(image, builder.check().data(), builder.check().size());
+  Append(image, blockStarts.data(), blockStarts.size());
+  Append(image, valueOffsets.data(), valueOffsets.size());
+  image.resize(layout.scores, '\0');
+  Append(image, scores.data(), scores.size());
+  image.append(pool);
+  return image;
+}
+
+bool TrieLM::CompileFile(const char* sortedDataPath, const char* outputPath) {
+  MemoryMappedFile file;
+  if (!file.open(sortedDataPath)) {
+    return false;
+  }
+  std::unique_ptr<ParselessPhraseDB> db =
+      ParselessPhraseDB::CreateValidatedDB(file.data(), file.length());
+  if (db == nullptr) {
+    return false;
+  }
+
+  std::string image = Compile(*db);
+  std::ofstream output(outputPath, std::ios::binary | std::ios::trunc);
+  output.write(image.data(), static_cast<std::streamsize>(image.size()));
+  return output.good();
+}
+
+bool TrieLM::isLoaded() const { return base_ != nullptr; }
+
+bool TrieLM::open(const char* path) {
+  if (isLoaded()) {
+    return false;
+  }
+  if (!mmapedFile_.open(path)) {
+    return false;
+  }
+  if (!load(mmapedFile_.data(), mmapedFile_.length())) {
+    mmapedFile_.close();
+    return false;
+  }
+  return true;
+}
+
+bool TrieLM::open(std::string_view image) {
+  if (isLoaded()) {
+    return false;
+  }
+  if (image.size() < sizeof(Header) ||
+      !MemoryMappedFile::CopyToAlignedWords(image, ownedImage_)) {
+    return false;
+  }
+  if (!load(reinterpret_cast<const char*>(ownedImage_.data()),
+            image.size())) {
+    ownedImage_.clear();
+    return false;
+  }
+  return true;
+}
+
+void TrieLM::close() {
+  mmapedFile_.close();
+  ownedImage_.clear();
+  imageSize_ = 0;
+  slotCount_ = blockCount_ = entryCount_ = poolSize_ = 0;
+  base_ = check_ = nullptr;
+  blockStarts_ = nullptr;
+  valueOffsets_ = nullptr;
+  scores_ = nullptr;
+  pool_ = nullptr;
+}
+
+bool TrieLM::load(const char* data, size_t length) {
+  if (length < sizeof(Header)) {
+    return false;
+  }
+  Header header;
+  memcpy(&header, data, sizeof(Header));
+  if (memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+      header.version != kVersion || header.slotCount == 0) {
+    return false;
+  }
+  Layout layout = ComputeLayout(header);
+  if (layout.end > length) {
+    return false;
+  }
+
+  imageSize_ = length;
+  slotCount_ = header.slotCount;
+  blockCount_ = header.blockCount;
+  entryCount_ = header.entryCount;
+  poolSize_ = header.poolSize;
+  base_ = reinterpret_cast<const int32_t*>(data + layout.base);
+  check_ = reinterpret_cast<const int32_t*>(data + layout.check);
+  blockStarts_ = reinterpret_cast<const uint32_t*>(data + layout.blockStarts);
+  valueOffsets_ =
+      reinterpret_cast<const uint32_t*>(data + layout.valueOffsets);
+  scores_ = reinterpret_cast<const double*>(data + layout.scores);
+  pool_ = data + layout.pool;
+  return true;
+}
+
+int64_t TrieLM::walk(std::string_view key) const {
+  if (!isLoaded()) {
+    return -1;
+  }
+  int64_t slot = 0;
+  for (char c : key) {
+    int64_t child = int64_t{base_[slot]} + static_cast<unsigned char>(c) + 1;
+    if (child <= 0 || child >= slotCount_ || check_[child] != slot) {
+      return -1;
+    }
+    slot = child;
+  }
+  return slot;
+}
+
+int64_t TrieLM::findBlock(std::string_view key) const {
+  int64_t slot = walk(key);
+  if (slot < 0) {
+    return -1;
+  }
+  int64_t terminal = int64_t{base_[slot]} + kTerminalCode;
+  if (terminal <= 0 || terminal >= slotCount_ || check_[terminal] != slot) {
+    return -1;
+  }
+  int64_t block = -int64_t{base_[terminal]} - 1;
+  return block >= 0 && block < blockCount_ ? block : -1;
+}
+
+std::vector<Formosa::Gramambular2::LanguageModel::Unigram> TrieLM::getUnigrams(
+    const std::string& key) {
+  int64_t block = findBlock(key);
+  if (block < 0) {
+    return {};
+  }
+
+  uint32_t first = blockStarts_[block];
+  uint32_t last = std::min(blockStarts_[block + 1], entryCount_);
+  std::vector<Formosa::Gramambular2::LanguageModel::Unigram> results;
+  for (uint32_t i = first; i < last; ++i) {
+    size_t offset = valueOffsets_[i];
+    ValueLength length = 0;
+    if (offset + sizeof(length) > poolSize_) {
+      continue;
+    }
+    memcpy(&length, pool_ + offset, sizeof(length));
+    offset += sizeof(length);
+    if (offset + length > poolSize_) {
+      continue;
+    }
+    results.emplace_back(std::string(pool_ + offset, length), scores_[i]);
+  }
+  return results;
+}
+
+bool TrieLM::hasUnigrams(const std::string& key) {
+  return findBlock(key) >= 0;
+}
+
+bool TrieLM::hasKeysWithPrefix(std::string_view prefix) const {
+  return blockCount_ > 0 && walk(prefix) >= 0;
+}
+
+}  // namespace McBopomofo
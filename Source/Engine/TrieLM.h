@@ -0,0 +1,122 @@
+// Copyright (c) 2026 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef SRC_ENGINE_TRIELM_H_
+#define SRC_ENGINE_TRIELM_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "MemoryMappedFile.h"
+#include "ParselessPhraseDB.h"
+#include "gramambular2/language_model.h"
+
+namespace McBopomofo {
+
+// A language model backed by a compiled double-array trie over the readings.
+// It returns the same unigrams as ParselessLM for the same sorted data, but
+// an exact lookup takes one array probe per byte of the key instead of a
+// binary search over the text, and checking whether any reading starts with
+// a prefix comes for free. The compiled image is designed to be mmapped as
+// is: it consists of fixed-width arrays in the native (little-endian) byte
+// order that are used in place, so opening it reads nothing but the header.
+//
+// The image has a header followed by these sections:
+//
+//   int32_t base[slotCount], check[slotCount]: the double array. The child of
+//       slot s for byte c is base[s] + c + 1 if check of that slot is s. The
+//       terminal child, at base[s], stores -(block + 1) as its base.
+//   uint32_t blockStarts[blockCount + 1]: the unigrams of each key, which
+//       keep the order of the rows in the source.
+//   uint32_t valueOffsets[entryCount]: the value of each unigram in the pool.
+//   double scores[entryCount]: the score of each unigram.
+//   char pool[poolSize]: the deduplicated values, each prefixed with its
+//       16-bit length.
+class TrieLM : public Formosa::Gramambular2::LanguageModel {
+ public:
+  TrieLM() = default;
+  TrieLM(const TrieLM&) = delete;
+  TrieLM(TrieLM&&) = delete;
+  TrieLM& operator=(const TrieLM&) = delete;
+  TrieLM& operator=(TrieLM&&) = delete;
+
+  // Compiles the rows of a sorted DB in the "key value score" format that
+  // ParselessLM reads. Rows without a value column are skipped since
+  // ParselessLM never returns them, and so are values of 64 KiB or more.
+  static std::string Compile(const ParselessPhraseDB& db);
+
+  // Compiles a sorted data file, such as data.txt, into a trie image file.
+  static bool CompileFile(const char* sortedDataPath, const char* outputPath);
+
+  bool isLoaded() const;
+  bool open(const char* path);
+
+  // Opens an in-memory image, such as the output of Compile(). The image is
+  // copied.
+  bool open(std::string_view image);
+  void close();
+
+  std::vector<Formosa::Gramambular2::LanguageModel::Unigram> getUnigrams(
+      const std::string& key) override;
+  bool hasUnigrams(const std::string& key) override;
+
+  // Returns true if any key starts with the prefix. This only walks the trie.
+  bool hasKeysWithPrefix(std::string_view prefix) const;
+
+  // Returns the size of the loaded image in bytes.
+  size_t imageSize() const { return imageSize_; }
+
+ private:
+  struct Header;
+
+  bool load(const char* data, size_t length);
+
+  // Returns the slot reached by the bytes of the key, or -1.
+  int64_t walk(std::string_view key) const;
+
+  // Returns the block of the key's unigrams, or -1.
+  int64_t findBlock(std::string_view key) const;
+
+  MemoryMappedFile mmapedFile_;
+  // Holds in-memory images. uint64_t keeps the sections aligned.
+  std::vector<uint64_t> ownedImage_;
+
+  size_t imageSize_ = 0;
+  uint32_t slotCount_ = 0;
+  uint32_t blockCount_ = 0;
+  uint32_t entryCount_ = 0;
+  uint32_t poolSize_ = 0;
+  const int32_t* base_ = nullptr;
+  const int32_t* check_ = nullptr;
+  const uint32_t* blockStarts_ = nullptr;
+  const uint32_t* valueOffsets_ = nullptr;
+  const double* scores_ = nullptr;
+  const char* pool_ = nullptr;
+};
+
+}  // namespace McBopomofo
+
+#endif  // SRC_ENGINE_TRIELM_H_
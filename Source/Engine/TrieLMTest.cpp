@@ -0,0 +1,174 @@
+// Copyright (c) 2026 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include "TrieLM.h"
+
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "ParselessLM.h"
+#include "gtest/gtest.h"
+
+namespace McBopomofo {
+
+using Unigram = Formosa::Gramambular2::LanguageModel::Unigram;
+
+namespace {
+
+constexpr char kSample[] = R"(# format org.openvanilla.mcbopomofo.sorted
+_punctuation_list ， 0
+ㄅㄚ 八 -3.27631260
+ㄅㄚ 吧 -3.59800309
+ㄅㄚ 巴 -3.80233706
+ㄅㄚ-ㄅㄞˇ 八百 -4.67026409
+ㄅㄚ-ㄅㄞˇ 捌佰 -7.26686119
+ㄅㄚ˙ 吧 -3.59800309
+ㄆㄚ 趴
+ㄇㄚ
+)";
+
+void ExpectSameUnigrams(const std::vector<Unigram>& a,
+                        const std::vector<Unigram>& b) {
+  ASSERT_EQ(a.size(), b.size());
+  for (size_t i = 0; i < a.size(); ++i) {
+    EXPECT_EQ(a[i].value(), b[i].value());
+    EXPECT_EQ(a[i].score(), b[i].score());
+  }
+}
+
+}  // namespace
+
+TEST(TrieLMTest, UnopenedInstanceReturnsNothing) {
+  TrieLM lm;
+  EXPECT_FALSE(lm.isLoaded());
+  EXPECT_FALSE(lm.hasUnigrams("ㄅㄚ"));
+  EXPECT_TRUE(lm.getUnigrams("ㄅㄚ").empty());
+  EXPECT_FALSE(lm.hasKeysWithPrefix(""));
+}
+
+TEST(TrieLMTest, MatchesParselessLM) {
+  ParselessPhraseDB db(kSample, sizeof(kSample) - 1, /*validate_pragma=*/true);
+  TrieLM lm;
+  ASSERT_TRUE(lm.open(TrieLM::Compile(db)));
+  EXPECT_TRUE(lm.isLoaded());
+
+  ParselessLM reference;
+  ASSERT_TRUE(reference.open(std::make_unique<ParselessPhraseDB>(
+      kSample, sizeof(kSample) - 1, /*validate_pragma=*/true)));
+
+  for (const char* key : {"ㄅㄚ", "ㄅㄚ-ㄅㄞˇ", "ㄅㄚ˙", "ㄆㄚ", "ㄇㄚ",
+                          "_punctuation_list", "ㄅ", "ㄅㄚ-", "ㄅㄚㄅ", "",
+                          "#", "ㄈㄚ"}) {
+    SCOPED_TRACE(key);
+    EXPECT_EQ(lm.hasUnigrams(key), reference.hasUnigrams(key));
+    ExpectSameUnigrams(lm.getUnigrams(key), reference.getUnigrams(key));
+  }
+
+  std::vector<Unigram> unigrams = lm.getUnigrams("ㄅㄚ-ㄅㄞˇ");
+  ASSERT_EQ(unigrams.size(), 2);
+  EXPECT_EQ(unigrams[0].value(), "八百");
+  EXPECT_EQ(unigrams[0].score(), -4.67026409);
+  EXPECT_EQ(unigrams[1].value(), "捌佰");
+}
+
+TEST(TrieLMTest, HasKeysWithPrefix) {
+  ParselessPhraseDB db(kSample, sizeof(kSample) - 1, /*validate_pragma=*/true);
+  TrieLM lm;
+  ASSERT_TRUE(lm.open(TrieLM::Compile(db)));
+
+  EXPECT_TRUE(lm.hasKeysWithPrefix(""));
+  EXPECT_TRUE(lm.hasKeysWithPrefix("ㄅ"));
+  EXPECT_TRUE(lm.hasKeysWithPrefix("ㄅㄚ-"));
+  EXPECT_TRUE(lm.hasKeysWithPrefix("ㄅㄚ-ㄅㄞˇ"));
+  EXPECT_TRUE(lm.hasKeysWithPrefix("_punct"));
+  EXPECT_FALSE(lm.hasKeysWithPrefix("ㄅㄚ-ㄅㄞˇ-"));
+  EXPECT_FALSE(lm.hasKeysWithPrefix("ㄈ"));
+  EXPECT_FALSE(lm.hasKeysWithPrefix("ㄇㄚ"));
+}
+
+TEST(TrieLMTest, RejectsInvalidImages) {
+  ParselessPhraseDB db(kSample, sizeof(kSample) - 1, /*validate_pragma=*/true);
+  std::string image = TrieLM::Compile(db);
+
+  TrieLM lm;
+  EXPECT_FALSE(lm.open(std::string_view()));
+  EXPECT_FALSE(lm.open(std::string_view(image).substr(0, image.size() - 1)));
+  std::string badMagic = image;
+  badMagic[0] = 'X';
+  EXPECT_FALSE(lm.open(badMagic));
+  EXPECT_FALSE(lm.isLoaded());
+
+  EXPECT_TRUE(lm.open(image));
+  EXPECT_FALSE(lm.open(image));
+  lm.close();
+  EXPECT_FALSE(lm.isLoaded());
+  EXPECT_TRUE(lm.open(image));
+}
+
+TEST(TrieLMTest, EmptyDB) {
+  std::string data = "";
+  ParselessPhraseDB db(data.c_str(), 1);
+  TrieLM lm;
+  ASSERT_TRUE(lm.open(TrieLM::Compile(db)));
+  EXPECT_FALSE(lm.hasUnigrams("ㄅㄚ"));
+  EXPECT_FALSE(lm.hasKeysWithPrefix(""));
+}
+
+TEST(TrieLMTest, CompileFileAndOpen) {
+  constexpr const char* data_path = "data.txt";
+  if (!std::filesystem::exists(data_path)) {
+    GTEST_SKIP();
+  }
+
+  std::filesystem::path trie_path =
+      std::filesystem::temp_directory_path() /
+      "org.openvanilla.mcbopomofo.TrieLMTest.trie";
+  ASSERT_TRUE(TrieLM::CompileFile(data_path, trie_path.c_str()));
+
+  TrieLM lm;
+  ASSERT_TRUE(lm.open(trie_path.c_str()));
+  ParselessLM reference;
+  ASSERT_TRUE(reference.open(data_path));
+
+  MemoryMappedFile file;
+  ASSERT_TRUE(file.open(data_path));
+  ParselessPhraseDB db(file.data(), file.length(), /*validate_pragma=*/true);
+  std::string key;
+  for (std::string_view row : db.rows("")) {
+    std::string_view rowKey = ParselessPhraseDB::DecodeRow(row).key;
+    if (rowKey == key) {
+      continue;
+    }
+    key = rowKey;
+    ASSERT_EQ(lm.hasUnigrams(key), reference.hasUnigrams(key)) << key;
+    ExpectSameUnigrams(lm.getUnigrams(key), reference.getUnigrams(key));
+  }
+
+  lm.close();
+  std::filesystem::remove(trie_path);
+}
+
+}  // namespace McBopomofo
@@ -24,13 +24,22 @@
 
 #include "UserOverrideModel.h"
 
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <bit>
 #include <cassert>
+#include <cerrno>
 #include <cmath>
-#include <list>
+#include <cstdio>
+#include <cstring>
 #include <string>
+#include <string_view>
 #include <utility>
 #include <vector>
 
+#include "MemoryMappedFile.h"
 #include "gramambular2/reading_grid.h"
 
 namespace McBopomofo {
@@ -45,20 +54,185 @@ static constexpr char kEmptyNodeString[] = "()";
 static double Score(size_t eventCount, size_t totalCount, double eventTimestamp,
                     double timestamp, double lambda);
 
-// Form the observation key from the nodes of a walk. This goes backward, but
-// we are using a const_iterator, the "end" here should be a .cbegin() of a
-// vector.
-static std::string FormObservationKey(
-    std::vector<Formosa::Gramambular2::ReadingGrid::NodePtr>::const_iterator
-        head,
-    std::vector<Formosa::Gramambular2::ReadingGrid::NodePtr>::const_iterator
-        end);
+static bool IsPunctuation(
+    const Formosa::Gramambular2::ReadingGrid::NodePtr& node) {
+  const std::string& reading = node->reading();
+  return !reading.empty() && reading[0] == '_';
+}
+
+namespace {
+
+// Hashes a key fed in pieces the same as if it were fed in one piece, so that
+// the key of a walk hashes to the same value as its string form. The bytes are
+// gathered into 8-byte words, which are then mixed.
+class KeyHasher {
+ public:
+  void add(std::string_view piece) {
+    length_ += piece.size();
+    while (!piece.empty()) {
+      if (bufferLength_ == 0 && piece.size() >= sizeof(buffer_)) {
+        mix(piece.data());
+        piece.remove_prefix(sizeof(buffer_));
+        continue;
+      }
+      // The pieces of a walk's key are short, for which a plain loop beats a
+      // call to memcpy.
+      size_t n = std::min(sizeof(buffer_) - bufferLength_, piece.size());
+      for (size_t i = 0; i < n; ++i) {
+        buffer_[bufferLength_ + i] = piece[i];
+      }
+      bufferLength_ += n;
+      piece.remove_prefix(n);
+      if (bufferLength_ == sizeof(buffer_)) {
+        mix(buffer_);
+        bufferLength_ = 0;
+      }
+    }
+  }
+
+  uint64_t finish() {
+    memset(buffer_ + bufferLength_, 0, sizeof(buffer_) - bufferLength_);
+    mix(buffer_);
+    // The finalizer of MurmurHash3, with the length mixed in.
+    uint64_t h = hash_ ^ length_;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+  }
+
+ private:
+  void mix(const char* bytes) {
+    uint64_t word;
+    memcpy(&word, bytes, sizeof(word));
+    // The rotation carries the high bits of a word into the low bits of the
+    // next round, so that a change in them cannot be cancelled by the same
+    // change in a later word. UTF-8 keys differ in the high bits a lot.
+    hash_ = (std::rotl(hash_, 23) ^ (word * 0x9e3779b97f4a7c15ULL)) *
+            0xbf58476d1ce4e5b9ULL;
+  }
+
+  char buffer_[8];
+  size_t bufferLength_ = 0;
+  uint64_t hash_ = 0;
+  uint64_t length_ = 0;
+};
+
+// An observation key given in its string form.
+class StringKey {
+ public:
+  explicit StringKey(std::string_view key) : key_(key) {}
+
+  template <typename Visitor>
+  void forEachPiece(Visitor&& visitor) const {
+    visitor(key_);
+  }
+
+ private:
+  std::string_view key_;
+};
+
+// The observation key formed from the nodes of a walk, "(r,v)-(r,v)-(r,v)" for
+// the anterior, the previous, and the head node, which refers to the strings
+// of the nodes rather than copying them.
+class WalkKey {
+ public:
+  // This goes backward from the head, but since we are using a
+  // const_iterator, the "end" here should be a .cbegin() of a vector.
+  WalkKey(
+      std::vector<Formosa::Gramambular2::ReadingGrid::NodePtr>::const_iterator
+          head,
+      std::vector<Formosa::Gramambular2::ReadingGrid::NodePtr>::const_iterator
+          end) {
+    // Using the top unigram from the head node. Recall that this is an
+    // observation for *before* the user override, and when we provide
+    // a suggestion, this head node is never overridden yet.
+    parts_[2] = Part{&(*head)->reading(), &(*head)->unigrams()[0].value()};
+
+    // For the next two nodes, use their current unigram values. If it's a
+    // punctuation, we ignore the reading and the value altogether and treat
+    // it as if it's like the beginning of the sentence.
+    bool prevIsPunctuation = false;
+    if (head != end) {
+      --head;
+      prevIsPunctuation = IsPunctuation(*head);
+      if (!prevIsPunctuation) {
+        parts_[1] = Part{&(*head)->reading(), &(*head)->value()};
+      }
+    }
+    if (head != end && !prevIsPunctuation) {
+      --head;
+      if (!IsPunctuation(*head)) {
+        parts_[0] = Part{&(*head)->reading(), &(*head)->value()};
+      }
+    }
+  }
+
+  template <typename Visitor>
+  void forEachPiece(Visitor&& visitor) const {
+    for (size_t i = 0; i < parts_.size(); ++i) {
+      if (i > 0) {
+        visitor("-");
+      }
+      const Part& part = parts_[i];
+      if (part.reading == nullptr) {
+        visitor(kEmptyNodeString);
+        continue;
+      }
+      visitor("(");
+      visitor(*part.reading);
+      visitor(",");
+      visitor(*part.value);
+      visitor(")");
+    }
+  }
+
+ private:
+  // A part without a reading stands for the beginning of the sentence.
+  struct Part {
+    const std::string* reading = nullptr;
+    const std::string* value = nullptr;
+  };
+
+  std::array<Part, 3> parts_;
+};
+
+template <typename Key>
+uint64_t HashKey(const Key& key) {
+  KeyHasher hasher;
+  key.forEachPiece([&hasher](std::string_view piece) { hasher.add(piece); });
+  return hasher.finish();
+}
+
+template <typename Key>
+bool KeyEquals(const Key& key, std::string_view formed) {
+  size_t pos = 0;
+  bool equal = true;
+  key.forEachPiece([&](std::string_view piece) {
+    equal = equal && pos <= formed.size() &&
+            formed.compare(pos, piece.size(), piece) == 0;
+    pos += piece.size();
+  });
+  return equal && pos == formed.size();
+}
+
+template <typename Key>
+std::string FormKey(const Key& key) {
+  std::string formed;
+  key.forEachPiece([&formed](std::string_view piece) { formed += piece; });
+  return formed;
+}
+
+}  // namespace
 
 UserOverrideModel::UserOverrideModel(size_t capacity, double decayConstant)
     : capacity_(capacity) {
   assert(capacity_ > 0);
   // NOLINTNEXTLINE(readability-magic-numbers)
   decayExponent_ = log(0.5) / decayConstant;
+  decayHorizon_ = log(kDecayThreshold) / decayExponent_;
 }
 
 void UserOverrideModel::observe(
@@ -142,159 +316,584 @@ void UserOverrideModel::observe(
   auto endPoint = breakingUp ? walkAfterUserOverride.nodes.begin()
                              : walkBeforeUserOverride.nodes.begin();
 
-  std::string key = FormObservationKey(nodeIter, endPoint);
-  observe(key, currentNode->currentUnigram().value(), timestamp,
-          forceHighScoreOverride);
+  observeKey(WalkKey(nodeIter, endPoint), currentNode->value(), timestamp,
+             forceHighScoreOverride);
 }
 
 UserOverrideModel::Suggestion UserOverrideModel::suggest(
     const Formosa::Gramambular2::ReadingGrid::WalkResult& currentWalk,
     size_t cursor, double timestamp) {
   auto nodeIter = currentWalk.findNodeAt(cursor);
-  std::string key = FormObservationKey(nodeIter, currentWalk.nodes.begin());
-  return suggest(key, timestamp);
+  if (nodeIter == currentWalk.nodes.cend()) {
+    return UserOverrideModel::Suggestion{};
+  }
+  return suggestKey(WalkKey(nodeIter, currentWalk.nodes.begin()), timestamp);
 }
 
 void UserOverrideModel::observe(const std::string& key,
                                 const std::string& candidate, double timestamp,
                                 bool forceHighScoreOverride) {
-  auto mapIter = lruMap_.find(key);
-  if (mapIter == lruMap_.end()) {
-    auto keyValuePair = KeyObservationPair(key, Observation());
-    Observation& observation = keyValuePair.second;
-    observation.update(candidate, timestamp, forceHighScoreOverride);
-
-    lruList_.push_front(keyValuePair);
-    auto listIter = lruList_.begin();
-    auto lruKeyValue =
-        std::pair<std::string, std::list<KeyObservationPair>::iterator>(
-            key, listIter);
-    lruMap_.insert(lruKeyValue);
-
-    if (lruList_.size() > capacity_) {
-      auto lastKeyValuePair = lruList_.end();
-      --lastKeyValuePair;
-      lruMap_.erase(lastKeyValuePair->first);
-      lruList_.pop_back();
+  observeKey(StringKey(key), candidate, timestamp, forceHighScoreOverride);
+}
+
+UserOverrideModel::Suggestion UserOverrideModel::suggest(const std::string& key,
+                                                         double timestamp) {
+  return suggestKey(StringKey(key), timestamp);
+}
+
+// Returns the bytes that the string allocated, which is none if it fits in
+// its small string buffer.
+static size_t HeapBytes(const std::string& str) {
+  auto object = reinterpret_cast<const char*>(&str);
+  bool isInline = str.data() >= object && str.data() < object + sizeof(str);
+  return isInline ? 0 : str.capacity() + 1;
+}
+
+uint64_t UserOverrideModel::KeyHash(std::string_view key) {
+  return HashKey(StringKey(key));
+}
+
+size_t UserOverrideModel::memoryUsage() const {
+  size_t bytes = observations_.capacity() * sizeof(Observation) +
+                 slots_.capacity() * sizeof(Slot);
+  for (const Observation& observation : observations_) {
+    bytes += HeapBytes(observation.key);
+    for (const Override& o : observation.overrides) {
+      bytes += HeapBytes(o.candidate);
     }
-  } else {
-    auto listIter = mapIter->second;
-    lruList_.splice(lruList_.begin(), lruList_, listIter);
+  }
+  return bytes;
+}
 
-    auto& keyValuePair = *listIter;
-    Observation& observation = keyValuePair.second;
-    observation.update(candidate, timestamp, forceHighScoreOverride);
+template <typename Key>
+uint32_t UserOverrideModel::find(uint64_t hash, const Key& key) const {
+  if (slots_.empty()) {
+    return kNoIndex;
+  }
+  size_t mask = slots_.size() - 1;
+  auto tag = static_cast<uint32_t>(hash >> 32);
+  for (size_t i = hash & mask;; i = (i + 1) & mask) {
+    const Slot& slot = slots_[i];
+    if (slot.index == kNoIndex) {
+      return kNoIndex;
+    }
+    if (slot.tag == tag) {
+      const Observation& observation = observations_[slot.index];
+      if (observation.hash == hash && KeyEquals(key, observation.key)) {
+        return slot.index;
+      }
+    }
   }
 }
 
-UserOverrideModel::Suggestion UserOverrideModel::suggest(const std::string& key,
-                                                         double timestamp) {
-  auto mapIter = lruMap_.find(key);
-  if (mapIter == lruMap_.end()) {
-    return UserOverrideModel::Suggestion{};
+template <typename Key>
+void UserOverrideModel::observeKey(const Key& key, std::string_view candidate,
+                                   double timestamp,
+                                   bool forceHighScoreOverride) {
+  ++changeCount_;
+  uint64_t hash = HashKey(key);
+  uint32_t index = find(hash, key);
+  if (index == kNoIndex) {
+    index = insert(hash, FormKey(key), /*asLeastRecent=*/false);
+  } else if (index != mostRecent_) {
+    unlink(index);
+    link(index, /*asLeastRecent=*/false);
   }
+  observations_[index].update(candidate, timestamp, forceHighScoreOverride,
+                              decayHorizon_);
+  sweep(timestamp);
+}
 
-  auto listIter = mapIter->second;
-  auto& keyValuePair = *listIter;
-  const Observation& observation = keyValuePair.second;
+template <typename Key>
+UserOverrideModel::Suggestion UserOverrideModel::suggestKey(
+    const Key& key, double timestamp) const {
+  uint32_t index = find(HashKey(key), key);
+  if (index == kNoIndex) {
+    return UserOverrideModel::Suggestion{};
+  }
 
-  std::string candidate;
-  bool forceHighScoreOverride = false;
+  const Observation& observation = observations_[index];
+  if (timestamp > observation.expiry) {
+    return UserOverrideModel::Suggestion{};
+  }
+  const Override* best = nullptr;
   double score = 0;
-  for (auto i = observation.overrides.begin(); i != observation.overrides.end();
-       ++i) {
-    const Override& o = i->second;
+  for (uint32_t i = 0; i < observation.overrideCount; ++i) {
+    const Override& o = observation.overrides[i];
+    if (timestamp - o.timestamp > decayHorizon_) {
+      continue;
+    }
     double overrideScore = Score(o.count, observation.count, o.timestamp,
                                  timestamp, decayExponent_);
     if (overrideScore == 0.0) {
       continue;
     }
 
-    if (overrideScore > score) {
-      candidate = i->first;
-      forceHighScoreOverride = o.forceHighScoreOverride;
+    // Ties go to the candidate that sorts first.
+    if (overrideScore > score ||
+        (overrideScore == score && o.candidate < best->candidate)) {
+      best = &o;
       score = overrideScore;
     }
   }
-  return UserOverrideModel::Suggestion{candidate, forceHighScoreOverride};
+  if (best == nullptr) {
+    return UserOverrideModel::Suggestion{};
+  }
+  return UserOverrideModel::Suggestion{best->candidate,
+                                       best->forceHighScoreOverride};
 }
 
-void UserOverrideModel::Observation::update(const std::string& candidate,
-                                            double timestamp,
-                                            bool forceHighScoreOverride) {
-  count++;
-  auto& o = overrides[candidate];
-  o.timestamp = timestamp;
-  o.count++;
-  o.forceHighScoreOverride = forceHighScoreOverride;
+uint32_t UserOverrideModel::insert(uint64_t hash, std::string key,
+                                   bool asLeastRecent) {
+  uint32_t index;
+  if (observations_.size() < capacity_) {
+    if ((observations_.size() + 1) * 4 > slots_.size() * 3) {
+      growSlots();
+    }
+    index = static_cast<uint32_t>(observations_.size());
+    observations_.emplace_back();
+  } else {
+    // Reuse the least recently used observation, whose strings keep their
+    // buffers.
+    index = leastRecent_;
+    eraseSlot(index);
+    unlink(index);
+  }
+
+  Observation& observation = observations_[index];
+  observation.key = std::move(key);
+  observation.hash = hash;
+  observation.count = 0;
+  observation.overrideCount = 0;
+  observation.expiry = 0;
+
+  size_t mask = slots_.size() - 1;
+  size_t i = hash & mask;
+  while (slots_[i].index != kNoIndex) {
+    i = (i + 1) & mask;
+  }
+  slots_[i] = Slot{static_cast<uint32_t>(hash >> 32), index};
+  link(index, asLeastRecent);
+  return index;
 }
 
-static double Score(size_t eventCount, size_t totalCount, double eventTimestamp,
-                    double timestamp, double lambda) {
-  double decay = exp((timestamp - eventTimestamp) * lambda);
-  if (decay < kDecayThreshold) {
-    return 0.0;
+void UserOverrideModel::erase(uint32_t index) {
+  eraseSlot(index);
+  unlink(index);
+  auto last = static_cast<uint32_t>(observations_.size() - 1);
+  if (index != last) {
+    // Point the slot and the neighbors of the last observation to its new
+    // place.
+    Observation& moved = observations_[last];
+    size_t mask = slots_.size() - 1;
+    size_t i = moved.hash & mask;
+    while (slots_[i].index != last) {
+      i = (i + 1) & mask;
+    }
+    slots_[i].index = index;
+    if (moved.newer != kNoIndex) {
+      observations_[moved.newer].older = index;
+    } else {
+      mostRecent_ = index;
+    }
+    if (moved.older != kNoIndex) {
+      observations_[moved.older].newer = index;
+    } else {
+      leastRecent_ = index;
+    }
+    observations_[index] = std::move(moved);
   }
+  observations_.pop_back();
+}
 
-  double prob =
-      static_cast<double>(eventCount) / static_cast<double>(totalCount);
-  return prob * decay;
+void UserOverrideModel::sweep(double timestamp) {
+  // Observing an observation makes it the most recently used, so the least
+  // recently used ones are the first to decay. Sweeping more than one per
+  // observe() lets a backlog of decayed ones, as after loading an old model,
+  // clear over time.
+  constexpr int kMaxSweptPerObserve = 2;
+  for (int i = 0; i < kMaxSweptPerObserve && leastRecent_ != kNoIndex &&
+                  timestamp > observations_[leastRecent_].expiry;
+       ++i) {
+    erase(leastRecent_);
+  }
 }
 
-static std::string CombineReadingValue(const std::string& reading,
-                                       const std::string& value) {
-  return std::string("(") + reading + "," + value + ")";
+void UserOverrideModel::link(uint32_t index, bool asLeastRecent) {
+  Observation& observation = observations_[index];
+  if (asLeastRecent) {
+    observation.newer = leastRecent_;
+    observation.older = kNoIndex;
+    if (leastRecent_ != kNoIndex) {
+      observations_[leastRecent_].older = index;
+    }
+    leastRecent_ = index;
+    if (mostRecent_ == kNoIndex) {
+      mostRecent_ = index;
+    }
+    return;
+  }
+  observation.newer = kNoIndex;
+  observation.older = mostRecent_;
+  if (mostRecent_ != kNoIndex) {
+    observations_[mostRecent_].newer = index;
+  }
+  mostRecent_ = index;
+  if (leastRecent_ == kNoIndex) {
+    leastRecent_ = index;
+  }
 }
 
-static bool IsPunctuation(
-    const Formosa::Gramambular2::ReadingGrid::NodePtr& node) {
-  const std::string& reading = node->reading();
-  return !reading.empty() && reading[0] == '_';
+void UserOverrideModel::unlink(uint32_t index) {
+  Observation& observation = observations_[index];
+  if (observation.newer != kNoIndex) {
+    observations_[observation.newer].older = observation.older;
+  } else {
+    mostRecent_ = observation.older;
+  }
+  if (observation.older != kNoIndex) {
+    observations_[observation.older].newer = observation.newer;
+  } else {
+    leastRecent_ = observation.newer;
+  }
+  observation.newer = kNoIndex;
+  observation.older = kNoIndex;
+}
+
+void UserOverrideModel::eraseSlot(uint32_t index) {
+  size_t mask = slots_.size() - 1;
+  size_t i = observations_[index].hash & mask;
+  while (slots_[i].index != index) {
+    i = (i + 1) & mask;
+  }
+  // Shift the following slots of the probe run back, so that lookups do not
+  // need tombstones.
+  for (size_t j = (i + 1) & mask; slots_[j].index != kNoIndex;
+       j = (j + 1) & mask) {
+    size_t home = observations_[slots_[j].index].hash & mask;
+    if (((j - home) & mask) >= ((j - i) & mask)) {
+      slots_[i] = slots_[j];
+      i = j;
+    }
+  }
+  slots_[i] = Slot{};
+}
+
+void UserOverrideModel::growSlots() {
+  constexpr size_t kInitialSlotCount = 16;
+  size_t slotCount = slots_.empty() ? kInitialSlotCount : slots_.size() * 2;
+  slots_.assign(slotCount, Slot{});
+  size_t mask = slotCount - 1;
+  for (uint32_t index = 0; index < observations_.size(); ++index) {
+    uint64_t hash = observations_[index].hash;
+    size_t i = hash & mask;
+    while (slots_[i].index != kNoIndex) {
+      i = (i + 1) & mask;
+    }
+    slots_[i] = Slot{static_cast<uint32_t>(hash >> 32), index};
+  }
 }
 
-static std::string FormObservationKey(
-    std::vector<Formosa::Gramambular2::ReadingGrid::NodePtr>::const_iterator
-        head,
-    std::vector<Formosa::Gramambular2::ReadingGrid::NodePtr>::const_iterator
-        end) {
-  // Using the top unigram from the head node. Recall that this is an
-  // observation for *before* the user override, and when we provide
-  // a suggestion, this head node is never overridden yet.
-  std::string headStr =
-      CombineReadingValue((*head)->reading(), (*head)->unigrams()[0].value());
-
-  // For the next two nodes, use their current unigram values. If it's a
-  // punctuation, we ignore the reading and the value altogether and treat
-  // it as if it's like the beginning of the sentence.
-  std::string prevStr;
-  bool prevIsPunctuation = false;
-  if (head != end) {
-    --head;
-    prevIsPunctuation = IsPunctuation(*head);
-    if (prevIsPunctuation) {
-      prevStr = kEmptyNodeString;
+namespace {
+
+// The serialized model is a header followed by the observations, from the
+// most recently used to the least. Each observation is an ObservationRecord
+// followed by its key and its overrides, and each override an OverrideRecord
+// followed by its candidate. The numbers are in the host's byte order.
+constexpr char kSerializedMagic[8] = {'M', 'C', 'B', 'P', 'U', 'O', 'M', 'S'};
+constexpr uint32_t kSerializedVersion = 1;
+
+struct SerializedHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t observationCount;
+  uint64_t payloadLength;
+  // A checksum of the payload, which catches torn or damaged files.
+  uint64_t payloadChecksum;
+};
+
+struct ObservationRecord {
+  uint32_t keyLength;
+  uint32_t overrideCount;
+  uint64_t count;
+};
+
+struct OverrideRecord {
+  uint32_t candidateLength;
+  uint32_t forceHighScoreOverride;
+  uint64_t count;
+  double timestamp;
+};
+
+// FNV-1a over 8-byte words rather than bytes, which is fast enough to check
+// the largest models in a few milliseconds.
+uint64_t Checksum(std::string_view data) {
+  constexpr uint64_t kPrime = 0x100000001b3ULL;
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= data.size(); i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, data.data() + i, sizeof(word));
+    hash = (hash ^ word) * kPrime;
+  }
+  for (; i < data.size(); ++i) {
+    hash = (hash ^ static_cast<unsigned char>(data[i])) * kPrime;
+  }
+  return hash ^ (hash >> 32);
+}
+
+template <typename T>
+void Append(std::string& out, const T& record) {
+  out.append(reinterpret_cast<const char*>(&record), sizeof(T));
+}
+
+// Reads from a byte range with bounds checks. Once a read fails, all further
+// reads fail.
+class Reader {
+ public:
+  Reader(const char* data, size_t length) : ptr_(data), end_(data + length) {}
+
+  template <typename T>
+  bool read(T* record) {
+    if (!ok_ || static_cast<size_t>(end_ - ptr_) < sizeof(T)) {
+      ok_ = false;
+      return false;
+    }
+    memcpy(record, ptr_, sizeof(T));
+    ptr_ += sizeof(T);
+    return true;
+  }
+
+  bool read(size_t length, std::string* str) {
+    if (!ok_ || static_cast<size_t>(end_ - ptr_) < length) {
+      ok_ = false;
+      return false;
+    }
+    str->assign(ptr_, length);
+    ptr_ += length;
+    return true;
+  }
+
+  bool atEnd() const { return ok_ && ptr_ == end_; }
+
+ private:
+  const char* ptr_;
+  const char* end_;
+  bool ok_ = true;
+};
+
+}  // namespace
+
+std::string UserOverrideModel::serialize() const {
+  size_t size = sizeof(SerializedHeader);
+  for (const Observation& observation : observations_) {
+    size += sizeof(ObservationRecord) + observation.key.size();
+    for (uint32_t i = 0; i < observation.overrideCount; ++i) {
+      const Override& o = observation.overrides[i];
+      size += sizeof(OverrideRecord) + o.candidate.size();
+    }
+  }
+  std::string out;
+  out.reserve(size);
+  out.resize(sizeof(SerializedHeader));
+  for (uint32_t index = mostRecent_; index != kNoIndex;
+       index = observations_[index].older) {
+    const Observation& observation = observations_[index];
+    Append(out, ObservationRecord{
+                    static_cast<uint32_t>(observation.key.size()),
+                    observation.overrideCount, observation.count});
+    out.append(observation.key);
+    for (uint32_t i = 0; i < observation.overrideCount; ++i) {
+      const Override& o = observation.overrides[i];
+      Append(out, OverrideRecord{static_cast<uint32_t>(o.candidate.size()),
+                                 o.forceHighScoreOverride ? 1U : 0U, o.count,
+                                 o.timestamp});
+      out.append(o.candidate);
+    }
+  }
+
+  SerializedHeader header{};
+  memcpy(header.magic, kSerializedMagic, sizeof(header.magic));
+  header.version = kSerializedVersion;
+  header.observationCount = static_cast<uint32_t>(observations_.size());
+  header.payloadLength = out.size() - sizeof(SerializedHeader);
+  header.payloadChecksum =
+      Checksum(std::string_view(out).substr(sizeof(SerializedHeader)));
+  memcpy(out.data(), &header, sizeof(header));
+  return out;
+}
+
+bool UserOverrideModel::deserialize(const char* data, size_t length) {
+  SerializedHeader header;
+  Reader headerReader(data, length);
+  if (data == nullptr || !headerReader.read(&header) ||
+      memcmp(header.magic, kSerializedMagic, sizeof(header.magic)) != 0 ||
+      header.version != kSerializedVersion ||
+      header.payloadLength != length - sizeof(SerializedHeader)) {
+    return false;
+  }
+  std::string_view payload(data + sizeof(SerializedHeader),
+                           header.payloadLength);
+  if (Checksum(payload) != header.payloadChecksum) {
+    return false;
+  }
+
+  // Build the new model on the side, so that a failure leaves this one as is.
+  UserOverrideModel loaded(capacity_, 1.0);
+  loaded.decayExponent_ = decayExponent_;
+  loaded.decayHorizon_ = decayHorizon_;
+  Reader reader(payload.data(), payload.size());
+  for (uint32_t i = 0; i < header.observationCount; ++i) {
+    ObservationRecord record;
+    std::string key;
+    if (!reader.read(&record) || !reader.read(record.keyLength, &key)) {
+      return false;
+    }
+    // The observations are in most recently used order, and so the ones past
+    // the capacity are the ones to drop. Duplicate keys are not expected; the
+    // first one wins.
+    uint64_t hash = HashKey(StringKey(key));
+    Observation* observation = nullptr;
+    if (loaded.size() < capacity_ &&
+        loaded.find(hash, StringKey(key)) == kNoIndex) {
+      uint32_t index =
+          loaded.insert(hash, std::move(key), /*asLeastRecent=*/true);
+      observation = &loaded.observations_[index];
+      observation->count = record.count;
+    }
+    for (uint32_t j = 0; j < record.overrideCount; ++j) {
+      OverrideRecord overrideRecord;
+      std::string candidate;
+      if (!reader.read(&overrideRecord) ||
+          !reader.read(overrideRecord.candidateLength, &candidate)) {
+        return false;
+      }
+      if (observation == nullptr) {
+        continue;
+      }
+      // Keep the most recent overrides if there are more than fit.
+      Override* o = nullptr;
+      if (observation->overrideCount < kMaxOverrides) {
+        o = &observation->overrides[observation->overrideCount++];
+      } else {
+        o = &observation->overrides[0];
+        for (Override& other : observation->overrides) {
+          if (other.timestamp < o->timestamp) {
+            o = &other;
+          }
+        }
+        if (o->timestamp >= overrideRecord.timestamp) {
+          continue;
+        }
+      }
+      o->candidate = std::move(candidate);
+      o->count = overrideRecord.count;
+      o->timestamp = overrideRecord.timestamp;
+      o->forceHighScoreOverride = overrideRecord.forceHighScoreOverride != 0;
+      observation->expiry = std::max(
+          observation->expiry, o->timestamp + loaded.decayHorizon_);
+    }
+  }
+  if (!reader.atEnd()) {
+    return false;
+  }
+
+  *this = std::move(loaded);
+  return true;
+}
+
+bool UserOverrideModel::save(const char* path) const {
+  return WriteFile(path, serialize());
+}
+
+bool UserOverrideModel::load(const char* path) {
+  MemoryMappedFile file;
+  if (!file.open(path)) {
+    return false;
+  }
+  return deserialize(file.data(), file.length());
+}
+
+bool UserOverrideModel::WriteFile(const char* path, std::string_view data) {
+  std::string tempPath = std::string(path) + ".tmp";
+  int fd = ::open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
+    return false;
+  }
+  bool written = true;
+  while (!data.empty()) {
+    ssize_t n = ::write(fd, data.data(), data.size());
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      written = false;
+      break;
+    }
+    data.remove_prefix(static_cast<size_t>(n));
+  }
+  // The data must be on the disk before the rename, or a crash could leave
+  // the renamed file empty.
+  written = written && ::fsync(fd) == 0;
+  written = ::close(fd) == 0 && written;
+  if (!written || std::rename(tempPath.c_str(), path) != 0) {
+    std::remove(tempPath.c_str());
+    return false;
+  }
+  return true;
+}
+
+void UserOverrideModel::Observation::update(std::string_view candidate,
+                                            double timestamp,
+                                            bool forceHighScoreOverride,
+                                            double decayHorizon) {
+  // Drop the overrides that have fully decayed.
+  for (uint32_t i = 0; i < overrideCount;) {
+    if (timestamp - overrides[i].timestamp > decayHorizon) {
+      std::swap(overrides[i], overrides[--overrideCount]);
     } else {
-      prevStr = CombineReadingValue((*head)->reading(),
-                                    (*head)->currentUnigram().value());
+      ++i;
     }
-  } else {
-    prevStr = kEmptyNodeString;
   }
 
-  std::string anteriorStr;
-  if (head != end && !prevIsPunctuation) {
-    --head;
-    if (IsPunctuation((*head))) {
-      anteriorStr = kEmptyNodeString;
+  count++;
+  Override* o = nullptr;
+  for (uint32_t i = 0; i < overrideCount; ++i) {
+    if (overrides[i].candidate == candidate) {
+      o = &overrides[i];
+      break;
+    }
+  }
+  if (o == nullptr) {
+    if (overrideCount < kMaxOverrides) {
+      o = &overrides[overrideCount++];
     } else {
-      anteriorStr = CombineReadingValue((*head)->reading(),
-                                        (*head)->currentUnigram().value());
+      o = &overrides[0];
+      for (uint32_t i = 1; i < overrideCount; ++i) {
+        if (overrides[i].timestamp < o->timestamp) {
+          o = &overrides[i];
+        }
+      }
     }
-  } else {
-    anteriorStr = kEmptyNodeString;
+    o->candidate.assign(candidate);
+    o->count = 0;
   }
+  o->timestamp = timestamp;
+  o->count++;
+  o->forceHighScoreOverride = forceHighScoreOverride;
+  expiry = std::max(expiry, timestamp + decayHorizon);
+}
 
-  return anteriorStr + "-" + prevStr + "-" + headStr;
+static double Score(size_t eventCount, size_t totalCount, double eventTimestamp,
+                    double timestamp, double lambda) {
+  double decay = exp((timestamp - eventTimestamp) * lambda);
+  if (decay < kDecayThreshold) {
+    return 0.0;
+  }
+
+  double prob =
+      static_cast<double>(eventCount) / static_cast<double>(totalCount);
+  return prob * decay;
 }
 
 }  // namespace McBopomofo
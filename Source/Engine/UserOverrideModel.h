@@ -24,15 +24,30 @@
 #ifndef SRC_ENGINE_USEROVERRIDEMODEL_H_
 #define SRC_ENGINE_USEROVERRIDEMODEL_H_
 
-#include <list>
-#include <map>
+#include <array>
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <utility>
+#include <vector>
 
 #include "gramambular2/reading_grid.h"
 
 namespace McBopomofo {
 
+// UserOverrideModel learns which candidates the user picks in which contexts.
+// A context, or observation key, is formed from a node and the two nodes
+// before it in a walk, as in "(r1,v1)-(r2,v2)-(r3,v3)". The observations are
+// kept in a flat open-addressed table, indexed by a 64-bit hash of the key and
+// verified against the key itself, with an intrusive LRU list through the
+// table's entries. Looking up a walk hashes the key's pieces in place, so
+// suggest() does not allocate, apart from the returned candidate if it is too
+// long for the small string buffer.
+//
+// An override whose score has decayed below the threshold is as good as gone,
+// so observe() also sweeps a few of the least recently used observations that
+// have fully decayed, and drops the decayed overrides of the observation it
+// updates. The model thus holds only live observations, whatever its capacity.
 class UserOverrideModel {
  public:
   UserOverrideModel(size_t capacity, double decayConstant);
@@ -62,28 +77,119 @@ class UserOverrideModel {
 
   Suggestion suggest(const std::string& key, double timestamp);
 
+  // Serializes the observations, in most recently used order, into a compact
+  // binary form that keeps their timestamps. Serializing is cheap, so the
+  // owner can do it on the thread that uses the model and write the bytes out
+  // on another one with WriteFile().
+  std::string serialize() const;
+
+  // Replaces the observations with serialized ones. If there are more than the
+  // capacity, the least recently used ones are dropped. Returns false and
+  // leaves the model unchanged if the data is damaged or of another version.
+  bool deserialize(const char* data, size_t length);
+
+  // Saves the serialized model to the file with WriteFile().
+  bool save(const char* path) const;
+
+  // Loads the model saved at the path. Returns false and leaves the model
+  // unchanged if the file cannot be read or is damaged.
+  bool load(const char* path);
+
+  // Writes the data to a temporary file next to the path, syncs it, and
+  // renames it over the path, so that a crash leaves either the old file or
+  // the new one.
+  static bool WriteFile(const char* path, std::string_view data);
+
+  // The number of observations made since the model was created or loaded.
+  // The owner can compare it to the count at the last save to tell whether
+  // there is anything new to save.
+  uint64_t changeCount() const { return changeCount_; }
+
+  size_t size() const { return observations_.size(); }
+
+  // Returns the bytes allocated for the observations and the table, including
+  // the keys and candidates too long to be stored inline in their strings.
+  size_t memoryUsage() const;
+
+  // Returns the hash under which the observation of the key is indexed.
+  static uint64_t KeyHash(std::string_view key);
+
  private:
+  static constexpr uint32_t kNoIndex = UINT32_MAX;
+
+  // The number of candidates kept per observation. When a new one does not
+  // fit, it replaces the one observed least recently.
+  static constexpr size_t kMaxOverrides = 4;
+
   struct Override {
-    size_t count = 0;
+    std::string candidate;
     double timestamp = 0;
+    uint64_t count = 0;
     bool forceHighScoreOverride = false;
   };
 
   struct Observation {
-    size_t count;
-    std::map<std::string, Override> overrides;
+    std::string key;
+    uint64_t hash = 0;
+    uint64_t count = 0;
+    // The neighbors in the LRU list, towards the most and the least recently
+    // used ends.
+    uint32_t newer = kNoIndex;
+    uint32_t older = kNoIndex;
+    uint32_t overrideCount = 0;
+    // The time after which all the overrides have fully decayed.
+    double expiry = 0;
+    std::array<Override, kMaxOverrides> overrides;
+
+    void update(std::string_view candidate, double timestamp,
+                bool forceHighScoreOverride, double decayHorizon);
+  };
 
-    Observation() : count(0) {}
-    void update(const std::string& candidate, double timestamp,
-                bool forceHighScoreOverride);
+  struct Slot {
+    uint32_t tag = 0;
+    uint32_t index = kNoIndex;
   };
 
-  typedef std::pair<std::string, Observation> KeyObservationPair;
+  // Returns the index of the observation with the key, or kNoIndex. Key is
+  // one of the key types in the .cpp file, which hash and compare the key
+  // without forming it.
+  template <typename Key>
+  uint32_t find(uint64_t hash, const Key& key) const;
+
+  template <typename Key>
+  void observeKey(const Key& key, std::string_view candidate,
+                  double timestamp, bool forceHighScoreOverride);
+
+  template <typename Key>
+  Suggestion suggestKey(const Key& key, double timestamp) const;
+
+  // Adds an observation with no overrides, evicting the least recently used
+  // one if the model is full, and returns its index. The new observation is
+  // the most recently used, or the least if asLeastRecent is true.
+  uint32_t insert(uint64_t hash, std::string key, bool asLeastRecent);
+
+  // Removes the observation, moving the last one into its place.
+  void erase(uint32_t index);
+
+  // Drops up to a few of the least recently used observations if they have
+  // fully decayed by the timestamp.
+  void sweep(double timestamp);
+
+  void link(uint32_t index, bool asLeastRecent);
+  void unlink(uint32_t index);
+  void eraseSlot(uint32_t index);
+  void growSlots();
 
   size_t capacity_;
   double decayExponent_;
-  std::list<KeyObservationPair> lruList_;
-  std::map<std::string, std::list<KeyObservationPair>::iterator> lruMap_;
+  // How long an override takes to fully decay, after which suggest() skips it
+  // without computing its score.
+  double decayHorizon_;
+  std::vector<Observation> observations_;
+  std::vector<Slot> slots_;
+  uint32_t mostRecent_ = kNoIndex;
+  uint32_t leastRecent_ = kNoIndex;
+  uint64_t changeCount_ = 0;
 };
 
 }  // namespace McBopomofo
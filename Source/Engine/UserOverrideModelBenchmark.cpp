@@ -0,0 +1,464 @@
+// Copyright (c) 2026 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include <benchmark/benchmark.h>
+
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "UserOverrideModel.h"
+#include "gramambular2/language_model.h"
+#include "gramambular2/reading_grid.h"
+
+namespace {
+
+using UserOverrideModel = McBopomofo::UserOverrideModel;
+using LanguageModel = Formosa::Gramambular2::LanguageModel;
+using ReadingGrid = Formosa::Gramambular2::ReadingGrid;
+
+// A recorded override stream, one observation per line as
+// "<timestamp>\t<key>\t<candidate>", for example gathered by logging the
+// arguments of UserOverrideModel::observe(). The benchmarks that replay it are
+// skipped if the file is absent.
+static const char* kRecordedStreamPath = "uom-stream.tsv";
+
+constexpr double kHalfLife = 5400.0;
+constexpr double kNow = 1700000000;
+
+std::string KeyOf(size_t i) {
+  std::string n = std::to_string(i);
+  return "(ㄐㄧ,積" + n + ")-(ㄧㄡˊ,由)-(ㄐㄧ,機" + n + ")";
+}
+
+// Fills the model to its capacity with keys shaped like the real ones, each
+// with two candidates.
+void Fill(UserOverrideModel& uom, size_t capacity) {
+  for (size_t i = 0; i < capacity; ++i) {
+    std::string key = KeyOf(i);
+    uom.observe(key, "機油", kNow + static_cast<double>(i));
+    uom.observe(key, "積由", kNow + static_cast<double>(i) + 1);
+  }
+}
+
+std::filesystem::path BenchmarkFilePath() {
+  return std::filesystem::temp_directory_path() /
+         "org.openvanilla.mcbopomofo.UserOverrideModelBenchmark.dat";
+}
+
+static void BM_UserOverrideModelSuggest(benchmark::State& state) {
+  size_t capacity = static_cast<size_t>(state.range(0));
+  UserOverrideModel uom(capacity, kHalfLife);
+  Fill(uom, capacity);
+  std::vector<std::string> keys;
+  for (size_t i = 0; i < 1024; ++i) {
+    // Half of the keys are hits.
+    keys.push_back(KeyOf(i % 2 == 0 ? i * capacity / 1024 : capacity + i));
+  }
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(uom.suggest(keys[i++ & 1023], kNow + 100));
+  }
+}
+BENCHMARK(BM_UserOverrideModelSuggest)->Arg(500)->Arg(5000)->Arg(100000);
+
+static void BM_UserOverrideModelObserve(benchmark::State& state) {
+  size_t capacity = static_cast<size_t>(state.range(0));
+  UserOverrideModel uom(capacity, kHalfLife);
+  Fill(uom, capacity);
+  std::vector<std::string> keys;
+  for (size_t i = 0; i < 1024; ++i) {
+    // Half of the keys are new, each of which evicts the oldest one.
+    keys.push_back(KeyOf(i % 2 == 0 ? i * capacity / 1024 : capacity + i));
+  }
+  size_t i = 0;
+  for (auto _ : state) {
+    uom.observe(keys[i++ & 1023], "機油", kNow + 100);
+  }
+}
+BENCHMARK(BM_UserOverrideModelObserve)->Arg(500)->Arg(5000)->Arg(100000);
+
+// Draws indices in [0, cardinality) with a Zipf distribution, which is how
+// the contexts that users type are distributed: a few are very frequent and
+// most are rare.
+std::vector<size_t> ZipfStream(size_t cardinality, size_t length,
+                               unsigned int seed) {
+  std::vector<double> weights(cardinality);
+  for (size_t i = 0; i < cardinality; ++i) {
+    weights[i] = 1.0 / static_cast<double>(i + 1);
+  }
+  std::discrete_distribution<size_t> distribution(weights.begin(),
+                                                  weights.end());
+  std::mt19937 generator(seed);
+  std::vector<size_t> stream(length);
+  for (size_t& index : stream) {
+    index = distribution(generator);
+  }
+  return stream;
+}
+
+void ReportMemory(benchmark::State& state, const UserOverrideModel& uom) {
+  state.counters["entries"] = static_cast<double>(uom.size());
+  state.counters["bytes_per_entry"] =
+      uom.size() == 0 ? 0
+                      : static_cast<double>(uom.memoryUsage()) /
+                            static_cast<double>(uom.size());
+}
+
+// Replays a synthetic stream through the key-based overloads: every step asks
+// for a suggestion, as every walk does, and one in four also observes an
+// override. The arguments are the capacity and the number of distinct keys.
+static void BM_UserOverrideModelReplayKeys(benchmark::State& state) {
+  size_t capacity = static_cast<size_t>(state.range(0));
+  size_t cardinality = static_cast<size_t>(state.range(1));
+  constexpr size_t kStreamLength = 1 << 16;
+  std::vector<size_t> stream = ZipfStream(cardinality, kStreamLength, 42);
+  std::vector<std::string> keys;
+  keys.reserve(cardinality);
+  for (size_t i = 0; i < cardinality; ++i) {
+    keys.push_back(KeyOf(i));
+  }
+
+  UserOverrideModel uom(capacity, kHalfLife);
+  size_t step = 0;
+  size_t hits = 0;
+  size_t suggestions = 0;
+  size_t observations = 0;
+  size_t insertions = 0;
+  for (auto _ : state) {
+    const std::string& key = keys[stream[step % kStreamLength]];
+    double now = kNow + static_cast<double>(step);
+    // The stream is too short for anything to decay, and so a key has a
+    // suggestion if and only if it is in the model.
+    bool found = !uom.suggest(key, now).empty();
+    hits += found ? 1 : 0;
+    ++suggestions;
+    if (step % 4 == 0) {
+      uom.observe(key, step % 8 == 0 ? "機油" : "積由", now);
+      ++observations;
+      // A new key makes the model grow, or evict once it is full.
+      insertions += found ? 0 : 1;
+    }
+    ++step;
+  }
+  state.counters["hit_rate"] =
+      static_cast<double>(hits) / static_cast<double>(suggestions);
+  state.counters["new_key_rate"] =
+      static_cast<double>(insertions) / static_cast<double>(observations);
+  ReportMemory(state, uom);
+}
+BENCHMARK(BM_UserOverrideModelReplayKeys)
+    ->ArgsProduct({{500, 5000, 50000}, {1000, 10000, 100000}})
+    ->ArgNames({"capacity", "keys"});
+
+// The cost of observing a key that is already there, against that of one
+// that is new and evicts the least recently used observation.
+static void BM_UserOverrideModelObserveExisting(benchmark::State& state) {
+  size_t capacity = static_cast<size_t>(state.range(0));
+  UserOverrideModel uom(capacity, kHalfLife);
+  Fill(uom, capacity);
+  std::vector<std::string> keys;
+  for (size_t i = 0; i < 1024; ++i) {
+    keys.push_back(KeyOf(i * capacity / 1024));
+  }
+  size_t i = 0;
+  for (auto _ : state) {
+    uom.observe(keys[i++ & 1023], "機油", kNow + 100);
+  }
+  ReportMemory(state, uom);
+}
+BENCHMARK(BM_UserOverrideModelObserveExisting)
+    ->Arg(500)
+    ->Arg(5000)
+    ->Arg(50000);
+
+static void BM_UserOverrideModelObserveEvicting(benchmark::State& state) {
+  size_t capacity = static_cast<size_t>(state.range(0));
+  UserOverrideModel uom(capacity, kHalfLife);
+  Fill(uom, capacity);
+  // Keys made ahead, so that only the observation is measured. Every one is
+  // new when it is observed.
+  constexpr size_t kKeyCount = 1 << 16;
+  std::vector<std::string> keys;
+  keys.reserve(kKeyCount);
+  for (size_t i = 0; i < kKeyCount; ++i) {
+    keys.push_back(KeyOf(capacity + i));
+  }
+  size_t i = 0;
+  for (auto _ : state) {
+    if (i == kKeyCount) {
+      state.PauseTiming();
+      for (std::string& key : keys) {
+        key = KeyOf(capacity + i++);
+      }
+      i = 0;
+      state.ResumeTiming();
+    }
+    uom.observe(keys[i++], "機油", kNow + 100);
+  }
+  ReportMemory(state, uom);
+}
+BENCHMARK(BM_UserOverrideModelObserveEvicting)
+    ->Arg(500)
+    ->Arg(5000)
+    ->Arg(50000);
+
+// A language model with the given number of syllables, each with a few
+// single-character values, for the walk-based overloads.
+class SyntheticLM : public LanguageModel {
+ public:
+  explicit SyntheticLM(size_t syllableCount) {
+    for (size_t i = 0; i < syllableCount; ++i) {
+      std::string reading = ReadingOf(i);
+      std::vector<Unigram>& unigrams = db_[reading];
+      for (int j = 0; j < 4; ++j) {
+        unigrams.emplace_back("字" + std::to_string(i * 4 + j), -2.0 - j);
+      }
+    }
+  }
+
+  static std::string ReadingOf(size_t i) { return "ㄅ" + std::to_string(i); }
+
+  std::vector<Unigram> getUnigrams(const std::string& key) override {
+    auto it = db_.find(key);
+    return it == db_.end() ? std::vector<Unigram>() : it->second;
+  }
+
+  bool hasUnigrams(const std::string& key) override {
+    return db_.find(key) != db_.end();
+  }
+
+ private:
+  std::map<std::string, std::vector<Unigram>> db_;
+};
+
+// A walk before and after the user overrides the node at the cursor.
+struct WalkSample {
+  ReadingGrid::WalkResult before;
+  ReadingGrid::WalkResult after;
+  size_t cursor;
+};
+
+// Types sentences of Zipf-distributed syllables and overrides one node of
+// each with another candidate.
+std::vector<WalkSample> MakeWalkSamples(size_t syllableCount,
+                                        size_t sampleCount) {
+  constexpr size_t kSentenceLength = 8;
+  auto lm = std::make_shared<SyntheticLM>(syllableCount);
+  std::vector<size_t> syllables =
+      ZipfStream(syllableCount, sampleCount * kSentenceLength, 7);
+  std::mt19937 generator(11);
+  std::vector<WalkSample> samples;
+  samples.reserve(sampleCount);
+  for (size_t i = 0; i < sampleCount; ++i) {
+    ReadingGrid grid(lm);
+    for (size_t j = 0; j < kSentenceLength; ++j) {
+      grid.insertReading(
+          SyntheticLM::ReadingOf(syllables[i * kSentenceLength + j]));
+    }
+    WalkSample sample;
+    sample.before = grid.walk().copyWithFixedNodes();
+    sample.cursor = generator() % kSentenceLength;
+    const ReadingGrid::NodePtr& node = sample.before.nodes[sample.cursor];
+    grid.overrideCandidate(sample.cursor, node->unigrams()[1].value());
+    sample.after = grid.walk().copyWithFixedNodes();
+    samples.push_back(std::move(sample));
+  }
+  return samples;
+}
+
+// Replays walks through the walk-based overloads: a suggestion for every node
+// of a walk, as KeyHandler asks for, and then the observation of an override.
+// The arguments are the capacity and the number of syllables, which sets the
+// number of distinct contexts.
+static void BM_UserOverrideModelReplayWalks(benchmark::State& state) {
+  size_t capacity = static_cast<size_t>(state.range(0));
+  size_t syllableCount = static_cast<size_t>(state.range(1));
+  constexpr size_t kSampleCount = 4096;
+  std::vector<WalkSample> samples =
+      MakeWalkSamples(syllableCount, kSampleCount);
+
+  UserOverrideModel uom(capacity, kHalfLife);
+  size_t step = 0;
+  size_t hits = 0;
+  size_t suggestions = 0;
+  for (auto _ : state) {
+    const WalkSample& sample = samples[step % kSampleCount];
+    double now = kNow + static_cast<double>(step);
+    for (size_t cursor = 0; cursor < sample.before.nodes.size(); ++cursor) {
+      hits += uom.suggest(sample.before, cursor, now).empty() ? 0 : 1;
+      ++suggestions;
+    }
+    uom.observe(sample.before, sample.after, sample.cursor, now);
+    ++step;
+  }
+  state.counters["hit_rate"] =
+      static_cast<double>(hits) / static_cast<double>(suggestions);
+  state.counters["suggestions_per_walk"] =
+      static_cast<double>(suggestions) / static_cast<double>(step);
+  ReportMemory(state, uom);
+}
+BENCHMARK(BM_UserOverrideModelReplayWalks)
+    ->ArgsProduct({{500, 5000, 50000}, {100, 1000}})
+    ->ArgNames({"capacity", "syllables"});
+
+static void BM_UserOverrideModelSuggestWalk(benchmark::State& state) {
+  size_t capacity = static_cast<size_t>(state.range(0));
+  constexpr size_t kSampleCount = 1024;
+  std::vector<WalkSample> samples = MakeWalkSamples(1000, kSampleCount);
+  UserOverrideModel uom(capacity, kHalfLife);
+  for (size_t i = 0; i < kSampleCount; i += 2) {
+    uom.observe(samples[i].before, samples[i].after, samples[i].cursor, kNow);
+  }
+  size_t step = 0;
+  for (auto _ : state) {
+    const WalkSample& sample = samples[step++ % kSampleCount];
+    benchmark::DoNotOptimize(uom.suggest(sample.before, sample.cursor, kNow));
+  }
+}
+BENCHMARK(BM_UserOverrideModelSuggestWalk)->Arg(500)->Arg(50000);
+
+struct RecordedObservation {
+  double timestamp;
+  std::string key;
+  std::string candidate;
+};
+
+std::vector<RecordedObservation> LoadRecordedStream() {
+  std::vector<RecordedObservation> stream;
+  std::ifstream input(kRecordedStreamPath);
+  std::string line;
+  while (std::getline(input, line)) {
+    std::stringstream fields(line);
+    RecordedObservation observation;
+    std::string timestamp;
+    if (std::getline(fields, timestamp, '\t') &&
+        std::getline(fields, observation.key, '\t') &&
+        std::getline(fields, observation.candidate)) {
+      observation.timestamp = std::stod(timestamp);
+      stream.push_back(std::move(observation));
+    }
+  }
+  return stream;
+}
+
+// Replays the recorded stream into a new model of the given capacity, asking
+// for a suggestion before each observation.
+static void BM_UserOverrideModelReplayRecorded(benchmark::State& state) {
+  std::vector<RecordedObservation> stream = LoadRecordedStream();
+  if (stream.empty()) {
+    state.SkipWithError("No recorded stream at uom-stream.tsv");
+    return;
+  }
+  size_t capacity = static_cast<size_t>(state.range(0));
+  size_t hits = 0;
+  for (auto _ : state) {
+    UserOverrideModel uom(capacity, kHalfLife);
+    hits = 0;
+    for (const RecordedObservation& observation : stream) {
+      UserOverrideModel::Suggestion suggestion =
+          uom.suggest(observation.key, observation.timestamp);
+      hits += suggestion.candidate == observation.candidate ? 1 : 0;
+      uom.observe(observation.key, observation.candidate,
+                  observation.timestamp);
+    }
+    state.PauseTiming();
+    ReportMemory(state, uom);
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(stream.size()));
+  // How often the model would have suggested what the user then picked.
+  state.counters["correct_suggestion_rate"] =
+      static_cast<double>(hits) / static_cast<double>(stream.size());
+}
+BENCHMARK(BM_UserOverrideModelReplayRecorded)
+    ->Arg(500)
+    ->Arg(5000)
+    ->Arg(50000)
+    ->Unit(benchmark::kMillisecond);
+
+static void BM_UserOverrideModelSerialize(benchmark::State& state) {
+  size_t capacity = static_cast<size_t>(state.range(0));
+  UserOverrideModel uom(capacity, kHalfLife);
+  Fill(uom, capacity);
+  size_t bytes = 0;
+  for (auto _ : state) {
+    std::string data = uom.serialize();
+    bytes = data.size();
+    benchmark::DoNotOptimize(data);
+  }
+  state.counters["file_bytes"] = static_cast<double>(bytes);
+}
+BENCHMARK(BM_UserOverrideModelSerialize)
+    ->Arg(500)
+    ->Arg(5000)
+    ->Arg(50000)
+    ->Arg(100000)
+    ->Unit(benchmark::kMicrosecond);
+
+static void BM_UserOverrideModelSave(benchmark::State& state) {
+  size_t capacity = static_cast<size_t>(state.range(0));
+  UserOverrideModel uom(capacity, kHalfLife);
+  Fill(uom, capacity);
+  std::filesystem::path path = BenchmarkFilePath();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(uom.save(path.c_str()));
+  }
+  std::filesystem::remove(path);
+}
+BENCHMARK(BM_UserOverrideModelSave)
+    ->Arg(500)
+    ->Arg(5000)
+    ->Arg(50000)
+    ->Arg(100000)
+    ->Unit(benchmark::kMicrosecond);
+
+static void BM_UserOverrideModelLoad(benchmark::State& state) {
+  size_t capacity = static_cast<size_t>(state.range(0));
+  UserOverrideModel uom(capacity, kHalfLife);
+  Fill(uom, capacity);
+  std::filesystem::path path = BenchmarkFilePath();
+  uom.save(path.c_str());
+  for (auto _ : state) {
+    UserOverrideModel loaded(capacity, kHalfLife);
+    benchmark::DoNotOptimize(loaded.load(path.c_str()));
+  }
+  std::filesystem::remove(path);
+}
+BENCHMARK(BM_UserOverrideModelLoad)
+    ->Arg(500)
+    ->Arg(5000)
+    ->Arg(50000)
+    ->Arg(100000)
+    ->Unit(benchmark::kMicrosecond);
+
+};  // namespace
+
+BENCHMARK_MAIN();
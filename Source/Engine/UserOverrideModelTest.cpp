@@ -21,7 +21,10 @@
 // FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
 // OTHER DEALINGS IN THE SOFTWARE.
 
+#include <filesystem>
+#include <set>
 #include <string>
+#include <vector>
 
 #include "UserOverrideModel.h"
 #include "gramambular2/reading_grid.h"
@@ -58,6 +61,69 @@ TEST(UserOverrideModelTest, BasicOperation) {
   ASSERT_TRUE(v.empty());
 }
 
+TEST(UserOverrideModelTest, SerializeAndDeserialize) {
+  UserOverrideModel uom(kCapacity, kHalflife);
+  uom.observe("k1", "a", kFakeNow);
+  uom.observe("k1", "b", kFakeNow + 1);
+  uom.observe("k1", "b", kFakeNow + 2);
+  uom.observe("k2", "c", kFakeNow, /*forceHighScoreOverride=*/true);
+  EXPECT_EQ(uom.changeCount(), 4);
+  std::string data = uom.serialize();
+
+  UserOverrideModel loaded(kCapacity, kHalflife);
+  ASSERT_TRUE(loaded.deserialize(data.data(), data.size()));
+  EXPECT_EQ(loaded.size(), 2);
+  EXPECT_EQ(loaded.changeCount(), 0);
+  EXPECT_EQ(loaded.suggest("k1", kFakeNow + 3).candidate, "b");
+  auto v = loaded.suggest("k2", kFakeNow + kHalflife * 20);
+  EXPECT_EQ(v.candidate, "c");
+  EXPECT_TRUE(v.forceHighScoreOverride);
+  // The timestamps survive, and so does the decay.
+  EXPECT_TRUE(loaded.suggest("k2", kFakeNow + kHalflife * 21).empty());
+  EXPECT_EQ(loaded.serialize(), data);
+
+  // A model with a smaller capacity keeps the most recently used ones.
+  UserOverrideModel small(1, kHalflife);
+  ASSERT_TRUE(small.deserialize(data.data(), data.size()));
+  EXPECT_EQ(small.size(), 1);
+  EXPECT_EQ(small.suggest("k2", kFakeNow).candidate, "c");
+  EXPECT_TRUE(small.suggest("k1", kFakeNow).empty());
+
+  // Damaged data is rejected and leaves the model as it is.
+  std::string damaged = data;
+  damaged[damaged.size() - 1] ^= 1;
+  EXPECT_FALSE(small.deserialize(damaged.data(), damaged.size()));
+  EXPECT_FALSE(small.deserialize(data.data(), data.size() - 1));
+  EXPECT_FALSE(small.deserialize(data.data(), 4));
+  EXPECT_EQ(small.suggest("k2", kFakeNow).candidate, "c");
+
+  UserOverrideModel empty(kCapacity, kHalflife);
+  std::string emptyData = empty.serialize();
+  ASSERT_TRUE(loaded.deserialize(emptyData.data(), emptyData.size()));
+  EXPECT_EQ(loaded.size(), 0);
+}
+
+TEST(UserOverrideModelTest, SaveAndLoad) {
+  std::filesystem::path path =
+      std::filesystem::temp_directory_path() /
+      "org.openvanilla.mcbopomofo.UserOverrideModelTest.dat";
+  UserOverrideModel uom(kCapacity, kHalflife);
+  for (int i = 0; i < kCapacity + 2; ++i) {
+    uom.observe("k" + std::to_string(i), "v", kFakeNow + i);
+  }
+  ASSERT_TRUE(uom.save(path.c_str()));
+  EXPECT_FALSE(std::filesystem::exists(path.string() + ".tmp"));
+
+  UserOverrideModel loaded(kCapacity, kHalflife);
+  ASSERT_TRUE(loaded.load(path.c_str()));
+  EXPECT_EQ(loaded.size(), kCapacity);
+  EXPECT_EQ(loaded.suggest("k6", kFakeNow).candidate, "v");
+  EXPECT_TRUE(loaded.suggest("k0", kFakeNow).empty());
+  std::filesystem::remove(path);
+  EXPECT_FALSE(loaded.load(path.c_str()));
+  EXPECT_EQ(loaded.size(), kCapacity);
+}
+
 TEST(UserOverrideModelTest, FreshVsFrequent) {
   UserOverrideModel uom(kCapacity, kHalflife);
   std::string key = "abc";
@@ -120,6 +186,91 @@ TEST(UserOverrideModelTest, LRUBehavior) {
   ASSERT_TRUE(v.empty());
 }
 
+TEST(UserOverrideModelTest, ManyObservations) {
+  constexpr int kLargeCapacity = 100;
+  UserOverrideModel uom(kLargeCapacity, kHalflife);
+  for (int i = 0; i < 1000; ++i) {
+    uom.observe("k" + std::to_string(i), "v" + std::to_string(i),
+                kFakeNow + i);
+  }
+  EXPECT_EQ(uom.size(), kLargeCapacity);
+  for (int i = 0; i < 1000; ++i) {
+    auto v = uom.suggest("k" + std::to_string(i), kFakeNow + 1000);
+    if (i < 1000 - kLargeCapacity) {
+      EXPECT_TRUE(v.empty()) << i;
+    } else {
+      EXPECT_EQ(v.candidate, "v" + std::to_string(i));
+    }
+  }
+
+  // Observing again makes an observation the most recently used.
+  uom.observe("k900", "w", kFakeNow + 1000);
+  for (int i = 1000; i < 1000 + kLargeCapacity - 1; ++i) {
+    uom.observe("k" + std::to_string(i), "v", kFakeNow + i);
+  }
+  EXPECT_FALSE(uom.suggest("k900", kFakeNow + 2000).empty());
+  EXPECT_TRUE(uom.suggest("k901", kFakeNow + 2000).empty());
+}
+
+TEST(UserOverrideModelTest, MemoryUsageStaysFlatWhenEvicting) {
+  constexpr int kLargeCapacity = 100;
+  UserOverrideModel uom(kLargeCapacity, kHalflife);
+  for (int i = 0; i < kLargeCapacity; ++i) {
+    uom.observe("k" + std::to_string(i), "v", kFakeNow + i);
+  }
+  size_t usage = uom.memoryUsage();
+  EXPECT_GT(usage, 0);
+
+  // Evictions reuse the storage of the evicted observations.
+  for (int i = kLargeCapacity; i < 10 * kLargeCapacity; ++i) {
+    uom.observe("k" + std::to_string(i), "v", kFakeNow + i);
+  }
+  EXPECT_EQ(uom.size(), kLargeCapacity);
+  EXPECT_EQ(uom.memoryUsage(), usage);
+}
+
+TEST(UserOverrideModelTest, ManyCandidatesForOneKey) {
+  UserOverrideModel uom(kCapacity, kHalflife);
+  for (int i = 0; i < 10; ++i) {
+    uom.observe("abc", "v" + std::to_string(i), kFakeNow + i);
+  }
+  EXPECT_EQ(uom.suggest("abc", kFakeNow + 10).candidate, "v9");
+
+  // An older candidate that was pushed out can come back.
+  uom.observe("abc", "v0", kFakeNow + 11);
+  uom.observe("abc", "v0", kFakeNow + 12);
+  EXPECT_EQ(uom.suggest("abc", kFakeNow + 12).candidate, "v0");
+}
+
+TEST(UserOverrideModelTest, SweepsDecayedObservations) {
+  constexpr int kLargeCapacity = 100;
+  UserOverrideModel uom(kLargeCapacity, kHalflife);
+  for (int i = 0; i < 10; ++i) {
+    uom.observe("k" + std::to_string(i), "v", kFakeNow + i);
+  }
+  EXPECT_EQ(uom.size(), 10);
+
+  // Each observation sweeps a few of the decayed ones.
+  double later = kFakeNow + kHalflife * 30;
+  uom.observe("new0", "v", later);
+  EXPECT_LT(uom.size(), 11);
+  for (int i = 1; i < 10; ++i) {
+    uom.observe("new" + std::to_string(i), "v", later + i);
+  }
+  EXPECT_EQ(uom.size(), 10);
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_TRUE(uom.suggest("k" + std::to_string(i), later).empty());
+    EXPECT_EQ(uom.suggest("new" + std::to_string(i), later + 10).candidate,
+              "v");
+  }
+
+  // A decayed candidate of an observation that is observed again is dropped.
+  uom.observe("new0", "decayed", later + 20);
+  uom.observe("new0", "w", later + kHalflife * 30);
+  EXPECT_EQ(uom.suggest("new0", later + kHalflife * 30).candidate, "w");
+  EXPECT_EQ(uom.serialize().find("decayed"), std::string::npos);
+}
+
 constexpr char kSampleData[] = R"(
 ㄐㄧ 機 -3.02367199
 ㄐㄧ 積 -3.72854036
@@ -273,6 +424,103 @@ TEST(UserOverrideModelTest, WalkResultSnapshotTest) {
   suggestion = uom.suggest(walkLatest, 1, timestamp);
   timestamp += 1.0;
   ASSERT_EQ(suggestion.candidate, "機油");
+
+  // The key of a walk hashes and compares the same as its string form, which
+  // is what a saved model holds.
+  EXPECT_EQ(uom.suggest("()-(ㄐㄧ,積)-(ㄧㄡˊ,由)", timestamp).candidate, "機油");
+  std::string data = uom.serialize();
+  UserOverrideModel loaded(kCapacity, kHalflife);
+  ASSERT_TRUE(loaded.deserialize(data.data(), data.size()));
+  EXPECT_EQ(loaded.suggest(walkLatest, 1, timestamp).candidate, "機油");
+}
+
+TEST(UserOverrideModelTest, WalkKeysMatchTheirStringForms) {
+  // Readings and values of 1 to 9 bytes put the key's pieces across the
+  // 8-byte words that the key hash is computed from.
+  std::string data;
+  for (size_t i = 1; i <= 9; ++i) {
+    data += std::string(i, 'a') + " " + std::string(i, 'A') + " -1\n";
+    data += std::string(i, 'b') + " " + std::string(i, 'B') + " -1\n";
+    data += std::string(i, 'c') + " " + std::string(i, 'C') + " -1\n";
+  }
+  auto lm = std::make_shared<SimpleLM>(data.c_str());
+  UserOverrideModel uom(kCapacity, kHalflife);
+
+  for (size_t i = 1; i <= 9; ++i) {
+    for (size_t j = 1; j <= 9; ++j) {
+      std::string a(i, 'a');
+      std::string b(j, 'b');
+      std::string c((i + j) % 9 + 1, 'c');
+      std::string key = "(" + a + "," + std::string(i, 'A') + ")-(" + b +
+                        "," + std::string(j, 'B') + ")-(" + c + "," +
+                        std::string(c.size(), 'C') + ")";
+      uom.observe(key, "x", kFakeNow);
+
+      Formosa::Gramambular2::ReadingGrid grid(lm);
+      grid.insertReading(a);
+      grid.insertReading(b);
+      grid.insertReading(c);
+      auto walk = grid.walk();
+      ASSERT_EQ(walk.nodes.size(), 3);
+      EXPECT_EQ(uom.suggest(walk, 3, kFakeNow).candidate, "x") << key;
+      EXPECT_EQ(uom.suggest(walk, 2, kFakeNow).candidate, "x") << key;
+    }
+  }
+
+  // A walk shorter than three nodes stands in "()" for the missing ones.
+  Formosa::Gramambular2::ReadingGrid grid(lm);
+  grid.insertReading("aaaaaaa");
+  uom.observe("()-()-(aaaaaaa,AAAAAAA)", "y", kFakeNow);
+  EXPECT_EQ(uom.suggest(grid.walk(), 1, kFakeNow).candidate, "y");
+}
+
+TEST(UserOverrideModelTest, KeysOfEveryLengthStayApart) {
+  // Keys that only differ in their length or in trailing zero bytes must not
+  // be taken for one another.
+  constexpr size_t kMaxLength = 40;
+  UserOverrideModel uom(kMaxLength * 2 + 2, kHalflife);
+  std::vector<std::string> keys;
+  for (size_t i = 0; i <= kMaxLength; ++i) {
+    keys.push_back(std::string(i, 'k'));
+    keys.push_back("k" + std::string(i, '\0'));
+  }
+  for (size_t i = 0; i < keys.size(); ++i) {
+    uom.observe(keys[i], "v" + std::to_string(i), kFakeNow);
+  }
+  EXPECT_EQ(uom.size(), keys.size() - 1);  // "k" appears twice.
+  for (size_t i = 0; i < keys.size(); ++i) {
+    if (keys[i] == "k") {
+      continue;
+    }
+    EXPECT_EQ(uom.suggest(keys[i], kFakeNow).candidate, "v" + std::to_string(i))
+        << i;
+  }
+}
+
+TEST(UserOverrideModelTest, KeysDifferingInTheSameBitsHashApart) {
+  // Flipping the same bit of two bytes in different words must not cancel
+  // out. UTF-8 keys have many bytes with the high bit set.
+  const std::string key = "(ㄅ,a)-(ㄆ,b)-(ㄇ,c)";
+  std::set<uint64_t> hashes{UserOverrideModel::KeyHash(key)};
+  size_t variants = 1;
+  for (size_t i = 0; i < key.size(); ++i) {
+    for (size_t j = i + 1; j < key.size(); ++j) {
+      for (int bit = 0; bit < 8; ++bit) {
+        std::string variant = key;
+        variant[i] = static_cast<char>(variant[i] ^ (1 << bit));
+        variant[j] = static_cast<char>(variant[j] ^ (1 << bit));
+        hashes.insert(UserOverrideModel::KeyHash(variant));
+        ++variants;
+      }
+    }
+  }
+  EXPECT_EQ(hashes.size(), variants);
+
+  std::string flipped = key;
+  flipped[7] = static_cast<char>(flipped[7] ^ 0x80);
+  flipped[15] = static_cast<char>(flipped[15] ^ 0x80);
+  EXPECT_NE(UserOverrideModel::KeyHash(flipped),
+            UserOverrideModel::KeyHash(key));
 }
 
 }  // namespace McBopomofo
@@ -28,24 +28,130 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <fstream>
+#include <iterator>
+#include <span>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 namespace McBopomofo {
 
-bool UserPhrasesLM::open(const char* path) {
+bool UserPhrasesLM::open(const char* path, const char* snapshotPath) {
   if (!mmapedFile_.open(path)) {
     return false;
   }
 
+  int64_t stamp = mmapedFile_.identity().modificationTimeNanoseconds;
+  if (snapshotPath != nullptr) {
+    ByteBlockBackedDictionary::SnapshotUse use = dictionary_.loadSnapshot(
+        snapshotPath, mmapedFile_.data(), mmapedFile_.length(), stamp,
+        ByteBlockBackedDictionary::ColumnOrder::VALUE_THEN_KEY);
+    if (use != ByteBlockBackedDictionary::SnapshotUse::NOT_USED) {
+      rebuildKeyFilter(dictionary_.keyCount());
+      rememberParsedTail();
+      if (use ==
+          ByteBlockBackedDictionary::SnapshotUse::USED_WITH_APPENDED_TEXT) {
+        dictionary_.saveSnapshot(snapshotPath, mmapedFile_.data(), stamp);
+      }
+      settleChanges();
+      return true;
+    }
+  }
+
   // MemoryMappedFile self-closes, and so this is fine.
-  return load(mmapedFile_.data(), mmapedFile_.length());
+  if (!load(mmapedFile_.data(), mmapedFile_.length())) {
+    return false;
+  }
+  rememberParsedTail();
+  if (snapshotPath != nullptr) {
+    dictionary_.saveSnapshot(snapshotPath, mmapedFile_.data(), stamp);
+  }
+  return true;
+}
+
+bool UserPhrasesLM::reopen(const char* path, const char* snapshotPath) {
+  if (parseAppendedLines(path)) {
+    return true;
+  }
+  closeFile();
+  return open(path, snapshotPath);
 }
 
 void UserPhrasesLM::close() {
+  closeFile();
+  addedValues_.clear();
+  removedValues_.clear();
+}
+
+void UserPhrasesLM::closeFile() {
   dictionary_.clear();
+  keyFilter_.clear();
+  keyFilterCapacity_ = 0;
   mmapedFile_.close();
+  retiredFiles_.clear();
+  parsedTail_.clear();
+}
+
+bool UserPhrasesLM::parseAppendedLines(const char* path) {
+  if (!mmapedFile_.isOpen() || mmapedFile_.path() != path ||
+      retiredFiles_.size() >= kMaxRetiredFiles) {
+    return false;
+  }
+
+  MemoryMappedFile file;
+  if (!file.open(path)) {
+    return false;
+  }
+  const MemoryMappedFile::FileIdentity& oldIdentity = mmapedFile_.identity();
+  size_t parsedSize = dictionary_.parsedSize();
+  if (file.identity().device != oldIdentity.device ||
+      file.identity().inode != oldIdentity.inode ||
+      file.length() <= parsedSize ||
+      std::string_view(file.data() + parsedSize - parsedTail_.size(),
+                        parsedTail_.size()) != parsedTail_) {
+    return false;
+  }
+
+  size_t oldKeyCount = dictionary_.keyCount();
+  if (!dictionary_.parseAppended(
+          file.data(), file.length(),
+          ByteBlockBackedDictionary::ColumnOrder::VALUE_THEN_KEY)) {
+    return false;
+  }
+  retiredFiles_.push_back(std::move(mmapedFile_));
+  mmapedFile_ = std::move(file);
+  rememberParsedTail();
+
+  if (dictionary_.keyCount() > keyFilterCapacity_) {
+    // Leave room for the next appends so that the filter is not rebuilt for
+    // each new phrase.
+    rebuildKeyFilter(dictionary_.keyCount() + dictionary_.keyCount() / 4);
+  } else {
+    dictionary_.forEachKey(
+        [this](std::string_view key) { keyFilter_.add(key); }, oldKeyCount);
+  }
+  settleChanges();
+  return true;
+}
+
+void UserPhrasesLM::rebuildKeyFilter(size_t capacity) {
+  keyFilter_.reset(capacity + addedValues_.size());
+  keyFilterCapacity_ = capacity;
+  dictionary_.forEachKey(
+      [this](std::string_view key) { keyFilter_.add(key); });
+  for (const auto& [reading, values] : addedValues_) {
+    keyFilter_.add(reading);
+  }
+}
+
+void UserPhrasesLM::rememberParsedTail() {
+  size_t parsedSize = dictionary_.parsedSize();
+  size_t length = std::min(parsedSize, kAppendCheckLength);
+  parsedTail_.assign(mmapedFile_.data() + parsedSize - length, length);
 }
 
 bool UserPhrasesLM::load(const char* data, size_t length) {
@@ -53,23 +159,174 @@ bool UserPhrasesLM::load(const char* data, size_t length) {
     return false;
   }
 
-  return dictionary_.parse(
-      data, length, ByteBlockBackedDictionary::ColumnOrder::VALUE_THEN_KEY);
+  keyFilter_.clear();
+  // Imported user phrase files can be tens of MB, so large files are parsed
+  // on all hardware threads.
+  ByteBlockBackedDictionary::ParseOptions options;
+  options.columnOrder = ByteBlockBackedDictionary::ColumnOrder::VALUE_THEN_KEY;
+  options.threadCount = 0;
+  if (!dictionary_.parse(data, length, options)) {
+    return false;
+  }
+
+  rebuildKeyFilter(dictionary_.keyCount());
+  settleChanges();
+  return true;
+}
+
+static bool Contains(const std::vector<std::string>& values,
+                     std::string_view value) {
+  return std::find(values.begin(), values.end(), value) != values.end();
+}
+
+// Returns the values of the reading in the map, or nullptr if there are none.
+static const std::vector<std::string>* FindValues(
+    const std::unordered_map<std::string, std::vector<std::string>>& map,
+    const std::string& reading) {
+  auto it = map.find(reading);
+  return it != map.end() ? &it->second : nullptr;
+}
+
+// Removes the value from the values of the reading, and the reading itself
+// if no value is left. Returns false if the value is not there.
+static bool EraseValue(
+    std::unordered_map<std::string, std::vector<std::string>>& map,
+    const std::string& reading, std::string_view value) {
+  auto it = map.find(reading);
+  if (it == map.end()) {
+    return false;
+  }
+  auto valueIt = std::find(it->second.begin(), it->second.end(), value);
+  if (valueIt == it->second.end()) {
+    return false;
+  }
+  it->second.erase(valueIt);
+  if (it->second.empty()) {
+    map.erase(it);
+  }
+  return true;
+}
+
+bool UserPhrasesLM::fileHasValue(const std::string& reading,
+                                 std::string_view value) const {
+  std::span<const std::string_view> values = dictionary_.getValues(reading);
+  return std::find(values.begin(), values.end(), value) != values.end();
+}
+
+bool UserPhrasesLM::add(const std::string& reading, const std::string& value) {
+  if (EraseValue(removedValues_, reading, value)) {
+    // The value may still be in the file, in which case it shows again.
+    if (fileHasValue(reading, value)) {
+      return true;
+    }
+  } else if (fileHasValue(reading, value)) {
+    return false;
+  }
+
+  std::vector<std::string>& added = addedValues_[reading];
+  if (Contains(added, value)) {
+    return false;
+  }
+  added.push_back(value);
+  // A filter that is not built lets every key pass.
+  if (keyFilter_.isBuilt()) {
+    keyFilter_.add(reading);
+  }
+  return true;
+}
+
+bool UserPhrasesLM::remove(const std::string& reading,
+                           const std::string& value) {
+  bool removed = EraseValue(addedValues_, reading, value);
+  const std::vector<std::string>* hidden = FindValues(removedValues_, reading);
+  if (fileHasValue(reading, value) &&
+      (hidden == nullptr || !Contains(*hidden, value))) {
+    removedValues_[reading].push_back(value);
+    removed = true;
+  }
+  return removed;
+}
+
+bool UserPhrasesLM::discard(const std::string& reading,
+                            const std::string& value) {
+  bool discarded = EraseValue(addedValues_, reading, value);
+  discarded |= EraseValue(removedValues_, reading, value);
+  return discarded;
+}
+
+size_t UserPhrasesLM::pendingChangeCount() const {
+  size_t count = 0;
+  for (const auto& [reading, values] : addedValues_) {
+    count += values.size();
+  }
+  for (const auto& [reading, values] : removedValues_) {
+    count += values.size();
+  }
+  return count;
+}
+
+void UserPhrasesLM::settleChanges() {
+  for (auto it = addedValues_.begin(); it != addedValues_.end();) {
+    std::erase_if(it->second, [&](const std::string& value) {
+      return fileHasValue(it->first, value);
+    });
+    it = it->second.empty() ? addedValues_.erase(it) : std::next(it);
+  }
+  for (auto it = removedValues_.begin(); it != removedValues_.end();) {
+    std::erase_if(it->second, [&](const std::string& value) {
+      return !fileHasValue(it->first, value);
+    });
+    it = it->second.empty() ? removedValues_.erase(it) : std::next(it);
+  }
 }
+
 std::vector<Formosa::Gramambular2::LanguageModel::Unigram>
 UserPhrasesLM::getUnigrams(const std::string& key) {
   std::vector<Formosa::Gramambular2::LanguageModel::Unigram> v;
+  if (!keyFilter_.mayContain(key)) {
+    return v;
+  }
 
-  std::vector<std::string_view> values = dictionary_.getValues(key);
+  std::span<const std::string_view> values = dictionary_.getValues(key);
+  const std::vector<std::string>* added = FindValues(addedValues_, key);
+  if (values.empty() && added == nullptr) {
+    keyFilter_.recordFalsePositive();
+  }
+  const std::vector<std::string>* removed = FindValues(removedValues_, key);
   for (const auto& value : values) {
-    v.emplace_back(std::string(value), kUserUnigramScore);
+    if (removed == nullptr || !Contains(*removed, value)) {
+      v.emplace_back(std::string(value), kUserUnigramScore);
+    }
+  }
+  if (added != nullptr) {
+    for (const auto& value : *added) {
+      v.emplace_back(value, kUserUnigramScore);
+    }
   }
 
   return v;
 }
 
 bool UserPhrasesLM::hasUnigrams(const std::string& key) {
-  return dictionary_.hasKey(key);
+  if (!keyFilter_.mayContain(key)) {
+    return false;
+  }
+  if (addedValues_.contains(key)) {
+    return true;
+  }
+  const std::vector<std::string>* removed = FindValues(removedValues_, key);
+  if (removed != nullptr) {
+    // The reading is there only if some value in the file is not hidden.
+    std::span<const std::string_view> values = dictionary_.getValues(key);
+    return std::any_of(values.begin(), values.end(), [removed](auto value) {
+      return !Contains(*removed, value);
+    });
+  }
+  if (!dictionary_.hasKey(key)) {
+    keyFilter_.recordFalsePositive();
+    return false;
+  }
+  return true;
 }
 
 std::vector<ByteBlockBackedDictionary::Issue> UserPhrasesLM::getParsingIssues()
@@ -24,11 +24,13 @@
 #ifndef SRC_ENGINE_USERPHRASESLM_H_
 #define SRC_ENGINE_USERPHRASESLM_H_
 
-#include <map>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
 #include "ByteBlockBackedDictionary.h"
+#include "KeyFilter.h"
 #include "MemoryMappedFile.h"
 #include "gramambular2/language_model.h"
 
@@ -42,24 +44,96 @@ class UserPhrasesLM : public Formosa::Gramambular2::LanguageModel {
   UserPhrasesLM& operator=(const UserPhrasesLM&) = delete;
   UserPhrasesLM& operator=(UserPhrasesLM&&) = delete;
 
-  bool open(const char* path);
+  // If snapshotPath is given, the index is loaded from the snapshot file
+  // there when it matches the file, and otherwise parsed and saved there, so
+  // that the next open of a large file is a validated mapping instead of a
+  // parse. See ByteBlockBackedDictionary::saveSnapshot().
+  bool open(const char* path, const char* snapshotPath = nullptr);
   void close();
 
+  // Opens the file like open(), except that if the file is the one already
+  // open and it has only grown, as it does when a phrase is appended to it,
+  // only the new lines are parsed into the existing index. Adding a phrase
+  // then costs time proportional to the phrase rather than to the file. The
+  // file counts as grown if it is the same file (device and inode), is
+  // larger, and still has the same bytes at the end of the part that was
+  // parsed. Any other change, or too many appends in a row, leads to a full
+  // reparse. A snapshot is only saved on a full reparse; the next open
+  // parses the appended lines on top of it.
+  bool reopen(const char* path, const char* snapshotPath = nullptr);
+
   // Allows loading existing in-memory data. It's the caller's responsibility
   // to make sure that data outlives this instance.
   bool load(const char* data, size_t length);
 
+  // Adds a phrase in memory, on top of the loaded file, so that lookups
+  // return it right away. The caller is expected to write the phrase to the
+  // file as well, possibly later and on another thread; once a reload shows
+  // the phrase in the file, the in-memory entry is dropped. Returns false if
+  // the phrase is already there.
+  bool add(const std::string& reading, const std::string& value);
+
+  // Hides a phrase, whether it comes from the file or from add(), in the same
+  // way. Returns false if there is no such phrase.
+  bool remove(const std::string& reading, const std::string& value);
+
+  // Drops any in-memory change to a phrase, so that it shows as it does in
+  // the loaded file. This is for when writing the change to the file failed.
+  // Returns false if there is no change to the phrase.
+  bool discard(const std::string& reading, const std::string& value);
+
+  // The number of phrases added or removed in memory that the loaded file
+  // does not reflect yet.
+  size_t pendingChangeCount() const;
+
   std::vector<Formosa::Gramambular2::LanguageModel::Unigram> getUnigrams(
       const std::string& key) override;
   bool hasUnigrams(const std::string& key) override;
 
   std::vector<ByteBlockBackedDictionary::Issue> getParsingIssues() const;
 
+  // The stats of the key filter since the data was last loaded. The filter
+  // is rebuilt on every load.
+  KeyFilter::Stats keyFilterStats() const { return keyFilter_.stats(); }
+
   static constexpr double kUserUnigramScore = 0;
 
  protected:
+  // The number of mappings of earlier sizes of the file that are kept alive
+  // for the index before a full reparse is done.
+  static constexpr size_t kMaxRetiredFiles = 16;
+
+  // The number of bytes at the end of the parsed text that must still match
+  // for the file to count as grown.
+  static constexpr size_t kAppendCheckLength = 256;
+
+  // Parses the appended lines if the file at the path is the open file grown.
+  // Returns false if it is not, and the caller should do a full reparse.
+  bool parseAppendedLines(const char* path);
+
+  void rebuildKeyFilter(size_t capacity);
+  void rememberParsedTail();
+
+  // Closes the file and clears the index, but keeps the in-memory changes.
+  void closeFile();
+
+  // Drops the in-memory changes that the loaded file now reflects.
+  void settleChanges();
+
+  bool fileHasValue(const std::string& reading, std::string_view value) const;
+
   MemoryMappedFile mmapedFile_;
+  // Mappings of the file before it grew. The index still points into them.
+  std::vector<MemoryMappedFile> retiredFiles_;
+  std::string parsedTail_;
   ByteBlockBackedDictionary dictionary_;
+  KeyFilter keyFilter_;
+  size_t keyFilterCapacity_ = 0;
+
+  // The in-memory changes, keyed by reading. Added values come after the
+  // ones from the file; removed values hide the file's values.
+  std::unordered_map<std::string, std::vector<std::string>> addedValues_;
+  std::unordered_map<std::string, std::vector<std::string>> removedValues_;
 };
 
 }  // namespace McBopomofo
@@ -23,6 +23,7 @@
 
 #include <cstdio>
 #include <filesystem>
+#include <fstream>
 #include <string>
 #include <vector>
 
@@ -59,4 +60,234 @@ TEST(UserPhrasesLMTest, ValuesContainingSpaces) {
   EXPECT_EQ(results[0].score(), UserPhrasesLM::kUserUnigramScore);
 }
 
+TEST(UserPhrasesLMTest, KeyFilter) {
+  constexpr char kTestData[] = "value1 reading1\nvalue2 reading2";
+
+  UserPhrasesLM lm;
+  EXPECT_FALSE(lm.hasUnigrams("reading1"));
+  ASSERT_TRUE(lm.load(kTestData, sizeof(kTestData)));
+  EXPECT_TRUE(lm.hasUnigrams("reading1"));
+  EXPECT_TRUE(lm.hasUnigrams("reading2"));
+  EXPECT_FALSE(lm.hasUnigrams("reading3"));
+  EXPECT_FALSE(lm.hasUnigrams("value1"));
+  EXPECT_TRUE(lm.getUnigrams("reading3").empty());
+
+  KeyFilter::Stats stats = lm.keyFilterStats();
+  EXPECT_EQ(stats.lookups, 5);
+  EXPECT_EQ(stats.lookupsSaved + stats.falsePositives, 3);
+
+  // Reloading starts over.
+  ASSERT_TRUE(lm.load(kTestData, sizeof(kTestData)));
+  EXPECT_EQ(lm.keyFilterStats().lookups, 0);
+  lm.close();
+  EXPECT_FALSE(lm.hasUnigrams("reading1"));
+}
+
+// Tells whether the last reopen() parsed only the appended lines.
+class InspectableUserPhrasesLM : public UserPhrasesLM {
+ public:
+  size_t retiredFileCount() const { return retiredFiles_.size(); }
+};
+
+TEST(UserPhrasesLMTest, ReopenParsesAppendedLines) {
+  std::filesystem::path path =
+      std::filesystem::temp_directory_path() /
+      "org.openvanilla.mcbopomofo.UserPhrasesLMTest.txt";
+  auto write = [&path](const std::string& data, std::ios::openmode mode) {
+    std::ofstream out(path, std::ios::binary | mode);
+    out << data;
+  };
+
+  write("value1 reading1\n", std::ios::trunc);
+  InspectableUserPhrasesLM lm;
+  ASSERT_TRUE(lm.reopen(path.c_str()));
+  EXPECT_TRUE(lm.hasUnigrams("reading1"));
+  EXPECT_FALSE(lm.hasUnigrams("reading2"));
+
+  // Appends are parsed on their own, and values of existing keys keep their
+  // order.
+  write("value2 reading2\nvalue3 reading1\nnoreading\n", std::ios::app);
+  ASSERT_TRUE(lm.reopen(path.c_str()));
+  EXPECT_EQ(lm.retiredFileCount(), 1);
+  EXPECT_TRUE(lm.hasUnigrams("reading2"));
+  std::vector<Formosa::Gramambular2::LanguageModel::Unigram> results =
+      lm.getUnigrams("reading1");
+  ASSERT_EQ(results.size(), 2);
+  EXPECT_EQ(results[0].value(), "value1");
+  EXPECT_EQ(results[1].value(), "value3");
+  ASSERT_EQ(lm.getParsingIssues().size(), 1);
+  EXPECT_EQ(lm.getParsingIssues()[0].lineNumber, 4);
+
+  write("value4 reading4\n", std::ios::app);
+  ASSERT_TRUE(lm.reopen(path.c_str()));
+  EXPECT_EQ(lm.retiredFileCount(), 2);
+  EXPECT_TRUE(lm.hasUnigrams("reading4"));
+  EXPECT_TRUE(lm.hasUnigrams("reading2"));
+
+  // Rewriting the file in place is not an append, even though it grows.
+  write(
+      "value5 reading5\nvalue1 reading1\nvalue6 reading6\nvalue8 reading8\n"
+      "value9 reading9\n",
+      std::ios::trunc);
+  ASSERT_TRUE(lm.reopen(path.c_str()));
+  EXPECT_EQ(lm.retiredFileCount(), 0);
+  EXPECT_TRUE(lm.hasUnigrams("reading5"));
+  EXPECT_FALSE(lm.hasUnigrams("reading2"));
+  EXPECT_TRUE(lm.getParsingIssues().empty());
+
+  // Nor is shrinking.
+  write("value1 reading1\n", std::ios::trunc);
+  ASSERT_TRUE(lm.reopen(path.c_str()));
+  EXPECT_EQ(lm.retiredFileCount(), 0);
+  EXPECT_FALSE(lm.hasUnigrams("reading5"));
+
+  // An append to a last line without a linefeed continues that line.
+  write("value7 reading7", std::ios::trunc);
+  ASSERT_TRUE(lm.reopen(path.c_str()));
+  write("x\n", std::ios::app);
+  ASSERT_TRUE(lm.reopen(path.c_str()));
+  EXPECT_EQ(lm.retiredFileCount(), 0);
+  EXPECT_TRUE(lm.hasUnigrams("reading7x"));
+  EXPECT_FALSE(lm.hasUnigrams("reading7"));
+
+  // Many appends in a row eventually lead to a full reparse, which drops the
+  // old mappings.
+  for (int i = 0; i < 40; ++i) {
+    write("value reading" + std::to_string(i) + "\n", std::ios::app);
+    ASSERT_TRUE(lm.reopen(path.c_str()));
+    EXPECT_LT(lm.retiredFileCount(), 20);
+  }
+  for (int i = 0; i < 40; ++i) {
+    EXPECT_TRUE(lm.hasUnigrams("reading" + std::to_string(i)));
+  }
+  EXPECT_TRUE(lm.hasUnigrams("reading7x"));
+
+  lm.close();
+  std::filesystem::remove(path);
+}
+
+TEST(UserPhrasesLMTest, AddAndRemoveInMemory) {
+  std::filesystem::path path =
+      std::filesystem::temp_directory_path() /
+      "org.openvanilla.mcbopomofo.UserPhrasesLMTest.overlay.txt";
+  auto write = [&path](const std::string& data, std::ios::openmode mode) {
+    std::ofstream out(path, std::ios::binary | mode);
+    out << data;
+  };
+
+  write("value1 reading1\nvalue2 reading1\n", std::ios::trunc);
+  UserPhrasesLM lm;
+  ASSERT_TRUE(lm.reopen(path.c_str()));
+
+  EXPECT_FALSE(lm.add("reading1", "value1"));
+  EXPECT_TRUE(lm.add("reading1", "value3"));
+  EXPECT_TRUE(lm.add("reading2", "value4"));
+  EXPECT_FALSE(lm.add("reading2", "value4"));
+  EXPECT_TRUE(lm.remove("reading1", "value1"));
+  EXPECT_FALSE(lm.remove("reading1", "value1"));
+  EXPECT_FALSE(lm.remove("reading3", "value1"));
+  EXPECT_EQ(lm.pendingChangeCount(), 3);
+
+  std::vector<Formosa::Gramambular2::LanguageModel::Unigram> results =
+      lm.getUnigrams("reading1");
+  ASSERT_EQ(results.size(), 2);
+  EXPECT_EQ(results[0].value(), "value2");
+  EXPECT_EQ(results[1].value(), "value3");
+  EXPECT_TRUE(lm.hasUnigrams("reading2"));
+
+  // A reading whose values are all removed is gone.
+  EXPECT_TRUE(lm.remove("reading1", "value2"));
+  EXPECT_TRUE(lm.remove("reading1", "value3"));
+  EXPECT_FALSE(lm.hasUnigrams("reading1"));
+  EXPECT_TRUE(lm.getUnigrams("reading1").empty());
+
+  // Adding a removed value from the file brings it back in its place.
+  EXPECT_TRUE(lm.add("reading1", "value1"));
+  EXPECT_TRUE(lm.add("reading1", "value2"));
+  results = lm.getUnigrams("reading1");
+  ASSERT_EQ(results.size(), 2);
+  EXPECT_EQ(results[0].value(), "value1");
+  EXPECT_EQ(results[1].value(), "value2");
+  EXPECT_EQ(lm.pendingChangeCount(), 1);
+
+  // A discarded change shows the phrase as it is in the file again.
+  EXPECT_TRUE(lm.remove("reading1", "value2"));
+  EXPECT_TRUE(lm.discard("reading1", "value2"));
+  EXPECT_FALSE(lm.discard("reading1", "value2"));
+  EXPECT_EQ(lm.getUnigrams("reading1").size(), 2);
+  EXPECT_TRUE(lm.add("reading3", "value3"));
+  EXPECT_TRUE(lm.discard("reading3", "value3"));
+  EXPECT_FALSE(lm.hasUnigrams("reading3"));
+  EXPECT_EQ(lm.pendingChangeCount(), 1);
+
+  // A reload that does not have the change yet keeps it; one that does drops
+  // it.
+  write("value5 reading5\n", std::ios::app);
+  ASSERT_TRUE(lm.reopen(path.c_str()));
+  EXPECT_TRUE(lm.hasUnigrams("reading2"));
+  EXPECT_EQ(lm.pendingChangeCount(), 1);
+  write("value4 reading2\n", std::ios::app);
+  ASSERT_TRUE(lm.reopen(path.c_str()));
+  EXPECT_EQ(lm.pendingChangeCount(), 0);
+  ASSERT_EQ(lm.getUnigrams("reading2").size(), 1);
+
+  // The same goes for removals, including on a full reparse.
+  EXPECT_TRUE(lm.remove("reading5", "value5"));
+  EXPECT_FALSE(lm.hasUnigrams("reading5"));
+  write("value1 reading1\nvalue2 reading1\nvalue4 reading2\n",
+        std::ios::trunc);
+  ASSERT_TRUE(lm.reopen(path.c_str()));
+  EXPECT_EQ(lm.pendingChangeCount(), 0);
+  EXPECT_FALSE(lm.hasUnigrams("reading5"));
+
+  // Closing drops the changes that are still pending.
+  EXPECT_TRUE(lm.add("reading6", "value6"));
+  lm.close();
+  EXPECT_EQ(lm.pendingChangeCount(), 0);
+  EXPECT_FALSE(lm.hasUnigrams("reading6"));
+  std::filesystem::remove(path);
+}
+
+TEST(UserPhrasesLMTest, OpenWithSnapshot) {
+  std::filesystem::path path =
+      std::filesystem::temp_directory_path() /
+      "org.openvanilla.mcbopomofo.UserPhrasesLMTest.snapshot.txt";
+  std::filesystem::path snapshotPath = path.string() + ".snapshot";
+  {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out << "value1 reading1\nvalue2 reading2\nvalue3 reading1\n";
+  }
+  std::filesystem::remove(snapshotPath);
+
+  {
+    UserPhrasesLM lm;
+    ASSERT_TRUE(lm.open(path.c_str(), snapshotPath.c_str()));
+    EXPECT_TRUE(std::filesystem::exists(snapshotPath));
+  }
+  {
+    UserPhrasesLM lm;
+    ASSERT_TRUE(lm.open(path.c_str(), snapshotPath.c_str()));
+    std::vector<Formosa::Gramambular2::LanguageModel::Unigram> results =
+        lm.getUnigrams("reading1");
+    ASSERT_EQ(results.size(), 2);
+    EXPECT_EQ(results[0].value(), "value1");
+    EXPECT_EQ(results[1].value(), "value3");
+    EXPECT_TRUE(lm.hasUnigrams("reading2"));
+    EXPECT_FALSE(lm.hasUnigrams("reading3"));
+  }
+  {
+    std::ofstream out(path, std::ios::binary | std::ios::app);
+    out << "value4 reading3\n";
+  }
+  {
+    UserPhrasesLM lm;
+    ASSERT_TRUE(lm.open(path.c_str(), snapshotPath.c_str()));
+    EXPECT_TRUE(lm.hasUnigrams("reading3"));
+    EXPECT_EQ(lm.getUnigrams("reading1").size(), 2);
+  }
+
+  std::filesystem::remove(path);
+  std::filesystem::remove(snapshotPath);
+}
+
 }  // namespace McBopomofo
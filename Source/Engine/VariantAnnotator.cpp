@@ -24,6 +24,8 @@
 #include "VariantAnnotator.h"
 
 #include <cassert>
+#include <cstdint>
+#include <limits>
 
 static constexpr char kDelimiterChar = ' ';
 static constexpr char kSeparatorChar = '-';
@@ -31,16 +33,121 @@ static constexpr const char* kUnannotatedReading = "na";
 
 namespace McBopomofo {
 
-static std::string GetSecondColumn(std::string_view row) {
-  auto it = row.cbegin();
-  while (it != row.cend()) {
-    if (*it == kDelimiterChar) {
-      ++it;
+static constexpr uint32_t kFNVOffsetBasis = 2166136261u;
+static constexpr uint32_t kFNVPrime = 16777619u;
+
+static uint32_t HashPiece(uint32_t hash, std::string_view piece) {
+  for (char c : piece) {
+    hash = (hash ^ static_cast<uint8_t>(c)) * kFNVPrime;
+  }
+  return hash;
+}
+
+// Hashes the key formed by the parts as if it had been joined first.
+static uint32_t HashKey(std::string_view first, std::string_view second) {
+  uint32_t hash = HashPiece(kFNVOffsetBasis, first);
+  if (!second.empty()) {
+    hash = (hash ^ static_cast<uint8_t>(kSeparatorChar)) * kFNVPrime;
+    hash = HashPiece(hash, second);
+  }
+  return hash;
+}
+
+static bool KeyEquals(std::string_view key, std::string_view first,
+                      std::string_view second) {
+  if (second.empty()) {
+    return key == first;
+  }
+  return key.length() == first.length() + 1 + second.length() &&
+         key.substr(0, first.length()) == first &&
+         key[first.length()] == kSeparatorChar &&
+         key.substr(first.length() + 1) == second;
+}
+
+void VariantAnnotator::KeyTable::build(const ParselessPhraseDB& db) {
+  clear();
+  ParselessPhraseDB::RowRange rows = db.rows("");
+  if (rows.empty()) {
+    return;
+  }
+  rowsBegin_ = rows.front().data();
+
+  size_t count = 0;
+  for (std::string_view row : rows) {
+    (void)row;
+    ++count;
+  }
+  // Keep the load factor at or below 3/4 so that probe sequences stay short.
+  size_t capacity = 16;
+  while (capacity * 3 < count * 4) {
+    capacity *= 2;
+  }
+  slots_.resize(capacity);
+  size_t mask = capacity - 1;
+
+  for (std::string_view row : rows) {
+    size_t delimiter = row.find(kDelimiterChar);
+    if (delimiter == std::string_view::npos) {
+      continue;
+    }
+    std::string_view key = row.substr(0, delimiter);
+    std::string_view value = row.substr(delimiter + 1);
+    auto offset = static_cast<size_t>(row.data() - rowsBegin_);
+    if (offset > std::numeric_limits<uint32_t>::max() - 1) {
+      // Too large for 32-bit offsets; leave the rest out.
       break;
     }
-    ++it;
+    if (key.length() > std::numeric_limits<uint16_t>::max() ||
+        value.length() > std::numeric_limits<uint16_t>::max()) {
+      continue;
+    }
+
+    uint32_t hash = HashKey(key, {});
+    size_t index = hash & mask;
+    bool found = false;
+    while (slots_[index].offset != kEmpty) {
+      const Slot& slot = slots_[index];
+      if (slot.hash == hash &&
+          std::string_view(rowsBegin_ + slot.offset, slot.keyLength) == key) {
+        found = true;
+        break;
+      }
+      index = (index + 1) & mask;
+    }
+    // As with a prefix lookup in the db, the first row of a key wins.
+    if (!found) {
+      slots_[index] = Slot{hash, static_cast<uint32_t>(offset),
+                           static_cast<uint16_t>(key.length()),
+                           static_cast<uint16_t>(value.length())};
+    }
   }
-  return {it, row.cend()};
+}
+
+void VariantAnnotator::KeyTable::clear() {
+  rowsBegin_ = nullptr;
+  slots_.clear();
+  slots_.shrink_to_fit();
+}
+
+std::string_view VariantAnnotator::KeyTable::find(
+    std::string_view first, std::string_view second) const {
+  if (slots_.empty()) {
+    return {};
+  }
+  uint32_t hash = HashKey(first, second);
+  size_t mask = slots_.size() - 1;
+  for (size_t index = hash & mask; slots_[index].offset != kEmpty;
+       index = (index + 1) & mask) {
+    const Slot& slot = slots_[index];
+    if (slot.hash != hash) {
+      continue;
+    }
+    const char* row = rowsBegin_ + slot.offset;
+    if (KeyEquals(std::string_view(row, slot.keyLength), first, second)) {
+      return {row + slot.keyLength + 1, slot.valueLength};
+    }
+  }
+  return {};
 }
 
 bool VariantAnnotator::loadPUAFile(const std::filesystem::path& bpmfvsPUAPath) {
@@ -57,6 +164,7 @@ bool VariantAnnotator::loadPUAFile(const std::filesystem::path& bpmfvsPUAPath) {
 
   puaMap_ = std::move(db);
   bpmfvsPUAFile_ = std::move(file);
+  puaTable_.build(*puaMap_);
   return true;
 }
 
@@ -75,18 +183,27 @@ bool VariantAnnotator::loadVariantsFile(
 
   variantsMap_ = std::move(db);
   bpmfvsVariantsFile_ = std::move(file);
+  variantsTable_.build(*variantsMap_);
   return true;
 }
 
 void VariantAnnotator::loadPUAMap(std::unique_ptr<ParselessPhraseDB> puaMap) {
+  puaTable_.clear();
   bpmfvsPUAFile_.close();
   puaMap_ = std::move(puaMap);
+  if (puaMap_ != nullptr) {
+    puaTable_.build(*puaMap_);
+  }
 }
 
 void VariantAnnotator::loadVariantsMap(
     std::unique_ptr<ParselessPhraseDB> variantsMap) {
+  variantsTable_.clear();
   bpmfvsVariantsFile_.close();
   variantsMap_ = std::move(variantsMap);
+  if (variantsMap_ != nullptr) {
+    variantsTable_.build(*variantsMap_);
+  }
 }
 
 bool VariantAnnotator::loaded() const {
@@ -95,31 +212,10 @@ bool VariantAnnotator::loaded() const {
 
 VariantAnnotator::Result VariantAnnotator::annotateSingleCharacter(
     const std::string& value, const std::string& reading) const {
-  if (!loaded()) {
-    return {};
-  }
-
-  std::string variant = findDefaultOrAnnotatedVariant(value, reading);
-  if (!variant.empty()) {
-    // If variant != value, a variant selector must have been used.
-    bool selectorUsed = variant != value;
-    return Result{variant, selectorUsed, false};
-  }
-
-  // Now try the fallback.
-  variant = findUnannotatedVariant(value);
-  if (variant.empty() || variant == reading) {
-    return Result{value, false, false};
-  }
-
-  std::string puaBlock = findCombinedPUABopomofoReading(reading);
-  if (!puaBlock.empty()) {
-    // The string is the value + Variant 0 selector + the Bopomofo block in PUA.
-    return Result{variant + puaBlock, true, true};
-  }
-
-  // Only the unannotated Variant 0 is found.
-  return Result{variant, true, false};
+  CombinedResult result;
+  annotateInto(value, reading, result);
+  return Result{std::move(result.annotatedString), result.hasVariantSelectors,
+                result.hasPUACodePoints};
 }
 
 VariantAnnotator::CombinedResult VariantAnnotator::annotate(
@@ -132,53 +228,79 @@ VariantAnnotator::CombinedResult VariantAnnotator::annotate(
     return combinedResult;
   }
 
+  // A variant selector takes 4 bytes and a PUA code point 3, so this is
+  // enough for most strings to be annotated without reallocating.
+  size_t length = 0;
+  for (const std::string& value : values) {
+    length += value.length() + 7;
+  }
+  combinedResult.annotatedString.reserve(length);
+  combinedResult.accumulatedStringLength.reserve(values.size() + 1);
   combinedResult.accumulatedStringLength.push_back(0);
 
   for (size_t i = 0, s = values.size(); i < s; i++) {
-    Result result = annotateSingleCharacter(values[i], readings[i]);
-    combinedResult.annotatedString += result.annotatedString;
-    combinedResult.hasPUACodePoints |= result.hasPUACodePoints;
-    combinedResult.hasVariantSelectors |= result.hasVariantSelectors;
+    annotateInto(values[i], readings[i], combinedResult);
     combinedResult.accumulatedStringLength.push_back(
         combinedResult.annotatedString.length());
   }
   return combinedResult;
 }
 
-std::string VariantAnnotator::findCombinedPUABopomofoReading(
-    const std::string& reading) const {
-  if (puaMap_ == nullptr) {
-    return {};
+void VariantAnnotator::annotateInto(std::string_view value,
+                                    std::string_view reading,
+                                    CombinedResult& result) const {
+  if (!loaded()) {
+    return;
   }
 
-  std::string key = reading + kDelimiterChar;
-  std::vector<std::string_view> readings = puaMap_->findRows(key);
-  if (readings.empty()) {
-    return {};
+  std::string_view variant = findDefaultOrAnnotatedVariant(value, reading);
+  if (!variant.empty()) {
+    // If variant != value, a variant selector must have been used.
+    result.annotatedString += variant;
+    result.hasVariantSelectors |= variant != value;
+    return;
   }
-  return GetSecondColumn(readings[0]);
-}
 
-std::string VariantAnnotator::findDefaultOrAnnotatedVariant(
-    const std::string& value, const std::string& reading) const {
-  if (variantsMap_ == nullptr) {
-    return {};
+  // Now try the fallback.
+  variant = findUnannotatedVariant(value);
+  if (variant.empty() || variant == reading) {
+    result.annotatedString += value;
+    return;
   }
 
-  std::string key = value + kSeparatorChar + reading + kDelimiterChar;
-  std::vector<std::string_view> variants = variantsMap_->findRows(key);
-  if (variants.empty()) {
+  result.annotatedString += variant;
+  result.hasVariantSelectors = true;
+
+  std::string_view puaBlock = findCombinedPUABopomofoReading(reading);
+  if (!puaBlock.empty()) {
+    // The string is the value + Variant 0 selector + the Bopomofo block in PUA.
+    result.annotatedString += puaBlock;
+    result.hasPUACodePoints = true;
+  }
+  // Otherwise only the unannotated Variant 0 is found.
+}
+
+std::string_view VariantAnnotator::findCombinedPUABopomofoReading(
+    std::string_view reading) const {
+  return puaTable_.find(reading);
+}
+
+std::string_view VariantAnnotator::findDefaultOrAnnotatedVariant(
+    std::string_view value, std::string_view reading) const {
+  if (reading.empty()) {
     return {};
   }
-  return GetSecondColumn(variants[0]);
+  return variantsTable_.find(value, reading);
 }
 
-std::string VariantAnnotator::findUnannotatedVariant(
-    const std::string& value) const {
+std::string_view VariantAnnotator::findUnannotatedVariant(
+    std::string_view value) const {
   return findDefaultOrAnnotatedVariant(value, kUnannotatedReading);
 }
 
 void VariantAnnotator::closeMemoryMapFiles() {
+  puaTable_.clear();
+  variantsTable_.clear();
   puaMap_ = nullptr;
   variantsMap_ = nullptr;
   bpmfvsPUAFile_.close();
@@ -24,15 +24,23 @@
 #ifndef SRC_ENGINE_VARIANTANNOTATOR_H_
 #define SRC_ENGINE_VARIANTANNOTATOR_H_
 
+#include <cstdint>
 #include <filesystem>
 #include <memory>
 #include <string>
+#include <string_view>
+#include <vector>
 
 #include "MemoryMappedFile.h"
 #include "ParselessPhraseDB.h"
 
 namespace McBopomofo {
 
+// Annotates characters with the Unicode variant selectors and the Bopomofo
+// blocks in the PUA that tell fonts which reading to show. When a db is
+// loaded, its rows are compiled into a flat hash table by their keys, so that
+// annotating a character takes a few hash probes and returns views into the
+// db instead of copies.
 class VariantAnnotator {
  public:
   // Loads the compiled bpmfvs PUA code point db.
@@ -88,19 +96,55 @@ class VariantAnnotator {
       const std::vector<std::string>& readings) const;
 
  protected:
-  [[nodiscard]] std::string findCombinedPUABopomofoReading(
-      const std::string& reading) const;
+  // An open-addressed table of the rows of a db by their first columns. A key
+  // is given in up to two parts joined by a separator, as in 個-ㄍㄜˋ, so
+  // that lookups do not need to form it.
+  class KeyTable {
+   public:
+    void build(const ParselessPhraseDB& db);
+    void clear();
+
+    // Returns the second column of the row whose key is the first part, or
+    // the first and second parts joined by the separator if the second part
+    // is not empty. Returns an empty view if there is no such row.
+    [[nodiscard]] std::string_view find(std::string_view first,
+                                        std::string_view second = {}) const;
+
+   private:
+    struct Slot {
+      uint32_t hash = 0;
+      // The row's position from the start of the db's rows, or kEmpty.
+      uint32_t offset = kEmpty;
+      uint16_t keyLength = 0;
+      uint16_t valueLength = 0;
+    };
+
+    static constexpr uint32_t kEmpty = UINT32_MAX;
+
+    const char* rowsBegin_ = nullptr;
+    std::vector<Slot> slots_;
+  };
 
-  [[nodiscard]] std::string findDefaultOrAnnotatedVariant(
-      const std::string& value, const std::string& reading) const;
+  // Appends the annotated character to the result's string and updates its
+  // flags. The accumulated lengths are left to the caller.
+  void annotateInto(std::string_view value, std::string_view reading,
+                    CombinedResult& result) const;
+
+  [[nodiscard]] std::string_view findCombinedPUABopomofoReading(
+      std::string_view reading) const;
+
+  [[nodiscard]] std::string_view findDefaultOrAnnotatedVariant(
+      std::string_view value, std::string_view reading) const;
 
-  [[nodiscard]] std::string findUnannotatedVariant(
-      const std::string& value) const;
+  [[nodiscard]] std::string_view findUnannotatedVariant(
+      std::string_view value) const;
 
   void closeMemoryMapFiles();
 
   std::unique_ptr<ParselessPhraseDB> variantsMap_;
   std::unique_ptr<ParselessPhraseDB> puaMap_;
+  KeyTable variantsTable_;
+  KeyTable puaTable_;
 
   MemoryMappedFile bpmfvsVariantsFile_;
   MemoryMappedFile bpmfvsPUAFile_;
@@ -0,0 +1,137 @@
+// Copyright (c) 2026 and onwards The McBopomofo Authors.
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the "Software"), to deal in the Software without
+// restriction, including without limitation the rights to use,
+// copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following
+// conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+// OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+
+#include <benchmark/benchmark.h>
+
+#include <cassert>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "VariantAnnotator.h"
+
+namespace {
+
+using VariantAnnotator = McBopomofo::VariantAnnotator;
+
+static const char* kVariantsPath = "bpmfvs-variants.txt";
+static const char* kPUAPath = "bpmfvs-pua.txt";
+
+// The length and the number of the composing buffers in the annotation
+// benchmark.
+constexpr size_t kBufferLength = 20;
+constexpr size_t kBufferCount = 256;
+
+struct Pair {
+  std::string value;
+  std::string reading;
+};
+
+// Returns the value-reading pairs in the variants file, including the "na"
+// rows, which exercise the fallback lookups.
+std::vector<Pair> LoadRealPairs() {
+  std::ifstream input(kVariantsPath);
+  assert(input.is_open());
+
+  std::vector<Pair> pairs;
+  std::string line;
+  std::getline(input, line);
+  while (std::getline(input, line)) {
+    const size_t separator = line.find('-');
+    const size_t delimiter = line.find(' ');
+    if (separator != std::string::npos && delimiter != std::string::npos &&
+        separator < delimiter) {
+      pairs.push_back(Pair{line.substr(0, separator),
+                           line.substr(separator + 1,
+                                       delimiter - separator - 1)});
+    }
+  }
+  assert(!pairs.empty());
+  return pairs;
+}
+
+static void BM_VariantAnnotatorLoad(benchmark::State& state) {
+  assert(std::filesystem::exists(kVariantsPath));
+  assert(std::filesystem::exists(kPUAPath));
+  for (auto _ : state) {
+    VariantAnnotator annotator;
+    benchmark::DoNotOptimize(annotator.loadVariantsFile(kVariantsPath));
+    benchmark::DoNotOptimize(annotator.loadPUAFile(kPUAPath));
+  }
+}
+BENCHMARK(BM_VariantAnnotatorLoad);
+
+static void BM_VariantAnnotatorAnnotateSingleCharacter(
+    benchmark::State& state) {
+  VariantAnnotator annotator;
+  bool loaded = annotator.loadVariantsFile(kVariantsPath) &&
+                annotator.loadPUAFile(kPUAPath);
+  assert(loaded);
+  (void)loaded;
+  const std::vector<Pair> pairs = LoadRealPairs();
+  auto pair = pairs.begin();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        annotator.annotateSingleCharacter(pair->value, pair->reading));
+    if (++pair == pairs.end()) {
+      pair = pairs.begin();
+    }
+  }
+}
+BENCHMARK(BM_VariantAnnotatorAnnotateSingleCharacter);
+
+static void BM_VariantAnnotatorAnnotateBuffer(benchmark::State& state) {
+  VariantAnnotator annotator;
+  bool loaded = annotator.loadVariantsFile(kVariantsPath) &&
+                annotator.loadPUAFile(kPUAPath);
+  assert(loaded);
+  (void)loaded;
+  const std::vector<Pair> pairs = LoadRealPairs();
+  struct Buffer {
+    std::vector<std::string> values;
+    std::vector<std::string> readings;
+  };
+  std::vector<Buffer> buffers(kBufferCount);
+  size_t index = 0;
+  for (Buffer& buffer : buffers) {
+    for (size_t i = 0; i < kBufferLength; i++) {
+      buffer.values.push_back(pairs[index].value);
+      buffer.readings.push_back(pairs[index].reading);
+      index = (index + 97) % pairs.size();
+    }
+  }
+  auto buffer = buffers.begin();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        annotator.annotate(buffer->values, buffer->readings));
+    if (++buffer == buffers.end()) {
+      buffer = buffers.begin();
+    }
+  }
+}
+BENCHMARK(BM_VariantAnnotatorAnnotateBuffer);
+
+}  // namespace
+
+BENCHMARK_MAIN();
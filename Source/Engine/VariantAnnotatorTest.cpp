@@ -185,4 +185,39 @@ TEST(VariantAnnotatorTest, AnnotateCharactersWithVariant0ButNoPUA) {
   EXPECT_FALSE(result.hasPUACodePoints);
 }
 
+TEST(VariantAnnotatorTest, ReloadingReplacesTheTables) {
+  auto annotator = CreateLoadedAnnotator();
+
+  // Of rows with the same key, the first one is used, as a db lookup would.
+  const char* variantsData = reinterpret_cast<const char*>(
+      u8"# format org.openvanilla.mcbopomofo.sorted\n"
+      u8"個-na 個\U000E01E0\n"
+      u8"個-ㄍㄜˋ 個\U000E01E1\n"
+      u8"個-ㄍㄜˋ 個\n"
+      u8"個人-ㄍㄜˋ 個人");
+  annotator->loadVariantsMap(
+      ParselessPhraseDB::CreateValidatedDB(variantsData, strlen(variantsData)));
+  ASSERT_TRUE(annotator->loaded());
+
+  VariantAnnotator::Result result =
+      annotator->annotateSingleCharacter("個", "ㄍㄜˋ");
+  EXPECT_EQ(result.annotatedString,
+            reinterpret_cast<const char*>(u8"個\U000E01E1"));
+  EXPECT_TRUE(result.hasVariantSelectors);
+
+  // Rows from the previous db are gone.
+  result = annotator->annotateSingleCharacter("一", "ㄧˊ");
+  EXPECT_EQ(result.annotatedString, "一");
+  EXPECT_FALSE(result.hasVariantSelectors);
+
+  // Keys only match whole.
+  result = annotator->annotateSingleCharacter("個", "ㄍ");
+  EXPECT_EQ(result.annotatedString,
+            reinterpret_cast<const char*>(u8"個\U000E01E0"));
+  EXPECT_FALSE(result.hasPUACodePoints);
+  result = annotator->annotateSingleCharacter("個人", "");
+  EXPECT_EQ(result.annotatedString, "個人");
+  EXPECT_FALSE(result.hasVariantSelectors);
+}
+
 }  // namespace McBopomofo
@@ -450,8 +450,9 @@ LanguageModel::Unigram ReadingGrid::Node::currentUnigram() const {
   return unigrams_.empty() ? LanguageModel::Unigram{} : *unigramIter_;
 }
 
-std::string ReadingGrid::Node::value() const {
-  return unigrams_.empty() ? "" : unigramIter_->value();
+const std::string& ReadingGrid::Node::value() const {
+  static const std::string kEmptyValue;
+  return unigrams_.empty() ? kEmptyValue : unigramIter_->value();
 }
 
 double ReadingGrid::Node::score() const {
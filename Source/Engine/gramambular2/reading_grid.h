@@ -133,7 +133,8 @@ class ReadingGrid {
     // Returns the top or overridden unigram.
     [[nodiscard]] LanguageModel::Unigram currentUnigram() const;
 
-    [[nodiscard]] std::string value() const;
+    // Returns the value of the current unigram, without copying it.
+    [[nodiscard]] const std::string& value() const;
 
     [[nodiscard]] double score() const;
 
@@ -33,6 +33,10 @@ NS_ASSUME_NONNULL_BEGIN
 @property (class, readonly, nonatomic) McBopomofo::McBopomofoLM *languageModelPlainBopomofo;
 @property (class, readonly, nonatomic) McBopomofo::UserOverrideModel *userOverrideModel;
 @property (class, readonly, nonatomic) McBopomofo::VariantAnnotator *variantAnnotator;
+
+/// Saves the user override model a while later, off the keystroke path.
+/// Calls made before that save happens are coalesced into it.
++ (void)scheduleUserOverrideModelSave;
 @end
 
 NS_ASSUME_NONNULL_END
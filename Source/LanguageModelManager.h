@@ -29,6 +29,13 @@ NS_ASSUME_NONNULL_BEGIN
 @interface LanguageModelManager : NSObject
 
 + (void)loadDataModel:(InputMode)mode;
+/// Reloads the language models whose data files have been replaced since
+/// they were loaded. Returns YES if any of them was reloaded.
++ (BOOL)reloadDataModelsIfChanged;
+/// Saves what the user override model has learned since its last save, and
+/// returns after the file is written. Called when the app terminates or the
+/// user logs out, before a scheduled save would happen.
++ (void)saveUserOverrideModel;
 + (void)loadUserPhrasesWithPlainBopomofoEnabled:(BOOL)userPhraseForPlainBopomofo NS_SWIFT_NAME(loadUserPhrases(enableForPlainBopomofo:));
 + (void)loadUserPhraseReplacement;
 + (void)setupDataModelValueConverter;
@@ -32,11 +32,14 @@
 
 static const int kUserOverrideModelCapacity = 500;
 static const double kObservedOverrideHalflife = 5400.0; // 1.5 hr.
+static const int64_t kUserOverrideModelSaveDelay = 10; // seconds.
 
 static McBopomofo::McBopomofoLM gLanguageModelMcBopomofo;
 static McBopomofo::McBopomofoLM gLanguageModelPlainBopomofo;
 static McBopomofo::UserOverrideModel gUserOverrideModel(kUserOverrideModelCapacity, kObservedOverrideHalflife);
 static McBopomofo::VariantAnnotator gVariantAnnotator;
+// The change count of the user override model at its last successful save.
+static uint64_t gSavedUserOverrideModelChangeCount = 0;
 
 static NSString *const kUserDataTemplateName = @"template-data";
 static NSString *const kUserDataPlainBopomofoTemplateName = @"template-data-plain-bpmf";
@@ -130,8 +133,22 @@ static void LTLoadVariantAnnotatorData()
     }
 }
 
++ (BOOL)reloadDataModelsIfChanged
+{
+    bool mcBopomofoReloaded = gLanguageModelMcBopomofo.reloadLanguageModelIfChanged();
+    bool plainBopomofoReloaded = gLanguageModelPlainBopomofo.reloadLanguageModelIfChanged();
+    if (mcBopomofoReloaded || plainBopomofoReloaded) {
+        NSLog(@"Reloaded language models, McBopomofo: %d, Plain Bopomofo: %d", mcBopomofoReloaded, plainBopomofoReloaded);
+    }
+    return mcBopomofoReloaded || plainBopomofoReloaded;
+}
+
 + (void)loadUserPhrasesWithPlainBopomofoEnabled:(BOOL)userPhraseForPlainBopomofo
 {
+    // Keep the parsed user files as snapshots so that the next launch does not have to parse them again.
+    const char *snapshotFolder = [self indexSnapshotFolderPath].fileSystemRepresentation;
+    gLanguageModelMcBopomofo.setIndexSnapshotFolder(snapshotFolder);
+    gLanguageModelPlainBopomofo.setIndexSnapshotFolder(snapshotFolder);
     gLanguageModelMcBopomofo.loadUserPhrases([self userPhrasesDataPathMcBopomofo].UTF8String, [self excludedPhrasesDataPathMcBopomofo].UTF8String);
     gLanguageModelPlainBopomofo.loadUserPhrases(userPhraseForPlainBopomofo ? [self userPhrasesDataPathPlainBopomofo].UTF8String : NULL,
         [self excludedPhrasesDataPathPlainBopomofo].UTF8String);
@@ -139,6 +156,7 @@ static void LTLoadVariantAnnotatorData()
 
 + (void)loadUserPhraseReplacement
 {
+    gLanguageModelMcBopomofo.setIndexSnapshotFolder([self indexSnapshotFolderPath].fileSystemRepresentation);
     gLanguageModelMcBopomofo.loadPhraseReplacementMap([self phraseReplacementDataPathMcBopomofo].UTF8String);
 }
 
@@ -323,6 +341,8 @@ static void LTLoadVariantAnnotatorData()
     return YES;
 }
 
+// Returns YES if the file does not have the phrase afterwards, and NO if it
+// could not be read or written.
 + (BOOL)_removePhrase:(NSString *)phrase atPath:(NSString *)path
 {
     NSString *exactPhrase = nil;
@@ -335,7 +355,7 @@ static void LTLoadVariantAnnotatorData()
     key = components[1];
 
     if (![[NSFileManager defaultManager] fileExistsAtPath:path]) {
-        return NO;
+        return YES;
     }
     NSError *error = nil;
     NSString *content = [[NSString alloc] initWithContentsOfURL:[NSURL fileURLWithPath:path] encoding:NSUTF8StringEncoding error:&error];
@@ -344,7 +364,7 @@ static void LTLoadVariantAnnotatorData()
     }
     NSArray *lines = [content componentsSeparatedByString:@"\n"];
 
-    BOOL result = NO;
+    BOOL found = NO;
     NSMutableString *mutableString = [NSMutableString string];
     for (NSString *line in lines) {
         NSString *trimmed = [line stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceAndNewlineCharacterSet]];
@@ -356,22 +376,54 @@ static void LTLoadVariantAnnotatorData()
         }
         if ([lineComponents[0] isEqualToString:exactPhrase] &&
             [lineComponents[1] isEqualToString:key]) {
-            result = YES;
+            found = YES;
             continue;
         }
         [mutableString appendString:line];
         [mutableString appendString:@"\n"];
     }
-    if (result) {
-        NSError *writeError;
-        [mutableString writeToURL:[NSURL fileURLWithPath:path] atomically:YES encoding:NSUTF8StringEncoding error:&writeError];
-        if (writeError != nil) {
-            return NO;
-        }
+    if (!found) {
         return YES;
     }
 
-    return NO;
+    NSError *writeError = nil;
+    return [mutableString writeToURL:[NSURL fileURLWithPath:path] atomically:YES encoding:NSUTF8StringEncoding error:&writeError];
+}
+
+// The user phrase files and the user override model are written on this
+// queue, so that typing does not wait for the file I/O. The writes stay in
+// order.
+static dispatch_queue_t LTUserDataWriteQueue()
+{
+    static dispatch_queue_t queue;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        queue = dispatch_queue_create("org.openvanilla.McBopomofo.UserDataWrites", DISPATCH_QUEUE_SERIAL);
+    });
+    return queue;
+}
+
+// Takes the phrase off one file and, if asked to, appends it to the other
+// one, on the write queue. If either fails, the in-memory changes to the
+// phrase are discarded on the main queue, so that what is shown matches the
+// files.
++ (void)_queueMovingPhrase:(NSString *)userPhrase from:(NSString *)fromPath to:(NSString *)toPath append:(BOOL)append
+{
+    NSArray *components = [userPhrase componentsSeparatedByString:@" "];
+    std::string reading([components[1] UTF8String]);
+    std::string value([components[0] UTF8String]);
+    dispatch_async(LTUserDataWriteQueue(), ^{
+        BOOL succeeded = [self _removePhrase:userPhrase atPath:fromPath];
+        if (append && ![self _checkIfPhrase:userPhrase existAtPath:toPath]) {
+            succeeded = [self _writePhrase:userPhrase atEndOfPath:toPath] && succeeded;
+        }
+        if (!succeeded) {
+            NSLog(@"Failed to update user phrase files for %@, discarding the change", userPhrase);
+            dispatch_async(dispatch_get_main_queue(), ^{
+                gLanguageModelMcBopomofo.discardUserPhraseChanges(reading, value);
+            });
+        }
+    });
 }
 
 + (BOOL)writeUserPhrase:(NSString *)userPhrase
@@ -380,19 +432,20 @@ static void LTLoadVariantAnnotatorData()
         return NO;
     }
 
-    NSString *excludePath = [self excludedPhrasesDataPathMcBopomofo];
-    [self _removePhrase:userPhrase atPath:excludePath];
-
-    NSString *includePath = [self userPhrasesDataPathMcBopomofo];
-    if ([self _checkIfPhrase:userPhrase existAtPath:includePath]) {
+    NSArray *components = [userPhrase componentsSeparatedByString:@" "];
+    if (components.count != 2) {
         return NO;
     }
-    BOOL result = [self _writePhrase:userPhrase atEndOfPath:includePath];
 
-    //  We use FSEventStream to monitor the change of the user phrase folder,
-    //  so we don't have to load data here.
-    //  [self loadUserPhrases];
-    return result;
+    // The phrase takes effect right away in memory, and the files are
+    // updated in the background. The reload that follows the write (through
+    // the FSEventStream that monitors the user phrase folder) finds the
+    // phrase in the file and drops the in-memory copy. The phrase is taken
+    // off the excluded phrases in memory even if it is already a user phrase,
+    // so the excluded phrase file is always updated.
+    BOOL added = gLanguageModelMcBopomofo.addUserPhrase([components[1] UTF8String], [components[0] UTF8String]);
+    [self _queueMovingPhrase:userPhrase from:[self excludedPhrasesDataPathMcBopomofo] to:[self userPhrasesDataPathMcBopomofo] append:added];
+    return added;
 }
 
 + (BOOL)removeUserPhrase:(NSString *)userPhrase
@@ -401,19 +454,15 @@ static void LTLoadVariantAnnotatorData()
         return NO;
     }
 
-    NSString *includePath = [self userPhrasesDataPathMcBopomofo];
-    [self _removePhrase:userPhrase atPath:includePath];
-
-    NSString *excludePath = [self excludedPhrasesDataPathMcBopomofo];
-    if ([self _checkIfPhrase:userPhrase existAtPath:excludePath]) {
+    NSArray *components = [userPhrase componentsSeparatedByString:@" "];
+    if (components.count != 2) {
         return NO;
     }
-    BOOL result = [self _writePhrase:userPhrase atEndOfPath:excludePath];
 
-    //  We use FSEventStream to monitor the change of the user phrase folder,
-    //  so we don't have to load data here.
-    //  [self loadUserPhrases];
-    return result;
+    // See writeUserPhrase: above.
+    BOOL excluded = gLanguageModelMcBopomofo.excludeUserPhrase([components[1] UTF8String], [components[0] UTF8String]);
+    [self _queueMovingPhrase:userPhrase from:[self userPhrasesDataPathMcBopomofo] to:[self excludedPhrasesDataPathMcBopomofo] append:excluded];
+    return excluded;
 }
 
 + (NSString *)dataFolderPath
@@ -460,11 +509,102 @@ static void LTLoadVariantAnnotatorData()
     return &gLanguageModelPlainBopomofo;
 }
 
+// The folder for the data that McBopomofo writes for itself. It is kept out
+// of the user phrase folder, since writing there would make the folder's
+// FSEventStream reload the user phrases.
++ (NSString *)cachesFolderPath
+{
+    NSString *cachesPath = NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES).firstObject;
+    return [cachesPath stringByAppendingPathComponent:[NSBundle mainBundle].bundleIdentifier ?: @"McBopomofo"];
+}
+
++ (NSString *)indexSnapshotFolderPath
+{
+    NSString *folder = [[self cachesFolderPath] stringByAppendingPathComponent:@"IndexSnapshots"];
+    [[NSFileManager defaultManager] createDirectoryAtPath:folder withIntermediateDirectories:YES attributes:nil error:nil];
+    return folder;
+}
+
++ (NSString *)userOverrideModelPath
+{
+    return [[self cachesFolderPath] stringByAppendingPathComponent:@"user-override-model.dat"];
+}
+
 + (McBopomofo::UserOverrideModel *)userOverrideModel
 {
+    // Restore what was learned in the previous sessions, with the timestamps
+    // that the decay is based on.
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        gUserOverrideModel.load([self userOverrideModelPath].fileSystemRepresentation);
+    });
     return &gUserOverrideModel;
 }
 
++ (void)scheduleUserOverrideModelSave
+{
+    static BOOL savePending = NO;
+    if (savePending) {
+        return;
+    }
+    savePending = YES;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, kUserOverrideModelSaveDelay * NSEC_PER_SEC), dispatch_get_main_queue(), ^{
+        savePending = NO;
+        [self _saveUserOverrideModelWaitingUntilDone:NO];
+    });
+}
+
++ (void)saveUserOverrideModel
+{
+    [self _saveUserOverrideModelWaitingUntilDone:YES];
+}
+
++ (void)_saveUserOverrideModelWaitingUntilDone:(BOOL)waitUntilDone
+{
+    uint64_t changeCount = gUserOverrideModel.changeCount();
+    if (changeCount == gSavedUserOverrideModelChangeCount) {
+        return;
+    }
+
+    // Only the serialization, which takes microseconds for the model's
+    // capacity, is done here; the model is only used on the main thread.
+    std::string data = gUserOverrideModel.serialize();
+    NSString *path = [self userOverrideModelPath];
+    __block BOOL succeeded = NO;
+    dispatch_block_t write = ^{
+        [[NSFileManager defaultManager] createDirectoryAtPath:path.stringByDeletingLastPathComponent withIntermediateDirectories:YES attributes:nil error:nil];
+        succeeded = McBopomofo::UserOverrideModel::WriteFile(path.fileSystemRepresentation, data);
+        if (!succeeded) {
+            NSLog(@"Failed to save the user override model to %@", path);
+        }
+    };
+
+    // The write queue runs the writes in order, so a synchronous save also
+    // waits for the ones scheduled before it.
+    if (waitUntilDone) {
+        dispatch_sync(LTUserDataWriteQueue(), write);
+        [self _userOverrideModelSaveDidFinish:succeeded changeCount:changeCount];
+        return;
+    }
+    dispatch_async(LTUserDataWriteQueue(), ^{
+        write();
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [self _userOverrideModelSaveDidFinish:succeeded changeCount:changeCount];
+        });
+    });
+}
+
++ (void)_userOverrideModelSaveDidFinish:(BOOL)succeeded changeCount:(uint64_t)changeCount
+{
+    if (succeeded) {
+        gSavedUserOverrideModelChangeCount = MAX(gSavedUserOverrideModelChangeCount, changeCount);
+        return;
+    }
+    // Try again later rather than wait for the next observation, which may
+    // never come in this session.
+    [self scheduleUserOverrideModelSave];
+}
+
 + (McBopomofo::VariantAnnotator *)variantAnnotator
 {
     return &gVariantAnnotator;